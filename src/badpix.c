@@ -0,0 +1,405 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Bad (hot and cold) pixel map - found once per project and repaired in each calibrated
+**  frame by visiting only the listed pixels.
+**  Hot pixels are those well above the background of the master dark, cold pixels those
+**  with little response in the master flat. Without a master dark, hot pixels are found
+**  in the base image as single pixels standing well above all their neighbours (a star
+**  spreads over its neighbours). A bad pixel is replaced by the mean of its good
+**  neighbours of the same colour - adjacent for colour frames, 2 pixels away for single
+**  channel frames which are taken to be colour filter array (Bayer) mosaics.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define HOT_SIGMA 10.0			// Hot pixel threshold (background noise multiple)
+#define HOT_MIN 1024.0			// Least hot pixel excess over the background
+#define HOT_SPREAD 0.25			// Light detection - neighbours below this fraction of the pixel
+#define COLD_INV 2.0			// Cold pixel flat reciprocal (under half the mean response)
+#define BADPIX_MAX 0.002		// Most of the frame that may be mapped
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <pipeline.h>
+
+
+/* Prototypes */
+
+int badpix_map(PipeRun *, GtkWidget *);
+int badpix_from_masters(ImgFrame *, ImgFrame *, BadPixMap *);
+int badpix_from_light(ImgFrame *, BadPixMap *);
+void badpix_repair(ImgFrame *, BadPixMap *);
+void badpix_free(BadPixMap *);
+static int badpix_scan(ImgFrame *, ImgFrame *, float, BadPixMap *);
+static int is_hot_light(ImgFrame *, int, int, float, float);
+static int is_bad(BadPixMap *, guint32);
+static int off_cmp(const void *, const void *);
+
+extern ImgFrame * frame_load_img(Image *, GtkWidget *);
+extern void frame_free(ImgFrame *);
+extern void frame_background(ImgFrame *, float *, float *);
+extern void log_msg_extra(char*, char*, char*, char*, GtkWidget*);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-badpix.c ";
+
+
+/* Make sure the project has a bad pixel map for the run (built once) and apply it */
+
+int badpix_map(PipeRun *run, GtkWidget *window)
+{
+    char extra[256];
+    int base;
+    ImgFrame *frm, *ref;
+    BadPixMap *bp;
+
+    bp = &(run->proj->badpix);
+    ref = (run->master_dark) ? run->master_dark : run->flat_inv;
+
+    /* Already built for this frame size */
+    if (bp->width > 0 && (ref == NULL || (ref->width == bp->width && ref->height == bp->height)))
+    {
+	run->cal.badpix = bp;
+    	return TRUE;
+    }
+
+    badpix_free(bp);
+
+    if (ref != NULL)
+    {
+	if (! badpix_from_masters(run->master_dark, run->flat_inv, bp))
+	    return FALSE;
+    }
+    else
+    {
+	base = run->base;
+
+	if (base < 0 || base >= run->n_frames)
+	    base = 0;
+
+	if (run->n_frames == 0)
+	    return TRUE;
+
+	if ((frm = frame_load_img(run->frames[base].img, window)) == NULL)
+	    return FALSE;
+
+	badpix_from_light(frm, bp);
+	frame_free(frm);
+    }
+
+    sprintf(extra, "%d bad pixels mapped", bp->n);
+    log_msg_extra("APP0017", "Bad pixel map", extra, NULL, NULL);
+    run->cal.badpix = bp;
+
+    return TRUE;
+}
+
+
+/* Hot pixels from the master dark and cold pixels from the master flat reciprocal (either may be NULL) */
+
+int badpix_from_masters(ImgFrame *dark, ImgFrame *flat_inv, BadPixMap *bp)
+{
+    float bg, sigma, thresh;
+    ImgFrame *ref;
+
+    ref = (dark) ? dark : flat_inv;
+
+    if (ref == NULL)
+    	return FALSE;
+
+    if (dark != NULL && flat_inv != NULL)
+    	if (dark->width != flat_inv->width || dark->height != flat_inv->height || dark->channels != flat_inv->channels)
+	    flat_inv = NULL;
+
+    bg = sigma = 0.0f;
+
+    if (dark != NULL)
+	frame_background(dark, &bg, &sigma);
+
+    thresh = bg + MAX(HOT_SIGMA * sigma, HOT_MIN);
+
+    /* Raise the threshold until the map is a sensible size */
+    while(! badpix_scan(dark, flat_inv, thresh, bp))
+    {
+	/* Too many cold pixels (a poor flat) - leave them out */
+	if (thresh > 65535.0f || dark == NULL)
+	{
+	    flat_inv = NULL;
+
+	    if (dark == NULL)
+	    {
+		bp->width = ref->width;
+		bp->height = ref->height;
+		return TRUE;
+	    }
+	}
+
+	thresh = bg + (thresh - bg) * 2.0f;
+    }
+
+    return TRUE;
+}
+
+
+/* Hot pixels found in a light frame */
+
+int badpix_from_light(ImgFrame *frm, BadPixMap *bp)
+{
+    int x, y, sz, max_n, s;
+    float bg, sigma, excess;
+
+    frame_background(frm, &bg, &sigma);
+    excess = MAX(HOT_SIGMA * sigma, HOT_MIN);
+    s = (frm->channels == 1) ? 2 : 1;
+
+    for(;;)
+    {
+	bp->width = frm->width;
+	bp->height = frm->height;
+	bp->n = 0;
+	sz = 1024;
+	bp->off = (guint32 *) malloc(sz * sizeof(guint32));
+	max_n = (int) ((double) frm->width * frm->height * BADPIX_MAX) + 1;
+
+	for(y = s; y < frm->height - s && bp->n <= max_n; y++)
+	{
+	    for(x = s; x < frm->width - s; x++)
+	    {
+		if (! is_hot_light(frm, x, y, bg, excess))
+		    continue;
+
+		if (bp->n == sz)
+		{
+		    sz *= 2;
+		    bp->off = (guint32 *) realloc(bp->off, sz * sizeof(guint32));
+		}
+
+		bp->off[bp->n++] = (guint32) y * frm->width + x;
+	    }
+	}
+
+	if (bp->n <= max_n)
+	    break;
+
+	badpix_free(bp);
+	excess *= 2.0f;
+    }
+
+    return TRUE;
+}
+
+
+/* Repair the mapped pixels of a frame */
+
+void badpix_repair(ImgFrame *frm, BadPixMap *bp)
+{
+    int i, j, k, c, x, y, nx, ny, s, cnt;
+    float sum;
+    float *p;
+    static const int nb[8][2] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1}, {-1, -1}, {1, -1}, {-1, 1}, {1, 1} };
+
+    if (bp == NULL || bp->n == 0 || frm->width != bp->width || frm->height != bp->height)
+    	return;
+
+    s = (frm->channels == 1) ? 2 : 1;
+    p = frm->data;
+
+    for(i = 0; i < bp->n; i++)
+    {
+	x = bp->off[i] % bp->width;
+	y = bp->off[i] / bp->width;
+
+	for(c = 0; c < frm->channels; c++)
+	{
+	    sum = 0.0f;
+	    cnt = 0;
+
+	    /* Straight neighbours first, diagonals only if none of those are good */
+	    for(j = 0; j < 8 && ! (j == 4 && cnt > 0); j++)
+	    {
+		nx = x + nb[j][0] * s;
+		ny = y + nb[j][1] * s;
+
+		if (nx < 0 || ny < 0 || nx >= frm->width || ny >= frm->height)
+		    continue;
+
+		k = ny * frm->width + nx;
+
+		if (is_bad(bp, (guint32) k))
+		    continue;
+
+		sum += p[(size_t) k * frm->channels + c];
+		cnt++;
+	    }
+
+	    if (cnt > 0)
+		p[(size_t) bp->off[i] * frm->channels + c] = sum / cnt;
+	}
+    }
+
+    return;
+}
+
+
+/* Free the map contents */
+
+void badpix_free(BadPixMap *bp)
+{
+    free(bp->off);
+    memset(bp, 0, sizeof(BadPixMap));
+
+    return;
+}
+
+
+/* Build the (sorted) list for a hot threshold - FALSE if too many */
+
+static int badpix_scan(ImgFrame *dark, ImgFrame *flat_inv, float thresh, BadPixMap *bp)
+{
+    int c, ch, bad, sz, max_n;
+    size_t i, npix;
+    ImgFrame *ref;
+
+    ref = (dark) ? dark : flat_inv;
+    ch = ref->channels;
+    npix = (size_t) ref->width * ref->height;
+    max_n = (int) (npix * BADPIX_MAX) + 1;
+
+    bp->width = ref->width;
+    bp->height = ref->height;
+    bp->n = 0;
+    sz = 1024;
+    bp->off = (guint32 *) malloc(sz * sizeof(guint32));
+
+    for(i = 0; i < npix; i++)
+    {
+	bad = FALSE;
+
+	for(c = 0; c < ch && ! bad; c++)
+	{
+	    if (dark && dark->data[i * ch + c] > thresh)
+		bad = TRUE;
+
+	    /* The flat reciprocal is 0 where there was no response at all */
+	    if (flat_inv && (flat_inv->data[i * ch + c] > COLD_INV || flat_inv->data[i * ch + c] == 0.0f))
+		bad = TRUE;
+	}
+
+	if (! bad)
+	    continue;
+
+	if (bp->n == max_n)
+	{
+	    badpix_free(bp);
+	    return FALSE;
+	}
+
+	if (bp->n == sz)
+	{
+	    sz *= 2;
+	    bp->off = (guint32 *) realloc(bp->off, sz * sizeof(guint32));
+	}
+
+	bp->off[bp->n++] = (guint32) i;
+    }
+
+    return TRUE;
+}
+
+
+/* A single pixel well above the background with its neighbours (same colour) near it */
+
+static int is_hot_light(ImgFrame *frm, int x, int y, float bg, float excess)
+{
+    int c, dx, dy, s, ch;
+    float v, nv, mx;
+    float *p;
+
+    s = (frm->channels == 1) ? 2 : 1;
+    ch = frm->channels;
+
+    for(c = 0; c < ch; c++)
+    {
+	p = frm->data + ((size_t) y * frm->width + x) * ch + c;
+	v = *p - bg;
+
+	if (v < excess)
+	    continue;
+
+	mx = 0.0f;
+
+	for(dy = -s; dy <= s; dy += s)
+	    for(dx = -s; dx <= s; dx += s)
+	    {
+		if (dx == 0 && dy == 0)
+		    continue;
+
+		nv = p[((ptrdiff_t) dy * frm->width + dx) * ch] - bg;
+
+		if (nv > mx)
+		    mx = nv;
+	    }
+
+	if (mx < v * HOT_SPREAD)
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+/* Pixel is in the (sorted) map */
+
+static int is_bad(BadPixMap *bp, guint32 off)
+{
+    return (bsearch(&off, bp->off, bp->n, sizeof(guint32), off_cmp) != NULL);
+}
+
+
+/* Compare offsets */
+
+static int off_cmp(const void *a, const void *b)
+{
+    guint32 x, y;
+
+    x = *(const guint32 *) a;
+    y = *(const guint32 *) b;
+
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,649 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Application:	StarsAl (benchmark)
+**
+** Author:	Anthony Buckley
+**
+** Description:
+**  	Repeatable performance benchmark on synthetic data - no image files or GTK needed.
+**  	Frames are generated in memory with a known transform each, then each stage is timed:
+**  	dark combine, calibration, star detection, the quality pre-pass, registration (with the
+**  	error against the known transform), coarse to fine registration, registration predicted
+**  	from the frames before (use -D with a small -S and -R for a drifting sequence), phase
+**  	correlation (translation only, use -R 0 to compare like with like), stacking (bilinear
+**  	and Lanczos-3) and viewer zoom.
+**  	The pipeline measures every frame (quality pre-pass) before matching the ones kept, so
+**  	its registration cost a frame is the quality figure plus the coarse to fine or
+**  	predicted one (the first of each run of frames is not predicted).
+**  	Results are written as JSON (standard output or -o file) for comparing versions
+**  	and machines.
+**
+**	Usage: starsal-bench [-W width] [-H height] [-n frames] [-d darks] [-s stars/MP]
+**			     [-p psf sigma] [-N noise] [-x hot pixels] [-S max shift]
+**			     [-R max rotation deg] [-D drift px/frame] [-r seed] [-j threads]
+**			     [-k scalar|sse|avx2] [-o file]
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <version.h>
+#include <preferences.h>
+#include <synth.h>
+
+
+/* Defines */
+
+#define ZOOM_REPEAT 3
+
+
+/* Types */
+
+typedef struct _BenchResult
+{
+    double gen_ms;
+    double dark_ms, calib_ms, detect_ms, match_ms, stack_ms;
+    double stars_mean;
+    double quality_ms;			// Binned quality pre-pass of every frame
+    int registered;
+    double err_mean, err_max;
+    double pyr_ms;			// Coarse to fine (detect and match) for frames after the first
+    int pyr_registered;
+    double pyr_err_mean, pyr_err_max;
+    double pred_ms;			// Predicted from the frames before (steady drift, -D)
+    int pred_registered;
+    double pred_err_mean, pred_err_max;
+    double pc_ms;			// Phase correlation (translation only) for frames after the first
+    int pc_registered;
+    double pc_err_mean, pc_err_max;
+    double lanczos_ms;			// Stack with Lanczos-3 interpolation
+    double driz_ms;			// Drizzle 2x, drop 0.7
+    double fits_write_ms, fits_read_ms;	// Stacked result to a float FITS file and back
+    int fits_exact;
+    double tiff_write_ms, tiff_read_ms;	// Stacked result to a 16 bit deflate TIFF file and back
+    int tiff_ok;
+    double zoom_ms[4];
+} BenchResult;
+
+
+/* Prototypes */
+
+int bench_options(int, char **, SynthParams *, int *, int *, char **);
+void bench_run(SynthParams *, int, int, BenchResult *);
+double xform_error(Xform *, Xform *, int, int);
+void bench_zoom(ImgFrame *, BenchResult *);
+void bench_write(FILE *, SynthParams *, int, int, int, BenchResult *);
+double elapsed_ms(gint64);
+void bench_usage(char *);
+
+extern void synth_default_params(SynthParams *);
+extern SynthField * synth_new_field(SynthParams *);
+extern void synth_free_field(SynthField *);
+extern void synth_frame_xform(SynthField *, int, Xform *);
+extern ImgFrame * synth_light(SynthField *, Xform *);
+extern ImgFrame * synth_dark(SynthField *);
+extern ImgFrame * frame_new(int, int, int);
+extern void frame_free(ImgFrame *);
+extern ImgFrame * combine_darks(ImgFrame **, int, JobToken *);
+extern int subtract_dark(ImgFrame *, ImgFrame *);
+extern int detect_stars(ImgFrame *, Star **, ImgQuality *);
+extern int match_stars(Star *, int, Star *, int, Xform *);
+extern int frame_quality(ImgFrame *, ImgQuality *);
+extern void xform_identity(Xform *);
+extern int register_frame(ImgFrame *, Star *, int, Xform *, Xform *, Star **, ImgQuality *);
+extern void xform_extrapolate(Xform *, Xform *, Xform *);
+extern PhaseRef * phase_ref_new(ImgFrame *);
+extern int phase_register(PhaseRef *, ImgFrame *, Xform *);
+extern void phase_ref_free(PhaseRef *);
+extern void xform_apply(Xform *, double, double, double *, double *);
+extern void warp_accumulate(ImgFrame *, Xform *, ImgFrame *, float *, float, int);
+extern void stack_average(ImgFrame *, float *, int);
+extern ImgFrame * drizzle_new(PipeRun *, ImgFrame *, float **, int *);
+extern void drizzle_accumulate(PipeRun *, ImgFrame *, Xform *, ImgFrame *, float *, float);
+extern void drizzle_average(ImgFrame *, float *, int, int);
+extern int fits_write(ImgFrame *, char *, int, FitsInfo *, GtkWidget *);
+extern ImgFrame * fits_read(char *, FitsInfo *, GtkWidget *);
+extern int tiff_write(ImgFrame *, char *, int, int, GtkWidget *);
+extern ImgFrame * tiff_read(char *, int, GtkWidget *);
+extern int add_user_pref(char *, char *);
+extern void calib_kernel_force(const char *);
+extern const char * calib_kernel_nm();
+extern void warp_kernel_force(const char *);
+extern const char * warp_kernel_nm();
+extern int job_sched_init(int);
+extern void job_sched_close();
+extern int job_thread_count();
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-bench.c ";
+
+
+/* Benchmark control */
+
+int main(int argc, char *argv[])
+{
+    int n_frames, n_darks;
+    char *out_fn;
+    FILE *fd;
+    SynthParams prm;
+    BenchResult res;
+
+    app_msg_extra[0] = '\0';
+    synth_default_params(&prm);
+    n_frames = 10;
+    n_darks = 10;
+    out_fn = NULL;
+
+    if (! bench_options(argc, argv, &prm, &n_frames, &n_darks, &out_fn))
+    {
+	bench_usage(argv[0]);
+    	exit(2);
+    }
+
+    job_sched_init(FALSE);
+
+    memset(&res, 0, sizeof(BenchResult));
+    bench_run(&prm, n_frames, n_darks, &res);
+
+    fd = stdout;
+
+    if (out_fn != NULL && (fd = fopen(out_fn, "w")) == NULL)
+    {
+    	perror(out_fn);
+	job_sched_close();
+    	exit(1);
+    }
+
+    bench_write(fd, &prm, n_frames, n_darks, job_thread_count(), &res);
+
+    if (fd != stdout)
+    	fclose(fd);
+
+    job_sched_close();
+
+    exit(0);
+}
+
+
+/* Command line options */
+
+int bench_options(int argc, char *argv[], SynthParams *prm, int *n_frames, int *n_darks, char **out_fn)
+{
+    int c;
+
+    while((c = getopt(argc, argv, "W:H:n:d:s:p:N:x:S:R:D:r:j:k:o:")) != -1)
+    {
+    	switch(c)
+	{
+	    case 'W': prm->width = atoi(optarg); break;
+	    case 'H': prm->height = atoi(optarg); break;
+	    case 'n': *n_frames = atoi(optarg); break;
+	    case 'd': *n_darks = atoi(optarg); break;
+	    case 's': prm->star_density = atof(optarg); break;
+	    case 'p': prm->psf_sigma = atof(optarg); break;
+	    case 'N': prm->noise = atof(optarg); break;
+	    case 'x': prm->hot_pixels = atoi(optarg); break;
+	    case 'S': prm->max_shift = atof(optarg); break;
+	    case 'R': prm->max_rot = atof(optarg); break;
+	    case 'D': prm->drift = atof(optarg); break;
+	    case 'r': prm->seed = (uint32_t) strtoul(optarg, NULL, 10); break;
+	    case 'j': add_user_pref(THREAD_COUNT, optarg); break;
+	    case 'k': calib_kernel_force(optarg); warp_kernel_force(optarg); break;
+	    case 'o': *out_fn = optarg; break;
+	    default: return FALSE;
+	}
+    }
+
+    if (prm->width < 64 || prm->height < 64 || *n_frames < 2 || *n_darks < 0 || prm->psf_sigma <= 0.0)
+    	return FALSE;
+
+    return TRUE;
+}
+
+
+/* Generate the data and time each stage */
+
+void bench_run(SynthParams *prm, int n_frames, int n_darks, BenchResult *res)
+{
+    int i, n_reg, wch, *n_stars;
+    double err;
+    gint64 t;
+    float *cnt;
+    SynthField *fld;
+    ImgFrame **darks, **lights, *master, *sum, *lz;
+    Star **stars, *pst;
+    Xform *truth, *found, *seq;
+    Xform pyr, pred;
+    ImgQuality qual;
+    PhaseRef *pc;
+    PipeRun run;
+    char *fn;
+
+    /* Data */
+    t = g_get_monotonic_time();
+    fld = synth_new_field(prm);
+    darks = (ImgFrame **) calloc(n_darks + 1, sizeof(ImgFrame *));
+    lights = (ImgFrame **) calloc(n_frames, sizeof(ImgFrame *));
+    truth = (Xform *) calloc(n_frames, sizeof(Xform));
+    found = (Xform *) calloc(n_frames, sizeof(Xform));
+    seq = (Xform *) calloc(n_frames, sizeof(Xform));
+    stars = (Star **) calloc(n_frames, sizeof(Star *));
+    n_stars = (int *) calloc(n_frames, sizeof(int));
+
+    for(i = 0; i < n_darks; i++)
+    	darks[i] = synth_dark(fld);
+
+    for(i = 0; i < n_frames; i++)
+    {
+	synth_frame_xform(fld, i, &(truth[i]));
+	lights[i] = synth_light(fld, &(truth[i]));
+    }
+
+    res->gen_ms = elapsed_ms(t);
+
+    /* Dark combine */
+    master = NULL;
+
+    if (n_darks > 0)
+    {
+	t = g_get_monotonic_time();
+	master = combine_darks(darks, n_darks, NULL);
+	res->dark_ms = elapsed_ms(t);
+    }
+
+    /* Calibrate */
+    t = g_get_monotonic_time();
+
+    for(i = 0; i < n_frames; i++)
+	subtract_dark(lights[i], master);
+
+    res->calib_ms = elapsed_ms(t);
+
+    /* Detection */
+    t = g_get_monotonic_time();
+
+    for(i = 0; i < n_frames; i++)
+    {
+	n_stars[i] = detect_stars(lights[i], &(stars[i]), NULL);
+	res->stars_mean += n_stars[i];
+    }
+
+    res->detect_ms = elapsed_ms(t);
+    res->stars_mean /= n_frames;
+
+    /* Quality pre-pass */
+    t = g_get_monotonic_time();
+
+    for(i = 0; i < n_frames; i++)
+	frame_quality(lights[i], &qual);
+
+    res->quality_ms = elapsed_ms(t);
+
+    /* Registration against frame 0 */
+    t = g_get_monotonic_time();
+    n_reg = 0;
+
+    for(i = 1; i < n_frames; i++)
+    	if (match_stars(stars[0], n_stars[0], stars[i], n_stars[i], &(found[i])))
+	    n_reg++;
+
+    res->match_ms = elapsed_ms(t);
+    res->registered = n_reg;
+
+    for(i = 1; i < n_frames; i++)
+    {
+	err = xform_error(&(found[i]), &(truth[i]), prm->width, prm->height);
+	res->err_mean += err / (n_frames - 1);
+
+	if (err > res->err_max)
+	    res->err_max = err;
+    }
+
+    /* Coarse to fine registration against frame 0 */
+    t = g_get_monotonic_time();
+
+    for(i = 1; i < n_frames; i++)
+    {
+	if (register_frame(lights[i], stars[0], n_stars[0], NULL, &pyr, &pst, NULL))
+	{
+	    res->pyr_registered++;
+	    err = xform_error(&pyr, &(truth[i]), prm->width, prm->height);
+	    res->pyr_err_mean += err / (n_frames - 1);
+
+	    if (err > res->pyr_err_max)
+		res->pyr_err_max = err;
+	}
+
+	free(pst);
+    }
+
+    res->pyr_ms = elapsed_ms(t);
+
+    /* Each frame predicted from the two before (frame 0 is the identity) */
+    xform_identity(&(seq[0]));
+    t = g_get_monotonic_time();
+
+    for(i = 1; i < n_frames; i++)
+    {
+	xform_extrapolate(&(seq[i - 1]), (i > 1) ? &(seq[i - 2]) : NULL, &pred);
+
+	if (register_frame(lights[i], stars[0], n_stars[0], &pred, &pyr, &pst, NULL))
+	{
+	    res->pred_registered++;
+	    err = xform_error(&pyr, &(truth[i]), prm->width, prm->height);
+	    res->pred_err_mean += err / (n_frames - 1);
+
+	    if (err > res->pred_err_max)
+		res->pred_err_max = err;
+	}
+	else
+	    pyr = pred;
+
+	seq[i] = pyr;
+	free(pst);
+    }
+
+    res->pred_ms = elapsed_ms(t);
+
+    /* Phase correlation against frame 0 (reference spectrum included) */
+    t = g_get_monotonic_time();
+
+    if ((pc = phase_ref_new(lights[0])) != NULL)
+    {
+	for(i = 1; i < n_frames; i++)
+	{
+	    if (! phase_register(pc, lights[i], &pyr))
+	    	continue;
+
+	    res->pc_registered++;
+	    err = xform_error(&pyr, &(truth[i]), prm->width, prm->height);
+	    res->pc_err_mean += err / (n_frames - 1);
+
+	    if (err > res->pc_err_max)
+		res->pc_err_max = err;
+	}
+
+	phase_ref_free(pc);
+    }
+
+    res->pc_ms = elapsed_ms(t);
+
+    /* Stack (with the found transforms) */
+    sum = frame_new(prm->width, prm->height, 1);
+    cnt = (float *) calloc((size_t) prm->width * prm->height, sizeof(float));
+    found[0] = truth[0];
+    t = g_get_monotonic_time();
+
+    for(i = 0; i < n_frames; i++)
+	warp_accumulate(lights[i], &(found[i]), sum, cnt, 1.0f, WARP_BILINEAR);
+
+    stack_average(sum, cnt, n_frames);
+    res->stack_ms = elapsed_ms(t);
+
+    /* Again with Lanczos-3 (into a fresh accumulator, the bilinear result is kept for the viewer) */
+    lz = frame_new(prm->width, prm->height, 1);
+    memset(cnt, 0, (size_t) prm->width * prm->height * sizeof(float));
+    t = g_get_monotonic_time();
+
+    for(i = 0; i < n_frames; i++)
+	warp_accumulate(lights[i], &(found[i]), lz, cnt, 1.0f, WARP_LANCZOS3);
+
+    stack_average(lz, cnt, n_frames);
+    res->lanczos_ms = elapsed_ms(t);
+    frame_free(lz);
+    free(cnt);
+
+    /* Drizzle */
+    memset(&run, 0, sizeof(PipeRun));
+    run.driz_scale = 2.0;
+    run.driz_drop = 0.7;
+    run.cfa = CFA_NONE;
+    t = g_get_monotonic_time();
+    lz = drizzle_new(&run, lights[0], &cnt, &wch);
+
+    for(i = 0; i < n_frames; i++)
+	drizzle_accumulate(&run, lights[i], &(found[i]), lz, cnt, 1.0f);
+
+    drizzle_average(lz, cnt, wch, n_frames);
+    res->driz_ms = elapsed_ms(t);
+    frame_free(lz);
+
+    /* Result file round trip */
+    fn = g_build_filename(g_get_tmp_dir(), "starsal_bench.fits", NULL);
+    t = g_get_monotonic_time();
+    fits_write(sum, fn, FITS_FLOAT32, NULL, NULL);
+    res->fits_write_ms = elapsed_ms(t);
+    t = g_get_monotonic_time();
+    lz = fits_read(fn, NULL, NULL);
+    res->fits_read_ms = elapsed_ms(t);
+    res->fits_exact = (lz != NULL && memcmp(lz->data, sum->data, (size_t) prm->width * prm->height * sizeof(float)) == 0);
+    frame_free(lz);
+    unlink(fn);
+    g_free(fn);
+
+    fn = g_build_filename(g_get_tmp_dir(), "starsal_bench.tif", NULL);
+    t = g_get_monotonic_time();
+    tiff_write(sum, fn, 16, TRUE, NULL);
+    res->tiff_write_ms = elapsed_ms(t);
+    t = g_get_monotonic_time();
+    lz = tiff_read(fn, FALSE, NULL);
+    res->tiff_read_ms = elapsed_ms(t);
+    res->tiff_ok = (lz != NULL && lz->width == sum->width && lz->height == sum->height);
+    frame_free(lz);
+    unlink(fn);
+    g_free(fn);
+
+    /* Viewer */
+    bench_zoom(sum, res);
+
+    /* Tidy up */
+    for(i = 0; i < n_darks; i++)
+    	frame_free(darks[i]);
+
+    for(i = 0; i < n_frames; i++)
+    {
+    	frame_free(lights[i]);
+	free(stars[i]);
+    }
+
+    frame_free(master);
+    frame_free(sum);
+    free(cnt);
+    free(darks);
+    free(lights);
+    free(truth);
+    free(found);
+    free(seq);
+    free(stars);
+    free(n_stars);
+    synth_free_field(fld);
+
+    return;
+}
+
+
+/* Largest distance between where two transforms put the corners and centre */
+
+double xform_error(Xform *xf, Xform *truth, int w, int h)
+{
+    int i;
+    double d, max_d, x1, y1, x2, y2;
+    const double px[5] = { 0.0, 1.0, 0.0, 1.0, 0.5 };
+    const double py[5] = { 0.0, 0.0, 1.0, 1.0, 0.5 };
+
+    max_d = 0.0;
+
+    for(i = 0; i < 5; i++)
+    {
+	xform_apply(xf, px[i] * w, py[i] * h, &x1, &y1);
+	xform_apply(truth, px[i] * w, py[i] * h, &x2, &y2);
+	d = hypot(x1 - x2, y1 - y2);
+
+	if (d > max_d)
+	    max_d = d;
+    }
+
+    return max_d;
+}
+
+
+/* Time the viewer scaling (as for fit, actual, x2 and x3) */
+
+void bench_zoom(ImgFrame *frm, BenchResult *res)
+{
+    int i, j, x, y, v, stride;
+    guchar *p;
+    gint64 t;
+    GdkPixbuf *pixbuf, *scaled;
+    const double scale[4] = { 0.25, 1.0, 2.0, 3.0 };
+
+    pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, frm->width, frm->height);
+    stride = gdk_pixbuf_get_rowstride(pixbuf);
+
+    for(y = 0; y < frm->height; y++)
+    {
+	p = gdk_pixbuf_get_pixels(pixbuf) + (size_t) y * stride;
+
+	for(x = 0; x < frm->width; x++, p += 3)
+	{
+	    v = (int) (frm->data[(size_t) y * frm->width + x] / 257.0f);
+	    p[0] = p[1] = p[2] = (guchar) CLAMP(v, 0, 255);
+	}
+    }
+
+    for(i = 0; i < 4; i++)
+    {
+	t = g_get_monotonic_time();
+
+	for(j = 0; j < ZOOM_REPEAT; j++)
+	{
+	    scaled = gdk_pixbuf_scale_simple(pixbuf, (int) (frm->width * scale[i]),
+	    				     (int) (frm->height * scale[i]), GDK_INTERP_BILINEAR);
+	    g_object_unref(scaled);
+	}
+
+	res->zoom_ms[i] = elapsed_ms(t) / ZOOM_REPEAT;
+    }
+
+    g_object_unref(pixbuf);
+
+    return;
+}
+
+
+/* Results as JSON */
+
+void bench_write(FILE *fd, SynthParams *prm, int n_frames, int n_darks, int threads, BenchResult *res)
+{
+    double mpix;
+
+    mpix = (double) prm->width * prm->height / 1e6;
+
+    fprintf(fd, "{\n");
+    fprintf(fd, "  \"version\": \"%s\",\n", VERSION);
+    fprintf(fd, "  \"threads\": %d,\n", threads);
+    fprintf(fd, "  \"processors\": %u,\n", g_get_num_processors());
+    fprintf(fd, "  \"calib_kernel\": \"%s\",\n", calib_kernel_nm());
+    fprintf(fd, "  \"warp_kernel\": \"%s\",\n", warp_kernel_nm());
+    fprintf(fd, "  \"params\": { \"width\": %d, \"height\": %d, \"frames\": %d, \"darks\": %d, "
+		"\"star_density\": %g, \"psf_sigma\": %g, \"noise\": %g, \"hot_pixels\": %d, "
+		"\"max_shift\": %g, \"max_rot\": %g, \"drift\": %g, \"seed\": %u },\n",
+		prm->width, prm->height, n_frames, n_darks, prm->star_density, prm->psf_sigma,
+		prm->noise, prm->hot_pixels, prm->max_shift, prm->max_rot, prm->drift, prm->seed);
+    fprintf(fd, "  \"generate\": { \"ms\": %.1f },\n", res->gen_ms);
+    fprintf(fd, "  \"dark_combine\": { \"ms\": %.1f, \"mpix_per_s\": %.2f },\n",
+		res->dark_ms, (res->dark_ms > 0.0) ? mpix * n_darks / (res->dark_ms / 1000.0) : 0.0);
+    fprintf(fd, "  \"calibrate\": { \"ms\": %.1f, \"per_frame_ms\": %.2f },\n",
+		res->calib_ms, res->calib_ms / n_frames);
+    fprintf(fd, "  \"detect\": { \"ms\": %.1f, \"per_frame_ms\": %.2f, \"stars_mean\": %.1f },\n",
+		res->detect_ms, res->detect_ms / n_frames, res->stars_mean);
+    fprintf(fd, "  \"quality\": { \"ms\": %.1f, \"per_frame_ms\": %.2f },\n",
+		res->quality_ms, res->quality_ms / n_frames);
+    fprintf(fd, "  \"register\": { \"ms\": %.1f, \"per_frame_ms\": %.2f, \"registered\": %d, "
+		"\"of\": %d, \"err_mean_px\": %.4f, \"err_max_px\": %.4f },\n",
+		res->match_ms, res->match_ms / (n_frames - 1), res->registered, n_frames - 1,
+		res->err_mean, res->err_max);
+    fprintf(fd, "  \"register_pyramid\": { \"ms\": %.1f, \"per_frame_ms\": %.2f, \"registered\": %d, "
+		"\"of\": %d, \"err_mean_px\": %.4f, \"err_max_px\": %.4f },\n",
+		res->pyr_ms, res->pyr_ms / (n_frames - 1), res->pyr_registered, n_frames - 1,
+		res->pyr_err_mean, res->pyr_err_max);
+    fprintf(fd, "  \"register_predicted\": { \"ms\": %.1f, \"per_frame_ms\": %.2f, \"registered\": %d, "
+		"\"of\": %d, \"err_mean_px\": %.4f, \"err_max_px\": %.4f },\n",
+		res->pred_ms, res->pred_ms / (n_frames - 1), res->pred_registered, n_frames - 1,
+		res->pred_err_mean, res->pred_err_max);
+    fprintf(fd, "  \"register_phase\": { \"ms\": %.1f, \"per_frame_ms\": %.2f, \"registered\": %d, "
+		"\"of\": %d, \"err_mean_px\": %.4f, \"err_max_px\": %.4f },\n",
+		res->pc_ms, res->pc_ms / (n_frames - 1), res->pc_registered, n_frames - 1,
+		res->pc_err_mean, res->pc_err_max);
+    fprintf(fd, "  \"stack\": { \"ms\": %.1f, \"per_frame_ms\": %.2f, \"mpix_per_s\": %.2f },\n",
+		res->stack_ms, res->stack_ms / n_frames,
+		(res->stack_ms > 0.0) ? mpix * n_frames / (res->stack_ms / 1000.0) : 0.0);
+    fprintf(fd, "  \"stack_lanczos\": { \"ms\": %.1f, \"per_frame_ms\": %.2f, \"mpix_per_s\": %.2f },\n",
+		res->lanczos_ms, res->lanczos_ms / n_frames,
+		(res->lanczos_ms > 0.0) ? mpix * n_frames / (res->lanczos_ms / 1000.0) : 0.0);
+    fprintf(fd, "  \"drizzle\": { \"scale\": 2.0, \"drop\": 0.7, \"ms\": %.1f, \"per_frame_ms\": %.2f, \"mpix_per_s\": %.2f },\n",
+		res->driz_ms, res->driz_ms / n_frames,
+		(res->driz_ms > 0.0) ? mpix * n_frames / (res->driz_ms / 1000.0) : 0.0);
+    fprintf(fd, "  \"fits\": { \"write_ms\": %.1f, \"read_ms\": %.1f, \"exact\": %s },\n",
+		res->fits_write_ms, res->fits_read_ms, (res->fits_exact) ? "true" : "false");
+    fprintf(fd, "  \"tiff\": { \"bits\": 16, \"deflate\": true, \"write_ms\": %.1f, \"read_ms\": %.1f, \"ok\": %s },\n",
+		res->tiff_write_ms, res->tiff_read_ms, (res->tiff_ok) ? "true" : "false");
+    fprintf(fd, "  \"zoom\": { \"fit_ms\": %.2f, \"x1_ms\": %.2f, \"x2_ms\": %.2f, \"x3_ms\": %.2f }\n",
+		res->zoom_ms[0], res->zoom_ms[1], res->zoom_ms[2], res->zoom_ms[3]);
+    fprintf(fd, "}\n");
+
+    return;
+}
+
+
+/* Milliseconds since 't' */
+
+double elapsed_ms(gint64 t)
+{
+    return (g_get_monotonic_time() - t) / 1000.0;
+}
+
+
+/* Usage */
+
+void bench_usage(char *prog)
+{
+    fprintf(stderr, "Usage: %s [-W width] [-H height] [-n frames] [-d darks] [-s stars/MP]\n", prog);
+    fprintf(stderr, "\t[-p psf sigma] [-N noise] [-x hot pixels] [-S max shift] [-R max rotation deg]\n");
+    fprintf(stderr, "\t[-D drift px/frame] [-r seed] [-j threads] [-k scalar|sse|avx2] [-o file]\n");
+
+    return;
+}
@@ -0,0 +1,330 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Calibration kernels - bias and (scaled) dark subtraction, clipped at zero, and flat
+**  division for a run of samples. Flats are passed as reciprocals so the division is a multiply.
+**  Frames are decoded to floats so the kernels work on floats. There is also a running
+**  sum of rows (pyramid binning for registration). Each has a scalar version and, on x86,
+**  SSE and AVX2 versions. The best version the processor supports is chosen on first use.
+**  The vector versions are compiled with target attributes so no special compiler flags
+**  are needed for the file.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CALIB_X86
+#endif
+
+
+/* Includes */
+
+#include <stdlib.h>
+#include <string.h>
+#include <gtk/gtk.h>
+#ifdef CALIB_X86
+#include <immintrin.h>
+#endif
+
+
+/* Types */
+
+typedef void (*CalibF32Func)(const float *, const float *, const float *, float, const float *, float *, size_t);
+typedef void (*AccumF32Func)(const float *, float *, size_t);
+
+
+/* Prototypes */
+
+void calib_f32(const float *, const float *, const float *, float, const float *, float *, size_t);
+void accum_f32(const float *, float *, size_t);
+const char * calib_kernel_nm();
+void calib_kernel_force(const char *);
+static void calib_dispatch();
+static void calib_f32_scalar(const float *, const float *, const float *, float, const float *, float *, size_t);
+static void accum_f32_scalar(const float *, float *, size_t);
+#ifdef CALIB_X86
+static void calib_f32_sse(const float *, const float *, const float *, float, const float *, float *, size_t);
+static void calib_f32_avx2(const float *, const float *, const float *, float, const float *, float *, size_t);
+static void accum_f32_sse(const float *, float *, size_t);
+static void accum_f32_avx2(const float *, float *, size_t);
+#endif
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-calib_kernels.c ";
+static gsize dispatch_once = 0;
+static CalibF32Func f32_fn = calib_f32_scalar;
+static AccumF32Func acc_fn = accum_f32_scalar;
+static const char *kernel_nm = "scalar";
+
+
+/* Calibrate float samples: out = max(in - bias - k * dark, 0) * flat_inv. Bias, dark and flat_inv may be NULL, out may be in */
+
+void calib_f32(const float *in, const float *bias, const float *dark, float k, const float *flat_inv, float *out, size_t n)
+{
+    if (g_once_init_enter(&dispatch_once))
+    {
+	calib_dispatch();
+	g_once_init_leave(&dispatch_once, 1);
+    }
+
+    (*f32_fn)(in, bias, dark, k, flat_inv, out, n);
+
+    return;
+}
+
+
+/* Add a run of samples into a running sum: acc += in */
+
+void accum_f32(const float *in, float *acc, size_t n)
+{
+    if (g_once_init_enter(&dispatch_once))
+    {
+	calib_dispatch();
+	g_once_init_leave(&dispatch_once, 1);
+    }
+
+    (*acc_fn)(in, acc, n);
+
+    return;
+}
+
+
+/* Name of the kernels in use */
+
+const char * calib_kernel_nm()
+{
+    if (g_once_init_enter(&dispatch_once))
+    {
+	calib_dispatch();
+	g_once_init_leave(&dispatch_once, 1);
+    }
+
+    return kernel_nm;
+}
+
+
+/* Force a kernel set by name (benchmarks) - ignored if not supported, call before any use */
+
+void calib_kernel_force(const char *nm)
+{
+    if (g_once_init_enter(&dispatch_once))
+    {
+	calib_dispatch();
+	g_once_init_leave(&dispatch_once, 1);
+    }
+
+    if (strcmp(nm, "scalar") == 0)
+    {
+	f32_fn = calib_f32_scalar;
+	acc_fn = accum_f32_scalar;
+	kernel_nm = "scalar";
+    }
+#ifdef CALIB_X86
+    else if (strcmp(nm, "sse") == 0 && __builtin_cpu_supports("sse4.1"))
+    {
+	f32_fn = calib_f32_sse;
+	acc_fn = accum_f32_sse;
+	kernel_nm = "sse";
+    }
+    else if (strcmp(nm, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+    {
+	f32_fn = calib_f32_avx2;
+	acc_fn = accum_f32_avx2;
+	kernel_nm = "avx2";
+    }
+#endif
+
+    return;
+}
+
+
+/* Choose the kernels for this processor */
+
+static void calib_dispatch()
+{
+#ifdef CALIB_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+	f32_fn = calib_f32_avx2;
+	acc_fn = accum_f32_avx2;
+	kernel_nm = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse4.1"))
+    {
+	f32_fn = calib_f32_sse;
+	acc_fn = accum_f32_sse;
+	kernel_nm = "sse";
+    }
+#endif
+
+    return;
+}
+
+
+/* Scalar float version (also does the vector tails) */
+
+static void calib_f32_scalar(const float *in, const float *bias, const float *dark, float k, const float *flat_inv, float *out, size_t n)
+{
+    size_t i;
+    float f;
+
+    for(i = 0; i < n; i++)
+    {
+    	f = (bias) ? in[i] - bias[i] : in[i];
+	f = (dark) ? f - k * dark[i] : f;
+	f = (f > 0.0f) ? f : 0.0f;
+	out[i] = (flat_inv) ? f * flat_inv[i] : f;
+    }
+
+    return;
+}
+
+
+/* Scalar running sum (also does the vector tails) */
+
+static void accum_f32_scalar(const float *in, float *acc, size_t n)
+{
+    size_t i;
+
+    for(i = 0; i < n; i++)
+    	acc[i] += in[i];
+
+    return;
+}
+
+
+#ifdef CALIB_X86
+
+/* SSE float version - 4 samples at a time */
+
+__attribute__((target("sse4.1")))
+static void calib_f32_sse(const float *in, const float *bias, const float *dark, float k, const float *flat_inv, float *out, size_t n)
+{
+    size_t i;
+    __m128 v, z, kv;
+
+    z = _mm_setzero_ps();
+    kv = _mm_set1_ps(k);
+
+    for(i = 0; i + 4 <= n; i += 4)
+    {
+    	v = _mm_loadu_ps(in + i);
+
+	if (bias)
+	    v = _mm_sub_ps(v, _mm_loadu_ps(bias + i));
+
+	if (dark)
+	    v = _mm_sub_ps(v, _mm_mul_ps(kv, _mm_loadu_ps(dark + i)));
+
+	v = _mm_max_ps(v, z);
+
+	if (flat_inv)
+	    v = _mm_mul_ps(v, _mm_loadu_ps(flat_inv + i));
+
+	_mm_storeu_ps(out + i, v);
+    }
+
+    calib_f32_scalar(in + i, (bias) ? bias + i : NULL, (dark) ? dark + i : NULL, k, (flat_inv) ? flat_inv + i : NULL, out + i, n - i);
+
+    return;
+}
+
+
+/* AVX2 float version - 8 samples at a time */
+
+__attribute__((target("avx2")))
+static void calib_f32_avx2(const float *in, const float *bias, const float *dark, float k, const float *flat_inv, float *out, size_t n)
+{
+    size_t i;
+    __m256 v, z, kv;
+
+    z = _mm256_setzero_ps();
+    kv = _mm256_set1_ps(k);
+
+    for(i = 0; i + 8 <= n; i += 8)
+    {
+    	v = _mm256_loadu_ps(in + i);
+
+	if (bias)
+	    v = _mm256_sub_ps(v, _mm256_loadu_ps(bias + i));
+
+	if (dark)
+	    v = _mm256_sub_ps(v, _mm256_mul_ps(kv, _mm256_loadu_ps(dark + i)));
+
+	v = _mm256_max_ps(v, z);
+
+	if (flat_inv)
+	    v = _mm256_mul_ps(v, _mm256_loadu_ps(flat_inv + i));
+
+	_mm256_storeu_ps(out + i, v);
+    }
+
+    calib_f32_scalar(in + i, (bias) ? bias + i : NULL, (dark) ? dark + i : NULL, k, (flat_inv) ? flat_inv + i : NULL, out + i, n - i);
+
+    return;
+}
+
+
+/* SSE running sum - 4 samples at a time */
+
+__attribute__((target("sse4.1")))
+static void accum_f32_sse(const float *in, float *acc, size_t n)
+{
+    size_t i;
+
+    for(i = 0; i + 4 <= n; i += 4)
+    	_mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_loadu_ps(in + i)));
+
+    accum_f32_scalar(in + i, acc + i, n - i);
+
+    return;
+}
+
+
+/* AVX2 running sum - 8 samples at a time */
+
+__attribute__((target("avx2")))
+static void accum_f32_avx2(const float *in, float *acc, size_t n)
+{
+    size_t i;
+
+    for(i = 0; i + 8 <= n; i += 8)
+    	_mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_loadu_ps(in + i)));
+
+    accum_f32_scalar(in + i, acc + i, n - i);
+
+    return;
+}
+
+#endif
@@ -0,0 +1,611 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+/*
+** Description:
+**  Calibration - build the master dark, bias, flat and dark flat and apply them to the
+**  light frames in one pass (see calib_kernels.c).
+**  Masters are built a frame at a time, the next frame being decoded while the current
+**  one is added (if the memory budget has room), so only the running sum, minimum and
+**  maximum are held however many frames there are. The master is the mean with the highest and lowest sample of each
+**  pixel rejected (3 or more frames). Flats have the dark flat (or bias) subtracted and
+**  are kept as the reciprocal of the flat normalised to a mean of 1 in each channel.
+**  Dark scaling fits the dark to each light by least squares on the high frequency
+**  (pixel less its neighbours of the same colour) part of each, sampled on a sparse grid.
+**  The fixed pattern that scales with exposure and temperature is what remains, so the
+**  factor that removes it best is the one that leaves the least residual noise.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define FLAT_MIN 0.01			// Flat pixels below this fraction of the mean are dead
+#define SCALE_GRID 4			// Dark scaling samples every 'n'th row and column
+#define MASTER_FRAMES 4			// Sum, minimum, maximum and the frame being added
+#define SCALE_SAT 60000.0		// Dark scaling ignores samples near saturation
+#define SCALE_MAX 8.0			// Dark scale limit
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <pipeline.h>
+#include <instrument.h>
+
+
+/* Types */
+
+typedef struct _CalSet
+{
+    MasterBuilder *mb;
+    ImgFrame *frm;
+    ImgFrame *sub;
+    CalMasters *cal;
+    float k;
+    ImgFrame *flat;
+    double *mean;			// Flat normalising only
+} CalSet;
+
+typedef struct _MasterLoad
+{
+    Image *img;
+    ImgFrame *frm;
+} MasterLoad;
+
+
+/* Prototypes */
+
+ImgFrame * make_master(GList *, int, ImgFrame *, JobToken *, GtkWidget *);
+ImgFrame * combine_darks(ImgFrame **, int, JobToken *);
+void master_init(MasterBuilder *, int);
+int master_add(MasterBuilder *, ImgFrame *, ImgFrame *);
+ImgFrame * master_finish(MasterBuilder *);
+void master_free(MasterBuilder *);
+ImgFrame * master_thermal(ImgFrame *, ImgFrame *);
+int calibrate_frame(ImgFrame *, CalMasters *);
+double dark_scale(ImgFrame *, CalMasters *);
+int subtract_dark(ImgFrame *, ImgFrame *);
+const char * master_nm(int);
+static void load_job(Job *);
+static void add_rows(int, int, gpointer);
+static void finish_rows(int, int, gpointer);
+static void flat_rows(int, int, gpointer);
+static void calib_rows(int, int, gpointer);
+static int same_size(ImgFrame *, ImgFrame *);
+
+extern ImgFrame * frame_new(int, int, int);
+extern void frame_free(ImgFrame *);
+extern ImgFrame * frame_load_img(Image *, GtkWidget *);
+extern Image * video_frame_array(GList *, int *);
+extern void badpix_repair(ImgFrame *, BadPixMap *);
+extern void calib_f32(const float *, const float *, const float *, float, const float *, float *, size_t);
+extern void job_submit(int, void (*)(Job *), gpointer, JobToken *, JobGroup *, void (*)(Job *));
+extern void job_group_init(JobGroup *);
+extern void job_group_wait(JobGroup *);
+extern void job_parallel_for(int, int, int, int, JobRangeFunc, gpointer, JobToken *);
+extern int job_cancelled(JobToken *);
+extern void job_progress(JobToken *, double, char *);
+extern void instr_start(InstrTimer *, int);
+extern void instr_stop(InstrTimer *, gint64, int);
+extern gint64 mem_reserve(gint64, gint64);
+extern void mem_release(gint64);
+extern void log_msg_extra(char*, char*, char*, char*, GtkWidget*);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-calibrate.c ";
+static const char *mst_nm[] = { "Master dark", "Master flat", "Master dark flat", "Master bias" };
+
+
+/* Build a master from a list of frames (or videos), subtracting 'sub' (if any) from each */
+
+ImgFrame * make_master(GList *gl, int kind, ImgFrame *sub, JobToken *token, GtkWidget *window)
+{
+    int i, n, ok, ahead;
+    char msg[100];
+    gint64 fsz, mem;
+    Image *imgs;
+    ImgFrame *frm;
+    MasterBuilder mb;
+    MasterLoad ld;
+    JobGroup grp;
+
+    if ((imgs = video_frame_array(gl, &n)) == NULL)
+    	return NULL;
+
+    master_init(&mb, kind);
+    job_group_init(&grp);
+    ok = TRUE;
+    ahead = TRUE;
+    mem = 0;
+
+    /* Start decoding the first frame */
+    ld.img = &(imgs[0]);
+    ld.frm = NULL;
+    job_submit(JOB_PRI_BATCH, load_job, &ld, token, &grp, NULL);
+
+    for(i = 1; i <= n; i++)
+    {
+	job_group_wait(&grp);
+	frm = ld.frm;
+	ld.frm = NULL;
+
+	/* Decode the next one while this is added - if the budget has room for it */
+	if (frm != NULL && mem == 0)
+	{
+	    fsz = (gint64) frm->width * frm->height * frm->channels * sizeof(float);
+	    mem = mem_reserve(fsz * (MASTER_FRAMES + 1), fsz * MASTER_FRAMES);
+	    ahead = (mem > fsz * MASTER_FRAMES);
+	}
+
+	if (i < n && ! job_cancelled(token) && ahead)
+	{
+	    ld.img = &(imgs[i]);
+	    job_submit(JOB_PRI_BATCH, load_job, &ld, token, &grp, NULL);
+	}
+
+	if (frm == NULL)
+	{
+	    sprintf(mb.err, "%s %d could not be loaded", mst_nm[kind], i);
+	    ok = FALSE;
+	}
+	else
+	{
+	    ok = master_add(&mb, frm, sub);
+	}
+
+	frame_free(frm);
+
+	if (! ok || job_cancelled(token))
+	    break;
+
+	if (i < n && ! ahead)
+	{
+	    ld.img = &(imgs[i]);
+	    job_submit(JOB_PRI_BATCH, load_job, &ld, token, &grp, NULL);
+	}
+
+	sprintf(msg, "%s: %d of %d", mst_nm[kind], i, n);
+	job_progress(token, (double) i / n, msg);
+    }
+
+    job_group_wait(&grp);
+    frame_free(ld.frm);
+    mem_release(mem);
+    free(imgs);
+
+    if (! ok || job_cancelled(token))
+    {
+	if (! job_cancelled(token))
+	    log_msg_extra("APP0018", (char *) mst_nm[kind], mb.err, "APP0018", window);
+
+	master_free(&mb);
+    	return NULL;
+    }
+
+    return master_finish(&mb);
+}
+
+
+/* Master dark from a set of (same size) frames already loaded */
+
+ImgFrame * combine_darks(ImgFrame **frm, int n, JobToken *token)
+{
+    int i;
+    MasterBuilder mb;
+
+    master_init(&mb, MST_DARK);
+
+    for(i = 0; i < n; i++)
+    {
+    	if (job_cancelled(token) || ! master_add(&mb, frm[i], NULL))
+	{
+	    master_free(&mb);
+	    return NULL;
+	}
+    }
+
+    return master_finish(&mb);
+}
+
+
+/* Start a master */
+
+void master_init(MasterBuilder *mb, int kind)
+{
+    memset(mb, 0, sizeof(MasterBuilder));
+    mb->kind = kind;
+
+    return;
+}
+
+
+/* Add a frame to a master (less 'sub' if present) */
+
+int master_add(MasterBuilder *mb, ImgFrame *frm, ImgFrame *sub)
+{
+    CalSet cs;
+    InstrTimer tmr;
+
+    if (sub != NULL && ! same_size(frm, sub))
+    {
+	sprintf(mb->err, "Frame %dx%d, Subtracted master %dx%d", frm->width, frm->height, sub->width, sub->height);
+    	return FALSE;
+    }
+
+    if (mb->sum == NULL)
+    {
+	mb->sum = frame_new(frm->width, frm->height, frm->channels);
+	mb->lo = frame_new(frm->width, frm->height, frm->channels);
+	mb->hi = frame_new(frm->width, frm->height, frm->channels);
+
+	if (mb->sum == NULL || mb->lo == NULL || mb->hi == NULL)
+	{
+	    master_free(mb);
+	    return FALSE;
+	}
+    }
+    else if (! same_size(frm, mb->sum))
+    {
+	sprintf(mb->err, "Frame %d size differs from the first frame", mb->n + 1);
+    	return FALSE;
+    }
+
+    memset(&cs, 0, sizeof(CalSet));
+    cs.mb = mb;
+    cs.frm = frm;
+    cs.sub = sub;
+    instr_start(&tmr, INS_CALIBRATE);
+    job_parallel_for(JOB_PRI_BATCH, 0, frm->height, 0, add_rows, &cs, NULL);
+    instr_stop(&tmr, (gint64) frm->width * frm->height * frm->channels * sizeof(float), 1);
+    mb->n++;
+
+    return TRUE;
+}
+
+
+/* Complete a master - the builder is freed and the master (or flat reciprocal) returned */
+
+ImgFrame * master_finish(MasterBuilder *mb)
+{
+    int c;
+    size_t i, sz;
+    double mean[3];
+    ImgFrame *out;
+    CalSet cs;
+
+    if (mb->n == 0)
+    {
+	master_free(mb);
+    	return NULL;
+    }
+
+    memset(&cs, 0, sizeof(CalSet));
+    cs.mb = mb;
+    job_parallel_for(JOB_PRI_BATCH, 0, mb->sum->height, 0, finish_rows, &cs, NULL);
+
+    out = mb->sum;
+    mb->sum = NULL;
+    master_free(mb);
+
+    if (out->channels > 3 || mb->kind != MST_FLAT)
+    	return out;
+
+    /* Flat - normalise each channel to a mean of 1 and take the reciprocal */
+    sz = (size_t) out->width * out->height * out->channels;
+    memset(mean, 0, sizeof(mean));
+
+    for(i = 0; i < sz; i++)
+    	mean[i % out->channels] += out->data[i];
+
+    for(c = 0; c < out->channels; c++)
+    	mean[c] /= (double) out->width * out->height;
+
+    cs.flat = out;
+    cs.mean = mean;
+    job_parallel_for(JOB_PRI_BATCH, 0, out->height, 0, flat_rows, &cs, NULL);
+
+    return out;
+}
+
+
+/* Free a master builder */
+
+void master_free(MasterBuilder *mb)
+{
+    frame_free(mb->sum);
+    frame_free(mb->lo);
+    frame_free(mb->hi);
+    mb->sum = mb->lo = mb->hi = NULL;
+
+    return;
+}
+
+
+/* Thermal signal (dark less bias) for dark scaling */
+
+ImgFrame * master_thermal(ImgFrame *dark, ImgFrame *bias)
+{
+    ImgFrame *out;
+
+    if (! same_size(dark, bias))
+    	return NULL;
+
+    if ((out = frame_new(dark->width, dark->height, dark->channels)) == NULL)
+    	return NULL;
+
+    calib_f32(dark->data, bias->data, NULL, 1.0f, NULL, out->data, (size_t) dark->width * dark->height * dark->channels);
+
+    return out;
+}
+
+
+/* Calibrate a frame in place (single pass) - any of the masters may be NULL */
+
+int calibrate_frame(ImgFrame *img, CalMasters *cal)
+{
+    char extra[100];
+    CalSet cs;
+    InstrTimer tmr;
+
+    if (cal->bias == NULL && cal->dark == NULL && cal->flat_inv == NULL && cal->badpix == NULL)
+    	return TRUE;
+
+    if ((cal->bias != NULL && ! same_size(img, cal->bias)) ||
+	(cal->dark != NULL && ! same_size(img, cal->dark)) ||
+	(cal->flat_inv != NULL && ! same_size(img, cal->flat_inv)))
+    {
+	sprintf(extra, "Image %dx%d does not match the calibration masters", img->width, img->height);
+	log_msg_extra("APP0018", "Calibration", extra, NULL, NULL);
+    	return FALSE;
+    }
+
+    memset(&cs, 0, sizeof(CalSet));
+    cs.frm = img;
+    cs.cal = cal;
+    instr_start(&tmr, INS_CALIBRATE);
+    cs.k = (cal->dark != NULL && cal->scale) ? (float) dark_scale(img, cal) : 1.0f;
+    job_parallel_for(JOB_PRI_BATCH, 0, img->height, 0, calib_rows, &cs, NULL);
+    badpix_repair(img, cal->badpix);
+    instr_stop(&tmr, (gint64) img->width * img->height * img->channels * sizeof(float), 1);
+
+    return TRUE;
+}
+
+
+/* Dark scale that best removes the dark pattern from a frame (least squares on a grid) */
+
+double dark_scale(ImgFrame *img, CalMasters *cal)
+{
+    int x, y, c, ch, w;
+    size_t i, nb;
+    double l, d, sld, sdd, k;
+    float *p, *q, *b;
+
+    ch = img->channels;
+    w = img->width;
+    nb = (size_t) 2 * ch;			// Same colour neighbours either side
+    p = img->data;
+    q = cal->dark->data;
+    b = (cal->bias) ? cal->bias->data : NULL;
+    sld = sdd = 0.0;
+
+    for(y = SCALE_GRID / 2; y < img->height; y += SCALE_GRID)
+    {
+	for(x = 2; x < w - 2; x += SCALE_GRID)
+	{
+	    for(c = 0; c < ch; c++)
+	    {
+		i = ((size_t) y * w + x) * ch + c;
+
+		if (p[i] >= SCALE_SAT || p[i - nb] >= SCALE_SAT || p[i + nb] >= SCALE_SAT)
+		    continue;
+
+		l = p[i] - 0.5 * (p[i - nb] + p[i + nb]);
+
+		if (b)
+		    l -= b[i] - 0.5 * (b[i - nb] + b[i + nb]);
+
+		d = q[i] - 0.5 * (q[i - nb] + q[i + nb]);
+		sld += l * d;
+		sdd += d * d;
+	    }
+	}
+    }
+
+    if (sdd <= 0.0)
+    	return 1.0;
+
+    k = sld / sdd;
+
+    return CLAMP(k, 0.0, SCALE_MAX);
+}
+
+
+/* Subtract a master dark from a frame (clipped at zero) */
+
+int subtract_dark(ImgFrame *img, ImgFrame *dark)
+{
+    CalMasters cal;
+
+    memset(&cal, 0, sizeof(CalMasters));
+    cal.dark = dark;
+
+    return calibrate_frame(img, &cal);
+}
+
+
+/* Master description */
+
+const char * master_nm(int kind)
+{
+    return mst_nm[kind];
+}
+
+
+/* Decode a frame ahead of use */
+
+static void load_job(Job *job)
+{
+    MasterLoad *ld;
+
+    ld = (MasterLoad *) job->data;
+    ld->frm = frame_load_img(ld->img, NULL);
+
+    return;
+}
+
+
+/* Add a frame to the running sum, minimum and maximum for a range of rows */
+
+static void add_rows(int lo, int hi, gpointer data)
+{
+    size_t j, j0, j1, row_sz;
+    float v;
+    float *s, *mn, *mx, *p, *q;
+    CalSet *cs;
+
+    cs = (CalSet *) data;
+    row_sz = (size_t) cs->frm->width * cs->frm->channels;
+    j0 = (size_t) lo * row_sz;
+    j1 = (size_t) hi * row_sz;
+    s = cs->mb->sum->data;
+    mn = cs->mb->lo->data;
+    mx = cs->mb->hi->data;
+    p = cs->frm->data;
+    q = (cs->sub) ? cs->sub->data : NULL;
+
+    for(j = j0; j < j1; j++)
+    {
+    	v = (q) ? p[j] - q[j] : p[j];
+
+	if (cs->mb->n == 0)
+	{
+	    s[j] = mn[j] = mx[j] = v;
+	    continue;
+	}
+
+	s[j] += v;
+
+	if (v < mn[j])
+	    mn[j] = v;
+
+	if (v > mx[j])
+	    mx[j] = v;
+    }
+
+    return;
+}
+
+
+/* Mean (rejecting the highest and lowest if 3 or more) for a range of rows */
+
+static void finish_rows(int lo, int hi, gpointer data)
+{
+    size_t j, row_sz;
+    float *s, *mn, *mx;
+    CalSet *cs;
+
+    cs = (CalSet *) data;
+    row_sz = (size_t) cs->mb->sum->width * cs->mb->sum->channels;
+    s = cs->mb->sum->data;
+    mn = cs->mb->lo->data;
+    mx = cs->mb->hi->data;
+
+    for(j = (size_t) lo * row_sz; j < (size_t) hi * row_sz; j++)
+    {
+    	if (cs->mb->n >= 3)
+	    s[j] = (s[j] - mn[j] - mx[j]) / (cs->mb->n - 2);
+	else
+	    s[j] /= cs->mb->n;
+
+	if (s[j] < 0.0f)
+	    s[j] = 0.0f;
+    }
+
+    return;
+}
+
+
+/* Normalised flat reciprocal for a range of rows */
+
+static void flat_rows(int lo, int hi, gpointer data)
+{
+    int ch;
+    size_t j, row_sz;
+    double m;
+    float *f;
+    CalSet *cs;
+
+    cs = (CalSet *) data;
+    ch = cs->flat->channels;
+    row_sz = (size_t) cs->flat->width * ch;
+    f = cs->flat->data;
+
+    for(j = (size_t) lo * row_sz; j < (size_t) hi * row_sz; j++)
+    {
+	m = cs->mean[j % ch];
+	f[j] = (f[j] > m * FLAT_MIN) ? (float) (m / f[j]) : 0.0f;	// Dead, left to the bad pixel map
+    }
+
+    return;
+}
+
+
+/* Calibration for a range of rows */
+
+static void calib_rows(int lo, int hi, gpointer data)
+{
+    size_t off, row_sz;
+    float *p;
+    CalSet *cs;
+
+    cs = (CalSet *) data;
+    row_sz = (size_t) cs->frm->width * cs->frm->channels;
+    off = (size_t) lo * row_sz;
+    p = cs->frm->data + off;
+    calib_f32(p, (cs->cal->bias) ? cs->cal->bias->data + off : NULL,
+    	      (cs->cal->dark) ? cs->cal->dark->data + off : NULL, cs->k,
+	      (cs->cal->flat_inv) ? cs->cal->flat_inv->data + off : NULL,
+	      p, (size_t) (hi - lo) * row_sz);
+
+    return;
+}
+
+
+/* Frames are the same size and shape */
+
+static int same_size(ImgFrame *a, ImgFrame *b)
+{
+    return (a->width == b->width && a->height == b->height && a->channels == b->channels);
+}
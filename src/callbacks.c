@@ -45,6 +45,17 @@
 #define round(x) ((x)>=0?(long)((x)+0.5):(long)((x)-0.5))
 
 
+/* Types */
+
+typedef struct _StageData
+{
+    MainUi *m_ui;
+    PipeRun *run;
+    int stage;
+    int ok;
+} StageData;
+
+
 /* Prototypes */
 
 void OnNewProj(GtkWidget *, gpointer);
@@ -69,6 +80,10 @@ void OnPrefs(GtkWidget *, gpointer);
 void OnViewLog(GtkWidget *, gpointer);
 void OnAbout(GtkWidget *, gpointer);
 void OnQuit(GtkWidget *, gpointer);
+void stop_processing(MainUi *);
+static void start_stage(MainUi *, int);
+static void stage_job(Job *);
+static void stage_done(Job *);
 
 
 extern void edit_project_main(ProjectData *, MainUi *);
@@ -89,13 +104,28 @@ extern int close_ui(char *);
 extern gint query_dialog(GtkWidget *, char *, char *);
 extern int get_user_pref(char *, char **);
 extern int show_image(char *, MainUi *);
+extern int show_video(Image *, char *, MainUi *);
 extern int show_meta(char *, int, gchar *, MainUi *);
+extern void update_image_quality(MainUi *);
+extern char * itostr(int);
 extern void img_fit_win(GdkPixbuf *, int, int, MainUi *);
 extern void img_scale_sz(MainUi *, int);
 extern void zoom_image(double, MainUi *);
 extern void mouse_drag_check(MainUi *);
 extern void drag_move_sw(gdouble, gdouble, gdouble, gdouble, MainUi *);
 extern int setup_alignment(char *, char *, MainUi *);
+extern int save_proj_init(ProjectData *, GtkWidget *);
+extern PipeRun * pipeline_new(ProjectData *, JobToken *);
+extern void pipeline_free(PipeRun *);
+extern int pipeline_stage(PipeRun *, int, GtkWidget *);
+extern const char * pipeline_stage_nm(int);
+extern void job_submit(int, void (*)(Job *), gpointer, JobToken *, JobGroup *, void (*)(Job *));
+extern void job_group_init(JobGroup *);
+extern void job_group_wait(JobGroup *);
+extern JobToken * job_token_new(char *);
+extern void job_token_cancel(JobToken *);
+extern int job_cancelled(JobToken *);
+extern int proj_has_calib(ProjectData *);
 
 
 /* Globals */
@@ -415,29 +445,32 @@ void OnImageSelect(GtkTreeSelection *selection, gpointer user_data)
 {  
     GtkTreeIter iter;
     GtkTreeModel *model;
-    GtkTreePath *path;
-    gchar *img_nm, *img_type, *s_path;
+    gchar *img_nm, *img_type;
     int idx;
+    Image *img;
     MainUi *m_ui;
 
     /* Data */
     m_ui = (MainUi *) user_data;
     idx = -1;
+    img = NULL;
 
-    /* Get selected image */
+    /* Get selected image (the list may be sorted, so use its index rather than the row) */
     if (gtk_tree_selection_get_selected (selection, &model, &iter))
     {
-	gtk_tree_model_get (model, &iter, IMAGE_TYPE, &img_type, IMAGE_NM, &img_nm, -1);
+	gtk_tree_model_get (model, &iter, IMAGE_TYPE, &img_type, IMAGE_NM, &img_nm, IMG_IDX, &idx, -1);
 	//g_print ("You selected an image: %s\n", img_nm);
-	path = gtk_tree_model_get_path (model, &iter);
-	s_path = gtk_tree_path_to_string (path);
-	idx = atoi(s_path);
-	gtk_tree_path_free (path);
-	g_free(s_path);
     }
 
-    /* Display the image */
-    show_image(img_nm, m_ui);
+    /* Display the image (the first frame of a video) */
+    if (idx >= 0)
+	img = (Image *) g_list_nth_data((strcmp(img_type, "I") == 0) ? m_ui->proj->images_gl : m_ui->proj->darks_gl, idx);
+
+    if (img != NULL && img->vframes > 0)
+	show_video(img, img_nm, m_ui);
+    else
+	show_image(img_nm, m_ui);
+
     show_meta(img_nm, idx, img_type, m_ui);
     g_free(img_nm);
     g_free(img_type);
@@ -465,42 +498,46 @@ void OnBaseToggle(GtkCellRendererToggle *cell_renderer, gchar *path, gpointer da
 {  
     MainUi *m_ui;
     GtkTreeModel *model;
-    GtkTreeIter iter;
-    gboolean state, set;
-    gchar *img_type;
+    GtkTreeIter iter, it;
+    gboolean set;
+    gchar *img_type, *t;
+    int idx;
 
     m_ui = (MainUi *) data;
     model = gtk_tree_view_get_model (GTK_TREE_VIEW (m_ui->image_list_tree));
-    set = gtk_tree_model_get_iter_from_string(model, &iter, path);
 
-    if (set)
-    {
-    	gtk_tree_model_get(model, &iter, BASE_IMG, &state, IMAGE_TYPE, &img_type, -1);
-    	gtk_list_store_set(GTK_LIST_STORE (model), &iter, BASE_IMG, !state, -1);
-    }
+    if (! gtk_tree_model_get_iter_from_string(model, &iter, path))
+    	return;
 
-    if (strcmp(img_type, "I") == 0)
-	set = gtk_tree_model_get_iter_from_string(model, &iter, m_ui->curr_img_base);
-    else
-	set = gtk_tree_model_get_iter_from_string(model, &iter, m_ui->curr_dark_base);
+    gtk_tree_model_get(model, &iter, IMAGE_TYPE, &img_type, IMG_IDX, &idx, -1);
 
-    if (set)
+    /* One base of each type - clear the others (the list may be sorted) */
+    set = gtk_tree_model_get_iter_first(model, &it);
+
+    while(set)
     {
-    	gtk_tree_model_get(model, &iter, BASE_IMG, &state, -1);
-    	gtk_list_store_set(GTK_LIST_STORE (model), &iter, 0, !state, -1);
+    	gtk_tree_model_get(model, &it, IMAGE_TYPE, &t, -1);
+
+	if (strcmp(t, img_type) == 0)
+	    gtk_list_store_set(GTK_LIST_STORE (model), &it, BASE_IMG, FALSE, -1);
+
+	g_free(t);
+	set = gtk_tree_model_iter_next(model, &it);
     }
 
+    gtk_list_store_set(GTK_LIST_STORE (model), &iter, BASE_IMG, TRUE, -1);
+
     if (strcmp(img_type, "I") == 0)
     {
 	free(m_ui->curr_img_base);
-	m_ui->curr_img_base = strdup((char *) path);
-	m_ui->proj->baseimg = atoi(m_ui->curr_img_base);
+	m_ui->curr_img_base = itostr(idx);
+	m_ui->proj->baseimg = idx;
     }
     else
     {
 	free(m_ui->curr_dark_base);
-	m_ui->curr_dark_base = strdup((char *) path);
-	m_ui->proj->basedark = atoi(m_ui->curr_dark_base);
+	m_ui->curr_dark_base = itostr(idx);
+	m_ui->proj->basedark = idx;
     }
 
     g_free(img_type);
@@ -519,8 +556,7 @@ void OnProcessDarks(GtkWidget *btn, gpointer user_data)
     m_ui = (MainUi *) user_data;
 
     /* Process all the darks */
-    gtk_widget_set_name(m_ui->darks_btnbx, "btnbx_3");
-    gtk_widget_set_name(m_ui->register_btnbx, "btnbx_1");
+    start_stage(m_ui, STG_DARKS);
 
     return;
 }  
@@ -535,6 +571,9 @@ void OnRegister(GtkWidget *btn, gpointer user_data)
     /* Get data */
     m_ui = (MainUi *) user_data;
 
+    /* Find stars and align to the base image */
+    start_stage(m_ui, STG_REGISTER);
+
     return;
 }  
 
@@ -548,6 +587,9 @@ void OnStack(GtkWidget *btn, gpointer user_data)
     /* Get data */
     m_ui = (MainUi *) user_data;
 
+    /* Stack and save the result */
+    start_stage(m_ui, STG_STACK);
+
     return;
 }  
 
@@ -660,3 +702,141 @@ void OnQuit(GtkWidget *window, gpointer user_data)
 
 /* CALLBACK other functions */
 
+
+/* Cancel any processing and wait for it to stop (before the project is closed) */
+
+void stop_processing(MainUi *m_ui)
+{
+    if (m_ui->pipe == NULL)
+    	return;
+
+    if (m_ui->pipe_busy)
+    {
+	job_token_cancel(m_ui->pipe->token);
+	job_group_wait(&(m_ui->pipe_grp));
+	m_ui->pipe_busy = FALSE;
+    }
+
+    pipeline_free(m_ui->pipe);
+    m_ui->pipe = NULL;
+
+    return;
+}
+
+
+/* Run a processing stage in the background */
+
+static void start_stage(MainUi *m_ui, int stage)
+{
+    StageData *sd;
+
+    if (m_ui->proj == NULL || m_ui->pipe_busy)
+    	return;
+
+    if (m_ui->pipe == NULL)
+    	m_ui->pipe = pipeline_new(m_ui->proj, job_token_new("Processing"));
+
+    sd = (StageData *) malloc(sizeof(StageData));
+    sd->m_ui = m_ui;
+    sd->run = m_ui->pipe;
+    sd->stage = stage;
+    sd->ok = FALSE;
+
+    m_ui->pipe_busy = TRUE;
+    gtk_widget_set_sensitive(m_ui->darks_btn, FALSE);
+    gtk_widget_set_sensitive(m_ui->register_btn, FALSE);
+    gtk_widget_set_sensitive(m_ui->stack_btn, FALSE);
+
+    job_group_init(&(m_ui->pipe_grp));
+    job_submit(JOB_PRI_BATCH, stage_job, sd, NULL, &(m_ui->pipe_grp), stage_done);
+
+    return;
+}
+
+
+/* Processing stage (worker thread) */
+
+static void stage_job(Job *job)
+{
+    StageData *sd;
+
+    sd = (StageData *) job->data;
+    sd->ok = pipeline_stage(sd->run, sd->stage, NULL);
+
+    /* Stacking includes saving the result */
+    if (sd->ok && sd->stage == STG_STACK)
+	sd->ok = pipeline_stage(sd->run, STG_WRITE, NULL);
+
+    return;
+}
+
+
+/* Processing stage finished (main thread) */
+
+static void stage_done(Job *job)
+{
+    char *msg;
+    StageData *sd;
+    MainUi *m_ui;
+
+    sd = (StageData *) job->data;
+    m_ui = sd->m_ui;
+
+    /* Project closed in the meantime */
+    if (sd->run != m_ui->pipe)
+    {
+    	free(sd);
+    	return;
+    }
+
+    m_ui->pipe_busy = FALSE;
+    gtk_widget_set_sensitive(m_ui->darks_btn, proj_has_calib(m_ui->proj));
+    gtk_widget_set_sensitive(m_ui->register_btn, TRUE);
+    gtk_widget_set_sensitive(m_ui->stack_btn, TRUE);
+
+    if (! sd->ok)
+    {
+	if (! job_cancelled(sd->run->token))
+	    app_msg("APP0018", (char *) pipeline_stage_nm(sd->stage), m_ui->window);
+
+	free(sd);
+    	return;
+    }
+
+    /* Colour code and save the new status */
+    switch(sd->stage)
+    {
+	case STG_DARKS:
+	    gtk_widget_set_name(m_ui->darks_btnbx, "btnbx_3");
+	    gtk_widget_set_name(m_ui->register_btnbx, "btnbx_1");
+	    break;
+
+	case STG_REGISTER:
+	    update_image_quality(m_ui);
+	    gtk_widget_set_name(m_ui->register_btnbx, "btnbx_3");
+	    gtk_widget_set_name(m_ui->stack_btnbx, "btnbx_1");
+	    break;
+
+	case STG_STACK:
+	    update_image_quality(m_ui);
+	    gtk_widget_set_name(m_ui->stack_btnbx, "btnbx_3");
+	    msg = (char *) malloc(strlen(sd->run->out_fn) + 24);
+	    sprintf(msg, "Stacked image saved: %s", sd->run->out_fn);
+	    gtk_label_set_text(GTK_LABEL (m_ui->status_info), msg);
+	    free(msg);
+	    break;
+
+	default:
+	    break;
+    }
+
+    if (m_ui->proj->status < sd->stage + 1)
+    {
+	m_ui->proj->status = sd->stage + 1;
+	save_proj_init(m_ui->proj, m_ui->window);
+    }
+
+    free(sd);
+
+    return;
+}
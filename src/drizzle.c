@@ -0,0 +1,366 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Drizzle integration - for undersampled frames. Each calibrated pixel is shrunk to a
+**  'drop' (a fraction of the pixel side) about its centre, carried through the frame's
+**  transform onto an output grid finer than the base image (1.5 or 2 times) and added
+**  into each output pixel it overlaps in proportion to the area of overlap, as is the
+**  weight. The drop is taken as a square on the output grid (the transforms are near
+**  rotation free between frames), so the overlaps are simple products.
+**  Single channel frames with a colour filter array pattern set are drizzled as mosaics,
+**  each pixel dropping into its own colour only (each colour has its own weight).
+**  The output is worked in bands of rows, each band by one job from the input rows that
+**  can reach it, so all the threads share the one accumulator with no copies or locks.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define DRIZ_CELLS 8			// Most output cells a drop covers along each axis (scale 4, drop 1)
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <pipeline.h>
+#include <instrument.h>
+
+
+/* Types */
+
+typedef struct _DrizAcc
+{
+    ImgFrame *frm;
+    ImgFrame *sum;
+    float *cnt;
+    int wch;				// Weights per output pixel (1, or 3 for a mosaic)
+    int cfa[4];				// Mosaic colour of each pixel of a 2 x 2 cell (-1 is none)
+    Xform fwd;				// Frame pixel to output pixel
+    Xform inv;				// Output pixel to frame pixel
+    double half;			// Half the drop side (output pixels)
+    float w;
+} DrizAcc;
+
+
+/* Prototypes */
+
+ImgFrame * drizzle_new(PipeRun *, ImgFrame *, float **, int *);
+void drizzle_accumulate(PipeRun *, ImgFrame *, Xform *, ImgFrame *, float *, float);
+void drizzle_average(ImgFrame *, float *, int, int);
+static void drizzle_rows(int, int, gpointer);
+static void drizzle_average_rows(int, int, gpointer);
+static int drop_cover(double, double, int, int, int *, float *);
+static int cfa_map(PipeRun *, ImgFrame *, int *);
+
+extern ImgFrame * frame_new(int, int, int);
+extern int xform_invert(Xform *, Xform *);
+extern void xform_apply(Xform *, double, double, double *, double *);
+extern void job_parallel_for(int, int, int, int, JobRangeFunc, gpointer, JobToken *);
+extern void instr_start(InstrTimer *, int);
+extern void instr_stop(InstrTimer *, gint64, int);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-drizzle.c ";
+
+
+/* Output accumulator for frames like 'frm' and its weights ('wch' per pixel) */
+
+ImgFrame * drizzle_new(PipeRun *run, ImgFrame *frm, float **cnt, int *wch)
+{
+    int w, h, cfa[4];
+    ImgFrame *sum;
+
+    w = (int) (frm->width * run->driz_scale + 0.5);
+    h = (int) (frm->height * run->driz_scale + 0.5);
+    *wch = (cfa_map(run, frm, cfa)) ? 3 : 1;
+    sum = frame_new(w, h, (*wch == 3) ? 3 : frm->channels);
+    *cnt = (float *) calloc((size_t) w * h * *wch, sizeof(float));
+
+    return sum;
+}
+
+
+/* Drop a frame onto the output with weight 'w' */
+
+void drizzle_accumulate(PipeRun *run, ImgFrame *frm, Xform *xf, ImgFrame *sum, float *cnt, float w)
+{
+    double s;
+    DrizAcc acc;
+    InstrTimer tmr;
+
+    s = run->driz_scale;
+    acc.frm = frm;
+    acc.sum = sum;
+    acc.cnt = cnt;
+    acc.w = w;
+    acc.wch = (cfa_map(run, frm, acc.cfa)) ? 3 : 1;
+
+    /* Pixel centres: output u = (X + 0.5) * s - 0.5 for base image X */
+    acc.fwd.a = xf->a * s;
+    acc.fwd.b = xf->b * s;
+    acc.fwd.c = (xf->c + 0.5) * s - 0.5;
+    acc.fwd.d = xf->d * s;
+    acc.fwd.e = xf->e * s;
+    acc.fwd.f = (xf->f + 0.5) * s - 0.5;
+
+    if (! xform_invert(&(acc.fwd), &(acc.inv)))
+    	return;
+
+    acc.half = 0.5 * run->driz_drop * sqrt(fabs(acc.fwd.a * acc.fwd.e - acc.fwd.b * acc.fwd.d));
+
+    instr_start(&tmr, INS_WARP);
+    job_parallel_for(JOB_PRI_BATCH, 0, sum->height, 0, drizzle_rows, &acc, NULL);
+    instr_stop(&tmr, (gint64) frm->width * frm->height * frm->channels * sizeof(float), 1);
+
+    return;
+}
+
+
+/* Divide the sums by the weights (pixels no drop reached are 0) */
+
+void drizzle_average(ImgFrame *sum, float *cnt, int wch, int frames)
+{
+    DrizAcc acc;
+    InstrTimer tmr;
+
+    memset(&acc, 0, sizeof(DrizAcc));
+    acc.sum = sum;
+    acc.cnt = cnt;
+    acc.wch = wch;
+    instr_start(&tmr, INS_ACCUM);
+    job_parallel_for(JOB_PRI_BATCH, 0, sum->height, 0, drizzle_average_rows, &acc, NULL);
+    instr_stop(&tmr, (gint64) sum->width * sum->height * sum->channels * sizeof(float), frames);
+
+    return;
+}
+
+
+/* Drop the frame pixels that reach output rows [lo, hi) */
+
+static void drizzle_rows(int lo, int hi, gpointer data)
+{
+    int i, j, k, x, y, c, ch, oc, x0, x1, y0, y1, j0, k0, nj, nk, wo, wch;
+    double u, v, ylo, yhi, h, fa, fd;
+    double px[4], py[4], bx0, bx1, by0, by1;
+    float wu[DRIZ_CELLS], wv[DRIZ_CELLS];
+    float wt, wk, fw;
+    float *p, *s, *n, *sum, *cnt;
+    DrizAcc *acc;
+
+    acc = (DrizAcc *) data;
+    ch = acc->frm->channels;
+    oc = acc->sum->channels;
+    wo = acc->sum->width;
+    h = acc->half;
+    ylo = lo - 0.5;
+    yhi = hi - 0.5;
+
+    /* Frame pixels whose drops can reach the band - its corners taken back, plus the drop */
+    xform_apply(&(acc->inv), -0.5 - h, ylo - h, &px[0], &py[0]);
+    xform_apply(&(acc->inv), wo - 0.5 + h, ylo - h, &px[1], &py[1]);
+    xform_apply(&(acc->inv), -0.5 - h, yhi + h, &px[2], &py[2]);
+    xform_apply(&(acc->inv), wo - 0.5 + h, yhi + h, &px[3], &py[3]);
+    bx0 = bx1 = px[0];
+    by0 = by1 = py[0];
+
+    for(i = 1; i < 4; i++)
+    {
+	bx0 = MIN(bx0, px[i]); bx1 = MAX(bx1, px[i]);
+	by0 = MIN(by0, py[i]); by1 = MAX(by1, py[i]);
+    }
+
+    x0 = MAX((int) floor(bx0), 0);
+    x1 = MIN((int) ceil(bx1) + 1, acc->frm->width);
+    y0 = MAX((int) floor(by0), 0);
+    y1 = MIN((int) ceil(by1) + 1, acc->frm->height);
+
+    /* Locals - the stores to the output could otherwise alias the fields */
+    fa = acc->fwd.a;
+    fd = acc->fwd.d;
+    fw = acc->w;
+    wch = acc->wch;
+    sum = acc->sum->data;
+    cnt = acc->cnt;
+
+    for(y = y0; y < y1; y++)
+    {
+	u = fa * x0 + acc->fwd.b * y + acc->fwd.c;
+	v = fd * x0 + acc->fwd.e * y + acc->fwd.f;
+	p = acc->frm->data + ((size_t) y * acc->frm->width + x0) * ch;
+
+	for(x = x0; x < x1; x++, u += fa, v += fd, p += ch)
+	{
+	    /* Overlap of the drop with each output row and column it covers (within the band),
+	       the rows being the same along the frame row without rotation */
+	    if (x == x0 || fd != 0.0)
+		nk = drop_cover(v, h, lo, hi, &k0, wv);
+
+	    if (nk == 0)
+	    	continue;
+
+	    if ((nj = drop_cover(u, h, 0, wo, &j0, wu)) == 0)
+	    	continue;
+
+	    /* Overlap area (output pixels) times the frame weight */
+	    for(k = 0; k < nk; k++)
+	    {
+		wk = wv[k] * fw;
+		s = sum + ((size_t) (k0 + k) * wo + j0) * oc;
+		n = cnt + ((size_t) (k0 + k) * wo + j0) * wch;
+
+		if (wch == 3)
+		{
+		    /* Mosaic - own colour only */
+		    c = acc->cfa[(y & 1) * 2 + (x & 1)];
+
+		    for(j = 0; j < nj; j++)
+		    {
+			wt = wu[j] * wk;
+			s[j * 3 + c] += p[0] * wt;
+			n[j * 3 + c] += wt;
+		    }
+		}
+		else if (ch == 1)
+		{
+		    for(j = 0; j < nj; j++)
+		    {
+			wt = wu[j] * wk;
+			s[j] += p[0] * wt;
+			n[j] += wt;
+		    }
+		}
+		else
+		{
+		    for(j = 0; j < nj; j++, s += oc)
+		    {
+			wt = wu[j] * wk;
+
+			for(i = 0; i < ch; i++)
+			    s[i] += p[i] * wt;
+
+			n[j] += wt;
+		    }
+		}
+	    }
+	}
+    }
+
+    return;
+}
+
+
+/* Output cells [lo, hi) the drop [t - h, t + h] covers - first in 'i0', overlaps in 'w', returns the count */
+
+static int drop_cover(double t, double h, int lo, int hi, int *i0, float *w)
+{
+    int i, n;
+    double a, b, e;
+
+    /* Cell i spans [i - 0.5, i + 0.5), shifted here to [i, i + 1) */
+    a = t - h + 0.5;
+    b = t + h + 0.5;
+
+    if (b <= lo || a >= hi)
+    	return 0;
+
+    if (a < lo)
+    {
+	i = lo;
+	a = lo;
+    }
+    else
+	i = (int) a;
+
+    *i0 = i;
+
+    for(n = 0; i < hi && i < b && n < DRIZ_CELLS; i++, n++)
+    {
+	e = MIN(b, (double) (i + 1));
+	w[n] = (float) (e - a);
+	a = e;
+    }
+
+    return n;
+}
+
+
+/* Divide by the weights for a range of rows */
+
+static void drizzle_average_rows(int lo, int hi, gpointer data)
+{
+    int x, y, c, ch;
+    float n;
+    float *s, *w;
+    DrizAcc *acc;
+
+    acc = (DrizAcc *) data;
+    ch = acc->sum->channels;
+
+    for(y = lo; y < hi; y++)
+    {
+	s = acc->sum->data + (size_t) y * acc->sum->width * ch;
+	w = acc->cnt + (size_t) y * acc->sum->width * acc->wch;
+
+	for(x = 0; x < acc->sum->width; x++, s += ch, w += acc->wch)
+	{
+	    for(c = 0; c < ch; c++)
+	    {
+		n = w[(acc->wch == 3) ? c : 0];
+		s[c] = (n > 0.0f) ? s[c] / n : 0.0f;
+	    }
+	}
+    }
+
+    return;
+}
+
+
+/* Colour of each pixel of a 2 x 2 mosaic cell for a single channel frame - FALSE if not a mosaic */
+
+static int cfa_map(PipeRun *run, ImgFrame *frm, int *cfa)
+{
+    int i;
+    static const int map[5][4] = { {-1, -1, -1, -1},
+				   { 0, 1, 1, 2 },	// RGGB
+				   { 2, 1, 1, 0 },	// BGGR
+				   { 1, 0, 2, 1 },	// GRBG
+				   { 1, 2, 0, 1 } };	// GBRG
+
+    for(i = 0; i < 4; i++)
+    	cfa[i] = map[CLAMP(run->cfa, 0, 4)][i];
+
+    return (frm->channels == 1 && run->cfa != CFA_NONE);
+}
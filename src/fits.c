@@ -0,0 +1,628 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  FITS files - the stacked result and intermediate frames written and read back without
+**  loss as 32 bit float (BITPIX -32) or unsigned 16 bit (BITPIX 16, BZERO 32768) samples.
+**  A colour frame is a 3 plane cube (NAXIS3 = 3), rows top first (ROWORDER). The header
+**  carries the exposure, ISO, the number of frames combined and any frame transform.
+**  The file is moved in large blocks (a whole number of 2880 byte FITS records) straight
+**  through read and write, the samples converted to and from the big endian planes in the
+**  one buffer on the way, so there is no stdio copy or per sample call.
+**  The reader also takes the 8, 32 and -64 sample types other programs may write.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define FITS_REC 2880			// FITS record size (bytes)
+#define FITS_CARD 80			// Header card size (bytes)
+#define FITS_IO_RECS 360		// Records moved per read or write (about 1 MB)
+#define FITS_MAX_HDR 100		// Most header records read
+#define FITS_HDR_RECS 1			// Header records written (36 cards)
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <pipeline.h>
+#include <instrument.h>
+
+
+/* Types */
+
+typedef struct _FitsHdr
+{
+    int bitpix;
+    int size;				// Bytes per sample
+    int naxis, naxis1, naxis2, naxis3;
+    double bzero, bscale;
+    int bottom_up;			// ROWORDER = 'BOTTOM-UP'
+    int end;				// END card found
+} FitsHdr;
+
+
+/* Prototypes */
+
+int fits_write(ImgFrame *, char *, int, FitsInfo *, GtkWidget *);
+ImgFrame * fits_read(char *, FitsInfo *, GtkWidget *);
+void fits_info_img(Image *, FitsInfo *);
+static int write_header(int, char *, ImgFrame *, int, FitsInfo *, size_t *);
+static int write_data(int, char *, ImgFrame *, int, size_t *);
+static int read_header(int, char *, FitsHdr *, FitsInfo *, size_t *);
+static int read_data(int, char *, ImgFrame *, FitsHdr *, size_t *);
+static void card(char *, int *, char *, char *, char *);
+static void card_int(char *, int *, char *, int, char *);
+static void card_dbl(char *, int *, char *, double, char *);
+static void parse_card(char *, FitsHdr *, FitsInfo *);
+static void put_samples(char *, ImgFrame *, int, size_t, size_t);
+static void get_samples(char *, ImgFrame *, FitsHdr *, size_t, size_t);
+static void flip_rows(ImgFrame *);
+
+extern ImgFrame * frame_new(int, int, int);
+extern void frame_free(ImgFrame *);
+extern void instr_start(InstrTimer *, int);
+extern void instr_stop(InstrTimer *, gint64, int);
+extern void log_msg_extra(char*, char*, char*, char*, GtkWidget*);
+extern double exif_exposure(const char *);
+extern int write_all(int, unsigned char *, size_t);
+extern int read_all(int, unsigned char *, size_t);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-fits.c ";
+
+
+/* Write a frame as a FITS file, 'bitpix' FITS_FLOAT32 or FITS_UINT16 ('info' may be NULL) */
+
+int fits_write(ImgFrame *frm, char *fn, int bitpix, FitsInfo *info, GtkWidget *window)
+{
+    int fd, ok, err;
+    size_t total;
+    char *buf;
+    InstrTimer tmr;
+    char extra[256];
+
+    instr_start(&tmr, INS_WRITE);
+
+    if ((fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+	sprintf(extra, "Error: (%d) %s", errno, strerror(errno));
+	log_msg_extra("SYS9005", fn, extra, "SYS9005", window);
+    	return FALSE;
+    }
+
+    bitpix = (bitpix == FITS_UINT16) ? FITS_UINT16 : FITS_FLOAT32;
+    buf = (char *) malloc((size_t) FITS_REC * FITS_IO_RECS);
+    total = 0;
+
+    ok = (write_header(fd, buf, frm, bitpix, info, &total) && write_data(fd, buf, frm, bitpix, &total));
+    err = errno;
+
+    if (close(fd) != 0 && ok)
+    {
+	ok = FALSE;
+	err = errno;
+    }
+
+    free(buf);
+
+    if (! ok)
+    {
+	sprintf(extra, "Error: (%d) %s", err, strerror(err));
+	log_msg_extra("SYS9012", fn, extra, "SYS9012", window);
+	instr_stop(&tmr, 0, 0);
+    	return FALSE;
+    }
+
+    instr_stop(&tmr, (gint64) total, 1);
+
+    return TRUE;
+}
+
+
+/* Read a FITS image as a frame (samples as written, 0 - 65535 for this program's files),
+   'info' (may be NULL) gets any exposure, ISO, frame count and transform */
+
+ImgFrame * fits_read(char *fn, FitsInfo *info, GtkWidget *window)
+{
+    int fd, r, err;
+    size_t total;
+    char *buf;
+    FitsHdr hdr;
+    char extra[256];
+    FitsInfo tmp;
+    ImgFrame *frm;
+    InstrTimer tmr;
+
+    instr_start(&tmr, INS_DECODE);
+
+    if ((fd = open(fn, O_RDONLY)) < 0)
+    {
+	sprintf(extra, "Error: (%d) %s", errno, strerror(errno));
+	log_msg_extra("SYS9005", fn, extra, "SYS9005", window);
+    	return NULL;
+    }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    if (info == NULL)
+    	info = &tmp;
+
+    buf = (char *) malloc((size_t) FITS_REC * FITS_IO_RECS);
+    frm = NULL;
+    total = 0;
+
+    if ((r = read_header(fd, buf, &hdr, info, &total)) == TRUE)
+    {
+	frm = frame_new(hdr.naxis1, hdr.naxis2, hdr.naxis3);
+
+	if (frm == NULL || ! read_data(fd, buf, frm, &hdr, &total))
+	{
+	    r = FALSE;
+	    frame_free(frm);
+	    frm = NULL;
+	}
+    }
+
+    err = errno;
+    close(fd);
+    free(buf);
+
+    if (r < 0)
+    {
+	log_msg_extra("APP0024", fn, NULL, "APP0024", window);
+	instr_stop(&tmr, 0, 0);
+	return NULL;
+    }
+    else if (r == FALSE)
+    {
+	sprintf(extra, "Error: (%d) %s", err, strerror(err));
+	log_msg_extra("SYS9013", fn, extra, "SYS9013", window);
+	instr_stop(&tmr, 0, 0);
+	return NULL;
+    }
+
+    if (hdr.bottom_up)
+    	flip_rows(frm);
+
+    instr_stop(&tmr, (gint64) total, 1);
+
+    return frm;
+}
+
+
+/* Exposure and ISO from an image's Exif (eg. '1/60 sec.' or '30.0 sec.') */
+
+void fits_info_img(Image *img, FitsInfo *info)
+{
+    memset(info, 0, sizeof(FitsInfo));
+    info->ncombine = 1;
+
+    if (img == NULL)
+    	return;
+
+    info->exptime = exif_exposure(img->img_exif.exposure);
+
+    if (img->img_exif.iso != NULL)
+	info->iso = atoi(img->img_exif.iso);
+
+    return;
+}
+
+
+/* Add a header card - value (as is) in columns 11 - 30, right justified */
+
+static void card(char *hdr, int *nc, char *key, char *val, char *comment)
+{
+    char s[FITS_CARD + 1];
+
+    if (val == NULL)
+	snprintf(s, sizeof(s), "%-8.8s", key);
+    else if (val[0] == '\'')
+	snprintf(s, sizeof(s), "%-8.8s= %-20s%s%s", key, val, (comment) ? " / " : "", (comment) ? comment : "");
+    else
+	snprintf(s, sizeof(s), "%-8.8s= %20s%s%s", key, val, (comment) ? " / " : "", (comment) ? comment : "");
+
+    memcpy(hdr + *nc * FITS_CARD, s, strlen(s));
+    (*nc)++;
+
+    return;
+}
+
+
+/* Integer card */
+
+static void card_int(char *hdr, int *nc, char *key, int val, char *comment)
+{
+    char s[24];
+
+    sprintf(s, "%d", val);
+    card(hdr, nc, key, s, comment);
+
+    return;
+}
+
+
+/* Real card (full double precision) */
+
+static void card_dbl(char *hdr, int *nc, char *key, double val, char *comment)
+{
+    char s[32];
+
+    snprintf(s, sizeof(s), "%.17G", val);
+
+    if (strpbrk(s, ".E") == NULL)
+	strcat(s, ".");
+
+    card(hdr, nc, key, s, comment);
+
+    return;
+}
+
+
+/* Pick out the header values used */
+
+static void parse_card(char *c, FitsHdr *hdr, FitsInfo *info)
+{
+    char key[9], val[FITS_CARD];
+
+    memcpy(key, c, 8);
+    key[8] = '\0';
+    g_strchomp(key);
+
+    if (strcmp(key, "END") == 0)
+    {
+	hdr->end = TRUE;
+    	return;
+    }
+
+    if (c[8] != '=')
+    	return;
+
+    memcpy(val, c + 10, FITS_CARD - 10);
+    val[FITS_CARD - 10] = '\0';
+
+    if (strcmp(key, "BITPIX") == 0)
+	hdr->bitpix = atoi(val);
+    else if (strcmp(key, "NAXIS") == 0)
+	hdr->naxis = atoi(val);
+    else if (strcmp(key, "NAXIS1") == 0)
+	hdr->naxis1 = atoi(val);
+    else if (strcmp(key, "NAXIS2") == 0)
+	hdr->naxis2 = atoi(val);
+    else if (strcmp(key, "NAXIS3") == 0)
+	hdr->naxis3 = atoi(val);
+    else if (strcmp(key, "BZERO") == 0)
+	hdr->bzero = g_ascii_strtod(val, NULL);
+    else if (strcmp(key, "BSCALE") == 0)
+	hdr->bscale = g_ascii_strtod(val, NULL);
+    else if (strcmp(key, "ROWORDER") == 0)
+	hdr->bottom_up = (strstr(val, "BOTTOM-UP") != NULL);
+    else if (strcmp(key, "EXPTIME") == 0 || strcmp(key, "EXPOSURE") == 0)
+	info->exptime = g_ascii_strtod(val, NULL);
+    else if (strcmp(key, "ISOSPEED") == 0)
+	info->iso = atoi(val);
+    else if (strcmp(key, "NCOMBINE") == 0)
+	info->ncombine = atoi(val);
+    else if (strncmp(key, "XFORM_", 6) == 0 && key[6] >= 'A' && key[6] <= 'F' && key[7] == '\0')
+    {
+	(&(info->xf.a))[key[6] - 'A'] = g_ascii_strtod(val, NULL);
+	info->has_xform = TRUE;
+    }
+
+    return;
+}
+
+
+/* Header records */
+
+static int write_header(int fd, char *buf, ImgFrame *frm, int bitpix, FitsInfo *info, size_t *total)
+{
+    int nc;
+    size_t n;
+
+    nc = 0;
+    memset(buf, ' ', FITS_REC * FITS_HDR_RECS);
+    card(buf, &nc, "SIMPLE", "T", "Standard FITS");
+    card_int(buf, &nc, "BITPIX", bitpix, (bitpix == FITS_UINT16) ? "Unsigned 16 bit (BZERO)" : "32 bit float");
+    card_int(buf, &nc, "NAXIS", (frm->channels == 1) ? 2 : 3, NULL);
+    card_int(buf, &nc, "NAXIS1", frm->width, "Columns");
+    card_int(buf, &nc, "NAXIS2", frm->height, "Rows");
+
+    if (frm->channels > 1)
+	card_int(buf, &nc, "NAXIS3", frm->channels, "Colour planes (RGB)");
+
+    if (bitpix == FITS_UINT16)
+    {
+	card_int(buf, &nc, "BZERO", 32768, NULL);
+	card_int(buf, &nc, "BSCALE", 1, NULL);
+    }
+
+    card(buf, &nc, "ROWORDER", "'TOP-DOWN'", "First row is the top of the image");
+    card(buf, &nc, "CREATOR", "'StarsAl'", NULL);
+
+    if (info != NULL)
+    {
+	if (info->exptime > 0.0)
+	    card_dbl(buf, &nc, "EXPTIME", info->exptime, "Exposure (seconds)");
+
+	if (info->iso > 0)
+	    card_int(buf, &nc, "ISOSPEED", info->iso, NULL);
+
+	if (info->ncombine > 0)
+	    card_int(buf, &nc, "NCOMBINE", info->ncombine, "Frames combined");
+
+	if (info->has_xform)
+	{
+	    card_dbl(buf, &nc, "XFORM_A", info->xf.a, "Frame to base: X = A x + B y + C");
+	    card_dbl(buf, &nc, "XFORM_B", info->xf.b, NULL);
+	    card_dbl(buf, &nc, "XFORM_C", info->xf.c, NULL);
+	    card_dbl(buf, &nc, "XFORM_D", info->xf.d, "Frame to base: Y = D x + E y + F");
+	    card_dbl(buf, &nc, "XFORM_E", info->xf.e, NULL);
+	    card_dbl(buf, &nc, "XFORM_F", info->xf.f, NULL);
+	}
+    }
+
+    card(buf, &nc, "END", NULL, NULL);
+    n = (size_t) ((nc * FITS_CARD + FITS_REC - 1) / FITS_REC) * FITS_REC;
+    *total += n;
+
+    return write_all(fd, (unsigned char *) buf, n);
+}
+
+
+/* Sample planes in large blocks, the last padded to a whole record */
+
+static int write_data(int fd, char *buf, ImgFrame *frm, int bitpix, size_t *total)
+{
+    int sz;
+    size_t i, k, m, n, nb;
+
+    sz = (bitpix == FITS_UINT16) ? 2 : 4;
+    nb = (size_t) FITS_REC * FITS_IO_RECS / sz;
+    n = (size_t) frm->width * frm->height * frm->channels;
+
+    for(i = 0; i < n; i += k)
+    {
+	k = MIN(n - i, nb);
+	put_samples(buf, frm, bitpix, i, k);
+	m = k * sz;
+
+	if (i + k == n && m % FITS_REC != 0)
+	{
+	    memset(buf + m, 0, FITS_REC - m % FITS_REC);
+	    m += FITS_REC - m % FITS_REC;
+	}
+
+	if (! write_all(fd, (unsigned char *) buf, m))
+	    return FALSE;
+
+	*total += m;
+    }
+
+    return TRUE;
+}
+
+
+/* Header records to the END card - TRUE, FALSE (read failed) or -1 (not a FITS image read here) */
+
+static int read_header(int fd, char *buf, FitsHdr *hdr, FitsInfo *info, size_t *total)
+{
+    int i, r, sz;
+
+    memset(info, 0, sizeof(FitsInfo));
+    memset(hdr, 0, sizeof(FitsHdr));
+    hdr->bscale = 1.0;
+    hdr->naxis3 = 1;
+
+    for(r = 0; r < FITS_MAX_HDR && ! hdr->end; r++)
+    {
+	if (! read_all(fd, (unsigned char *) buf, FITS_REC))
+	    return (r == 0 && errno == EIO) ? -1 : FALSE;
+
+	if (r == 0 && strncmp(buf, "SIMPLE  =", 9) != 0)
+	    return -1;
+
+	for(i = 0; i < FITS_REC / FITS_CARD && ! hdr->end; i++)
+	    parse_card(buf + i * FITS_CARD, hdr, info);
+
+	*total += FITS_REC;
+    }
+
+    sz = abs(hdr->bitpix) / 8;
+
+    if (! hdr->end || hdr->naxis < 2 || hdr->naxis > 3 || hdr->naxis1 <= 0 || hdr->naxis2 <= 0
+    	|| (hdr->naxis3 != 1 && hdr->naxis3 != 3) || hdr->bscale == 0.0
+    	|| (hdr->bitpix != 8 && hdr->bitpix != 16 && hdr->bitpix != 32 && hdr->bitpix != -32 && hdr->bitpix != -64))
+	return -1;
+
+    hdr->size = sz;
+
+    return TRUE;
+}
+
+
+/* Sample planes in large blocks */
+
+static int read_data(int fd, char *buf, ImgFrame *frm, FitsHdr *hdr, size_t *total)
+{
+    size_t i, k, n, nb;
+
+    nb = (size_t) FITS_REC * FITS_IO_RECS / hdr->size;
+    n = (size_t) frm->width * frm->height * frm->channels;
+
+    for(i = 0; i < n; i += k)
+    {
+	k = MIN(n - i, nb);
+
+	if (! read_all(fd, (unsigned char *) buf, k * hdr->size))
+	    return FALSE;
+
+	get_samples(buf, frm, hdr, i, k);
+	*total += k * hdr->size;
+    }
+
+    return TRUE;
+}
+
+
+/* Samples [k, k + n) of the planes (plane by plane) to big endian file order */
+
+static void put_samples(char *buf, ImgFrame *frm, int bitpix, size_t k, size_t n)
+{
+    size_t i, np, px;
+    int c, v;
+    guint16 *p16;
+    guint32 *p32;
+    union { float f; guint32 u; } fu;
+
+    np = (size_t) frm->width * frm->height;
+    c = k / np;
+    px = k % np;
+    p16 = (guint16 *) buf;
+    p32 = (guint32 *) buf;
+
+    for(i = 0; i < n; i++)
+    {
+	if (bitpix == FITS_UINT16)
+	{
+	    /* Offset by BZERO, two's complement of v - 32768 is v with the top bit flipped */
+	    v = (int) (frm->data[px * frm->channels + c] + 0.5f);
+	    v = CLAMP(v, 0, 65535);
+	    p16[i] = GUINT16_TO_BE((guint16) (v ^ 0x8000));
+	}
+	else
+	{
+	    fu.f = frm->data[px * frm->channels + c];
+	    p32[i] = GUINT32_TO_BE(fu.u);
+	}
+
+	if (++px == np)
+	{
+	    px = 0;
+	    c++;
+	}
+    }
+
+    return;
+}
+
+
+/* File samples [k, k + n) into the frame, scaled by BSCALE and BZERO */
+
+static void get_samples(char *buf, ImgFrame *frm, FitsHdr *hdr, size_t k, size_t n)
+{
+    size_t i, np, px;
+    int c;
+    double v;
+    union { float f; guint32 u; } fu;
+    union { double d; guint64 u; } du;
+
+    np = (size_t) frm->width * frm->height;
+    c = k / np;
+    px = k % np;
+
+    for(i = 0; i < n; i++)
+    {
+	switch(hdr->bitpix)
+	{
+	    case 8:
+		v = ((guint8 *) buf)[i];
+		break;
+
+	    case 16:
+		v = (gint16) GUINT16_FROM_BE(((guint16 *) buf)[i]);
+		break;
+
+	    case 32:
+		v = (gint32) GUINT32_FROM_BE(((guint32 *) buf)[i]);
+		break;
+
+	    case -32:
+		fu.u = GUINT32_FROM_BE(((guint32 *) buf)[i]);
+		v = fu.f;
+		break;
+
+	    default:
+		du.u = GUINT64_FROM_BE(((guint64 *) buf)[i]);
+		v = du.d;
+		break;
+	}
+
+	/* Float files need no scaling - keep the sample exact */
+	if (hdr->bitpix == -32 && hdr->bscale == 1.0 && hdr->bzero == 0.0)
+	    frm->data[px * frm->channels + c] = fu.f;
+	else
+	    frm->data[px * frm->channels + c] = (float) (v * hdr->bscale + hdr->bzero);
+
+	if (++px == np)
+	{
+	    px = 0;
+	    c++;
+	}
+    }
+
+    return;
+}
+
+
+/* Turn a bottom row first image the right way up */
+
+static void flip_rows(ImgFrame *frm)
+{
+    int y;
+    size_t rs;
+    float *tmp, *a, *b;
+
+    rs = (size_t) frm->width * frm->channels;
+    tmp = (float *) malloc(rs * sizeof(float));
+
+    for(y = 0; y < frm->height / 2; y++)
+    {
+	a = frm->data + (size_t) y * rs;
+	b = frm->data + (size_t) (frm->height - 1 - y) * rs;
+	memcpy(tmp, a, rs * sizeof(float));
+	memcpy(a, b, rs * sizeof(float));
+	memcpy(b, tmp, rs * sizeof(float));
+    }
+
+    free(tmp);
+
+    return;
+}
@@ -0,0 +1,329 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Frame (working image) functions - create, load, save and convert.
+**  Images are decoded with gdk-pixbuf which needs no GTK initialisation, so these
+**  are shared by the user interface and the command line.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <pipeline.h>
+#include <instrument.h>
+
+
+/* Prototypes */
+
+ImgFrame * frame_new(int, int, int);
+void frame_free(ImgFrame *);
+ImgFrame * frame_load(char *, GtkWidget *);
+ImgFrame * frame_load_img(Image *, GtkWidget *);
+ImgFrame * frame_luma(ImgFrame *);
+ImgFrame * frame_bin_luma(ImgFrame *, int);
+int frame_save_pnm(ImgFrame *, char *, GtkWidget *);
+
+extern void accum_f32(const float *, float *, size_t);
+extern ImgFrame * tiff_read(char *, int, GtkWidget *);
+extern ImgFrame * video_frame_load(Image *, GtkWidget *);
+extern void instr_start(InstrTimer *, int);
+extern void instr_stop(InstrTimer *, gint64, int);
+extern void log_msg_extra(char*, char*, char*, char*, GtkWidget*);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-frame_io.c ";
+
+
+/* Create a new (zeroed) frame */
+
+ImgFrame * frame_new(int w, int h, int channels)
+{
+    ImgFrame *frm;
+
+    frm = (ImgFrame *) malloc(sizeof(ImgFrame));
+    frm->width = w;
+    frm->height = h;
+    frm->channels = channels;
+    frm->data = (float *) calloc((size_t) w * h * channels, sizeof(float));
+
+    if (frm->data == NULL)
+    {
+    	free(frm);
+    	return NULL;
+    }
+
+    return frm;
+}
+
+
+/* Free a frame */
+
+void frame_free(ImgFrame *frm)
+{
+    if (frm == NULL)
+    	return;
+
+    free(frm->data);
+    free(frm);
+
+    return;
+}
+
+
+/* Load an image file as an RGB frame scaled to 0 - 65535 (TIFF keeps its depth and may be grey) */
+
+ImgFrame * frame_load(char *path, GtkWidget *window)
+{
+    int x, y, w, h, n_ch, stride;
+    guchar *pixels, *p;
+    char *ext;
+    float *q;
+    char extra[256];
+    GdkPixbuf *pixbuf;
+    GError *err = NULL;
+    ImgFrame *frm;
+    InstrTimer tmr;
+
+    ext = strrchr(path, '.');
+
+    if (ext != NULL && (strcasecmp(ext, ".tif") == 0 || strcasecmp(ext, ".tiff") == 0))
+	if ((frm = tiff_read(path, TRUE, window)) != NULL)
+	    return frm;
+
+    instr_start(&tmr, INS_DECODE);
+
+    if ((pixbuf = gdk_pixbuf_new_from_file(path, &err)) == NULL)
+    {
+	extra[0] = '\0';
+
+	if (err)
+	{
+	    snprintf(extra, sizeof(extra), "%s", err->message);
+	    g_error_free(err);
+	}
+
+	log_msg_extra("APP0016", path, extra, "APP0016", window);
+    	return NULL;
+    }
+
+    w = gdk_pixbuf_get_width(pixbuf);
+    h = gdk_pixbuf_get_height(pixbuf);
+    n_ch = gdk_pixbuf_get_n_channels(pixbuf);
+    stride = gdk_pixbuf_get_rowstride(pixbuf);
+    pixels = gdk_pixbuf_get_pixels(pixbuf);
+
+    if ((frm = frame_new(w, h, 3)) == NULL)
+    {
+	g_object_unref(pixbuf);
+    	return NULL;
+    }
+
+    /* Drop any alpha channel */
+    for(y = 0; y < h; y++)
+    {
+	p = pixels + (size_t) y * stride;
+	q = frm->data + (size_t) y * w * 3;
+
+	for(x = 0; x < w; x++, p += n_ch, q += 3)
+	{
+	    q[0] = p[0] * 257.0f;
+	    q[1] = p[1] * 257.0f;
+	    q[2] = p[2] * 257.0f;
+	}
+    }
+
+    g_object_unref(pixbuf);
+    instr_stop(&tmr, (gint64) h * stride, 1);
+
+    return frm;
+}
+
+
+/* Load a project image, dark or video frame */
+
+ImgFrame * frame_load_img(Image *img, GtkWidget *window)
+{
+    char *path;
+    ImgFrame *frm;
+
+    if (img->vframe > 0)
+    	return video_frame_load(img, window);
+
+    path = (char *) malloc(strlen(img->path) + strlen(img->nm) + 2);
+    sprintf(path, "%s/%s", img->path, img->nm);
+    frm = frame_load(path, window);
+    free(path);
+
+    return frm;
+}
+
+
+/* Single channel (luminance) copy of a frame */
+
+ImgFrame * frame_luma(ImgFrame *frm)
+{
+    size_t i, n;
+    float *p;
+    ImgFrame *lum;
+
+    if ((lum = frame_new(frm->width, frm->height, 1)) == NULL)
+    	return NULL;
+
+    n = (size_t) frm->width * frm->height;
+
+    if (frm->channels == 1)
+    {
+	memcpy(lum->data, frm->data, n * sizeof(float));
+    	return lum;
+    }
+
+    for(i = 0, p = frm->data; i < n; i++, p += frm->channels)
+	lum->data[i] = 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+
+    return lum;
+}
+
+
+/* Luminance reduced by 'f' each way (mean of each f x f block, any remainder dropped) */
+
+ImgFrame * frame_bin_luma(ImgFrame *frm, int f)
+{
+    int x, y, i, j, ch, bw, bh;
+    size_t n;
+    float v, sc;
+    float *acc, *p;
+    ImgFrame *bin;
+
+    bw = frm->width / f;
+    bh = frm->height / f;
+    ch = frm->channels;
+
+    if (bw < 1 || bh < 1)
+    	return NULL;
+
+    if ((bin = frame_new(bw, bh, 1)) == NULL)
+    	return NULL;
+
+    n = (size_t) bw * f * ch;
+    acc = (float *) malloc(n * sizeof(float));
+    sc = 1.0f / (f * f);
+
+    for(y = 0; y < bh; y++)
+    {
+	/* Sum the block rows (vector), then across each block */
+	memcpy(acc, frm->data + (size_t) y * f * frm->width * ch, n * sizeof(float));
+
+	for(j = 1; j < f; j++)
+	    accum_f32(frm->data + ((size_t) y * f + j) * frm->width * ch, acc, n);
+
+	for(x = 0, p = acc; x < bw; x++)
+	{
+	    v = 0.0f;
+
+	    if (ch == 1)
+	    {
+		for(i = 0; i < f; i++, p++)
+		    v += *p;
+	    }
+	    else
+	    {
+		for(i = 0; i < f; i++, p += ch)
+		    v += 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+	    }
+
+	    bin->data[(size_t) y * bw + x] = v * sc;
+	}
+    }
+
+    free(acc);
+
+    return bin;
+}
+
+
+/* Write a frame as a 16 bit PPM (colour) or PGM (mono) file */
+
+int frame_save_pnm(ImgFrame *frm, char *fn, GtkWidget *window)
+{
+    char extra[256];
+    size_t i, n;
+    int v;
+    unsigned char *buf;
+    FILE *fd;
+    InstrTimer tmr;
+
+    instr_start(&tmr, INS_WRITE);
+
+    if ((fd = fopen(fn, "wb")) == NULL)
+    {
+	sprintf(extra, "Error: (%d) %s", errno, strerror(errno));
+	log_msg_extra("SYS9005", fn, extra, "SYS9005", window);
+    	return FALSE;
+    }
+
+    fprintf(fd, "%s\n%d %d\n65535\n", (frm->channels == 1) ? "P5" : "P6", frm->width, frm->height);
+
+    /* Samples are big endian */
+    n = (size_t) frm->width * frm->height * frm->channels;
+    buf = (unsigned char *) malloc(n * 2);
+
+    for(i = 0; i < n; i++)
+    {
+	v = (int) (frm->data[i] + 0.5f);
+	v = CLAMP(v, 0, 65535);
+	buf[i * 2] = (unsigned char) (v >> 8);
+	buf[i * 2 + 1] = (unsigned char) (v & 0xff);
+    }
+
+    if (fwrite(buf, 1, n * 2, fd) != n * 2)
+    {
+	sprintf(extra, "Error: (%d) %s", errno, strerror(errno));
+	log_msg_extra("SYS9012", fn, extra, "SYS9012", window);
+	free(buf);
+	fclose(fd);
+    	return FALSE;
+    }
+
+    free(buf);
+    fclose(fd);
+    instr_stop(&tmr, (gint64) n * 2, 1);
+
+    return TRUE;
+}
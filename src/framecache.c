@@ -0,0 +1,993 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Calibrated frame cache - each light once decoded and calibrated is kept in the project
+**  'calcache' directory so registering or stacking again skips both. An entry is named by
+**  a hash of the light file contents and of the calibration (masters, dark scaling and bad
+**  pixel map), so a changed light or master simply misses. Frames are stored losslessly in
+**  bands of rows, the float bytes split into planes and each plane deflated (or stored if it
+**  will not compress), the bands being compressed and expanded across the worker threads.
+**  The cache is held to a size limit (user preference, 0 turns it off) by removing the
+**  least recently used entries; the file times carry the use order between runs. Entries
+**  used in the current run are never removed, so a project larger than the limit keeps
+**  the frames that fit rather than each new frame pushing out the last.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define CACHE_DIR "calcache"
+#define CACHE_EXT ".cal"
+#define CACHE_MAGIC "SALCAL1"		// File format (8 bytes with the terminator)
+#define CACHE_BAND 32			// Rows per compressed band
+#define CACHE_ZLEVEL 1			// Deflate level, run length matches only (Z_RLE)
+#define CACHE_RAW_FRAC 16		// A plane is stored unless deflate saves 1/16th
+#define CACHE_HASH_BUF 1048576		// Light file read size when hashing
+#define HASH_P1 0x9E3779B185EBCA87ULL
+#define HASH_P2 0xC2B2AE3D27D4EB4FULL
+#define HASH_P3 0x165667B19E3779F9ULL
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <preferences.h>
+#include <pipeline.h>
+#include <instrument.h>
+
+
+/* Types */
+
+typedef struct _CacheHash
+{
+    guint64 v[4];			// Lanes
+    guint64 len;
+    unsigned char tail[32];		// Bytes short of a block, held for the next update
+    int n_tail;
+} CacheHash;
+
+typedef struct _CacheHdr
+{
+    char magic[8];
+    guint64 key;
+    guint32 width, height, channels;
+    guint32 n_bands;
+} CacheHdr;
+
+typedef struct _CacheWork
+{
+    ImgFrame *frm;
+    int n_bands;
+    unsigned char **buf;		// Compressed bands
+    guint32 *len;			// Compressed band sizes (with the plane sizes)
+    int failed;
+} CacheWork;
+
+
+/* Prototypes */
+
+void cache_open(PipeRun *);
+void cache_close(PipeRun *);
+ImgFrame * cache_frame(PipeRun *, int);
+static guint64 cal_key(CalMasters *);
+static guint64 file_key(Image *);
+static ImgFrame * cache_get(FrameCache *, guint64);
+static void cache_put(FrameCache *, guint64, ImgFrame *);
+static void pack_bands(int, int, gpointer);
+static void unpack_bands(int, int, gpointer);
+static void shuffle(const unsigned char *, unsigned char *, size_t);
+static void unshuffle(const unsigned char *, unsigned char *, size_t);
+static void cache_scan(FrameCache *);
+static CacheEntry * cache_entry(FrameCache *, guint64);
+static int cache_evict(FrameCache *, gint64);
+static char * entry_path(FrameCache *, guint64, char *);
+static void hash_init(CacheHash *);
+static void hash_update(CacheHash *, const void *, size_t);
+static void hash_block(CacheHash *, const unsigned char *);
+static guint64 hash_final(CacheHash *);
+static void hash_frame(CacheHash *, ImgFrame *);
+
+extern ImgFrame * frame_new(int, int, int);
+extern void frame_free(ImgFrame *);
+extern ImgFrame * frame_load_img(Image *, GtkWidget *);
+extern const guchar * video_frame_view(Image *, size_t *);
+extern int calibrate_frame(ImgFrame *, CalMasters *);
+extern int get_user_pref_int(char *, int *);
+extern int check_dir(char *);
+extern int make_dir(char *);
+extern void job_parallel_for(int, int, int, int, JobRangeFunc, gpointer, JobToken *);
+extern void instr_start(InstrTimer *, int);
+extern void instr_stop(InstrTimer *, gint64, int);
+extern gint64 mem_reserve(gint64, gint64);
+extern void mem_release(gint64);
+extern void log_msg_extra(char*, char*, char*, char*, GtkWidget*);
+extern int write_all(int, unsigned char *, size_t);
+extern int read_all(int, unsigned char *, size_t);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-framecache.c ";
+
+
+/* Set up the cache for a run once the masters are built (none if the size limit is 0) */
+
+void cache_open(PipeRun *run)
+{
+    int mb;
+    FrameCache *fc;
+
+    cache_close(run);
+
+    if (! get_user_pref_int(CAL_CACHE_MB, &mb))
+    	mb = 0;
+
+    if (mb <= 0)
+    	return;
+
+    fc = (FrameCache *) malloc(sizeof(FrameCache));
+    memset(fc, 0, sizeof(FrameCache));
+    fc->dir = (char *) malloc(strlen(run->proj->project_path) + strlen(CACHE_DIR) + 2);
+    sprintf(fc->dir, "%s/%s", run->proj->project_path, CACHE_DIR);
+
+    if (! check_dir(fc->dir))
+    {
+	if (! make_dir(fc->dir))
+	{
+	    free(fc->dir);
+	    free(fc);
+	    return;
+	}
+    }
+
+    fc->cap = (gint64) mb * 1048576;
+    fc->cal_key = cal_key(&(run->cal));
+    fc->opened = g_get_real_time();
+    g_mutex_init(&(fc->lock));
+    cache_scan(fc);
+    cache_evict(fc, 0);
+    run->cache = fc;
+
+    return;
+}
+
+
+/* Release the cache (the entries stay on disk) */
+
+void cache_close(PipeRun *run)
+{
+    FrameCache *fc;
+
+    if ((fc = run->cache) == NULL)
+    	return;
+
+    g_list_free_full(fc->entries, free);
+    g_mutex_clear(&(fc->lock));
+    free(fc->dir);
+    free(fc);
+    run->cache = NULL;
+
+    return;
+}
+
+
+/* A light decoded and calibrated - from the cache if it has been done before */
+
+ImgFrame * cache_frame(PipeRun *run, int i)
+{
+    guint64 key;
+    ImgFrame *frm;
+    FrameInfo *fi;
+    FrameCache *fc;
+
+    fi = &(run->frames[i]);
+    fc = run->cache;
+    key = 0;
+
+    if (fc != NULL)
+    {
+	/* The light is hashed once per run */
+	if (fi->src_key == 0)
+	    fi->src_key = file_key(fi->img);
+
+	if (fi->src_key != 0)
+	{
+	    key = fi->src_key ^ (fc->cal_key * HASH_P3);
+
+	    if ((frm = cache_get(fc, key)) != NULL)
+		return frm;
+	}
+    }
+
+    if ((frm = frame_load_img(fi->img, NULL)) == NULL)
+    	return NULL;
+
+    /* A frame that could not be calibrated is not kept */
+    if (calibrate_frame(frm, &(run->cal)) && key != 0 && ! g_atomic_int_get(&(fc->full)))
+	cache_put(fc, key, frm);
+
+    return frm;
+}
+
+
+/* Key for the calibration applied - masters, dark scaling and bad pixels */
+
+static guint64 cal_key(CalMasters *cal)
+{
+    int scale;
+    CacheHash h;
+
+    hash_init(&h);
+    hash_update(&h, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    hash_frame(&h, cal->bias);
+    hash_frame(&h, cal->dark);
+    hash_frame(&h, cal->flat_inv);
+    scale = (cal->dark != NULL && cal->scale);
+    hash_update(&h, &scale, sizeof(int));
+
+    if (cal->badpix != NULL && cal->badpix->n > 0)
+	hash_update(&h, cal->badpix->off, (size_t) cal->badpix->n * sizeof(guint32));
+
+    return hash_final(&h);
+}
+
+
+/* Key for the contents of a light file (0 if it cannot be read) */
+
+static guint64 file_key(Image *img)
+{
+    int fd;
+    ssize_t r;
+    char *path;
+    size_t len;
+    const guchar *p;
+    unsigned char *buf;
+    CacheHash h;
+
+    /* A video frame is keyed on its own data, not the whole file */
+    if (img->vframe > 0)
+    {
+	if ((p = video_frame_view(img, &len)) == NULL)
+	    return 0;
+
+	hash_init(&h);
+	hash_update(&h, &(img->vframe), sizeof(int));
+	hash_update(&h, p, len);
+
+	return hash_final(&h);
+    }
+
+    path = (char *) malloc(strlen(img->path) + strlen(img->nm) + 2);
+    sprintf(path, "%s/%s", img->path, img->nm);
+    fd = open(path, O_RDONLY);
+    free(path);
+
+    if (fd < 0)
+    	return 0;
+
+    buf = (unsigned char *) malloc(CACHE_HASH_BUF);
+    hash_init(&h);
+
+    while((r = read(fd, buf, CACHE_HASH_BUF)) != 0)
+    {
+	if (r < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+
+	    break;
+	}
+
+	hash_update(&h, buf, r);
+    }
+
+    close(fd);
+    free(buf);
+
+    if (r != 0)
+    	return 0;
+
+    return hash_final(&h);
+}
+
+
+/* Read an entry (NULL if it is not there or not usable) */
+
+static ImgFrame * cache_get(FrameCache *fc, guint64 key)
+{
+    int fd, i, ok;
+    size_t n;
+    char path[PATH_MAX];
+    unsigned char *file;
+    struct stat sb;
+    CacheHdr hdr;
+    CacheWork cw;
+    CacheEntry *ce;
+    InstrTimer tmr;
+
+    g_mutex_lock(&(fc->lock));
+    ce = cache_entry(fc, key);
+
+    if (ce != NULL)
+	ce->used = g_get_real_time();
+
+    g_mutex_unlock(&(fc->lock));
+
+    if (ce == NULL)
+    	return NULL;
+
+    instr_start(&tmr, INS_CACHE);
+    entry_path(fc, key, path);
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &sb) != 0)
+    {
+	if (fd >= 0)
+	    close(fd);
+
+	instr_stop(&tmr, 0, 0);
+    	return NULL;
+    }
+
+    file = (unsigned char *) malloc(sb.st_size);
+    ok = (sb.st_size > (off_t) sizeof(CacheHdr) && read_all(fd, file, sb.st_size));
+    close(fd);
+    memset(&cw, 0, sizeof(CacheWork));
+
+    if (ok)
+    {
+	memcpy(&hdr, file, sizeof(CacheHdr));
+	n = sizeof(CacheHdr) + (size_t) hdr.n_bands * sizeof(guint32);
+	ok = (memcmp(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic)) == 0 && hdr.key == key &&
+	      hdr.n_bands == (hdr.height + CACHE_BAND - 1) / CACHE_BAND && n <= (size_t) sb.st_size);
+    }
+
+    if (ok)
+	ok = ((cw.frm = frame_new(hdr.width, hdr.height, hdr.channels)) != NULL);
+
+    if (ok)
+    {
+	/* Band positions from the sizes */
+	cw.n_bands = hdr.n_bands;
+	cw.len = (guint32 *) (file + sizeof(CacheHdr));
+	cw.buf = (unsigned char **) malloc(cw.n_bands * sizeof(unsigned char *));
+
+	for(i = 0; i < cw.n_bands && ok; i++)
+	{
+	    cw.buf[i] = file + n;
+	    n += cw.len[i];
+	    ok = (n <= (size_t) sb.st_size);
+	}
+    }
+
+    if (ok)
+    {
+	job_parallel_for(JOB_PRI_BATCH, 0, cw.n_bands, 1, unpack_bands, &cw, NULL);
+	ok = ! cw.failed;
+    }
+
+    free(cw.buf);
+    free(file);
+
+    if (! ok)
+    {
+	/* Damaged or stale - forget it */
+	frame_free(cw.frm);
+	cw.frm = NULL;
+	unlink(path);
+	g_mutex_lock(&(fc->lock));
+
+	if ((ce = cache_entry(fc, key)) != NULL)
+	{
+	    fc->total -= ce->size;
+	    fc->entries = g_list_remove(fc->entries, ce);
+	    free(ce);
+	}
+
+	g_mutex_unlock(&(fc->lock));
+	instr_stop(&tmr, 0, 0);
+
+	return NULL;
+    }
+
+    /* Last use is the file time for the next run */
+    utime(path, NULL);
+    instr_stop(&tmr, (gint64) sb.st_size, 1);
+
+    return cw.frm;
+}
+
+
+/* Add an entry, making room for it first (a failure, or no room in the memory budget, just
+   leaves it out) */
+
+static void cache_put(FrameCache *fc, guint64 key, ImgFrame *frm)
+{
+    int fd, i, ok, reserved;
+    gint64 size, mem;
+    char path[PATH_MAX], tmp[PATH_MAX];
+    CacheHdr hdr;
+    char extra[256];
+    CacheWork cw;
+    CacheEntry *ce;
+
+    /* The packed bands are held to the memory budget (at most the frame size) */
+    size = (gint64) frm->width * frm->height * frm->channels * sizeof(float);
+
+    if ((mem = mem_reserve(size, 0)) < size)
+    {
+	mem_release(mem);
+    	return;
+    }
+
+    memset(&cw, 0, sizeof(CacheWork));
+    cw.frm = frm;
+    cw.n_bands = (frm->height + CACHE_BAND - 1) / CACHE_BAND;
+    cw.buf = (unsigned char **) calloc(cw.n_bands, sizeof(unsigned char *));
+    cw.len = (guint32 *) calloc(cw.n_bands, sizeof(guint32));
+    job_parallel_for(JOB_PRI_BATCH, 0, cw.n_bands, 1, pack_bands, &cw, NULL);
+
+    memset(&hdr, 0, sizeof(CacheHdr));
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.key = key;
+    hdr.width = frm->width;
+    hdr.height = frm->height;
+    hdr.channels = frm->channels;
+    hdr.n_bands = cw.n_bands;
+    size = sizeof(CacheHdr) + (gint64) cw.n_bands * sizeof(guint32);
+
+    for(i = 0; i < cw.n_bands; i++)
+	size += cw.len[i];
+
+    ok = (! cw.failed);
+    reserved = FALSE;
+
+    /* Room is reserved first. Entries used in this run are not removed for it - the run does
+       not fit so the frames cached so far are kept and the rest left out */
+    if (ok)
+    {
+	g_mutex_lock(&(fc->lock));
+
+	if ((ok = cache_evict(fc, size)))
+	    fc->total += size;
+	else
+	    g_atomic_int_set(&(fc->full), TRUE);
+
+	reserved = ok;
+
+	g_mutex_unlock(&(fc->lock));
+    }
+
+    /* Written aside and renamed so a reader never sees part of an entry */
+    if (ok)
+    {
+	entry_path(fc, key, path);
+	snprintf(tmp, sizeof(tmp), "%s.%d.%p", path, (int) getpid(), (void *) frm);
+
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0664)) < 0)
+	{
+	    ok = FALSE;
+	}
+	else
+	{
+	    ok = write_all(fd, (unsigned char *) &hdr, sizeof(CacheHdr)) &&
+		 write_all(fd, (unsigned char *) cw.len, cw.n_bands * sizeof(guint32));
+
+	    for(i = 0; i < cw.n_bands && ok; i++)
+		ok = write_all(fd, cw.buf[i], cw.len[i]);
+
+	    if (close(fd) != 0)
+		ok = FALSE;
+
+	    if (ok)
+		ok = (rename(tmp, path) == 0);
+
+	    if (! ok)
+	    {
+		sprintf(extra, "Error: (%d) %s", errno, strerror(errno));
+		log_msg_extra("SYS9012", path, extra, "SYS9012", NULL);
+		unlink(tmp);
+	    }
+	}
+    }
+
+    /* Take up the room reserved, or give it back */
+    if (reserved)
+    {
+	g_mutex_lock(&(fc->lock));
+
+	if (! ok)
+	{
+	    fc->total -= size;
+	}
+	else
+	{
+	    if ((ce = cache_entry(fc, key)) == NULL)
+	    {
+		ce = (CacheEntry *) malloc(sizeof(CacheEntry));
+		ce->key = key;
+		ce->size = 0;
+		fc->entries = g_list_prepend(fc->entries, ce);
+	    }
+
+	    fc->total -= ce->size;
+	    ce->size = size;
+	    ce->used = g_get_real_time();
+	}
+
+	g_mutex_unlock(&(fc->lock));
+    }
+
+    for(i = 0; i < cw.n_bands; i++)
+	free(cw.buf[i]);
+
+    free(cw.buf);
+    free(cw.len);
+    mem_release(mem);
+
+    return;
+}
+
+
+/* Shuffle and compress bands [lo, hi). Each band is the four byte planes, deflated on
+   their own (a plane that will not compress, the low mantissa bytes of noisy samples, is
+   kept as it is so reading it back is a copy), led by the plane sizes */
+
+static void pack_bands(int lo, int hi, gpointer data)
+{
+    int b, p, rows;
+    size_t n, m;
+    guint32 *sz;
+    unsigned char *tmp, *out;
+    z_stream zs;
+    CacheWork *cw;
+
+    cw = (CacheWork *) data;
+    n = (size_t) cw->frm->width * cw->frm->channels * CACHE_BAND * sizeof(float);
+    tmp = (unsigned char *) malloc(n);
+    memset(&zs, 0, sizeof(z_stream));
+
+    if (deflateInit2(&zs, CACHE_ZLEVEL, Z_DEFLATED, 15, 8, Z_RLE) != Z_OK)
+    {
+	g_atomic_int_set(&(cw->failed), TRUE);
+	free(tmp);
+    	return;
+    }
+
+    for(b = lo; b < hi && ! g_atomic_int_get(&(cw->failed)); b++)
+    {
+	rows = MIN(CACHE_BAND, cw->frm->height - b * CACHE_BAND);
+	n = (size_t) cw->frm->width * cw->frm->channels * rows * sizeof(float);
+	m = n / 4;
+	shuffle((unsigned char *) (cw->frm->data + (size_t) b * CACHE_BAND * cw->frm->width * cw->frm->channels),
+		tmp, n);
+
+	cw->buf[b] = (unsigned char *) malloc(4 * sizeof(guint32) + n);
+	sz = (guint32 *) cw->buf[b];
+	out = cw->buf[b] + 4 * sizeof(guint32);
+
+	for(p = 0; p < 4; p++)
+	{
+	    deflateReset(&zs);
+	    zs.next_in = tmp + p * m;
+	    zs.avail_in = m;
+	    zs.next_out = out;
+	    zs.avail_out = m - m / CACHE_RAW_FRAC;
+
+	    /* Not done in the space allowed - store it */
+	    if (deflate(&zs, Z_FINISH) == Z_STREAM_END)
+	    {
+		sz[p] = zs.total_out;
+	    }
+	    else
+	    {
+		memcpy(out, tmp + p * m, m);
+		sz[p] = m;
+	    }
+
+	    out += sz[p];
+	}
+
+	cw->len[b] = out - cw->buf[b];
+    }
+
+    deflateEnd(&zs);
+    free(tmp);
+
+    return;
+}
+
+
+/* Expand and unshuffle bands [lo, hi) */
+
+static void unpack_bands(int lo, int hi, gpointer data)
+{
+    int b, p, rows;
+    size_t n, m, pos;
+    guint32 sz[4];
+    unsigned char *tmp;
+    z_stream zs;
+    CacheWork *cw;
+
+    cw = (CacheWork *) data;
+    n = (size_t) cw->frm->width * cw->frm->channels * CACHE_BAND * sizeof(float);
+    tmp = (unsigned char *) malloc(n);
+    memset(&zs, 0, sizeof(z_stream));
+
+    if (inflateInit(&zs) != Z_OK)
+    {
+	g_atomic_int_set(&(cw->failed), TRUE);
+	free(tmp);
+    	return;
+    }
+
+    for(b = lo; b < hi && ! g_atomic_int_get(&(cw->failed)); b++)
+    {
+	rows = MIN(CACHE_BAND, cw->frm->height - b * CACHE_BAND);
+	n = (size_t) cw->frm->width * cw->frm->channels * rows * sizeof(float);
+	m = n / 4;
+	pos = 4 * sizeof(guint32);
+
+	if (cw->len[b] < pos)
+	{
+	    g_atomic_int_set(&(cw->failed), TRUE);
+	    break;
+	}
+
+	memcpy(sz, cw->buf[b], sizeof(sz));
+
+	for(p = 0; p < 4; p++)
+	{
+	    if (sz[p] > m || pos + sz[p] > cw->len[b])
+		break;
+
+	    if (sz[p] == m)
+	    {
+		memcpy(tmp + p * m, cw->buf[b] + pos, m);
+	    }
+	    else
+	    {
+		inflateReset(&zs);
+		zs.next_in = cw->buf[b] + pos;
+		zs.avail_in = sz[p];
+		zs.next_out = tmp + p * m;
+		zs.avail_out = m;
+
+		if (inflate(&zs, Z_FINISH) != Z_STREAM_END || zs.total_out != m)
+		    break;
+	    }
+
+	    pos += sz[p];
+	}
+
+	if (p < 4)
+	{
+	    g_atomic_int_set(&(cw->failed), TRUE);
+	    break;
+	}
+
+	unshuffle(tmp, (unsigned char *) (cw->frm->data + (size_t) b * CACHE_BAND * cw->frm->width * cw->frm->channels),
+		  n);
+    }
+
+    inflateEnd(&zs);
+    free(tmp);
+
+    return;
+}
+
+
+/* Group the bytes of 'n' bytes of floats by position (the exponent bytes compress well) */
+
+static void shuffle(const unsigned char *in, unsigned char *out, size_t n)
+{
+    size_t i, m;
+    unsigned char *o0, *o1, *o2, *o3;
+
+    m = n / 4;
+    o0 = out;
+    o1 = out + m;
+    o2 = out + m * 2;
+    o3 = out + m * 3;
+
+    for(i = 0; i < m; i++, in += 4)
+    {
+	o0[i] = in[0];
+	o1[i] = in[1];
+	o2[i] = in[2];
+	o3[i] = in[3];
+    }
+
+    return;
+}
+
+
+/* Reverse the shuffle */
+
+static void unshuffle(const unsigned char *in, unsigned char *out, size_t n)
+{
+    size_t i, m;
+    const unsigned char *i0, *i1, *i2, *i3;
+
+    m = n / 4;
+    i0 = in;
+    i1 = in + m;
+    i2 = in + m * 2;
+    i3 = in + m * 3;
+
+    for(i = 0; i < m; i++, out += 4)
+    {
+	out[0] = i0[i];
+	out[1] = i1[i];
+	out[2] = i2[i];
+	out[3] = i3[i];
+    }
+
+    return;
+}
+
+
+/* List the entries on disk, last used (file time) first */
+
+static void cache_scan(FrameCache *fc)
+{
+    int len;
+    guint64 key;
+    char path[PATH_MAX], *end;
+    DIR *d;
+    struct dirent *de;
+    struct stat sb;
+    CacheEntry *ce;
+
+    if ((d = opendir(fc->dir)) == NULL)
+    	return;
+
+    while((de = readdir(d)) != NULL)
+    {
+	len = strlen(de->d_name);
+	snprintf(path, sizeof(path), "%s/%s", fc->dir, de->d_name);
+
+	if (stat(path, &sb) != 0 || ! S_ISREG(sb.st_mode))
+	    continue;
+
+	/* Left by an interrupted write */
+	if (len != 16 + strlen(CACHE_EXT) || strcmp(de->d_name + 16, CACHE_EXT) != 0)
+	{
+	    if (strstr(de->d_name, CACHE_EXT ".") != NULL)
+		unlink(path);
+
+	    continue;
+	}
+
+	key = g_ascii_strtoull(de->d_name, &end, 16);
+
+	if (end != de->d_name + 16)
+	    continue;
+
+	ce = (CacheEntry *) malloc(sizeof(CacheEntry));
+	ce->key = key;
+	ce->size = sb.st_size;
+	ce->used = (gint64) sb.st_mtime * G_USEC_PER_SEC;
+	fc->entries = g_list_prepend(fc->entries, ce);
+	fc->total += ce->size;
+    }
+
+    closedir(d);
+
+    return;
+}
+
+
+/* Entry for a key (the lock is held) */
+
+static CacheEntry * cache_entry(FrameCache *fc, guint64 key)
+{
+    GList *l;
+
+    for(l = fc->entries; l != NULL; l = l->next)
+    	if (((CacheEntry *) l->data)->key == key)
+	    return (CacheEntry *) l->data;
+
+    return NULL;
+}
+
+
+/* Remove the least recently used entries until 'size' more fits - only those not used since
+   the cache was opened (FALSE if there is not the room). The lock is held */
+
+static int cache_evict(FrameCache *fc, gint64 size)
+{
+    char path[PATH_MAX];
+    GList *l;
+    CacheEntry *ce, *lru;
+
+    while(fc->entries != NULL && fc->total + size > fc->cap)
+    {
+	lru = NULL;
+
+	for(l = fc->entries; l != NULL; l = l->next)
+	{
+	    ce = (CacheEntry *) l->data;
+
+	    if (lru == NULL || ce->used < lru->used)
+		lru = ce;
+	}
+
+	if (lru->used >= fc->opened)
+	    return FALSE;
+
+	unlink(entry_path(fc, lru->key, path));
+	fc->total -= lru->size;
+	fc->entries = g_list_remove(fc->entries, lru);
+	free(lru);
+    }
+
+    return (fc->total + size <= fc->cap);
+}
+
+
+/* File name for a key */
+
+static char * entry_path(FrameCache *fc, guint64 key, char *path)
+{
+    snprintf(path, PATH_MAX, "%s/%016" G_GINT64_MODIFIER "x" CACHE_EXT, fc->dir, key);
+
+    return path;
+}
+
+
+/* 64 bit hash of a byte stream - four lanes of multiply and rotate over 32 byte blocks */
+
+static void hash_init(CacheHash *h)
+{
+    h->v[0] = HASH_P1 + HASH_P2;
+    h->v[1] = HASH_P2;
+    h->v[2] = 0;
+    h->v[3] = -HASH_P1;
+    h->len = 0;
+    h->n_tail = 0;
+
+    return;
+}
+
+
+/* Add bytes to a hash (any length) - a part block is held over, so the hash is of the bytes
+   whatever lengths they are added in */
+
+static void hash_update(CacheHash *h, const void *data, size_t n)
+{
+    size_t k;
+    const unsigned char *p;
+
+    p = (const unsigned char *) data;
+    h->len += n;
+
+    /* Complete a block held over */
+    if (h->n_tail > 0)
+    {
+	k = MIN(n, (size_t) (32 - h->n_tail));
+	memcpy(h->tail + h->n_tail, p, k);
+	h->n_tail += k;
+	p += k;
+	n -= k;
+
+	if (h->n_tail < 32)
+	    return;
+
+	hash_block(h, h->tail);
+	h->n_tail = 0;
+    }
+
+    for(; n >= 32; n -= 32, p += 32)
+	hash_block(h, p);
+
+    memcpy(h->tail, p, n);
+    h->n_tail = n;
+
+    return;
+}
+
+
+/* Mix a 32 byte block into the lanes */
+
+static void hash_block(CacheHash *h, const unsigned char *p)
+{
+    int i;
+    guint64 w[4];
+
+    memcpy(w, p, 32);
+
+    for(i = 0; i < 4; i++)
+    {
+	h->v[i] += w[i] * HASH_P2;
+	h->v[i] = ((h->v[i] << 31) | (h->v[i] >> 33)) * HASH_P1;
+    }
+
+    return;
+}
+
+
+/* Hash value (never 0) */
+
+static guint64 hash_final(CacheHash *h)
+{
+    int i;
+    guint64 r;
+
+    /* Bytes short of a block */
+    for(i = 0; i < h->n_tail; i++)
+    	h->v[0] = ((h->v[0] ^ h->tail[i]) * HASH_P1) + HASH_P3;
+
+    h->n_tail = 0;
+
+    r = ((h->v[0] << 1) | (h->v[0] >> 63)) + ((h->v[1] << 7) | (h->v[1] >> 57)) +
+	((h->v[2] << 12) | (h->v[2] >> 52)) + ((h->v[3] << 18) | (h->v[3] >> 46));
+    r ^= h->len * HASH_P3;
+    r ^= r >> 33;
+    r *= HASH_P2;
+    r ^= r >> 29;
+    r *= HASH_P3;
+    r ^= r >> 32;
+
+    return (r == 0) ? 1 : r;
+}
+
+
+/* Add a frame (size and samples, or a marker if none) to a hash */
+
+static void hash_frame(CacheHash *h, ImgFrame *frm)
+{
+    int sz[3];
+
+    memset(sz, 0, sizeof(sz));
+
+    if (frm != NULL)
+    {
+	sz[0] = frm->width;
+	sz[1] = frm->height;
+	sz[2] = frm->channels;
+    }
+
+    hash_update(h, sz, sizeof(sz));
+
+    if (frm != NULL)
+	hash_update(h, frm->data, (size_t) frm->width * frm->height * frm->channels * sizeof(float));
+
+    return;
+}
@@ -0,0 +1,443 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Frame table - the Exif strings of a list of frames (exposure, ISO, size, date) parsed
+**  once into numeric arrays, one per field and a row per frame in list order. Validating,
+**  matching and selecting frames are then plain loops over the arrays rather than string
+**  compares down the list. Exposures are compared as seconds so equal times written
+**  differently ('1/2 sec.', '0.5 sec.') match. Values that cannot be parsed are 0.
+**  Frames are grouped on their exposure signature (the chosen fields) in one pass through
+**  a hash table, so mixed sessions are found however many frames there are.
+**  Imaging sessions (nights) are found from the dates taken - frames in date order, a gap
+**  longer than the preference starting a new session.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define EXP_TOL 0.001			// Relative exposure step (exposure equality)
+#define SESSION_GAP 4			// Default session gap (hours)
+
+
+/* Includes */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <gtk/gtk.h>
+#include <project.h>
+#include <preferences.h>
+
+
+/* Types */
+
+typedef struct _FtSig
+{
+    gint64 exp;				// Exposure key (see exp_key)
+    int iso, width, height;
+} FtSig;
+
+
+/* Prototypes */
+
+FrameTable * frame_table_new(GList *);
+void frame_table_free(FrameTable *);
+int frame_table_match(FrameTable *, FrameTable *, int, int, char *);
+int frame_table_drop(GList **, char *);
+int frame_table_group(FrameTable *, int, int *);
+int frame_sessions(GList **, int);
+double exif_exposure(const char *);
+gint64 exif_time(const char *);
+static int exif_int(const char *);
+static gint64 exp_key(double);
+static guint sig_hash(gconstpointer);
+static gboolean sig_equal(gconstpointer, gconstpointer);
+static gint taken_cmp(gconstpointer, gconstpointer);
+
+extern void free_img(gpointer);
+extern int get_user_pref_int(char *, int *);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-frametable.c ";
+
+
+/* Build the table for a list of images or calibration frames (rows in list order) */
+
+FrameTable * frame_table_new(GList *gl)
+{
+    int i, n;
+    char *p;
+    FrameTable *t;
+    ImgExif *e;
+    GList *l;
+
+    n = g_list_length(gl);
+
+    /* One block for the table and arrays, the 8 byte ones first */
+    p = (char *) malloc(sizeof(FrameTable) + n * (sizeof(Image *) + sizeof(double) +
+    						sizeof(gint64) + sizeof(int) * 3));
+    t = (FrameTable *) p;
+    p += sizeof(FrameTable);
+
+    t->n = n;
+    t->exposure = (double *) p;
+    p += n * sizeof(double);
+    t->time = (gint64 *) p;
+    p += n * sizeof(gint64);
+    t->img = (Image **) p;
+    p += n * sizeof(Image *);
+    t->iso = (int *) p;
+    p += n * sizeof(int);
+    t->width = (int *) p;
+    p += n * sizeof(int);
+    t->height = (int *) p;
+
+    for(l = gl, i = 0; l != NULL; l = l->next, i++)
+    {
+	t->img[i] = (Image *) l->data;
+	e = &(t->img[i]->img_exif);
+
+	t->exposure[i] = exif_exposure(e->exposure);
+	t->time[i] = t->img[i]->taken;
+	t->iso[i] = exif_int(e->iso);
+	t->width[i] = exif_int(e->width);
+	t->height[i] = exif_int(e->height);
+    }
+
+    return t;
+}
+
+
+/* Free a table (the frames are not touched) */
+
+void frame_table_free(FrameTable *t)
+{
+    free(t);
+
+    return;
+}
+
+
+/* Mark the frames in 't' matching row 'r' of 'ref' in the 'fields' (FT_...) given - 'keep' is
+   set for each row, none match if there is no reference. Returns the number matching. */
+
+int frame_table_match(FrameTable *t, FrameTable *ref, int r, int fields, char *keep)
+{
+    int i, n, iso, w, h;
+    gint64 exp;
+
+    if (ref == NULL || r < 0 || r >= ref->n)
+    {
+	memset(keep, 0, t->n);
+	return 0;
+    }
+
+    memset(keep, 1, t->n);
+
+    if (fields & FT_EXPOSURE)
+    {
+	exp = exp_key(ref->exposure[r]);
+
+	for(i = 0; i < t->n; i++)
+	    keep[i] &= (exp_key(t->exposure[i]) == exp);
+    }
+
+    if (fields & FT_ISO)
+    {
+	iso = ref->iso[r];
+
+	for(i = 0; i < t->n; i++)
+	    keep[i] &= (t->iso[i] == iso);
+    }
+
+    if (fields & FT_SIZE)
+    {
+	w = ref->width[r];
+	h = ref->height[r];
+
+	for(i = 0; i < t->n; i++)
+	    keep[i] &= (t->width[i] == w) & (t->height[i] == h);
+    }
+
+    for(i = 0, n = 0; i < t->n; i++)
+	n += keep[i];
+
+    return n;
+}
+
+
+/* Remove and free the frames of a list not marked in 'keep' (rows in list order) - returns the
+   number removed. A table built from the list no longer matches it after this. */
+
+int frame_table_drop(GList **gl, char *keep)
+{
+    int i, n;
+    GList *l, *next;
+
+    n = 0;
+
+    for(l = *gl, i = 0; l != NULL; l = next, i++)
+    {
+	next = l->next;
+
+	if (! keep[i])
+	{
+	    free_img(l->data);
+	    *gl = g_list_delete_link(*gl, l);
+	    n++;
+	}
+    }
+
+    return n;
+}
+
+
+/* Group the frames on the fields (FT_...) given - 'grp' is set to each row's group, the groups
+   numbered in order of their first frame. Returns the number of groups. */
+
+int frame_table_group(FrameTable *t, int fields, int *grp)
+{
+    int i, n;
+    gpointer g;
+    FtSig *sig;
+    GHashTable *ht;
+
+    sig = (FtSig *) malloc((t->n + 1) * sizeof(FtSig));
+    memset(sig, 0, (t->n + 1) * sizeof(FtSig));
+    ht = g_hash_table_new(sig_hash, sig_equal);
+    n = 0;
+
+    for(i = 0; i < t->n; i++)
+    {
+	if (fields & FT_EXPOSURE)
+	    sig[i].exp = exp_key(t->exposure[i]);
+
+	if (fields & FT_ISO)
+	    sig[i].iso = t->iso[i];
+
+	if (fields & FT_SIZE)
+	{
+	    sig[i].width = t->width[i];
+	    sig[i].height = t->height[i];
+	}
+
+	if ((g = g_hash_table_lookup(ht, &(sig[i]))) != NULL)
+	{
+	    grp[i] = GPOINTER_TO_INT(g) - 1;
+	}
+	else
+	{
+	    grp[i] = n++;
+	    g_hash_table_insert(ht, &(sig[i]), GINT_TO_POINTER(n));
+	}
+    }
+
+    g_hash_table_destroy(ht);
+    free(sig);
+
+    return n;
+}
+
+
+/* Exposure signature hash and compare */
+
+static guint sig_hash(gconstpointer p)
+{
+    const FtSig *s = (const FtSig *) p;
+    guint h;
+
+    h = (guint) s->exp ^ (guint) (s->exp >> 32);
+    h = h * 31 + (guint) s->iso;
+    h = h * 31 + (guint) s->width;
+    h = h * 31 + (guint) s->height;
+
+    return h;
+}
+
+
+static gboolean sig_equal(gconstpointer a, gconstpointer b)
+{
+    const FtSig *s1 = (const FtSig *) a;
+    const FtSig *s2 = (const FtSig *) b;
+
+    return (s1->exp == s2->exp && s1->iso == s2->iso &&
+	    s1->width == s2->width && s1->height == s2->height);
+}
+
+
+/* Set the session of each frame of a list, optionally putting the list in date order - frames
+   with no date go last and join the session before. Returns the number of sessions. */
+
+int frame_sessions(GList **gl, int sort)
+{
+    int n, hrs;
+    gint64 gap, prev;
+    GList *l, *sorted;
+    Image *img;
+
+    if (*gl == NULL)
+    	return 0;
+
+    if (! get_user_pref_int(SESSION_GAP_HRS, &hrs) || hrs <= 0)
+    	hrs = SESSION_GAP;
+
+    gap = (gint64) hrs * 3600;
+
+    /* Stable, so equal dates (and undated frames) keep their order */
+    sorted = g_list_sort(g_list_copy(*gl), taken_cmp);
+    n = 0;
+    prev = 0;
+
+    for(l = sorted; l != NULL; l = l->next)
+    {
+	img = (Image *) l->data;
+
+	if (img->taken != 0)
+	{
+	    if (prev != 0 && img->taken - prev > gap)
+		n++;
+
+	    prev = img->taken;
+	}
+
+	img->session = n;
+    }
+
+    if (sort)
+    {
+	g_list_free(*gl);
+	*gl = sorted;
+    }
+    else
+    {
+	g_list_free(sorted);
+    }
+
+    return n + 1;
+}
+
+
+/* Date taken order, undated last */
+
+static gint taken_cmp(gconstpointer a, gconstpointer b)
+{
+    gint64 t1, t2;
+
+    t1 = ((const Image *) a)->taken;
+    t2 = ((const Image *) b)->taken;
+
+    if (t1 == t2)
+    	return 0;
+
+    if (t1 == 0)
+    	return 1;
+
+    if (t2 == 0)
+    	return -1;
+
+    return (t1 < t2) ? -1 : 1;
+}
+
+
+/* Exposure seconds from Exif text (eg. '1/60 sec.' or '30.0 sec.'), 0 if not known */
+
+double exif_exposure(const char *s)
+{
+    double n, d;
+
+    if (s == NULL)
+    	return 0.0;
+
+    if (sscanf(s, "%lf/%lf", &n, &d) == 2 && d > 0.0)
+	return n / d;
+
+    if (sscanf(s, "%lf", &n) == 1 && n > 0.0)
+	return n;
+
+    return 0.0;
+}
+
+
+/* Exif date and time ('YYYY:MM:DD HH:MM:SS') as seconds from 1970, 0 if not known - the
+   camera clock has no zone so this is only good for ordering and intervals */
+
+gint64 exif_time(const char *s)
+{
+    int y, mo, d, h, mi, sec;
+    gint64 t;
+    GDateTime *dt;
+
+    if (s == NULL)
+    	return 0;
+
+    if (sscanf(s, "%d:%d:%d %d:%d:%d", &y, &mo, &d, &h, &mi, &sec) != 6)
+    	return 0;
+
+    if ((dt = g_date_time_new_utc(y, mo, d, h, mi, (gdouble) sec)) == NULL)
+    	return 0;
+
+    t = g_date_time_to_unix(dt);
+    g_date_time_unref(dt);
+
+    return t;
+}
+
+
+/* Exposure as a whole number of EXP_TOL steps on a log scale - exposures are the same when
+   their keys are equal (grouping and matching both use this). Unknown exposures share a key. */
+
+static gint64 exp_key(double exp)
+{
+    if (exp <= 0.0)
+    	return G_MININT64;
+
+    return (gint64) floor(log(exp) / log1p(EXP_TOL) + 0.5);
+}
+
+
+/* Integer Exif value (ISO, width, height), 0 if not known */
+
+static int exif_int(const char *s)
+{
+    long v;
+    char *end;
+
+    if (s == NULL)
+    	return 0;
+
+    v = strtol(s, &end, 10);
+
+    if (end == s || v < 0 || v > G_MAXINT)
+    	return 0;
+
+    return (int) v;
+}
@@ -34,9 +34,11 @@
 /* Defines */
 
 #define MAX_SCALE 400
+#define LOADER_CHUNK 262144		// File bytes passed to the loader at a time
 
 /* Includes */
 #include <stdio.h>  
+#include <math.h>  
 #include <sys/stat.h>  
 #include <sys/types.h>  
 #include <unistd.h>  
@@ -47,6 +49,7 @@
 #include <libexif/exif-tag.h>
 #include <libexif/exif-loader.h>
 #include <project_ui.h>
+#include <instrument.h>
 
 
 /* Prototypes */
@@ -56,6 +59,9 @@ Image * setup_image(char *, char *, char *, ProjectUi *);
 int load_exif_data(Image *, char *, GtkWidget *);
 static char * get_exif_tag(ExifData *, ExifIfd, ExifTag);
 int show_image(char *, MainUi *);
+int show_video(Image *, char *, MainUi *);
+static void show_base(MainUi *);
+static GdkPixbuf * frame_pixbuf(ImgFrame *);
 void show_meta(char *, int, gchar *, MainUi *);
 void show_scale(double, MainUi *);
 void img_fit_win(GdkPixbuf *, int, int, MainUi *);
@@ -68,6 +74,7 @@ void mouse_drag_on(MainUi *);
 void mouse_drag_off(MainUi *);
 static void nudge_loader(MainUi *);
 static void init_loader(MainUi *);
+static double budget_scale(int, int, double);
 gboolean pulse_bar(gpointer data);
 
 static void OnAreaPrepared(GdkPixbufLoader *, gpointer);
@@ -77,7 +84,20 @@ static void OnClosed(GdkPixbufLoader *, gpointer);
 	
 extern void log_msg(char*, char*, char*, GtkWidget*);
 extern void trim_spaces(char *);
+extern void instr_start(InstrTimer *, int);
+extern void instr_stop(InstrTimer *, gint64, int);
 extern void view_menu_sensitive(MainUi *, int);
+extern Image * img_new(const char *, const char *);
+extern char * img_str(const char *);
+extern void free_img(gpointer);
+extern gint64 mem_reserve(gint64, gint64);
+extern void mem_release(gint64);
+extern gint64 exif_time(const char *);
+extern int video_file(const char *);
+extern int video_info(Image *, char *, GtkWidget *);
+extern ImgFrame * video_frame_load(Image *, GtkWidget *);
+extern void frame_free(ImgFrame *);
+extern Image * img_copy(Image *);
 
 
 /* Globals */
@@ -88,12 +108,14 @@ static double px_scale = 0;
 /* Pixbuf Loader variables */
 static GdkPixbufLoader *loader = NULL;
 static GdkPixbuf *loader_pixbuf = NULL;
-static guchar *filebuf = NULL;
-static guint filesize = 0;
-static guint curpos = 0;
+static FILE *loader_fd = NULL;
 
+/* Memory budget held for the image shown and for the scaled copy (bytes) */
+static gint64 base_mem = 0;
+static gint64 scaled_mem = 0;
 
-/* Determine image type */
+
+/* Determine image type (a pool string) */
 /*
  * (Probably overkill, but interesting !)
  *
@@ -114,7 +136,7 @@ char * image_type(char *path, GtkWidget *window)
     int i, j, c, err;
     struct stat filestat;
     char buf[10];
-    char *s;
+    const char *s;
     
     const int max_types = 8;
     const int max_cols = 11;
@@ -134,8 +156,7 @@ char * image_type(char *path, GtkWidget *window)
 	};
 
     /* Set default unknown */
-    s = (char *) malloc(9);
-    strcpy(s, "Unknown");
+    s = "Unknown";
 
     /* Check file */
     err = stat(path, &filestat);
@@ -143,13 +164,13 @@ char * image_type(char *path, GtkWidget *window)
     if ((err < 0) || (filestat.st_size == 0))
     {
     	log_msg("SYS9006", path, "SYS9006", window);
-	return s;
+	return img_str(s);
     }
 
     if ((fd = fopen(path, "r")) == (FILE *) NULL)
     {
     	log_msg("SYS9006", path, "SYS9006", window);
-	return s;
+	return img_str(s);
     }
 
     /* This is just a 'last man standing' approach */
@@ -179,14 +200,14 @@ char * image_type(char *path, GtkWidget *window)
     {
     	if (candidates[i] == TRUE)
     	{
-	    strcpy(s, img_types[i]);
+	    s = img_types[i];
 	    break;
     	}
     };
 
     fclose(fd);
 
-    return s;
+    return img_str(s);
 }  
 
 
@@ -196,17 +217,11 @@ Image * setup_image(char *nm, char *dir, char *image_full_path, ProjectUi *p_ui)
 {  
     Image *img;
 
-    img = (Image *) malloc(sizeof(Image));
-    img->nm = (char *) malloc(strlen(nm) + 1);
-    img->path = (char *) malloc(strlen(dir) + 1);
-    strcpy(img->nm, nm);
-    strcpy(img->path, dir);
+    img = img_new(nm, dir);
 
     if (! load_exif_data(img, image_full_path, p_ui->window))
     {
-    	free(img->nm);
-    	free(img->path);
-    	free(img);
+    	free_img(img);
     	return NULL;
     }
 
@@ -220,12 +235,19 @@ int load_exif_data(Image *img, char *full_path, GtkWidget *window)
 {  
     ExifData *ed;
     ExifEntry *entry;
+    InstrTimer tmr;
+
+    /* Videos have their own header */
+    if (video_file(full_path))
+    	return video_info(img, full_path, window);
 
     /* Load an ExifData object from an EXIF file */
+    instr_start(&tmr, INS_EXIF);
     ed = exif_data_new_from_file(full_path);
 
     if (!ed)
     {
+	instr_stop(&tmr, 0, 0);
 	log_msg("APP0010", full_path, "APP0010", window);
         return FALSE;
     }
@@ -252,21 +274,22 @@ int load_exif_data(Image *img, char *full_path, GtkWidget *window)
     
     /* Free the EXIF */
     exif_data_unref(ed);
+    instr_stop(&tmr, 0, 1);
     
     /* Not really exif data, but as far as possible, get the image type here */
     img->img_exif.type = image_type(full_path, window);
+    img->taken = exif_time(img->img_exif.date);
     //printf("%s - Type: %s\n", debug_hdr, img->img_exif.type); fflush(stdout);
 
     return TRUE;
 }
 
 
-/* Extract tag and contents if exists */
+/* Extract tag and contents if exists (a pool string) */
 
 static char * get_exif_tag(ExifData *d, ExifIfd ifd, ExifTag tag)
 {
     char buf[1024];
-    char *s;
 
     /* See if this tag exists */
     ExifEntry *entry = exif_content_get_entry(d->ifd[ifd], tag);
@@ -282,16 +305,11 @@ static char * get_exif_tag(ExifData *d, ExifIfd ifd, ExifTag tag)
         if (*buf)
         {
             //printf("%s - %s: %s\n", debug_hdr, exif_tag_get_name_in_ifd(tag,ifd), buf); fflush(stdout);
-	    s = (char *) malloc(strlen(buf) + 1);
-	    strcpy(s, buf);
-	    return s;
+	    return img_str(buf);
         }
     }
 
-    s = (char *) malloc(4);
-    sprintf(s, "N/A");
-
-    return s;
+    return img_str("N/A");
 }
 
 
@@ -299,18 +317,91 @@ static char * get_exif_tag(ExifData *d, ExifIfd ifd, ExifTag tag)
 
 int show_image(char *img_fn, MainUi *m_ui)
 {
-    int sw_h, sw_w;
     GError *err = NULL;
 
+    if (m_ui->base_pixbuf != NULL)
+	g_object_unref (m_ui->base_pixbuf);
+
     m_ui->base_pixbuf = gdk_pixbuf_new_from_file(img_fn, &err);
     m_ui->img_fn = strdup(img_fn);
+    show_base(m_ui);
+
+    return TRUE;
+}
+
+
+/* Show the first frame of a video */
+
+int show_video(Image *img, char *img_fn, MainUi *m_ui)
+{
+    Image *f;
+    ImgFrame *frm;
+
+    f = img_copy(img);
+    f->vframe = 1;
+    frm = video_frame_load(f, m_ui->window);
+    free_img(f);
+
+    if (frm == NULL)
+    	return FALSE;
+
+    if (m_ui->base_pixbuf != NULL)
+	g_object_unref (m_ui->base_pixbuf);
+
+    m_ui->base_pixbuf = frame_pixbuf(frm);
+    m_ui->img_fn = strdup(img_fn);
+    frame_free(frm);
+    show_base(m_ui);
+
+    return TRUE;
+}
+
+
+/* Fit the base image to the window */
+
+static void show_base(MainUi *m_ui)
+{
+    int sw_h, sw_w;
+    gint64 len;
+
+    /* Held against the memory budget in place of the last one */
+    len = (m_ui->base_pixbuf) ? (gint64) gdk_pixbuf_get_byte_length(m_ui->base_pixbuf) : 0;
+    mem_release(base_mem);
+    base_mem = mem_reserve(len, len);
     sw_w = gtk_widget_get_allocated_width (m_ui->img_scroll_win);
     sw_h = gtk_widget_get_allocated_height (m_ui->img_scroll_win);
 
     img_fit_win(m_ui->base_pixbuf, sw_w, sw_h, m_ui);
     view_menu_sensitive(m_ui, TRUE);
 
-    return TRUE;
+    return;
+}
+
+
+/* An 8 bit RGB pixbuf of a frame (grey or RGB) */
+
+static GdkPixbuf * frame_pixbuf(ImgFrame *frm)
+{
+    int x, y, c, ch, stride;
+    guchar *p;
+    const float *q;
+    GdkPixbuf *pixbuf;
+
+    pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, frm->width, frm->height);
+    stride = gdk_pixbuf_get_rowstride(pixbuf);
+    ch = frm->channels;
+
+    for(y = 0; y < frm->height; y++)
+    {
+	p = gdk_pixbuf_get_pixels(pixbuf) + (size_t) y * stride;
+	q = frm->data + (size_t) y * frm->width * ch;
+
+	for(x = 0; x < frm->width; x++, p += 3, q += ch)
+	    for(c = 0; c < 3; c++)
+		p[c] = (guchar) CLAMP((int) (q[(ch == 3) ? c : 0] / 257.0f), 0, 255);
+    }
+
+    return pixbuf;
 }
 
 
@@ -355,6 +446,12 @@ void show_meta(char *img_fn, int idx, gchar *img_type, MainUi *m_ui)
 
     gtk_text_buffer_insert (txt_buffer, &iter, buf, -1);
 
+    if (img->vframes > 0)
+    {
+	sprintf(buf, "Frames:  %d\n", img->vframes);
+	gtk_text_buffer_insert (txt_buffer, &iter, buf, -1);
+    }
+
     if (! gtk_widget_get_visible (m_ui->img_meta_vbox))
     {
     	gtk_widget_set_visible (m_ui->img_meta_vbox, TRUE);
@@ -408,6 +505,13 @@ void img_fit_win(GdkPixbuf *pixbuf, int win_w, int win_h, MainUi *m_ui)
 
 void img_scale_sz(MainUi *m_ui, int multx)
 {
+    /* A video frame is held in full already */
+    if (video_file(m_ui->img_fn) && px_scale > 0)
+    {
+	scale_pixmap((100.0 * multx) / px_scale, m_ui);
+	return;
+    }
+
     px_scale = 100 * multx;
     init_loader(m_ui);
 
@@ -437,8 +541,6 @@ void img_scale_sz(MainUi *m_ui, int multx)
 
 static void init_loader(MainUi *m_ui)
 {
-    FILE *file;
-
     /* Prepare the loader and local callbacks */
     loader = gdk_pixbuf_loader_new();
     g_signal_connect (G_OBJECT(loader), "area_prepared", G_CALLBACK (OnAreaPrepared), m_ui);
@@ -446,23 +548,8 @@ static void init_loader(MainUi *m_ui)
     g_signal_connect (G_OBJECT(loader), "size-prepared", G_CALLBACK (OnSizePrepared), m_ui);
     g_signal_connect (G_OBJECT(loader), "closed", G_CALLBACK (OnClosed), m_ui);
 
-    /* Load file into memory for easier cycling */
-    file = fopen (m_ui->img_fn, "r");
-
-    if (file)
-    {
-	struct stat statbuf;
-
-	if (stat(m_ui->img_fn, &statbuf) == 0)
-	{
-	    filesize = statbuf.st_size;
-	    filebuf = g_malloc(filesize);
-	    fread(filebuf, sizeof(char), filesize, file);
-	}
-
-	fclose(file);
-    }
-    else
+    /* The file is read a chunk at a time as the loader takes it (not held whole) */
+    if ((loader_fd = fopen (m_ui->img_fn, "r")) == NULL)
     {
 	log_msg("SYS9006", m_ui->img_fn, "SYS9006", m_ui->window);
 	return;
@@ -479,40 +566,59 @@ static void init_loader(MainUi *m_ui)
 
 static void nudge_loader(MainUi *m_ui)
 {
-    guint bitesize = 262144;  //65536;
-    guint writesize = bitesize;
+    size_t writesize;
+    guchar *buf;
     GError *err = NULL;
 
-    if (curpos >= filesize)
+    if (loader_fd == NULL)
 	return;
 
-    while(curpos < filesize)
-    {
-	/* Trim writesize if it extends past the end of the file */
-	if (curpos + bitesize >= filesize)
-	    writesize = filesize - curpos;
+    buf = (guchar *) malloc(LOADER_CHUNK);
 
+    while((writesize = fread(buf, 1, LOADER_CHUNK, loader_fd)) > 0)
+    {
 	/* Send next chunk of image */
-	if (!gdk_pixbuf_loader_write(loader, &filebuf[curpos], writesize, &err))
+	if (!gdk_pixbuf_loader_write(loader, buf, writesize, &err))
 	{
 	    log_msg("SYS9012", "GdkPixbufLoader", "SYS9012", m_ui->window);
-	    return;
+	    break;
 	}
-
-	curpos += writesize;
-     
-	/* 
-	** Clean up loader when we're finished writing the entire file; 
-	** loader_pixbuf is still around because we referenced it in OnAreaPrepared
-	*/
-	if (curpos >= filesize)
-	    gdk_pixbuf_loader_close(loader, &err);
     }
 
+    free(buf);
+    fclose(loader_fd);
+    loader_fd = NULL;
+
+    /* 
+    ** Clean up loader when we're finished writing the entire file; 
+    ** loader_pixbuf is still around because we referenced it in OnAreaPrepared
+    */
+    gdk_pixbuf_loader_close(loader, &err);
+
     return;
 }
 
 
+/* Scale (percent) for a scaled copy of a 'width' x 'height' image - as asked for if the
+   memory budget has room (in place of the last copy), otherwise the largest that fits
+   down to the original size */
+
+static double budget_scale(int width, int height, double scale)
+{
+    gint64 want, min;
+
+    want = (gint64) (width * (scale / 100.0)) * (gint64) (height * (scale / 100.0)) * 4;
+    min = MIN(want, (gint64) width * height * 4);
+    mem_release(scaled_mem);
+    scaled_mem = mem_reserve(want, min);
+
+    if (scaled_mem < want)
+	scale *= sqrt((double) scaled_mem / want);
+
+    return scale;
+}
+
+
 /* Show pulsing to indicate image loading in progress */
 
 gboolean pulse_bar(gpointer user_data)
@@ -558,6 +664,7 @@ void scale_pixmap(double step, MainUi *m_ui)
 
 g_print("scale_pixmap: step:  %0.2f\n", step);
     d_scale = (double) px_scale * step;
+    d_scale = budget_scale(gdk_pixbuf_get_width(m_ui->base_pixbuf), gdk_pixbuf_get_height(m_ui->base_pixbuf), d_scale);
     
     px_h = ((double) gdk_pixbuf_get_height(m_ui->base_pixbuf)) * (d_scale / 100.0);
     px_w = ((double) gdk_pixbuf_get_width(m_ui->base_pixbuf)) * (d_scale / 100.0);
@@ -715,6 +822,7 @@ void OnSizePrepared(GdkPixbufLoader *loader, gint width, gint height, gpointer u
     m_ui = (MainUi *) user_data;
 
     /* Set scaling if any */
+    px_scale = budget_scale(width, height, px_scale);
     px_w = (double) width * (px_scale / 100.0);
     px_h = (double) height * (px_scale / 100.0);
 
@@ -742,12 +850,8 @@ gdk_pixbuf_save (loader_pixbuf, handle, "jpeg", &err, "quality", "100", NULL);
 
     /* Reset */
     m_ui->pulse_status = FALSE;
-    g_free(filebuf);
     g_object_unref(loader_pixbuf);
     loader_pixbuf = NULL;
-    filebuf = NULL;
-    filesize = 0;
-    curpos = 0;
 
     show_scale(px_scale, m_ui);
 
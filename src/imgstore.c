@@ -0,0 +1,204 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Image record store - the image and calibration frame records (with their names, paths
+**  and Exif strings) for the projects open. Records are taken from slabs of many at a time
+**  (freed ones are reused) and the strings are copied into a shared pool, the repeated
+**  ones (directories, make, model, ISO, exposure and so on) held once. Loading a large
+**  project is then a handful of allocations and the records sit together in memory.
+**  Pool strings must not be changed or freed. The slabs and pool are released when the
+**  last record is freed. Main (GTK) thread only.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define IMG_SLAB 256			// Records per slab
+#define IMG_POOL_BLOCK 16384		// String pool block size
+
+
+/* Includes */
+
+#include <stdlib.h>
+#include <string.h>
+#include <gtk/gtk.h>
+#include <project.h>
+
+
+/* Types */
+
+typedef union _ImgSlot
+{
+    Image img;
+    union _ImgSlot *next;		// Free list link
+} ImgSlot;
+
+typedef struct _ImgSlab
+{
+    struct _ImgSlab *next;
+    ImgSlot slot[IMG_SLAB];
+} ImgSlab;
+
+
+/* Prototypes */
+
+Image * img_new(const char *, const char *);
+Image * img_copy(Image *);
+char * img_str(const char *);
+void free_img(gpointer);
+static Image * img_slot();
+static void img_store_reset();
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-imgstore.c ";
+static ImgSlab *slabs = NULL;
+static ImgSlot *free_slots = NULL;
+static GStringChunk *pool = NULL;
+static int live = 0;
+
+
+/* A new (zeroed) record for file 'nm' in directory 'path' (may be NULL) */
+
+Image * img_new(const char *nm, const char *path)
+{
+    Image *img;
+
+    img = img_slot();
+    memset(img, 0, sizeof(Image));
+
+    /* Names are seldom repeated so are not looked up */
+    if (pool == NULL)
+	pool = g_string_chunk_new(IMG_POOL_BLOCK);
+
+    img->nm = g_string_chunk_insert(pool, nm);
+    img->path = img_str(path);
+
+    return img;
+}
+
+
+/* A new record the same as another (sharing its strings) */
+
+Image * img_copy(Image *img)
+{
+    Image *cp;
+
+    cp = img_slot();
+    memcpy(cp, img, sizeof(Image));
+
+    return cp;
+}
+
+
+/* Take a record from the free list (a new slab if none) */
+
+static Image * img_slot()
+{
+    int i;
+    ImgSlab *sb;
+    ImgSlot *s;
+
+    if (free_slots == NULL)
+    {
+	sb = (ImgSlab *) malloc(sizeof(ImgSlab));
+	sb->next = slabs;
+	slabs = sb;
+
+	for(i = IMG_SLAB - 1; i >= 0; i--)
+	{
+	    sb->slot[i].next = free_slots;
+	    free_slots = &(sb->slot[i]);
+	}
+    }
+
+    s = free_slots;
+    free_slots = s->next;
+    live++;
+
+    return &(s->img);
+}
+
+
+/* Pool copy of a string (NULL stays NULL) - the same for equal strings */
+
+char * img_str(const char *str)
+{
+    if (str == NULL)
+    	return NULL;
+
+    if (pool == NULL)
+	pool = g_string_chunk_new(IMG_POOL_BLOCK);
+
+    return g_string_chunk_insert_const(pool, str);
+}
+
+
+/* Free an image or calibration frame */
+
+void free_img(gpointer data)
+{
+    ImgSlot *s;
+
+    if (data == NULL)
+    	return;
+
+    s = (ImgSlot *) data;
+    s->next = free_slots;
+    free_slots = s;
+
+    if (--live == 0)
+	img_store_reset();
+
+    return;
+}
+
+
+/* Release the slabs and strings (no records left) */
+
+static void img_store_reset()
+{
+    ImgSlab *sb;
+
+    while(slabs != NULL)
+    {
+	sb = slabs;
+	slabs = sb->next;
+	free(sb);
+    }
+
+    if (pool != NULL)
+	g_string_chunk_free(pool);
+
+    pool = NULL;
+    free_slots = NULL;
+
+    return;
+}
@@ -0,0 +1,190 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Processing instrumentation - per operation timers, byte and frame counters and
+**  time histograms. Timers wrap whole operations (a frame decode, a warp etc.) not
+**  pixel loops, so the cost is a clock read and a short lock per operation.
+**  A summary for the run is written to the log file (View Log).
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <instrument.h>
+
+
+/* Prototypes */
+
+void instr_start(InstrTimer *, int);
+void instr_stop(InstrTimer *, gint64, int);
+void instr_reset();
+void instr_get(int, InstrStats *);
+const char * instr_name(int);
+void instr_log_summary(char *);
+
+extern void log_msg_extra(char*, char*, char*, char*, GtkWidget*);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-instrument.c ";
+static const char *instr_nm[] = { "Decode", "Exif", "Calibrate", "Detect", "Match", "Warp", "Accumulate", "Write", "Cache" };
+static InstrStats stats[INS_COUNT];
+static GMutex instr_lock;
+
+
+/* Start timing an operation */
+
+void instr_start(InstrTimer *tmr, int id)
+{
+    tmr->id = id;
+    tmr->start = g_get_monotonic_time();
+
+    return;
+}
+
+
+/* Stop timing and add to the operation counters */
+
+void instr_stop(InstrTimer *tmr, gint64 bytes, int frames)
+{
+    int b;
+    gint64 us, ms;
+    InstrStats *st;
+
+    us = g_get_monotonic_time() - tmr->start;
+
+    for(b = 0, ms = us / 1000; ms > 0 && b < INSTR_BUCKETS - 1; ms >>= 1)
+    	b++;
+
+    st = &(stats[tmr->id]);
+
+    g_mutex_lock(&instr_lock);
+
+    if (st->calls == 0 || us < st->min_us)
+    	st->min_us = us;
+
+    if (us > st->max_us)
+    	st->max_us = us;
+
+    st->calls++;
+    st->total_us += us;
+    st->bytes += bytes;
+    st->frames += frames;
+    st->hist[b]++;
+
+    g_mutex_unlock(&instr_lock);
+
+    return;
+}
+
+
+/* Clear all counters (start of a run) */
+
+void instr_reset()
+{
+    g_mutex_lock(&instr_lock);
+    memset(stats, 0, sizeof(stats));
+    g_mutex_unlock(&instr_lock);
+
+    return;
+}
+
+
+/* Copy of the counters for an operation */
+
+void instr_get(int id, InstrStats *st)
+{
+    g_mutex_lock(&instr_lock);
+    *st = stats[id];
+    g_mutex_unlock(&instr_lock);
+
+    return;
+}
+
+
+/* Operation name */
+
+const char * instr_name(int id)
+{
+    if (id < 0 || id >= INS_COUNT)
+    	return "";
+
+    return instr_nm[id];
+}
+
+
+/* Write the counters for each operation used to the log */
+
+void instr_log_summary(char *title)
+{
+    int i, b, len;
+    char s[1000];
+    double secs;
+    InstrStats st;
+
+    log_msg_extra("APP0020", title, NULL, NULL, NULL);
+
+    for(i = 0; i < INS_COUNT; i++)
+    {
+	instr_get(i, &st);
+
+	if (st.calls == 0)
+	    continue;
+
+	secs = st.total_us / 1e6;
+	len = sprintf(s, "Calls %d  Total %.1f ms  Mean %.2f ms  Min %.2f ms  Max %.2f ms",
+			st.calls, st.total_us / 1e3, st.total_us / 1e3 / st.calls,
+			st.min_us / 1e3, st.max_us / 1e3);
+
+	if (st.frames > 0 && secs > 0.0)
+	    len += sprintf(s + len, "  Frames %d (%.2f/s)", st.frames, st.frames / secs);
+
+	if (st.bytes > 0 && secs > 0.0)
+	    len += sprintf(s + len, "  %.1f MB (%.1f MB/s)", st.bytes / 1048576.0, st.bytes / 1048576.0 / secs);
+
+	len += sprintf(s + len, "\n\tHistogram (ms):");
+
+	for(b = 0; b < INSTR_BUCKETS; b++)
+	    if (st.hist[b] > 0)
+		len += sprintf(s + len, "  <%d:%d", 1 << b, st.hist[b]);
+
+	log_msg_extra("APP0021", (char *) instr_nm[i], s, NULL, NULL);
+    }
+
+    return;
+}
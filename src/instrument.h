@@ -0,0 +1,79 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:	Processing instrumentation (timers and counters) details
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial
+**
+*/
+
+
+/* Includes */
+
+#include <glib.h>
+
+
+// Structure(s) for timing the processing hot spots.
+// A timer is started and stopped around each operation (eg. decoding one frame) and the
+// elapsed time, bytes and frames are added to the counters for that operation. Times are
+// also kept as a histogram (power of 2 millisecond buckets) to show the spread.
+
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#define INSTR_BUCKETS 16
+
+enum InstrId
+    {
+       INS_DECODE,
+       INS_EXIF,
+       INS_CALIBRATE,
+       INS_DETECT,
+       INS_MATCH,
+       INS_WARP,
+       INS_ACCUM,
+       INS_WRITE,
+       INS_CACHE,
+       INS_COUNT
+    };
+
+
+typedef struct _InstrTimer
+{
+    int id;
+    gint64 start;
+} InstrTimer;
+
+
+typedef struct _InstrStats
+{
+    int calls;
+    gint64 total_us, min_us, max_us;
+    gint64 bytes;
+    int frames;
+    int hist[INSTR_BUCKETS];		// Bucket 0 is < 1ms, bucket n is < 2^n ms
+} InstrStats;
+
+#endif
@@ -0,0 +1,637 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Application wide job scheduler.
+**  A fixed set of worker threads (sized from user preferences) each own a deque per priority.
+**  New work goes on the submitting worker's own deque (or round robin from other threads),
+**  workers take their own newest work first and steal the oldest work from the others when
+**  idle. Higher priority work is always taken before lower, wherever it is queued.
+**  A thread waiting on a job group runs queued jobs itself rather than blocking, so stages
+**  may split themselves up (job_parallel_for) from within a job without deadlock.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define MAX_THREADS 64
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <preferences.h>
+#include <jobs.h>
+
+
+/* Types */
+
+typedef struct _JobWorker
+{
+    GThread *thread;
+    GMutex lock;
+    GQueue *deque[JOB_PRI_LEVELS];
+    int idx;
+} JobWorker;
+
+typedef struct _RangeData
+{
+    JobRangeFunc fn;
+    gpointer data;
+    int lo, hi;
+} RangeData;
+
+
+/* Prototypes */
+
+int job_sched_init(int);
+void job_sched_close();
+int job_thread_count();
+void job_set_progress_fn(JobProgressFunc, gpointer);
+void job_submit(int, void (*)(Job *), gpointer, JobToken *, JobGroup *, void (*)(Job *));
+void job_group_init(JobGroup *);
+void job_group_wait(JobGroup *);
+void job_parallel_for(int, int, int, int, JobRangeFunc, gpointer, JobToken *);
+JobToken * job_token_new(char *);
+JobToken * job_token_ref(JobToken *);
+void job_token_unref(JobToken *);
+void job_token_cancel(JobToken *);
+int job_cancelled(JobToken *);
+void job_progress(JobToken *, double, char *);
+static gpointer worker_main(gpointer);
+static void queue_job(Job *);
+static Job * take_job(JobWorker *);
+static int run_one(JobWorker *);
+static void run_job(Job *);
+static void range_job(Job *);
+static gboolean job_done_idle(gpointer);
+static gboolean progress_idle(gpointer);
+
+extern int get_user_pref_int(char *, int *);
+extern void log_msg(char*, char*, char*, GtkWidget*);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-jobs.c ";
+static JobWorker *workers = NULL;
+static int n_workers = 0;
+static volatile gint next_worker = 0;
+static volatile gint sched_stop = FALSE;
+static int use_main_loop = FALSE;
+static GMutex sched_lock;
+static GCond sched_cond;
+static int pending = 0;				// Queued but not yet taken (under sched_lock)
+static GPrivate curr_worker;
+static JobProgressFunc progress_fn = NULL;
+static gpointer progress_data = NULL;
+static GMutex progress_lock;
+
+
+/* Start the worker threads. Completion and progress go via the GTK main loop if 'main_loop' */
+
+int job_sched_init(int main_loop)
+{
+    int i, j, n;
+
+    if (workers != NULL)
+    	return TRUE;
+
+    /* Thread count: preference, zero (or none) is one per processor */
+    if (! get_user_pref_int(THREAD_COUNT, &n) || n <= 0)
+    	n = (int) g_get_num_processors();
+
+    n = CLAMP(n, 1, MAX_THREADS);
+
+    g_mutex_init(&sched_lock);
+    g_cond_init(&sched_cond);
+    g_mutex_init(&progress_lock);
+    use_main_loop = main_loop;
+    sched_stop = FALSE;
+    pending = 0;
+
+    workers = (JobWorker *) malloc(n * sizeof(JobWorker));
+    memset(workers, 0, n * sizeof(JobWorker));
+    n_workers = n;
+
+    for(i = 0; i < n; i++)
+    {
+    	g_mutex_init(&(workers[i].lock));
+    	workers[i].idx = i;
+
+    	for(j = 0; j < JOB_PRI_LEVELS; j++)
+	    workers[i].deque[j] = g_queue_new();
+    }
+
+    for(i = 0; i < n; i++)
+	workers[i].thread = g_thread_new("starsal-worker", worker_main, &(workers[i]));
+
+    sprintf(app_msg_extra, "Worker threads: %d", n);
+    log_msg("APP0003", "Job scheduler started", NULL, NULL);
+
+    return TRUE;
+}
+
+
+/* Stop the worker threads, any work still queued is discarded */
+
+void job_sched_close()
+{
+    int i, j;
+    Job *job;
+
+    if (workers == NULL)
+    	return;
+
+    g_mutex_lock(&sched_lock);
+    sched_stop = TRUE;
+    g_cond_broadcast(&sched_cond);
+    g_mutex_unlock(&sched_lock);
+
+    for(i = 0; i < n_workers; i++)
+	g_thread_join(workers[i].thread);
+
+    for(i = 0; i < n_workers; i++)
+    {
+    	for(j = 0; j < JOB_PRI_LEVELS; j++)
+    	{
+	    while((job = (Job *) g_queue_pop_head(workers[i].deque[j])) != NULL)
+	    {
+		if (job->token)
+		    job_token_unref(job->token);
+
+		if (job->func == range_job)
+		    free(job->data);
+
+		free(job);
+	    }
+
+	    g_queue_free(workers[i].deque[j]);
+    	}
+
+    	g_mutex_clear(&(workers[i].lock));
+    }
+
+    free(workers);
+    workers = NULL;
+    n_workers = 0;
+
+    return;
+}
+
+
+/* Number of worker threads */
+
+int job_thread_count()
+{
+    return n_workers;
+}
+
+
+/* Set the function that displays progress (always called on the main thread if there is one) */
+
+void job_set_progress_fn(JobProgressFunc fn, gpointer user_data)
+{
+    progress_fn = fn;
+    progress_data = user_data;
+
+    return;
+}
+
+
+/* Queue a job */
+
+void job_submit(int priority, void (*func)(Job *), gpointer data, JobToken *token, JobGroup *group,
+		void (*done)(Job *))
+{
+    Job *job;
+
+    job = (Job *) malloc(sizeof(Job));
+    job->priority = CLAMP(priority, 0, JOB_PRI_LEVELS - 1);
+    job->func = func;
+    job->data = data;
+    job->token = token ? job_token_ref(token) : NULL;
+    job->group = group;
+    job->done = done;
+
+    if (group)
+    	g_atomic_int_inc(&(group->outstanding));
+
+    /* No threads (eg. failed init) - just run it */
+    if (workers == NULL)
+    {
+    	run_job(job);
+    	return;
+    }
+
+    queue_job(job);
+
+    return;
+}
+
+
+/* Initialise a job group for waiting on */
+
+void job_group_init(JobGroup *group)
+{
+    group->outstanding = 0;
+
+    return;
+}
+
+
+/* Wait for all the jobs in a group, running queued jobs in the meantime */
+
+void job_group_wait(JobGroup *group)
+{
+    JobWorker *self;
+
+    self = (JobWorker *) g_private_get(&curr_worker);
+
+    while(g_atomic_int_get(&(group->outstanding)) > 0)
+    {
+    	if (run_one(self))
+	    continue;
+
+	/* Nothing to help with - sleep until a job is queued or finishes */
+	g_mutex_lock(&sched_lock);
+
+	if (g_atomic_int_get(&(group->outstanding)) > 0 && pending == 0 && ! sched_stop)
+	    g_cond_wait(&sched_cond, &sched_lock);
+
+	g_mutex_unlock(&sched_lock);
+    }
+
+    return;
+}
+
+
+// Split the range [start, end) into chunks and run 'fn(lo, hi, data)' across the workers.
+// The caller helps and returns when all chunks are done. Chunks are queued in order, so with
+// stealing the idle workers take from the far end of the range first.
+
+void job_parallel_for(int priority, int start, int end, int chunk, JobRangeFunc fn, gpointer data, JobToken *token)
+{
+    int lo, n;
+    RangeData *rd;
+    JobGroup group;
+
+    if (end <= start)
+    	return;
+
+    /* Default chunking gives a few chunks per thread for balance */
+    if (chunk <= 0)
+    {
+	n = (n_workers > 0) ? n_workers * 4 : 1;
+	chunk = (end - start + n - 1) / n;
+    }
+
+    if (chunk >= end - start || n_workers <= 1)
+    {
+    	fn(start, end, data);
+    	return;
+    }
+
+    job_group_init(&group);
+
+    for(lo = start; lo < end; lo += chunk)
+    {
+	rd = (RangeData *) malloc(sizeof(RangeData));
+	rd->fn = fn;
+	rd->data = data;
+	rd->lo = lo;
+	rd->hi = MIN(lo + chunk, end);
+	job_submit(priority, range_job, rd, token, &group, NULL);
+    }
+
+    job_group_wait(&group);
+
+    return;
+}
+
+
+/* Create a token for an operation */
+
+JobToken * job_token_new(char *desc)
+{
+    JobToken *token;
+
+    token = (JobToken *) malloc(sizeof(JobToken));
+    memset(token, 0, sizeof(JobToken));
+    token->refs = 1;
+    token->desc = strdup(desc ? desc : "");
+    g_mutex_init(&(token->lock));
+
+    return token;
+}
+
+
+/* Add a reference to a token */
+
+JobToken * job_token_ref(JobToken *token)
+{
+    g_atomic_int_inc(&(token->refs));
+
+    return token;
+}
+
+
+/* Release a reference to a token */
+
+void job_token_unref(JobToken *token)
+{
+    if (! g_atomic_int_dec_and_test(&(token->refs)))
+    	return;
+
+    g_mutex_clear(&(token->lock));
+    free(token->desc);
+    free(token);
+
+    return;
+}
+
+
+/* Request cancellation - jobs check the token and stop at a convenient point */
+
+void job_token_cancel(JobToken *token)
+{
+    if (token)
+	g_atomic_int_set(&(token->cancelled), TRUE);
+
+    return;
+}
+
+
+/* Check for cancellation */
+
+int job_cancelled(JobToken *token)
+{
+    if (token == NULL)
+    	return FALSE;
+
+    return g_atomic_int_get(&(token->cancelled));
+}
+
+
+// Report progress (fraction 0 - 1 and optional message) from any thread.
+// Only the latest values are kept and at most one update is outstanding on the main loop.
+
+void job_progress(JobToken *token, double fraction, char *msg)
+{
+    if (token == NULL || progress_fn == NULL)
+    	return;
+
+    g_mutex_lock(&(token->lock));
+    token->fraction = fraction;
+
+    if (msg)
+	snprintf(token->msg, sizeof(token->msg), "%s", msg);
+
+    g_mutex_unlock(&(token->lock));
+
+    if (! use_main_loop)
+    {
+	g_mutex_lock(&progress_lock);
+	progress_fn(token, progress_data);
+	g_mutex_unlock(&progress_lock);
+    	return;
+    }
+
+    if (g_atomic_int_compare_and_exchange(&(token->idle_pending), FALSE, TRUE))
+    {
+	job_token_ref(token);
+	g_idle_add(progress_idle, token);
+    }
+
+    return;
+}
+
+
+/* Worker thread */
+
+static gpointer worker_main(gpointer arg)
+{
+    JobWorker *self;
+
+    self = (JobWorker *) arg;
+    g_private_set(&curr_worker, self);
+
+    while(! g_atomic_int_get(&sched_stop))
+    {
+    	if (run_one(self))
+	    continue;
+
+	g_mutex_lock(&sched_lock);
+
+	while(pending == 0 && ! sched_stop)
+	    g_cond_wait(&sched_cond, &sched_lock);
+
+	g_mutex_unlock(&sched_lock);
+    }
+
+    return NULL;
+}
+
+
+/* Place a job on a deque - the current worker's own if called from a job, else the next in turn */
+
+static void queue_job(Job *job)
+{
+    JobWorker *w;
+
+    if ((w = (JobWorker *) g_private_get(&curr_worker)) == NULL)
+    	w = &(workers[(guint) g_atomic_int_add(&next_worker, 1) % n_workers]);
+
+    g_mutex_lock(&(w->lock));
+    g_queue_push_tail(w->deque[job->priority], job);
+    g_mutex_unlock(&(w->lock));
+
+    g_mutex_lock(&sched_lock);
+    pending++;
+    g_cond_signal(&sched_cond);
+    g_mutex_unlock(&sched_lock);
+
+    return;
+}
+
+
+/* Find the next job: by priority, own newest first, otherwise steal the oldest from another */
+
+static Job * take_job(JobWorker *self)
+{
+    int pri, i, start;
+    JobWorker *w;
+    Job *job;
+
+    start = self ? self->idx : 0;
+
+    for(pri = 0; pri < JOB_PRI_LEVELS; pri++)
+    {
+	if (self)
+	{
+	    g_mutex_lock(&(self->lock));
+	    job = (Job *) g_queue_pop_tail(self->deque[pri]);
+	    g_mutex_unlock(&(self->lock));
+
+	    if (job)
+		return job;
+	}
+
+	for(i = 0; i < n_workers; i++)
+	{
+	    w = &(workers[(start + i) % n_workers]);
+
+	    if (w == self)
+	    	continue;
+
+	    g_mutex_lock(&(w->lock));
+	    job = (Job *) g_queue_pop_head(w->deque[pri]);
+	    g_mutex_unlock(&(w->lock));
+
+	    if (job)
+		return job;
+	}
+    }
+
+    return NULL;
+}
+
+
+/* Run a job if one can be found */
+
+static int run_one(JobWorker *self)
+{
+    Job *job;
+
+    if (workers == NULL)
+    	return FALSE;
+
+    if ((job = take_job(self)) == NULL)
+    	return FALSE;
+
+    g_mutex_lock(&sched_lock);
+    pending--;
+    g_mutex_unlock(&sched_lock);
+
+    run_job(job);
+
+    return TRUE;
+}
+
+
+/* Run a job and signal its completion */
+
+static void run_job(Job *job)
+{
+    /* Cancelled jobs are still 'completed' so that waits finish. A range chunk owns its
+       data so is always run (it frees the data and skips the work if cancelled). */
+    if (job->func == range_job || ! job_cancelled(job->token))
+	job->func(job);
+
+    if (job->group)
+    {
+	g_mutex_lock(&sched_lock);
+	g_atomic_int_add(&(job->group->outstanding), -1);
+	g_cond_broadcast(&sched_cond);
+	g_mutex_unlock(&sched_lock);
+    }
+
+    if (job->done && use_main_loop)
+    {
+    	g_idle_add(job_done_idle, job);
+    	return;
+    }
+
+    if (job->done)
+    	job->done(job);
+
+    if (job->token)
+	job_token_unref(job->token);
+
+    free(job);
+
+    return;
+}
+
+
+/* A chunk of a parallel range */
+
+static void range_job(Job *job)
+{
+    RangeData *rd;
+
+    rd = (RangeData *) job->data;
+
+    if (! job_cancelled(job->token))
+	rd->fn(rd->lo, rd->hi, rd->data);
+
+    free(rd);
+    job->data = NULL;
+
+    return;
+}
+
+
+/* Job completion on the main thread */
+
+static gboolean job_done_idle(gpointer user_data)
+{
+    Job *job;
+
+    job = (Job *) user_data;
+    job->done(job);
+
+    if (job->token)
+	job_token_unref(job->token);
+
+    free(job);
+
+    return FALSE;
+}
+
+
+/* Progress display on the main thread */
+
+static gboolean progress_idle(gpointer user_data)
+{
+    JobToken *token;
+
+    token = (JobToken *) user_data;
+    g_atomic_int_set(&(token->idle_pending), FALSE);
+
+    if (progress_fn)
+	progress_fn(token, progress_data);
+
+    job_token_unref(token);
+
+    return FALSE;
+}
@@ -0,0 +1,85 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:	Application job scheduler (thread pool) details
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial
+**
+*/
+
+
+/* Includes */
+
+#include <glib.h>
+
+
+// Structure(s) for jobs run on the application thread pool.
+// A job is a function and its data queued at a priority. Jobs may belong to a group that a
+// caller waits on (the waiting thread helps run queued jobs meanwhile). A token is shared by
+// all the jobs of one user visible operation (eg. stacking) and carries cancellation and
+// progress. Progress is coalesced and passed to the main (GTK) thread when one is running.
+
+#ifndef JOBS_H
+#define JOBS_H
+
+/* Priorities - lower value runs first */
+#define JOB_PRI_INTERACTIVE 0			// Eg. image decode for the viewer
+#define JOB_PRI_NORMAL 1
+#define JOB_PRI_BATCH 2				// Eg. stacking
+#define JOB_PRI_LEVELS 3
+
+typedef struct _JobToken
+{
+    volatile gint cancelled;
+    volatile gint refs;
+    volatile gint idle_pending;
+    char *desc;
+    GMutex lock;
+    double fraction;
+    char msg[100];
+} JobToken;
+
+
+typedef struct _JobGroup
+{
+    volatile gint outstanding;
+} JobGroup;
+
+
+typedef struct _Job
+{
+    int priority;
+    void (*func)(struct _Job *);
+    gpointer data;
+    JobToken *token;
+    JobGroup *group;
+    void (*done)(struct _Job *);		// Optional, called on the main thread when finished
+} Job;
+
+
+typedef void (*JobProgressFunc)(JobToken *, gpointer);
+typedef void (*JobRangeFunc)(int, int, gpointer);
+
+#endif
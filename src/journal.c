@@ -0,0 +1,860 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Pipeline journal - what each stage has done, kept in the project directory so a
+**  cancelled or crashed run picks up where it stopped and a stage run again only does the
+**  frames that changed.
+**  Darks: each calibration master is saved (FITS) with a key made from its frame files
+**  (names, sizes and times) and the master it was corrected by, so it is only built again
+**  when one of them changes.
+**  Register: the result for each light (transform and quality measures) is added to the
+**  journal file as it is found. The entries belong to a key made from the masters, the
+**  dark scaling, the bad pixel map, the registration method and the base image; a light
+**  whose file is unchanged is not registered again. Quality is assessed over all the
+**  frames as before.
+**  Stack: the accumulator (before averaging) is saved every minute or so, when the run is
+**  cancelled and when it completes, with the frames in it (file, transform and weight).
+**  It is used again if the stacking settings match and those frames are all still the
+**  same, only the others then being added - frames added to a project are just stacked
+**  on to the last result.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define JNL_HDR "StarsAl journal 2"
+#define JNL_LINE 4096
+#define JNL_CKPT_SECS 60		// Stack accumulator saved at most this often
+#define JNL_CKPT_MAGIC "SALSTK1"	// Checkpoint format (8 bytes with the terminator)
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <preferences.h>
+#include <pipeline.h>
+
+
+/* Types */
+
+typedef struct _JnlFrame
+{
+    gint64 size, mtime;			// File when registered
+    int registered;
+    Xform xf;
+    ImgQuality q;			// Measures only (assessed afresh)
+} JnlFrame;
+
+typedef struct _CkptHdr
+{
+    char magic[8];
+    char key[JNL_KEY];			// Stacking settings
+    gint32 width, height, channels;	// Accumulator
+    gint32 fw, fh, fc;			// Frames
+    gint32 wch;				// Weights per pixel
+    gint32 done;			// Frames added
+    gint64 n_cnt;			// Weights
+    gint64 list_len;			// Bytes of frame entries
+} CkptHdr;
+
+
+/* Prototypes */
+
+void journal_open(PipeRun *);
+void journal_close(PipeRun *);
+ImgFrame * journal_master(PipeRun *, GList *, int, ImgFrame *, int, GtkWidget *);
+int journal_register(PipeRun *, int, int);
+void journal_frame(PipeRun *, int);
+int journal_stack_resume(PipeRun *, StackAccum *);
+void journal_stack_save(PipeRun *, StackAccum *, int);
+static void journal_read(Journal *);
+static void journal_write(Journal *);
+static void frame_line(char *, char *, JnlFrame *);
+static int file_sig(Image *, gint64 *, gint64 *);
+static char * img_path(Image *);
+static void stack_key(PipeRun *, char *);
+static GString * stack_list(PipeRun *);
+static void frame_token(PipeRun *, int, GString *);
+static void set_key(char *, GString *);
+static char * master_fn(PipeRun *, int);
+
+extern ImgFrame * frame_new(int, int, int);
+extern void frame_free(ImgFrame *);
+extern ImgFrame * make_master(GList *, int, ImgFrame *, JobToken *, GtkWidget *);
+extern int fits_write(ImgFrame *, char *, int, FitsInfo *, GtkWidget *);
+extern ImgFrame * fits_read(char *, FitsInfo *, GtkWidget *);
+extern int64_t msec_time();
+extern void log_msg_extra(char*, char*, char*, char*, GtkWidget*);
+extern int write_all(int, unsigned char *, size_t);
+extern int read_all(int, unsigned char *, size_t);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-journal.c ";
+static const char *mst_fn[] = { "master_dark", "master_flat", "master_darkflat", "master_bias" };
+
+
+/* Load the journal for a run's project */
+
+void journal_open(PipeRun *run)
+{
+    Journal *jnl;
+    ProjectData *proj;
+
+    proj = run->proj;
+    jnl = (Journal *) malloc(sizeof(Journal));
+    memset(jnl, 0, sizeof(Journal));
+
+    jnl->fn = (char *) malloc(strlen(proj->project_path) + strlen(proj->project_name) + 14);
+    sprintf(jnl->fn, "%s/%s_journal.txt", proj->project_path, proj->project_name);
+    jnl->ckpt_fn = (char *) malloc(strlen(proj->project_path) + strlen(proj->project_name) + 13);
+    sprintf(jnl->ckpt_fn, "%s/%s_stack.ckpt", proj->project_path, proj->project_name);
+    jnl->frames = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+    g_mutex_init(&(jnl->lock));
+
+    journal_read(jnl);
+    run->jnl = jnl;
+
+    return;
+}
+
+
+/* Release the journal */
+
+void journal_close(PipeRun *run)
+{
+    Journal *jnl;
+
+    if ((jnl = run->jnl) == NULL)
+    	return;
+
+    if (jnl->fd != NULL)
+	fclose(jnl->fd);
+
+    g_hash_table_destroy(jnl->frames);
+    g_mutex_clear(&(jnl->lock));
+    free(jnl->fn);
+    free(jnl->ckpt_fn);
+    free(jnl);
+    run->jnl = NULL;
+
+    return;
+}
+
+
+/* A calibration master - the saved one if its frames (and the master 'sub_kind' it is
+   corrected by, if any) are unchanged, otherwise built and saved */
+
+ImgFrame * journal_master(PipeRun *run, GList *gl, int kind, ImgFrame *sub, int sub_kind, GtkWidget *window)
+{
+    char *fn, *path;
+    char key[JNL_KEY];
+    gint64 size, mtime;
+    GList *l;
+    GString *s;
+    ImgFrame *mst;
+    Journal *jnl;
+
+    if ((jnl = run->jnl) == NULL)
+	return make_master(gl, kind, sub, run->token, window);
+
+    s = g_string_new(NULL);
+    g_string_append_printf(s, "master %d\n", kind);
+
+    for(l = gl; l != NULL; l = l->next)
+    {
+	path = img_path((Image *) l->data);
+
+	if (! file_sig((Image *) l->data, &size, &mtime))
+	    size = mtime = -1;
+
+	g_string_append_printf(s, "%s %" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n", path, size, mtime);
+	free(path);
+    }
+
+    if (sub_kind >= 0)
+	g_string_append_printf(s, "sub %s\n", jnl->run_key[sub_kind]);
+
+    set_key(key, s);
+    g_string_free(s, TRUE);
+    fn = master_fn(run, kind);
+    mst = NULL;
+
+    if (strcmp(key, jnl->mst_key[kind]) == 0 && access(fn, R_OK) == 0)
+	mst = fits_read(fn, NULL, NULL);
+
+    if (mst == NULL)
+    {
+	if ((mst = make_master(gl, kind, sub, run->token, window)) == NULL)
+	{
+	    free(fn);
+	    return NULL;
+	}
+
+	/* Not saved - it will just be built again */
+	g_mutex_lock(&(jnl->lock));
+
+	if (fits_write(mst, fn, FITS_FLOAT32, NULL, NULL))
+	    strcpy(jnl->mst_key[kind], key);
+	else
+	    jnl->mst_key[kind][0] = '\0';
+
+	journal_write(jnl);
+	g_mutex_unlock(&(jnl->lock));
+    }
+
+    strcpy(jnl->run_key[kind], key);
+    free(fn);
+
+    return mst;
+}
+
+
+/* Start registration - the lights whose results are in the journal for the same masters,
+   settings and base image (and which are unchanged) are restored and marked done. The
+   base is done again if anything is left so its stars are to hand. Returns the number
+   restored */
+
+int journal_register(PipeRun *run, int base, int translate)
+{
+    int i, n, pending;
+    char key[JNL_KEY], *path;
+    gint64 size, mtime;
+    gchar *bp;
+    GString *s;
+    FrameInfo *fi;
+    JnlFrame *jf;
+    Journal *jnl;
+
+    for(i = 0; i < run->n_frames; i++)
+    	run->frames[i].restored = FALSE;
+
+    if ((jnl = run->jnl) == NULL)
+    	return 0;
+
+    /* What the results depend on */
+    s = g_string_new("register\n");
+
+    for(i = 0; i < 4; i++)
+	g_string_append_printf(s, "%s\n", jnl->run_key[i]);
+
+    g_string_append_printf(s, "%d %d\n", (run->cal.dark != NULL && run->cal.scale), translate);
+
+    if (run->cal.badpix != NULL && run->cal.badpix->n > 0)
+    {
+	bp = g_compute_checksum_for_data(G_CHECKSUM_SHA1, (guchar *) run->cal.badpix->off,
+					 (gsize) run->cal.badpix->n * sizeof(guint32));
+	g_string_append_printf(s, "%d %s\n", run->cal.badpix->n, bp);
+	g_free(bp);
+    }
+
+    path = img_path(run->frames[base].img);
+
+    if (! file_sig(run->frames[base].img, &size, &mtime))
+	size = mtime = -1;
+
+    g_string_append_printf(s, "%s %" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n", path, size, mtime);
+    free(path);
+    set_key(key, s);
+    g_string_free(s, TRUE);
+    g_mutex_lock(&(jnl->lock));
+
+    /* A new registration - the old entries no longer apply */
+    if (strcmp(key, jnl->reg_key) != 0)
+    {
+	strcpy(jnl->reg_key, key);
+	g_hash_table_remove_all(jnl->frames);
+	journal_write(jnl);
+	g_mutex_unlock(&(jnl->lock));
+
+    	return 0;
+    }
+
+    n = 0;
+    pending = 0;
+
+    for(i = 0; i < run->n_frames; i++)
+    {
+	fi = &(run->frames[i]);
+	path = img_path(fi->img);
+	jf = (JnlFrame *) g_hash_table_lookup(jnl->frames, path);
+	free(path);
+
+	if (jf == NULL || ! file_sig(fi->img, &size, &mtime) || size != jf->size || mtime != jf->mtime)
+	{
+	    pending++;
+	    continue;
+	}
+
+	free(fi->stars);
+	fi->stars = NULL;
+	fi->n_stars = jf->q.n_stars;
+	fi->registered = jf->registered;
+	fi->xf = jf->xf;
+	fi->img->quality = jf->q;
+	fi->restored = TRUE;
+	n++;
+    }
+
+    g_mutex_unlock(&(jnl->lock));
+
+    if (pending > 0 && run->frames[base].restored)
+    {
+	run->frames[base].restored = FALSE;
+	n--;
+    }
+
+    return n;
+}
+
+
+/* Add a light's registration result */
+
+void journal_frame(PipeRun *run, int i)
+{
+    char *path, *line;
+    FrameInfo *fi;
+    JnlFrame *jf;
+    Journal *jnl;
+
+    if ((jnl = run->jnl) == NULL)
+    	return;
+
+    fi = &(run->frames[i]);
+    jf = (JnlFrame *) malloc(sizeof(JnlFrame));
+    memset(jf, 0, sizeof(JnlFrame));
+
+    if (! file_sig(fi->img, &(jf->size), &(jf->mtime)))
+    {
+	free(jf);
+    	return;
+    }
+
+    jf->registered = fi->registered;
+    jf->xf = fi->xf;
+    jf->q = fi->img->quality;
+    jf->q.score = 0.0f;
+    jf->q.rejected = FALSE;
+    path = img_path(fi->img);
+    line = (char *) malloc(strlen(path) + 400);
+    frame_line(line, path, jf);
+
+    g_mutex_lock(&(jnl->lock));
+    g_hash_table_replace(jnl->frames, path, jf);
+
+    if (jnl->fd == NULL)
+	jnl->fd = fopen(jnl->fn, "a");
+
+    /* Each result is out of the process as soon as it is known */
+    if (jnl->fd != NULL)
+    {
+	fputs(line, jnl->fd);
+	fflush(jnl->fd);
+    }
+
+    g_mutex_unlock(&(jnl->lock));
+    free(line);
+
+    return;
+}
+
+
+/* Pick up a saved stack accumulator if it is for the same settings and all its frames are
+   still the same and registered (they are marked stacked) */
+
+int journal_stack_resume(PipeRun *run, StackAccum *acc)
+{
+    int fd, i, ok, len;
+    char key[JNL_KEY], *list, *p, *q;
+    struct stat sb;
+    char extra[256];
+    CkptHdr hdr;
+    GHashTable *tokens;
+    GString *s;
+
+    for(i = 0; i < run->n_frames; i++)
+    	run->frames[i].stacked = FALSE;
+
+    memset(acc, 0, sizeof(StackAccum));
+
+    if (run->jnl == NULL)
+    	return FALSE;
+
+    run->jnl->ckpt_time = msec_time();
+
+    if ((fd = open(run->jnl->ckpt_fn, O_RDONLY)) < 0)
+    	return FALSE;
+
+    stack_key(run, key);
+    list = NULL;
+    ok = (fstat(fd, &sb) == 0 && read_all(fd, (unsigned char *) &hdr, sizeof(CkptHdr)) &&
+	  memcmp(hdr.magic, JNL_CKPT_MAGIC, sizeof(hdr.magic)) == 0 && strcmp(hdr.key, key) == 0 &&
+	  hdr.width > 0 && hdr.height > 0 && hdr.channels > 0 && hdr.done > 0 && hdr.list_len > 0 &&
+	  hdr.n_cnt > 0 && (gint64) sizeof(CkptHdr) + hdr.list_len + (gint64) hdr.width * hdr.height *
+	  hdr.channels * sizeof(float) + hdr.n_cnt * (gint64) sizeof(float) == sb.st_size);
+
+    /* Every frame in it must match one now registered */
+    if (ok)
+    {
+	list = (char *) malloc(hdr.list_len + 1);
+	ok = read_all(fd, (unsigned char *) list, hdr.list_len);
+	list[hdr.list_len] = '\0';
+    }
+
+    if (ok)
+    {
+	tokens = g_hash_table_new(g_str_hash, g_str_equal);
+	s = g_string_new(NULL);
+
+	for(i = 0; i < run->n_frames; i++)
+	{
+	    if (! run->frames[i].registered)
+		continue;
+
+	    g_string_truncate(s, 0);
+	    frame_token(run, i, s);
+	    g_hash_table_insert(tokens, g_strdup(s->str), GINT_TO_POINTER(i + 1));
+	}
+
+	len = 0;
+
+	for(p = list; ok && *p != '\0'; p = q + 1)
+	{
+	    if ((q = strchr(p, '\n')) == NULL)
+		break;
+
+	    *q = '\0';
+
+	    if ((i = GPOINTER_TO_INT(g_hash_table_lookup(tokens, p))) == 0)
+		ok = FALSE;
+	    else
+		run->frames[i - 1].stacked = TRUE;
+
+	    len++;
+	}
+
+	ok = (ok && len == hdr.done);
+	g_hash_table_foreach(tokens, (GHFunc) g_free, NULL);
+	g_hash_table_destroy(tokens);
+	g_string_free(s, TRUE);
+    }
+
+    if (ok)
+    {
+	acc->sum = frame_new(hdr.width, hdr.height, hdr.channels);
+	acc->cnt = (float *) malloc(hdr.n_cnt * sizeof(float));
+	ok = (acc->sum != NULL && acc->cnt != NULL &&
+	      read_all(fd, (unsigned char *) acc->sum->data, (size_t) hdr.width * hdr.height * hdr.channels * sizeof(float)) &&
+	      read_all(fd, (unsigned char *) acc->cnt, hdr.n_cnt * sizeof(float)));
+    }
+
+    close(fd);
+    free(list);
+
+    if (! ok)
+    {
+	for(i = 0; i < run->n_frames; i++)
+	    run->frames[i].stacked = FALSE;
+
+	frame_free(acc->sum);
+	free(acc->cnt);
+	memset(acc, 0, sizeof(StackAccum));
+
+    	return FALSE;
+    }
+
+    acc->fw = hdr.fw;
+    acc->fh = hdr.fh;
+    acc->fc = hdr.fc;
+    acc->wch = hdr.wch;
+    acc->done = hdr.done;
+    acc->saved = hdr.done;
+    acc->n_cnt = hdr.n_cnt;
+
+    sprintf(extra, "%d frames stacked", acc->done);
+    log_msg_extra("APP0026", run->proj->project_name, extra, NULL, NULL);
+
+    return TRUE;
+}
+
+
+/* Save the stack accumulator with the frames in it (those marked stacked) - if a minute
+   has passed since the last, or 'force' */
+
+void journal_stack_save(PipeRun *run, StackAccum *acc, int force)
+{
+    int fd, ok;
+    char *tmp;
+    CkptHdr hdr;
+    char extra[256];
+    GString *list;
+
+    if (run->jnl == NULL || acc->sum == NULL || acc->done == acc->saved)
+    	return;
+
+    if (! force && msec_time() - run->jnl->ckpt_time < JNL_CKPT_SECS * 1000)
+    	return;
+
+    list = stack_list(run);
+    memset(&hdr, 0, sizeof(CkptHdr));
+    memcpy(hdr.magic, JNL_CKPT_MAGIC, sizeof(hdr.magic));
+    stack_key(run, hdr.key);
+    hdr.width = acc->sum->width;
+    hdr.height = acc->sum->height;
+    hdr.channels = acc->sum->channels;
+    hdr.fw = acc->fw;
+    hdr.fh = acc->fh;
+    hdr.fc = acc->fc;
+    hdr.wch = acc->wch;
+    hdr.done = acc->done;
+    hdr.n_cnt = acc->n_cnt;
+    hdr.list_len = list->len;
+
+    /* Written aside and renamed so the last one stands until this is complete */
+    tmp = (char *) malloc(strlen(run->jnl->ckpt_fn) + 5);
+    sprintf(tmp, "%s.tmp", run->jnl->ckpt_fn);
+
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0664)) < 0)
+    {
+	ok = FALSE;
+    }
+    else
+    {
+	ok = (write_all(fd, (unsigned char *) &hdr, sizeof(CkptHdr)) &&
+	      write_all(fd, (unsigned char *) list->str, list->len) &&
+	      write_all(fd, (unsigned char *) acc->sum->data,
+			(size_t) hdr.width * hdr.height * hdr.channels * sizeof(float)) &&
+	      write_all(fd, (unsigned char *) acc->cnt, hdr.n_cnt * sizeof(float)));
+
+	if (close(fd) != 0)
+	    ok = FALSE;
+
+	if (ok)
+	    ok = (rename(tmp, run->jnl->ckpt_fn) == 0);
+    }
+
+    if (! ok)
+    {
+	sprintf(extra, "Error: (%d) %s", errno, strerror(errno));
+	log_msg_extra("SYS9012", run->jnl->ckpt_fn, extra, "SYS9012", NULL);
+	unlink(tmp);
+    }
+    else
+    {
+	acc->saved = acc->done;
+    }
+
+    free(tmp);
+    g_string_free(list, TRUE);
+    run->jnl->ckpt_time = msec_time();
+
+    return;
+}
+
+
+/* Read the journal file (anything not understood is ignored) */
+
+static void journal_read(Journal *jnl)
+{
+    int kind, n;
+    char *line, *p;
+    char key[JNL_KEY];
+    FILE *fd;
+    JnlFrame *jf;
+    ImgQuality *q;
+    Xform *xf;
+
+    if ((fd = fopen(jnl->fn, "r")) == NULL)
+    	return;
+
+    line = (char *) malloc(JNL_LINE);
+
+    if (fgets(line, JNL_LINE, fd) == NULL || strncmp(line, JNL_HDR, strlen(JNL_HDR)) != 0)
+    {
+	fclose(fd);
+	free(line);
+    	return;
+    }
+
+    while(fgets(line, JNL_LINE, fd) != NULL)
+    {
+	if ((p = strchr(line, '\n')) == NULL)
+	    continue;
+
+	*p = '\0';
+
+	switch(line[0])
+	{
+	    case 'M':
+		if (sscanf(line, "M %d %40s", &kind, key) == 2 && kind >= 0 && kind < 4)
+		    strcpy(jnl->mst_key[kind], key);
+
+		break;
+
+	    case 'R':
+		if (sscanf(line, "R %40s", key) == 1)
+		{
+		    strcpy(jnl->reg_key, key);
+		    g_hash_table_remove_all(jnl->frames);
+		}
+
+		break;
+
+	    case 'F':
+		jf = (JnlFrame *) malloc(sizeof(JnlFrame));
+		memset(jf, 0, sizeof(JnlFrame));
+		xf = &(jf->xf);
+		q = &(jf->q);
+		n = 0;
+
+		if (sscanf(line, "F %" G_GINT64_FORMAT " %" G_GINT64_FORMAT " %d %lf %lf %lf %lf %lf %lf %d %d %f %f %f %f %n",
+			   &(jf->size), &(jf->mtime), &(jf->registered), &(xf->a), &(xf->b), &(xf->c),
+			   &(xf->d), &(xf->e), &(xf->f), &(q->measured), &(q->n_stars), &(q->fwhm), &(q->ecc),
+			   &(q->bg), &(q->noise), &n) >= 15 && n > 0 && line[n] != '\0')
+		    g_hash_table_replace(jnl->frames, strdup(line + n), jf);
+		else
+		    free(jf);
+
+		break;
+
+	    default:
+		break;
+	}
+    }
+
+    fclose(fd);
+    free(line);
+
+    return;
+}
+
+
+/* Write the journal afresh (the lock is held) */
+
+static void journal_write(Journal *jnl)
+{
+    int i;
+    char *line;
+    FILE *fd;
+    char extra[256];
+    GHashTableIter iter;
+    gpointer path, jf;
+
+    if (jnl->fd != NULL)
+    {
+	fclose(jnl->fd);
+	jnl->fd = NULL;
+    }
+
+    if ((fd = fopen(jnl->fn, "w")) == NULL)
+    {
+	sprintf(extra, "Error: (%d) %s", errno, strerror(errno));
+	log_msg_extra("SYS9012", jnl->fn, extra, "SYS9012", NULL);
+    	return;
+    }
+
+    fprintf(fd, "%s\n", JNL_HDR);
+
+    for(i = 0; i < 4; i++)
+    	if (jnl->mst_key[i][0] != '\0')
+	    fprintf(fd, "M %d %s\n", i, jnl->mst_key[i]);
+
+    if (jnl->reg_key[0] != '\0')
+	fprintf(fd, "R %s\n", jnl->reg_key);
+
+    g_hash_table_iter_init(&iter, jnl->frames);
+
+    while(g_hash_table_iter_next(&iter, &path, &jf))
+    {
+	line = (char *) malloc(strlen((char *) path) + 400);
+	frame_line(line, (char *) path, (JnlFrame *) jf);
+	fputs(line, fd);
+	free(line);
+    }
+
+    fclose(fd);
+
+    return;
+}
+
+
+/* Journal line for a light (transform exact) */
+
+static void frame_line(char *line, char *path, JnlFrame *jf)
+{
+    sprintf(line, "F %" G_GINT64_FORMAT " %" G_GINT64_FORMAT " %d %.17g %.17g %.17g %.17g %.17g %.17g %d %d %.9g %.9g %.9g %.9g %s\n",
+		  jf->size, jf->mtime, jf->registered, jf->xf.a, jf->xf.b, jf->xf.c, jf->xf.d, jf->xf.e, jf->xf.f,
+		  jf->q.measured, jf->q.n_stars, jf->q.fwhm, jf->q.ecc, jf->q.bg, jf->q.noise, path);
+
+    return;
+}
+
+
+/* Size and modification time of an image file */
+
+static int file_sig(Image *img, gint64 *size, gint64 *mtime)
+{
+    int ok;
+    char *path;
+    struct stat sb;
+
+    /* A video's frames share its file */
+    path = (char *) malloc(strlen(img->path) + strlen(img->nm) + 2);
+    sprintf(path, "%s/%s", img->path, img->nm);
+    ok = (stat(path, &sb) == 0);
+    free(path);
+
+    if (! ok)
+    	return FALSE;
+
+    *size = sb.st_size;
+    *mtime = sb.st_mtime;
+
+    return TRUE;
+}
+
+
+/* Full path of an image (to be freed) - with '#n' for frame n of a video */
+
+static char * img_path(Image *img)
+{
+    char *path;
+
+    path = (char *) malloc(strlen(img->path) + strlen(img->nm) + 14);
+
+    if (img->vframe > 0)
+	sprintf(path, "%s/%s#%d", img->path, img->nm, img->vframe);
+    else
+	sprintf(path, "%s/%s", img->path, img->nm);
+
+    return path;
+}
+
+
+/* Key for the stacking settings (with the registration they follow) */
+
+static void stack_key(PipeRun *run, char *key)
+{
+    GString *s;
+
+    s = g_string_new("stack\n");
+    g_string_append_printf(s, "%s\n%d %d %.17g %.17g %d\n", run->jnl->reg_key, run->interp, run->weighted,
+			   run->driz_scale, run->driz_drop, run->cfa);
+    set_key(key, s);
+    g_string_free(s, TRUE);
+
+    return;
+}
+
+
+/* Entries for the frames in the accumulator, one a line */
+
+static GString * stack_list(PipeRun *run)
+{
+    int i;
+    GString *s;
+
+    s = g_string_new(NULL);
+
+    for(i = 0; i < run->n_frames; i++)
+    {
+	if (! run->frames[i].stacked)
+	    continue;
+
+	frame_token(run, i, s);
+	g_string_append_c(s, '\n');
+    }
+
+    return s;
+}
+
+
+/* What a frame's contribution to the stack depends on - file, transform and weight */
+
+static void frame_token(PipeRun *run, int i, GString *s)
+{
+    char *path;
+    float w;
+    gint64 size, mtime;
+    FrameInfo *fi;
+
+    fi = &(run->frames[i]);
+    w = 1.0f;
+
+    if (run->weighted && fi->img->quality.score > 0.0f)
+	w = fi->img->quality.score;
+
+    if (! file_sig(fi->img, &size, &mtime))
+	size = mtime = -1;
+
+    path = img_path(fi->img);
+    g_string_append_printf(s, "%" G_GINT64_FORMAT " %" G_GINT64_FORMAT " %.17g %.17g %.17g %.17g %.17g %.17g %.9g %s",
+			   size, mtime, fi->xf.a, fi->xf.b, fi->xf.c, fi->xf.d, fi->xf.e, fi->xf.f, w, path);
+    free(path);
+
+    return;
+}
+
+
+/* Hex digest of a string as a key */
+
+static void set_key(char *key, GString *s)
+{
+    gchar *sum;
+
+    sum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, s->str, s->len);
+    g_strlcpy(key, sum, JNL_KEY);
+    g_free(sum);
+
+    return;
+}
+
+
+/* Saved master file (to be freed) */
+
+static char * master_fn(PipeRun *run, int kind)
+{
+    char *fn;
+    ProjectData *proj;
+
+    proj = run->proj;
+    fn = (char *) malloc(strlen(proj->project_path) + strlen(proj->project_name) + strlen(mst_fn[kind]) + 8);
+    sprintf(fn, "%s/%s_%s.fits", proj->project_path, proj->project_name, mst_fn[kind]);
+
+    return fn;
+}
@@ -34,6 +34,7 @@
 /* Includes */
 
 #include <project.h>
+#include <pipeline.h>
 
 
 /* Defines */
@@ -88,6 +89,9 @@ typedef struct _main_ui
 
     /* Other */
     ProjectData *proj;
+    PipeRun *pipe;				// Processing state carried between stages
+    int pipe_busy;
+    JobGroup pipe_grp;
     char *curr_img_base, *curr_dark_base;
     int img_drag_blocked, mouse_drag_mode; 
     guint pulse_status;
@@ -101,6 +105,14 @@ enum ImageCol
        IMAGE_TYPE,
        IMAGE_NM,
        IMG_TOOL_TIP,
+       IMG_IDX,
+       IMG_STARS,
+       IMG_FWHM,
+       IMG_ECC,
+       IMG_BG,
+       IMG_NOISE,
+       IMG_SCORE,
+       IMG_REJECT,
        IMG_N_COLUMNS
     };
 
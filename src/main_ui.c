@@ -35,6 +35,7 @@
 #define MAIN_UI
 #define TOGGLE_COL 1
 #define TEXT_COL 2
+#define NUM_COL 3
 
 
 /* Includes */
@@ -47,6 +48,7 @@
 #include <project.h>
 #include <defs.h>
 #include <preferences.h>
+#include <jobs.h>
 
 
 /* Types */
@@ -76,10 +78,16 @@ void help_tips_txt(MainUi *);
 void image_list(MainUi *);
 void display_proj(ProjectData *, MainUi *);
 void set_process_btns(ProjectData *, MainUi *);
+int proj_has_calib(ProjectData *);
 void set_image_list(ProjectData *, MainUi *);
 void new_image_col(int, char *, enum ImageCol, MainUi *);
 void col_set_attrs (GtkTreeViewColumn *, GtkCellRenderer *, GtkTreeModel *, GtkTreeIter *, gpointer);
+void num_set_attrs (GtkTreeViewColumn *, GtkCellRenderer *, GtkTreeModel *, GtkTreeIter *, gpointer);
+void set_quality_cols(GtkListStore *, GtkTreeIter *, Image *);
+void img_tip(Image *, char *, size_t);
+void update_image_quality(MainUi *);
 void process_panel(MainUi *);
+void job_progress_ui(JobToken *, gpointer);
 
 extern void OnNewProj(GtkWidget*, gpointer);
 extern void OnOpenProj(GtkWidget*, gpointer);
@@ -122,6 +130,8 @@ extern void log_msg(char*, char*, char*, GtkWidget*);
 extern void app_msg(char*, char *, GtkWidget *);
 extern int get_user_pref(char *, char **);
 */
+extern void job_set_progress_fn(JobProgressFunc, gpointer);
+extern int job_cancelled(JobToken *);
 
 
 
@@ -174,6 +184,9 @@ void main_ui(MainUi *m_ui)
     gtk_widget_set_visible (m_ui->img_meta_vbox, FALSE);
     gtk_widget_set_visible (m_ui->process_vbox, FALSE);
 
+    /* Background job progress is shown on the progress bar and information area */
+    job_set_progress_fn(job_progress_ui, m_ui);
+
     return;
 }
 
@@ -617,6 +630,7 @@ void set_image_list(ProjectData *proj, MainUi *m_ui)
 {  
     int i;
     char *s;
+    char tip[512];
     GList *l;
     Image *img;
     gboolean base;
@@ -627,7 +641,9 @@ void set_image_list(ProjectData *proj, MainUi *m_ui)
     if (GTK_IS_WIDGET (m_ui->image_list_tree))
     	gtk_widget_destroy(m_ui->image_list_tree);
 
-    store = gtk_list_store_new (IMG_N_COLUMNS, G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
+    store = gtk_list_store_new (IMG_N_COLUMNS, G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING,
+				G_TYPE_INT, G_TYPE_INT, G_TYPE_FLOAT, G_TYPE_FLOAT, G_TYPE_FLOAT,
+				G_TYPE_FLOAT, G_TYPE_FLOAT, G_TYPE_BOOLEAN);
 
     /* Iterate through the images and add the store */
     i = 0;
@@ -637,6 +653,7 @@ void set_image_list(ProjectData *proj, MainUi *m_ui)
     	img = (Image *) l->data;
     	s = (char *) malloc(strlen(img->nm) + strlen(img->path) + 2);
     	sprintf(s, "%s/%s", img->path, img->nm);
+    	img_tip(img, tip, sizeof(tip));
 
     	/* Check for the base or reference image */
     	if (i == proj->baseimg)
@@ -650,8 +667,10 @@ void set_image_list(ProjectData *proj, MainUi *m_ui)
 			    BASE_IMG, base,
 			    IMAGE_TYPE, "I",
 			    IMAGE_NM, s,
-			    IMG_TOOL_TIP, img->nm,
+			    IMG_TOOL_TIP, tip,
+			    IMG_IDX, i,
 			    -1);
+	set_quality_cols(store, &iter, img);
 	i++;
 	free(s);
     }
@@ -669,6 +688,7 @@ void set_image_list(ProjectData *proj, MainUi *m_ui)
     	img = (Image *) l->data;
     	s = (char *) malloc(strlen(img->nm) + strlen(img->path) + 2);
     	sprintf(s, "%s/%s", img->path, img->nm);
+    	img_tip(img, tip, sizeof(tip));
 
     	/* Check for the base or reference dark */
     	if (i == proj->basedark)
@@ -682,8 +702,10 @@ void set_image_list(ProjectData *proj, MainUi *m_ui)
 			    BASE_IMG, base,
 			    IMAGE_TYPE, "D",
 			    IMAGE_NM, s,
-			    IMG_TOOL_TIP, img->nm,
+			    IMG_TOOL_TIP, tip,
+			    IMG_IDX, i,
 			    -1);
+	set_quality_cols(store, &iter, NULL);
 	i++;
 	free(s);
     }
@@ -704,6 +726,12 @@ void set_image_list(ProjectData *proj, MainUi *m_ui)
     new_image_col(TOGGLE_COL, "Base", BASE_IMG, m_ui);
     new_image_col(TEXT_COL, "Type", IMAGE_TYPE, m_ui);
     new_image_col(TEXT_COL, "Image", IMAGE_NM, m_ui);
+    new_image_col(NUM_COL, "Stars", IMG_STARS, m_ui);
+    new_image_col(NUM_COL, "FWHM", IMG_FWHM, m_ui);
+    new_image_col(NUM_COL, "Ecc", IMG_ECC, m_ui);
+    new_image_col(NUM_COL, "Sky", IMG_BG, m_ui);
+    new_image_col(NUM_COL, "Noise", IMG_NOISE, m_ui);
+    new_image_col(NUM_COL, "Score", IMG_SCORE, m_ui);
 
     /* Add to the window container */
     gtk_container_add (GTK_CONTAINER (m_ui->lst_scroll_win), m_ui->image_list_tree);
@@ -750,6 +778,19 @@ void new_image_col(int col_type, char *col_title, enum ImageCol image_col, MainU
 	    if (strcmp(col_title, "Type") == 0)
 		g_object_set (G_OBJECT (renderer), "xpad", 10, NULL);
 
+	    gtk_tree_view_column_set_sort_column_id (column, image_col);
+            break;
+
+    	case NUM_COL:
+	    renderer = gtk_cell_renderer_text_new ();
+	    column = gtk_tree_view_column_new_with_attributes (col_title, renderer, NULL);
+
+	    gtk_tree_view_append_column (GTK_TREE_VIEW (m_ui->image_list_tree), column);
+	    gtk_cell_renderer_set_sensitive (GTK_CELL_RENDERER (renderer), TRUE);
+	    g_object_set (G_OBJECT (renderer), "foreground-rgba", &DARK_BLUE,
+					       "font", "Sans 10", "xalign", 1.0, "xpad", 6, NULL);
+	    gtk_tree_view_column_set_cell_data_func(column, renderer, num_set_attrs, GINT_TO_POINTER (image_col), NULL);
+	    gtk_tree_view_column_set_sort_column_id (column, image_col);
             break;
 
     	default:
@@ -772,8 +813,9 @@ void col_set_attrs (GtkTreeViewColumn *tree_column,
 		    gpointer data)
 {
     gchar *img_type;
+    gboolean rejected;
 
-    gtk_tree_model_get (model, iter, IMAGE_TYPE, &img_type, -1);
+    gtk_tree_model_get (model, iter, IMAGE_TYPE, &img_type, IMG_REJECT, &rejected, -1);
 
     /* Highlight Darks with a darker background */
     if (strcmp(img_type, "I") == 0)
@@ -781,12 +823,136 @@ void col_set_attrs (GtkTreeViewColumn *tree_column,
     else
 	g_object_set (G_OBJECT (cell), "cell-background-rgba", &LIGHT_GRAY, NULL);
 
+    /* Strike out images rejected for poor quality */
+    if (GTK_IS_CELL_RENDERER_TEXT (cell))
+	g_object_set (G_OBJECT (cell), "strikethrough", rejected, NULL);
+
     g_free(img_type);
 
     return; 
 }
 
 
+/* Format the quality figures (blank if not measured) */
+
+void num_set_attrs (GtkTreeViewColumn *tree_column,
+		    GtkCellRenderer *cell,
+		    GtkTreeModel *model,
+		    GtkTreeIter *iter,
+		    gpointer data)
+{
+    int col, n;
+    float f;
+    char s[20];
+
+    col_set_attrs (tree_column, cell, model, iter, NULL);
+    col = GPOINTER_TO_INT (data);
+    s[0] = '\0';
+
+    if (col == IMG_STARS)
+    {
+	gtk_tree_model_get (model, iter, col, &n, -1);
+
+	if (n >= 0)
+	    sprintf(s, "%d", n);
+    }
+    else
+    {
+	gtk_tree_model_get (model, iter, col, &f, -1);
+
+	if (f >= 0.0f)
+	{
+	    if (col == IMG_BG)
+		sprintf(s, "%.0f", f);
+	    else if (col == IMG_NOISE)
+		sprintf(s, "%.1f", f);
+	    else
+		sprintf(s, "%.2f", f);
+	}
+    }
+
+    g_object_set (G_OBJECT (cell), "text", s, NULL);
+
+    return; 
+}
+
+
+/* List row tool tip - the name, with the date taken and session if known and any video frames */
+
+void img_tip(Image *img, char *tip, size_t sz)
+{
+    int n;
+
+    n = snprintf(tip, sz, "%s", img->nm);
+
+    if (img->taken != 0 && n < (int) sz)
+	n += snprintf(tip + n, sz - n, "\n%s  (session %d)", img->img_exif.date, img->session + 1);
+
+    if (img->vframes > 0 && n < (int) sz)
+	snprintf(tip + n, sz - n, "\n%d video frames", img->vframes);
+
+    return;
+}
+
+
+/* Set the quality columns of a list row (not measured if no image) */
+
+void set_quality_cols(GtkListStore *store, GtkTreeIter *iter, Image *img)
+{
+    ImgQuality *q;
+
+    if (img == NULL || ! img->quality.measured)
+    {
+	gtk_list_store_set (store, iter,
+			    IMG_STARS, -1, IMG_FWHM, -1.0f, IMG_ECC, -1.0f, IMG_BG, -1.0f,
+			    IMG_NOISE, -1.0f, IMG_SCORE, -1.0f, IMG_REJECT, FALSE,
+			    -1);
+	return;
+    }
+
+    q = &(img->quality);
+    gtk_list_store_set (store, iter,
+			IMG_STARS, q->n_stars, IMG_FWHM, q->fwhm, IMG_ECC, q->ecc, IMG_BG, q->bg,
+			IMG_NOISE, q->noise, IMG_SCORE, q->score, IMG_REJECT, q->rejected,
+			-1);
+
+    return;
+}
+
+
+/* Refresh the image quality columns after registration */
+
+void update_image_quality(MainUi *m_ui)
+{
+    int idx;
+    gboolean set;
+    gchar *img_type;
+    Image *img;
+    GtkTreeIter iter;
+
+    if (! GTK_IS_WIDGET (m_ui->image_list_tree))
+    	return;
+
+    set = gtk_tree_model_get_iter_first (m_ui->model, &iter);
+
+    while(set)
+    {
+	gtk_tree_model_get (m_ui->model, &iter, IMAGE_TYPE, &img_type, IMG_IDX, &idx, -1);
+
+	if (strcmp(img_type, "I") == 0)
+	{
+	    img = (Image *) g_list_nth_data (m_ui->proj->images_gl, idx);
+	    set_quality_cols(GTK_LIST_STORE (m_ui->model), &iter, img);
+	}
+
+	g_free(img_type);
+	set = gtk_tree_model_iter_next (m_ui->model, &iter);
+    }
+
+    return;
+}
+
+
 /* Create the processing control panel buttons */
 
 void process_panel(MainUi *m_ui)
@@ -821,8 +987,8 @@ void process_panel(MainUi *m_ui)
 
 void set_process_btns(ProjectData *proj, MainUi *m_ui)
 {  
-    /* Disable and colour code the Darks button if not present */
-    if (! proj->darks_gl)
+    /* Disable and colour code the Darks button if there are no calibration frames */
+    if (! proj_has_calib(proj))
     {
     	if (proj->status == 0)
     	    proj->status = 1;
@@ -850,11 +1016,51 @@ void set_process_btns(ProjectData *proj, MainUi *m_ui)
 	    break;
     }
 
-    if (! proj->darks_gl)
-    {
-    	gtk_widget_set_sensitive(m_ui->darks_btn, FALSE);
+    gtk_widget_set_sensitive(m_ui->darks_btn, proj_has_calib(proj) && ! m_ui->pipe_busy);
+
+    if (! proj_has_calib(proj))
     	gtk_widget_set_name(m_ui->darks_btnbx, "btnbx_4");
-    }
 
     return; 
 }
+
+
+/* The project has frames for the calibration stage - darks, flats, dark flats or bias */
+
+int proj_has_calib(ProjectData *proj)
+{
+    return (proj->darks_gl != NULL || proj->flats_gl != NULL ||
+    	    proj->darkflats_gl != NULL || proj->bias_gl != NULL);
+}
+
+
+/* Show progress of a background job (called on the main thread) */
+
+void job_progress_ui(JobToken *token, gpointer user_data)
+{
+    MainUi *m_ui;
+    double fraction;
+    char msg[100];
+
+    m_ui = (MainUi *) user_data;
+
+    g_mutex_lock(&(token->lock));
+    fraction = token->fraction;
+    strcpy(msg, token->msg);
+    g_mutex_unlock(&(token->lock));
+
+    if (fraction >= 1.0 || job_cancelled(token))
+    {
+	gtk_widget_set_visible (m_ui->img_progress_bar, FALSE);
+    }
+    else
+    {
+	gtk_widget_set_visible (m_ui->img_progress_bar, TRUE);
+	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR (m_ui->img_progress_bar), CLAMP(fraction, 0.0, 1.0));
+    }
+
+    if (msg[0] != '\0')
+	gtk_label_set_text(GTK_LABEL (m_ui->status_info), msg);
+
+    return;
+}
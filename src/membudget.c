@@ -0,0 +1,161 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Memory budget - a single limit (user preference, 0 is half the physical memory) on the
+**  large buffers held across the application. Whatever holds frames or images for a while
+**  (frames in flight in a stage, read ahead, the accumulators, cache buffers, the viewer
+**  image) reserves the bytes first and releases them when done. A reservation is asked
+**  for as a wanted and a minimum amount and is granted as much of the wanted amount as is
+**  free, so the caller sizes its batches to what it gets rather than the machine swapping.
+**  The minimum is always granted (even over the budget) so work proceeds one item at a time
+**  however tight the budget. Reservations never wait, so worker threads cannot deadlock.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define MEM_FLOOR_MB 256		// Smallest budget
+
+
+/* Includes */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <preferences.h>
+
+
+/* Prototypes */
+
+void mem_budget_init();
+gint64 mem_reserve(gint64, gint64);
+int mem_reserve_count(gint64, int, int);
+void mem_release(gint64);
+static gint64 phys_mem();
+
+extern int get_user_pref_int(char *, int *);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-membudget.c ";
+static GMutex mem_lock;
+static gint64 budget = 0;			// Zero until set up
+static gint64 reserved = 0;
+
+
+/* Set (or reset after a preference change) the budget - reservations held are kept */
+
+void mem_budget_init()
+{
+    int mb;
+    gint64 b;
+
+    if (! get_user_pref_int(MEM_BUDGET_MB, &mb) || mb <= 0)
+	b = phys_mem() / 2;
+    else
+	b = (gint64) mb * 1048576;
+
+    b = MAX(b, (gint64) MEM_FLOOR_MB * 1048576);
+
+    g_mutex_lock(&mem_lock);
+    budget = b;
+    g_mutex_unlock(&mem_lock);
+
+    return;
+}
+
+
+/* Reserve up to 'want' bytes, at least 'min' - returns the bytes reserved */
+
+gint64 mem_reserve(gint64 want, gint64 min)
+{
+    gint64 n;
+
+    if (budget == 0)
+	mem_budget_init();
+
+    want = MAX(want, min);
+
+    g_mutex_lock(&mem_lock);
+    n = CLAMP(budget - reserved, min, want);
+    reserved += n;
+    g_mutex_unlock(&mem_lock);
+
+    return n;
+}
+
+
+/* Reserve room for up to 'want' items of 'each' bytes, at least 'min' - returns the number
+   of items reserved */
+
+int mem_reserve_count(gint64 each, int want, int min)
+{
+    int n;
+    gint64 got;
+
+    if (each <= 0)
+    	return want;
+
+    got = mem_reserve(each * want, each * min);
+    n = (int) (got / each);
+    mem_release(got - each * n);
+
+    return n;
+}
+
+
+/* Give back a reservation */
+
+void mem_release(gint64 n)
+{
+    g_mutex_lock(&mem_lock);
+    reserved = MAX(reserved - n, 0);
+    g_mutex_unlock(&mem_lock);
+
+    return;
+}
+
+
+/* Physical memory (bytes) */
+
+static gint64 phys_mem()
+{
+    long pages, page_sz;
+
+    pages = sysconf(_SC_PHYS_PAGES);
+    page_sz = sysconf(_SC_PAGESIZE);
+
+    if (pages <= 0 || page_sz <= 0)
+    	return (gint64) 4096 * 1048576;
+
+    return (gint64) pages * page_sz;
+}
@@ -0,0 +1,426 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Phase correlation - translation only registration for sequences that drift without
+**  rotation (planetary, well tracked deep sky). A central square crop of the luminance
+**  (a power of 2 on a side, Hann windowed) is transformed once for the base image and
+**  kept. Each frame's crop is transformed, the normalised cross power spectrum with the
+**  reference (tapered so the peak is a narrow Gaussian rather than a spike) is transformed
+**  back and its peak is the shift, refined to sub-pixel by a Gaussian through the peak and
+**  its neighbours. A peak that does not stand well clear of the rest of the surface is
+**  rejected so the caller can fall back to star matching.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define PC_MAX_SIZE 512			// Largest crop side
+#define PC_MIN_SIZE 64			// Smallest crop side
+#define PC_MIN_PSR 20.0			// Least peak to surface ratio (peak over surface sigma)
+#define PC_PEAK_SIGMA 1.0		// Correlation peak width (pixels)
+#define PC_BLOCK 32			// Transpose block side (divides PC_MIN_SIZE)
+#define PC_EPS 1e-12f
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <pipeline.h>
+#include <instrument.h>
+
+
+/* Prototypes */
+
+PhaseRef * phase_ref_new(ImgFrame *);
+int phase_register(PhaseRef *, ImgFrame *, Xform *);
+void phase_ref_free(PhaseRef *);
+static int crop_spectrum(PhaseRef *, ImgFrame *, float *, float *);
+static void fft_2d(PhaseRef *, float *, float *, int);
+static void fft_1d(PhaseRef *, float *, float *, int);
+static void transpose(float *, int);
+static double peak_offset(float, float, float);
+
+extern void xform_identity(Xform *);
+extern void instr_start(InstrTimer *, int);
+extern void instr_stop(InstrTimer *, gint64, int);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-phasecorr.c ";
+
+
+/* Reference spectrum from the base image (NULL if too small) */
+
+PhaseRef * phase_ref_new(ImgFrame *frm)
+{
+    int i, k, n;
+    double w;
+    PhaseRef *ref;
+
+    for(n = PC_MAX_SIZE; n >= PC_MIN_SIZE; n /= 2)
+    	if (frm->width >= n && frm->height >= n)
+	    break;
+
+    if (n < PC_MIN_SIZE)
+    	return NULL;
+
+    ref = (PhaseRef *) malloc(sizeof(PhaseRef));
+    ref->n = n;
+    ref->x0 = (frm->width - n) / 2;
+    ref->y0 = (frm->height - n) / 2;
+    ref->re = (float *) malloc((size_t) n * n * sizeof(float));
+    ref->im = (float *) malloc((size_t) n * n * sizeof(float));
+    ref->win = (float *) malloc(n * sizeof(float));
+    ref->cs = (float *) malloc(n * sizeof(float));
+    ref->taper = (float *) malloc(n * sizeof(float));
+
+    /* Hann window and twiddle factors (cos, sin pairs) */
+    for(i = 0; i < n; i++)
+    	ref->win[i] = (float) (0.5 - 0.5 * cos(2.0 * G_PI * i / n));
+
+    for(i = 0; i < n / 2; i++)
+    {
+    	ref->cs[i * 2] = (float) cos(2.0 * G_PI * i / n);
+    	ref->cs[i * 2 + 1] = (float) sin(2.0 * G_PI * i / n);
+    }
+
+    /* Gaussian taper on the spectrum - the peak becomes a Gaussian of PC_PEAK_SIGMA pixels */
+    for(i = 0; i < n; i++)
+    {
+	k = (i <= n / 2) ? i : n - i;
+	w = 2.0 * G_PI * PC_PEAK_SIGMA * k / n;
+    	ref->taper[i] = (float) exp(-0.5 * w * w);
+    }
+
+    if (! crop_spectrum(ref, frm, ref->re, ref->im))
+    {
+    	phase_ref_free(ref);
+    	return NULL;
+    }
+
+    return ref;
+}
+
+
+/* Translation taking a frame onto the base image - FALSE if the correlation is weak */
+
+int phase_register(PhaseRef *ref, ImgFrame *frm, Xform *xf)
+{
+    int i, n, px, py, x, y;
+    size_t sz;
+    float a, b, m, pk;
+    float *re, *im;
+    double sum, sum2, sd, tx, ty;
+    InstrTimer tmr;
+
+    n = ref->n;
+    sz = (size_t) n * n;
+    re = (float *) malloc(sz * sizeof(float));
+    im = (float *) malloc(sz * sizeof(float));
+    instr_start(&tmr, INS_MATCH);
+
+    if (! crop_spectrum(ref, frm, re, im))
+    {
+    	free(re);
+    	free(im);
+	instr_stop(&tmr, 0, 1);
+    	return FALSE;
+    }
+
+    /* Normalised cross power spectrum: frame * conj(reference) / |..|, tapered */
+    for(i = 0; i < (int) sz; i++)
+    {
+    	a = re[i] * ref->re[i] + im[i] * ref->im[i];
+    	b = im[i] * ref->re[i] - re[i] * ref->im[i];
+	m = ref->taper[i % n] * ref->taper[i / n] / (sqrtf(a * a + b * b) + PC_EPS);
+	re[i] = a * m;
+	im[i] = b * m;
+    }
+
+    fft_2d(ref, re, im, TRUE);
+
+    /* Peak and how far it stands above the rest */
+    px = py = 0;
+    pk = re[0];
+    sum = sum2 = 0.0;
+
+    for(i = 0; i < (int) sz; i++)
+    {
+    	sum += re[i];
+    	sum2 += (double) re[i] * re[i];
+
+	if (re[i] > pk)
+	{
+	    pk = re[i];
+	    px = i % n;
+	    py = i / n;
+	}
+    }
+
+    sum /= sz;
+    sd = sqrt(MAX(sum2 / sz - sum * sum, 0.0));
+
+    if (sd <= 0.0 || (pk - sum) / sd < PC_MIN_PSR)
+    {
+    	free(re);
+    	free(im);
+	instr_stop(&tmr, sz * 2 * sizeof(float), 1);
+    	return FALSE;
+    }
+
+    /* Sub-pixel, then unwrap (beyond half way is a negative shift) */
+    x = px;
+    y = py;
+    tx = px + peak_offset(re[y * n + (x + n - 1) % n], pk, re[y * n + (x + 1) % n]);
+    ty = py + peak_offset(re[((y + n - 1) % n) * n + x], pk, re[((y + 1) % n) * n + x]);
+
+    if (tx > n / 2)
+    	tx -= n;
+
+    if (ty > n / 2)
+    	ty -= n;
+
+    /* The frame is the base moved by (tx, ty) */
+    xform_identity(xf);
+    xf->c = -tx;
+    xf->f = -ty;
+
+    free(re);
+    free(im);
+    instr_stop(&tmr, sz * 2 * sizeof(float), 1);
+
+    return TRUE;
+}
+
+
+/* Free the reference */
+
+void phase_ref_free(PhaseRef *ref)
+{
+    if (ref == NULL)
+    	return;
+
+    free(ref->re);
+    free(ref->im);
+    free(ref->win);
+    free(ref->cs);
+    free(ref->taper);
+    free(ref);
+
+    return;
+}
+
+
+/* Windowed, mean removed luminance crop (spikes clipped) transformed */
+
+static int crop_spectrum(PhaseRef *ref, ImgFrame *frm, float *re, float *im)
+{
+    int x, y, n;
+    double mean;
+    float v;
+    float *p;
+
+    n = ref->n;
+
+    if (frm->width < ref->x0 + n || frm->height < ref->y0 + n)
+    	return FALSE;
+
+    mean = 0.0;
+
+    for(y = 0; y < n; y++)
+    {
+	p = re + (size_t) y * n;
+
+	for(x = 0; x < n; x++)
+	{
+	    p[x] = FRAME_LUMA(frm, (size_t) (ref->y0 + y) * frm->width + ref->x0 + x);
+	    mean += p[x];
+	}
+    }
+
+    /* Single pixel spikes (hot pixels stay put and would pin the peak at no shift) */
+    for(y = 1; y < n - 1; y++)
+    {
+	p = re + (size_t) y * n;
+
+	for(x = 1; x < n - 1; x++)
+	{
+	    v = MAX(MAX(p[x - 1], p[x + 1]), MAX(p[x - n], p[x + n]));
+
+	    if (p[x] > v)
+	    {
+		mean -= p[x] - v;
+		p[x] = v;
+	    }
+	}
+    }
+
+    mean /= (double) n * n;
+
+    for(y = 0; y < n; y++)
+    {
+	p = re + (size_t) y * n;
+
+	for(x = 0; x < n; x++)
+	    p[x] = (p[x] - (float) mean) * ref->win[x] * ref->win[y];
+    }
+
+    memset(im, 0, (size_t) n * n * sizeof(float));
+    fft_2d(ref, re, im, FALSE);
+
+    return TRUE;
+}
+
+
+/* 2D transform - columns, transpose, columns again. The forward spectrum is left transposed
+   (the reference and frames alike) and the inverse puts it back. Inverse is unscaled, only
+   the peak position matters */
+
+static void fft_2d(PhaseRef *ref, float *re, float *im, int inv)
+{
+    fft_1d(ref, re, im, inv);
+    transpose(re, ref->n);
+    transpose(im, ref->n);
+    fft_1d(ref, re, im, inv);
+
+    return;
+}
+
+
+/* Square transpose in place (in blocks to stay in cache) */
+
+static void transpose(float *p, int n)
+{
+    int bx, by, x, y;
+    float t;
+
+    for(by = 0; by < n; by += PC_BLOCK)
+    	for(bx = by; bx < n; bx += PC_BLOCK)
+	    for(y = by; y < by + PC_BLOCK; y++)
+		for(x = (bx == by) ? y + 1 : bx; x < bx + PC_BLOCK; x++)
+		{
+		    t = p[(size_t) y * n + x];
+		    p[(size_t) y * n + x] = p[(size_t) x * n + y];
+		    p[(size_t) x * n + y] = t;
+		}
+
+    return;
+}
+
+
+/* In place radix 2 transform of all the columns together - whole rows are the elements so
+   the butterflies run along memory */
+
+static void fft_1d(PhaseRef *ref, float *re, float *im, int inv)
+{
+    int i, j, k, n, x, len, half, step;
+    size_t a, b;
+    float t, wr, wi, ur, ui, vr, vi;
+
+    n = ref->n;
+
+    /* Bit reversed order */
+    for(i = 1, j = 0; i < n; i++)
+    {
+	for(k = n >> 1; j & k; k >>= 1)
+	    j ^= k;
+
+	j |= k;
+
+	if (i >= j)
+	    continue;
+
+	for(x = 0; x < n; x++)
+	{
+	    a = (size_t) i * n + x;
+	    b = (size_t) j * n + x;
+	    t = re[a]; re[a] = re[b]; re[b] = t;
+	    t = im[a]; im[a] = im[b]; im[b] = t;
+	}
+    }
+
+    /* Butterflies */
+    for(len = 2; len <= n; len <<= 1)
+    {
+	half = len >> 1;
+	step = n / len;
+
+	for(i = 0; i < n; i += len)
+	{
+	    for(k = 0; k < half; k++)
+	    {
+		wr = ref->cs[k * step * 2];
+		wi = (inv) ? ref->cs[k * step * 2 + 1] : -ref->cs[k * step * 2 + 1];
+		a = (size_t) (i + k) * n;
+		b = (size_t) (i + k + half) * n;
+
+		for(x = 0; x < n; x++, a++, b++)
+		{
+		    ur = re[a];
+		    ui = im[a];
+		    vr = re[b] * wr - im[b] * wi;
+		    vi = re[b] * wi + im[b] * wr;
+		    re[a] = ur + vr;
+		    im[a] = ui + vi;
+		    re[b] = ur - vr;
+		    im[b] = ui - vi;
+		}
+	    }
+	}
+    }
+
+    return;
+}
+
+
+/* Gaussian peak offset (-0.5 to 0.5) from three samples - a parabola through their logs */
+
+static double peak_offset(float l, float c, float r)
+{
+    double d, ll, lc, lr;
+
+    if (l <= 0.0f || c <= 0.0f || r <= 0.0f)
+    	return 0.0;
+
+    ll = log(l);
+    lc = log(c);
+    lr = log(r);
+    d = ll - 2.0 * lc + lr;
+
+    if (d >= 0.0)
+    	return 0.0;
+
+    return CLAMP(0.5 * (ll - lr) / d, -0.5, 0.5);
+}
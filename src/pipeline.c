@@ -0,0 +1,814 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Processing pipeline control - calibration, register, stack and write.
+**  Each stage runs any earlier stage not yet done, so the stages may be run one at a time
+**  (user interface) or all together (command line). Stages should be run from a job or a
+**  non-GTK thread and report through the run's job token. Each stage is timed and logged.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define REG_FRAME_COPIES 3		// A frame, its decode buffers and the star search copies
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <pipeline.h>
+#include <instrument.h>
+#include <preferences.h>
+
+
+/* Types */
+
+typedef struct _RegData
+{
+    PipeRun *run;
+    int base;
+    int translate;
+    PhaseRef *pc;
+    volatile gint done;
+} RegData;
+
+
+/* Prototypes */
+
+PipeRun * pipeline_new(ProjectData *, JobToken *);
+void pipeline_free(PipeRun *);
+int pipeline_stage(PipeRun *, int, GtkWidget *);
+int pipeline_darks(PipeRun *, GtkWidget *);
+int pipeline_register(PipeRun *, GtkWidget *);
+int pipeline_stack(PipeRun *, GtkWidget *);
+int pipeline_write(PipeRun *, GtkWidget *);
+int pipeline_run_all(PipeRun *, GtkWidget *);
+char * pipeline_out_fn(ProjectData *);
+const char * pipeline_stage_nm(int);
+static gint64 frame_bytes(PipeRun *, int);
+static void register_base(RegData *);
+static void measure_frames(int, int, gpointer);
+static void register_frames(int, int, gpointer);
+static int predict_xform(RegData *, int, int, Xform *);
+static void drizzle_prefs(PipeRun *);
+static void stage_start(PipeRun *, int, int64_t *);
+static void stage_end(PipeRun *, int, int64_t);
+
+extern void frame_free(ImgFrame *);
+extern int frame_save_pnm(ImgFrame *, char *, GtkWidget *);
+extern int fits_write(ImgFrame *, char *, int, FitsInfo *, GtkWidget *);
+extern void fits_info_img(Image *, FitsInfo *);
+extern int tiff_write(ImgFrame *, char *, int, int, GtkWidget *);
+extern ImgFrame * master_thermal(ImgFrame *, ImgFrame *);
+extern int badpix_map(PipeRun *, GtkWidget *);
+extern int get_user_pref(char *, char **);
+extern int get_user_pref_bool(char *, int *);
+extern int get_user_pref_int(char *, int *);
+extern int get_user_pref_dbl(char *, double *);
+extern int detect_stars(ImgFrame *, Star **, ImgQuality *);
+extern int quality_assess(PipeRun *, int);
+extern int frame_quality(ImgFrame *, ImgQuality *);
+extern int register_frame(ImgFrame *, Star *, int, Xform *, Xform *, Star **, ImgQuality *);
+extern void xform_identity(Xform *);
+extern void xform_extrapolate(Xform *, Xform *, Xform *);
+extern PhaseRef * phase_ref_new(ImgFrame *);
+extern int phase_register(PhaseRef *, ImgFrame *, Xform *);
+extern void phase_ref_free(PhaseRef *);
+extern ImgFrame * stack_frames(PipeRun *, GtkWidget *);
+extern void cache_open(PipeRun *);
+extern void cache_close(PipeRun *);
+extern ImgFrame * cache_frame(PipeRun *, int);
+extern void journal_open(PipeRun *);
+extern void journal_close(PipeRun *);
+extern ImgFrame * journal_master(PipeRun *, GList *, int, ImgFrame *, int, GtkWidget *);
+extern int journal_register(PipeRun *, int, int);
+extern void journal_frame(PipeRun *, int);
+extern void job_parallel_for(int, int, int, int, JobRangeFunc, gpointer, JobToken *);
+extern GList * video_expand(GList *);
+extern void video_list_free(GList *);
+extern int video_cfa(Image *);
+extern int job_thread_count();
+extern void mem_budget_init();
+extern int mem_reserve_count(gint64, int, int);
+extern void mem_release(gint64);
+extern int job_cancelled(JobToken *);
+extern void job_progress(JobToken *, double, char *);
+extern void job_token_unref(JobToken *);
+extern int64_t msec_time();
+extern void instr_reset();
+extern void instr_log_summary(char *);
+extern void log_msg_extra(char*, char*, char*, char*, GtkWidget*);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-pipeline.c ";
+static const char *stage_nm[] = { "Calibration", "Register", "Stack", "Write" };
+
+
+/* Set up a pipeline run for a project (takes ownership of the token) */
+
+PipeRun * pipeline_new(ProjectData *proj, JobToken *token)
+{
+    int i, k;
+    GList *l;
+    Image *img;
+    PipeRun *run;
+
+    run = (PipeRun *) malloc(sizeof(PipeRun));
+    memset(run, 0, sizeof(PipeRun));
+    run->proj = proj;
+    run->token = token;
+
+    /* Each frame of a video is a frame of the run */
+    run->frame_gl = video_expand(proj->images_gl);
+    run->n_frames = g_list_length(run->frame_gl);
+    run->frames = (FrameInfo *) calloc(run->n_frames, sizeof(FrameInfo));
+
+    for(l = run->frame_gl, i = 0, k = -1; l != NULL; l = l->next, i++)
+    {
+	img = (Image *) l->data;
+	run->frames[i].img = img;
+	xform_identity(&(run->frames[i].xf));
+
+	/* The base image (the first frame of a video) - a project image starts at each
+	   still or first frame */
+	if (img->vframe <= 1 && ++k == proj->baseimg)
+	    run->base = i;
+    }
+
+    run->out_fn = pipeline_out_fn(proj);
+    journal_open(run);
+    mem_budget_init();
+    instr_reset();
+
+    return run;
+}
+
+
+/* Free a pipeline run */
+
+void pipeline_free(PipeRun *run)
+{
+    int i;
+
+    if (run == NULL)
+    	return;
+
+    for(i = 0; i < run->n_frames; i++)
+    	free(run->frames[i].stars);
+
+    cache_close(run);
+    journal_close(run);
+    free(run->frames);
+    video_list_free(run->frame_gl);
+    frame_free(run->master_dark);
+    frame_free(run->master_bias);
+    frame_free(run->flat_inv);
+    frame_free(run->thermal);
+    frame_free(run->result);
+    free(run->out_fn);
+
+    if (run->token)
+	job_token_unref(run->token);
+
+    free(run);
+
+    return;
+}
+
+
+/* Run a stage by number */
+
+int pipeline_stage(PipeRun *run, int stage, GtkWidget *window)
+{
+    int ok;
+
+    switch(stage)
+    {
+	case STG_DARKS:
+	    ok = pipeline_darks(run, window);
+	    break;
+
+	case STG_REGISTER:
+	    ok = pipeline_register(run, window);
+	    break;
+
+	case STG_STACK:
+	    ok = pipeline_stack(run, window);
+	    break;
+
+	case STG_WRITE:
+	    ok = pipeline_write(run, window);
+	    break;
+
+	default:
+	    return FALSE;
+    }
+
+    /* Counters are cumulative for the run */
+    instr_log_summary(run->proj->project_name);
+
+    return ok;
+}
+
+
+/* Create the calibration masters (for those frames present) */
+
+int pipeline_darks(PipeRun *run, GtkWidget *window)
+{
+    int64_t t;
+    ImgFrame *dark_flat;
+    ProjectData *proj;
+
+    if (run->darks_done)
+    	return TRUE;
+
+    stage_start(run, STG_DARKS, &t);
+    proj = run->proj;
+
+    frame_free(run->master_dark);
+    frame_free(run->master_bias);
+    frame_free(run->flat_inv);
+    frame_free(run->thermal);
+    run->master_dark = run->master_bias = run->flat_inv = run->thermal = NULL;
+    memset(&(run->cal), 0, sizeof(CalMasters));
+
+    if (run->jnl != NULL)
+	memset(run->jnl->run_key, 0, sizeof(run->jnl->run_key));
+
+    /* Each is the saved one unless its frames have changed */
+    if (proj->bias_gl != NULL)
+	if ((run->master_bias = journal_master(run, proj->bias_gl, MST_BIAS, NULL, -1, window)) == NULL)
+	    return FALSE;
+
+    if (proj->darks_gl != NULL)
+	if ((run->master_dark = journal_master(run, proj->darks_gl, MST_DARK, NULL, -1, window)) == NULL)
+	    return FALSE;
+
+    /* Flats less the dark flat, or the bias if there are no dark flats */
+    if (proj->flats_gl != NULL)
+    {
+	dark_flat = NULL;
+
+	if (proj->darkflats_gl != NULL)
+	    if ((dark_flat = journal_master(run, proj->darkflats_gl, MST_DARKFLAT, NULL, -1, window)) == NULL)
+		return FALSE;
+
+	run->flat_inv = journal_master(run, proj->flats_gl, MST_FLAT, (dark_flat) ? dark_flat : run->master_bias,
+				       (dark_flat) ? MST_DARKFLAT : (run->master_bias) ? MST_BIAS : -1, window);
+	frame_free(dark_flat);
+
+	if (run->flat_inv == NULL)
+	    return FALSE;
+    }
+
+    /* Darks include the bias, so only a scaled dark needs the bias separately */
+    if (! get_user_pref_bool(DARK_SCALE, &(run->cal.scale)))
+    	run->cal.scale = FALSE;
+
+    if (run->master_dark != NULL && run->master_bias != NULL && run->cal.scale)
+    {
+	if ((run->thermal = master_thermal(run->master_dark, run->master_bias)) == NULL)
+	{
+	    log_msg_extra("APP0018", (char *) stage_nm[STG_DARKS], "Master dark and master bias sizes differ",
+	    		  "APP0018", window);
+	    return FALSE;
+	}
+
+	run->cal.bias = run->master_bias;
+	run->cal.dark = run->thermal;
+    }
+    else if (run->master_dark != NULL)
+    {
+	run->cal.dark = run->master_dark;
+    }
+    else
+    {
+	run->cal.bias = run->master_bias;
+    }
+
+    run->cal.flat_inv = run->flat_inv;
+
+    /* Hot and cold pixels (found once for the project) */
+    if (! badpix_map(run, window))
+    	return FALSE;
+
+    /* Calibrated lights from earlier runs with the same masters */
+    cache_open(run);
+    run->darks_done = TRUE;
+    stage_end(run, STG_DARKS, t);
+
+    return TRUE;
+}
+
+
+/* Find the stars in each image and the transform onto the base image */
+
+int pipeline_register(PipeRun *run, GtkWidget *window)
+{
+    char extra[256];
+    int i, n, base, want, chunk;
+    int64_t t;
+    gint64 each;
+    RegData rd;
+    FrameInfo *fi;
+
+    if (! pipeline_darks(run, window))
+    	return FALSE;
+
+    stage_start(run, STG_REGISTER, &t);
+
+    base = run->base;
+
+    if (base < 0 || base >= run->n_frames)
+    	base = 0;
+
+    /* The base image at full resolution first, then the others against it in parallel */
+    rd.run = run;
+    rd.base = base;
+    rd.pc = NULL;
+    rd.done = 0;
+
+    if (! get_user_pref_bool(REG_TRANSLATE, &(rd.translate)))
+    	rd.translate = FALSE;
+
+    /* Lights done before (and unchanged) are taken from the journal */
+    if ((n = journal_register(run, base, rd.translate)) > 0)
+    {
+	sprintf(extra, "%d of %d frames registered", n, run->n_frames);
+	log_msg_extra("APP0026", (char *) stage_nm[STG_REGISTER], extra, NULL, NULL);
+    }
+
+    register_base(&rd);
+
+    if (! run->frames[base].registered)
+    {
+	log_msg_extra("APP0019", run->frames[base].img->nm, NULL, NULL, NULL);
+	log_msg_extra("APP0018", (char *) stage_nm[STG_REGISTER], NULL, "APP0018", window);
+    	return FALSE;
+    }
+
+    /* Runs of frames (in order) per job so each frame can be predicted from the ones before.
+       A frame per thread is in flight unless the memory budget has room for fewer, when the
+       runs are made longer so only that many are */
+    each = frame_bytes(run, base) * REG_FRAME_COPIES;
+    want = job_thread_count();
+    n = mem_reserve_count(each, want, 1);
+    chunk = (n < want) ? (run->n_frames + n - 1) / n : 0;
+
+    /* Quality of every frame first (binned, cheap), so the poor ones are left out before matching */
+    job_parallel_for(JOB_PRI_BATCH, 0, run->n_frames, chunk, measure_frames, &rd, run->token);
+
+    if (! job_cancelled(run->token))
+    {
+	quality_assess(run, base);
+	rd.done = 0;
+	job_parallel_for(JOB_PRI_BATCH, 0, run->n_frames, chunk, register_frames, &rd, run->token);
+    }
+
+    mem_release(each * n);
+    phase_ref_free(rd.pc);
+
+    if (job_cancelled(run->token))
+    	return FALSE;
+
+    /* Frames from the journal may be rejected now too */
+    run->n_registered = 0;
+
+    for(i = 0; i < run->n_frames; i++)
+    {
+	fi = &(run->frames[i]);
+
+	if (fi->img->quality.rejected)
+	    fi->registered = FALSE;
+	else if (! fi->registered)
+	    log_msg_extra("APP0019", fi->img->nm, NULL, NULL, NULL);
+
+	if (fi->registered)
+	    run->n_registered++;
+    }
+
+    if (run->n_registered == 0)
+    {
+	log_msg_extra("APP0018", (char *) stage_nm[STG_REGISTER], NULL, "APP0018", window);
+    	return FALSE;
+    }
+
+    stage_end(run, STG_REGISTER, t);
+
+    return TRUE;
+}
+
+
+/* Stack the registered images */
+
+int pipeline_stack(PipeRun *run, GtkWidget *window)
+{
+    int64_t t;
+
+    if (run->n_registered == 0)
+	if (! pipeline_register(run, window))
+	    return FALSE;
+
+    stage_start(run, STG_STACK, &t);
+
+    if (! get_user_pref_bool(QUAL_WEIGHT, &(run->weighted)))
+    	run->weighted = FALSE;
+
+    if (! get_user_pref_int(STACK_INTERP, &(run->interp)) || run->interp != WARP_LANCZOS3)
+    	run->interp = WARP_BILINEAR;
+
+    drizzle_prefs(run);
+    frame_free(run->result);
+
+    if ((run->result = stack_frames(run, window)) == NULL)
+    {
+	if (! job_cancelled(run->token))
+	    log_msg_extra("APP0018", (char *) stage_nm[STG_STACK], NULL, "APP0018", window);
+
+    	return FALSE;
+    }
+
+    stage_end(run, STG_STACK, t);
+
+    return TRUE;
+}
+
+
+/* Write the stacked image - FITS unless a TIFF, PPM or PGM file is named */
+
+int pipeline_write(PipeRun *run, GtkWidget *window)
+{
+    int64_t t;
+    int ok, base, bitpix, compress;
+    char *p;
+    FitsInfo info;
+
+    if (run->result == NULL)
+	if (! pipeline_stack(run, window))
+	    return FALSE;
+
+    stage_start(run, STG_WRITE, &t);
+
+    p = strrchr(run->out_fn, '.');
+
+    /* The sample type applies to TIFF as well (16 bit or float) */
+    if (! get_user_pref_int(OUT_BITPIX, &bitpix))
+	bitpix = FITS_FLOAT32;
+
+    if (p != NULL && (strcasecmp(p, ".ppm") == 0 || strcasecmp(p, ".pgm") == 0))
+	ok = frame_save_pnm(run->result, run->out_fn, window);
+    else if (p != NULL && (strcasecmp(p, ".tif") == 0 || strcasecmp(p, ".tiff") == 0))
+    {
+	if (! get_user_pref_int(TIFF_COMPRESS, &compress))
+	    compress = TRUE;
+
+	ok = tiff_write(run->result, run->out_fn, (bitpix == FITS_UINT16) ? 16 : 32, compress, window);
+    }
+    else
+    {
+	/* Exposure and ISO of the base image (the subframe values), frames stacked */
+	base = run->base;
+
+	if (base < 0 || base >= run->n_frames)
+	    base = 0;
+
+	fits_info_img((run->n_frames > 0) ? run->frames[base].img : NULL, &info);
+	info.ncombine = run->n_registered;
+	ok = fits_write(run->result, run->out_fn, bitpix, &info, window);
+    }
+
+    if (! ok)
+    	return FALSE;
+
+    stage_end(run, STG_WRITE, t);
+
+    return TRUE;
+}
+
+
+/* All the stages */
+
+int pipeline_run_all(PipeRun *run, GtkWidget *window)
+{
+    return pipeline_stage(run, STG_WRITE, window);
+}
+
+
+/* Default output file for a project */
+
+char * pipeline_out_fn(ProjectData *proj)
+{
+    char *fn;
+
+    fn = (char *) malloc(strlen(proj->project_path) + strlen(proj->project_name) + 13);
+    sprintf(fn, "%s/%s_stack.fits", proj->project_path, proj->project_name);
+
+    return fn;
+}
+
+
+/* Stage name */
+
+const char * pipeline_stage_nm(int stage)
+{
+    if (stage < 0 || stage >= PIPE_STAGES)
+    	return "";
+
+    return stage_nm[stage];
+}
+
+
+/* Size of a decoded image - from its width and height (taken as colour), else by decoding it */
+
+static gint64 frame_bytes(PipeRun *run, int i)
+{
+    int w, h, ch;
+    ImgExif *e;
+    ImgFrame *frm;
+
+    e = &(run->frames[i].img->img_exif);
+    w = (e->width != NULL) ? atoi(e->width) : 0;
+    h = (e->height != NULL) ? atoi(e->height) : 0;
+    ch = 3;
+
+    if (w <= 0 || h <= 0)
+    {
+	if ((frm = cache_frame(run, i)) == NULL)
+	    return 0;
+
+	w = frm->width;
+	h = frm->height;
+	ch = frm->channels;
+	frame_free(frm);
+    }
+
+    return (gint64) w * h * ch * sizeof(float);
+}
+
+
+/* Decode and calibrate the base image, find its stars and measure its quality (as the others) */
+
+static void register_base(RegData *rd)
+{
+    ImgFrame *frm;
+    FrameInfo *fb;
+
+    fb = &(rd->run->frames[rd->base]);
+
+    /* Taken from the journal */
+    if (fb->restored)
+    	return;
+
+    free(fb->stars);
+    fb->stars = NULL;
+    fb->n_stars = 0;
+    fb->registered = FALSE;
+    xform_identity(&(fb->xf));
+    memset(&(fb->img->quality), 0, sizeof(ImgQuality));
+
+    if ((frm = cache_frame(rd->run, rd->base)) != NULL)
+    {
+	fb->n_stars = detect_stars(frm, &(fb->stars), NULL);
+	frame_quality(frm, &(fb->img->quality));
+
+	if (rd->translate)
+	    rd->pc = phase_ref_new(frm);
+
+	fb->registered = (fb->n_stars > 0 || rd->pc != NULL);
+	frame_free(frm);
+    }
+
+    if (! job_cancelled(rd->run->token))
+	journal_frame(rd->run, rd->base);
+
+    return;
+}
+
+
+/* Decode, calibrate and measure quality for a range of images (not the base). Translation only
+   is by phase correlation here on the frame at hand, so only those it is unsure of are decoded
+   again for star matching. */
+
+static void measure_frames(int lo, int hi, gpointer data)
+{
+    int i, n;
+    char msg[100];
+    ImgFrame *frm;
+    FrameInfo *fi;
+    RegData *rd;
+
+    rd = (RegData *) data;
+
+    for(i = lo; i < hi; i++)
+    {
+	if (job_cancelled(rd->run->token))
+	    return;
+
+	fi = &(rd->run->frames[i]);
+
+	if (i != rd->base && ! fi->restored)
+	{
+	    free(fi->stars);
+	    fi->stars = NULL;
+	    fi->n_stars = 0;
+	    fi->registered = FALSE;
+	    xform_identity(&(fi->xf));
+	    memset(&(fi->img->quality), 0, sizeof(ImgQuality));
+
+	    if ((frm = cache_frame(rd->run, i)) != NULL)
+	    {
+		fi->n_stars = frame_quality(frm, &(fi->img->quality));
+
+		if (rd->pc != NULL)
+		    fi->registered = phase_register(rd->pc, frm, &(fi->xf));
+
+		frame_free(frm);
+	    }
+	}
+
+	n = g_atomic_int_add(&(rd->done), 1) + 1;
+	sprintf(msg, "Measuring: %d of %d", n, rd->run->n_frames);
+	job_progress(rd->run->token, 0.5 * n / rd->run->n_frames, msg);
+    }
+
+    return;
+}
+
+
+/* The transforms onto the base image for a range of the images measured and not placed by
+   phase correlation - rejected ones are not matched. Stars are matched from the predicted
+   transform, else coarse to fine (see register_frame). */
+
+static void register_frames(int lo, int hi, gpointer data)
+{
+    int i, n;
+    char msg[100];
+    ImgFrame *frm;
+    FrameInfo *fi, *fb;
+    RegData *rd;
+    Star *st;
+    Xform pred;
+
+    rd = (RegData *) data;
+    fb = &(rd->run->frames[rd->base]);
+
+    for(i = lo; i < hi; i++)
+    {
+	if (job_cancelled(rd->run->token))
+	    return;
+
+	fi = &(rd->run->frames[i]);
+
+	if (i != rd->base && ! fi->restored && ! fi->img->quality.rejected)
+	{
+	    if (! fi->registered && fb->n_stars > 0 && (frm = cache_frame(rd->run, i)) != NULL)
+	    {
+		fi->registered = register_frame(frm, fb->stars, fb->n_stars,
+						(predict_xform(rd, lo, i, &pred)) ? &pred : NULL,
+						&(fi->xf), &st, NULL);
+		free(st);
+		frame_free(frm);
+	    }
+
+	    /* Kept unless cancelled part way */
+	    if (! job_cancelled(rd->run->token))
+		journal_frame(rd->run, i);
+	}
+
+	n = g_atomic_int_add(&(rd->done), 1) + 1;
+	sprintf(msg, "Registering: %d of %d", n, rd->run->n_frames);
+	job_progress(rd->run->token, 0.5 + 0.5 * n / rd->run->n_frames, msg);
+    }
+
+    return;
+}
+
+
+/* Transform for a frame predicted from the one or two before it - those done in this range
+   (or the base), in order, are safe to read. Rejected frames are not matched, so any in the
+   way are passed over and the last change carried on a step for each frame */
+
+static int predict_xform(RegData *rd, int lo, int i, Xform *pred)
+{
+    int j;
+    Xform x1, x2;
+    FrameInfo *f1, *f2;
+
+    for(j = i - 1; j >= 0 && (j >= lo || j == rd->base); j--)
+    	if (rd->run->frames[j].registered)
+	    break;
+
+    if (j < 0 || (j < lo && j != rd->base))
+    	return FALSE;
+
+    f1 = &(rd->run->frames[j]);
+    f2 = NULL;
+
+    if (j - 1 >= lo || (j - 1 >= 0 && j - 1 == rd->base))
+    	f2 = &(rd->run->frames[j - 1]);
+
+    if (f2 == NULL || ! f2->registered)
+    {
+	*pred = f1->xf;
+	return TRUE;
+    }
+
+    x1 = f1->xf;
+    x2 = f2->xf;
+
+    for(; j < i; j++)
+    {
+	xform_extrapolate(&x1, &x2, pred);
+	x2 = x1;
+	x1 = *pred;
+    }
+
+    return TRUE;
+}
+
+
+/* Drizzle scale, drop size and mosaic pattern (out of range values are taken as off) */
+
+static void drizzle_prefs(PipeRun *run)
+{
+    int i;
+    char *p;
+    static const char *cfa_nm[] = { "NONE", "RGGB", "BGGR", "GRBG", "GBRG" };
+
+    if (! get_user_pref_dbl(DRIZ_SCALE, &(run->driz_scale)) || run->driz_scale < 1.0 || run->driz_scale > 4.0)
+    	run->driz_scale = 1.0;
+
+    if (! get_user_pref_dbl(DRIZ_DROP, &(run->driz_drop)) || run->driz_drop < 0.1 || run->driz_drop > 1.0)
+    	run->driz_drop = 0.7;
+
+    run->cfa = CFA_NONE;
+    get_user_pref(CFA_PATTERN, &p);
+
+    for(i = CFA_RGGB; p != NULL && i <= CFA_GBRG; i++)
+    	if (strcasecmp(p, cfa_nm[i]) == 0)
+	    run->cfa = i;
+
+    /* A Bayer video gives its own pattern */
+    if (run->cfa == CFA_NONE && run->n_frames > 0)
+    	run->cfa = video_cfa(run->frames[0].img);
+
+    return;
+}
+
+
+/* Note the stage start */
+
+static void stage_start(PipeRun *run, int stage, int64_t *t)
+{
+    job_progress(run->token, 0.0, (char *) stage_nm[stage]);
+    *t = msec_time();
+
+    return;
+}
+
+
+/* Record and log the stage time */
+
+static void stage_end(PipeRun *run, int stage, int64_t t)
+{
+    char extra[256];
+    run->stage_ms[stage] = msec_time() - t;
+
+    sprintf(extra, "Project: %s  Elapsed: %ld ms", run->proj->project_name, (long) run->stage_ms[stage]);
+    log_msg_extra("APP0017", (char *) stage_nm[stage], extra, NULL, NULL);
+    job_progress(run->token, 1.0, NULL);
+
+    return;
+}
@@ -0,0 +1,284 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:	Processing pipeline (darks, register, stack) details
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial
+**
+*/
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <project.h>
+#include <jobs.h>
+
+
+// Structure(s) for the processing pipeline.
+// Frames are held as interleaved float samples (1 or 3 channels) on a 0 - 65535 scale
+// whatever the source bit depth. A transform maps frame coordinates onto the base image:
+//	x' = a*x + b*y + c
+//	y' = d*x + e*y + f
+// Calibration masters are built a frame at a time (streaming) as a mean with the highest
+// and lowest sample of each pixel rejected. The master flat is kept as the normalised
+// reciprocal so calibration is the single pass: max(light - bias - k * dark, 0) * flat_inv.
+// With dark scaling the dark is the thermal signal (master dark less bias, or the master
+// dark itself if there is no bias) and 'k' is fitted to each light, otherwise the dark is
+// the master dark (or nothing, leaving the bias) and 'k' is 1. Mapped bad pixels are
+// then repaired.
+// Translation only sequences may be registered by phase correlation against the base
+// image spectrum (kept for the run) instead, star matching being the fallback.
+// Calibrated lights may be cached on disk (compressed) keyed by the file contents and the
+// calibration, so registering or stacking again need not decode or calibrate them.
+// Stage progress is journalled in the project directory: the masters (saved as FITS) and
+// each light's registration are keyed by what they were made from, and the stacking sums
+// are checkpointed, so a run that is stopped or has frames added redoes only what changed.
+// Frame quality is measured as the stars are found (the scores are kept with each image)
+// and poor frames are rejected before they are matched.
+// The pipeline run holds the state carried between stages so the GUI may run the stages
+// one at a time and the command line may run them all in one go.
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#define PIPE_MAX_STARS 200
+#define PIPE_BIN 4			// Coarse registration reduction
+#define PIPE_STAGES 4
+#define JNL_KEY 41			// SHA1 hex digest and nul
+
+// Luminance of pixel 'i' of a 1 or 3 channel frame
+
+#define FRAME_LUMA(frm, i) ((frm)->channels == 1 ? (frm)->data[(i)] : \
+	0.299f * (frm)->data[(size_t) (i) * 3] + 0.587f * (frm)->data[(size_t) (i) * 3 + 1] + \
+	0.114f * (frm)->data[(size_t) (i) * 3 + 2])
+
+enum PipeStage
+    {
+       STG_DARKS,
+       STG_REGISTER,
+       STG_STACK,
+       STG_WRITE
+    };
+
+enum WarpInterp
+    {
+       WARP_BILINEAR,
+       WARP_LANCZOS3
+    };
+
+enum CfaPattern
+    {
+       CFA_NONE,
+       CFA_RGGB,
+       CFA_BGGR,
+       CFA_GRBG,
+       CFA_GBRG
+    };
+
+enum FitsBitpix
+    {
+       FITS_UINT16 = 16,
+       FITS_FLOAT32 = -32
+    };
+
+enum MasterKind
+    {
+       MST_DARK,
+       MST_FLAT,
+       MST_DARKFLAT,
+       MST_BIAS
+    };
+
+
+typedef struct _ImgFrame
+{
+    int width, height, channels;
+    float *data;
+} ImgFrame;
+
+
+typedef struct _Star
+{
+    float x, y;
+    float flux;
+} Star;
+
+
+typedef struct _Xform
+{
+    double a, b, c;
+    double d, e, f;
+} Xform;
+
+
+typedef struct _FitsInfo
+{
+    double exptime;			// Exposure (seconds), 0 if unknown
+    int iso;				// 0 if unknown
+    int ncombine;			// Frames stacked (1 for a single frame)
+    int has_xform;			// Frame to base image transform present
+    Xform xf;
+} FitsInfo;
+
+
+typedef struct _MasterBuilder
+{
+    int kind;
+    int n;				// Frames added
+    ImgFrame *sum, *lo, *hi;		// Per sample sum, minimum and maximum
+    char err[100];			// Why a frame could not be added (for the log)
+} MasterBuilder;
+
+
+typedef struct _CalMasters
+{
+    ImgFrame *bias;			// Each may be NULL (not owned)
+    ImgFrame *dark;
+    ImgFrame *flat_inv;
+    int scale;				// Fit the dark scale to each frame
+    BadPixMap *badpix;			// Pixels to repair (may be NULL)
+} CalMasters;
+
+
+typedef struct _PhaseRef
+{
+    int n;				// Crop side (power of 2)
+    int x0, y0;				// Crop origin
+    float *re, *im;			// Base image crop spectrum
+    float *win;				// Window (each way)
+    float *cs;				// Twiddle factors (cos, sin pairs)
+    float *taper;			// Spectrum taper (each way)
+} PhaseRef;
+
+
+// A run of output pixels along a row warped from a frame (affine - each pixel is one step
+// on in the source) and added into a stacking accumulator. The run must lie wholly within
+// the part of the source the interpolation can reach.
+
+typedef struct _WarpSpan
+{
+    const float *src;			// Source frame
+    int w, h, ch;
+    double sx, sy;			// Source position of the first pixel
+    double dx, dy;			// Source step per pixel
+    int n;				// Pixels
+    float *out;				// Accumulator sums (channels per pixel)
+    float *cnt;				// Accumulator coverage (one per pixel)
+    float wt;				// Frame weight
+} WarpSpan;
+
+
+typedef struct _CacheEntry
+{
+    guint64 key;
+    gint64 size;			// Bytes on disk
+    gint64 used;			// Last use (real time, microseconds)
+} CacheEntry;
+
+
+typedef struct _FrameCache
+{
+    char *dir;				// Project cache directory
+    guint64 cal_key;			// Hash of the calibration applied
+    gint64 cap;				// Size limit (bytes)
+    gint64 total;			// Size of the entries (bytes)
+    gint64 opened;			// Start of the run (real time, microseconds)
+    int full;				// No more room this run
+    GList *entries;			// CacheEntry
+    GMutex lock;
+} FrameCache;
+
+
+typedef struct _Journal
+{
+    char *fn;				// Progress journal (text)
+    char *ckpt_fn;			// Stacking checkpoint
+    char mst_key[4][JNL_KEY];		// Saved masters (MasterKind)
+    char run_key[4][JNL_KEY];		// Masters in use this run (empty if none)
+    char reg_key[JNL_KEY];		// Registration settings and masters
+    GHashTable *frames;			// Registered lights by path
+    FILE *fd;				// Journal open for appending (may be NULL)
+    int64_t ckpt_time;			// Last checkpoint (msec)
+    GMutex lock;
+} Journal;
+
+
+// Stacking sums (what a checkpoint holds)
+
+typedef struct _StackAccum
+{
+    ImgFrame *sum;			// Output sums
+    float *cnt;				// Coverage (drizzle weights per channel)
+    int64_t n_cnt;			// Coverage values
+    int fw, fh, fc;			// Output size
+    int wch;				// Drizzle weight channels
+    int done;				// Frames added
+    int saved;				// Frames in the saved copy
+} StackAccum;
+
+
+typedef struct _FrameInfo
+{
+    Image *img;
+    guint64 src_key;			// Hash of the file contents (0 until needed)
+    Star *stars;
+    int n_stars;
+    Xform xf;
+    int registered;			// TRUE if a transform to the base image was found
+    int restored;			// Registration taken from the journal
+    int stacked;			// Added to the stacking sums
+} FrameInfo;
+
+
+typedef struct _PipeRun
+{
+    ProjectData *proj;
+    JobToken *token;
+    ImgFrame *master_dark;
+    ImgFrame *master_bias;
+    ImgFrame *flat_inv;			// Normalised reciprocal of the master flat
+    ImgFrame *thermal;			// Master dark less bias (dark scaling)
+    CalMasters cal;			// What is applied to each light
+    int darks_done;			// All the calibration masters are built
+    FrameCache *cache;			// Calibrated lights kept on disk (may be NULL)
+    Journal *jnl;			// Stage progress (may be NULL)
+    GList *frame_gl;			// The images, videos expanded to a record a frame
+    int n_frames;
+    FrameInfo *frames;
+    int base;				// Base (reference) frame
+    int n_registered;
+    int weighted;			// Stack weighted by frame quality score
+    int interp;				// Stacking interpolation (WarpInterp)
+    double driz_scale;			// Drizzle output scale (1 is a plain mean stack)
+    double driz_drop;			// Drizzle drop size (fraction of a pixel)
+    int cfa;				// Mosaic pattern of single channel frames (CfaPattern)
+    ImgFrame *result;
+    char *out_fn;
+    int64_t stage_ms[PIPE_STAGES];
+} PipeRun;
+
+#endif
@@ -36,16 +36,27 @@
 // The format of the settings file in the application directory is as follows:-
 //	name_key|setting_value		- leading and trailing spaces are ignored
 //					- no spaces in key
+// Entries are also indexed by key in a hash table and each value is parsed once (at load or
+// update) into its numeric, boolean and path forms so the typed accessors do no string work.
 
 #ifndef USER_PREFS_H
 #define USER_PREFS_H
 
 #define PREF_KEY_SZ 25
 
+#define PREF_TYPE_INT  0x01
+#define PREF_TYPE_DBL  0x02
+#define PREF_TYPE_BOOL 0x04
+
 typedef struct _UserPrefData
 {
     char key[PREF_KEY_SZ];
     char *val;
+    int types;				// PREF_TYPE_xxx flags for the forms 'val' parsed into
+    int i_val;
+    double d_val;
+    int b_val;
+    char *path;				// 'val' with any leading '~' expanded, else 'val' itself
 } UserPrefData;
 
 // Key values for each preference setting detail stored
@@ -53,5 +64,21 @@ typedef struct _UserPrefData
 //#define SAMPLE_KEY "SAMPLEKEY1"
 #define PROJ_DIR "PROJDIR"
 #define BACKUP_DIR "BKUPDIR"
+#define THREAD_COUNT "THREADS"		// Worker threads, 0 is one per processor
+#define DARK_SCALE "DARKSCALE"		// Fit the dark to each light (darks may differ in exposure)
+#define QUAL_FWHM "QUALFWHM"		// Reject frames with star FWHM over this multiple of the median (0 is off)
+#define QUAL_STARS "QUALSTARS"		// Reject frames with fewer stars than this fraction of the median (0 is off)
+#define QUAL_ECC "QUALECC"		// Reject frames with star eccentricity over this (0 is off)
+#define QUAL_WEIGHT "QUALWEIGHT"	// Weight frames by quality score when stacking
+#define REG_TRANSLATE "REGTRANSLATE"	// Translation only frames - register by phase correlation (stars as fall back)
+#define STACK_INTERP "STACKINTERP"	// Stacking interpolation, 0 bilinear, 1 Lanczos-3 (sharper, slower)
+#define DRIZ_SCALE "DRIZSCALE"		// Drizzle output scale, 1 (off), 1.5 or 2 (undersampled frames)
+#define DRIZ_DROP "DRIZDROP"		// Drizzle drop size as a fraction of the pixel (0.1 - 1)
+#define CFA_PATTERN "CFAPATTERN"	// Colour filter array of single channel frames - NONE, RGGB, BGGR, GRBG, GBRG
+#define OUT_BITPIX "OUTBITPIX"		// FITS output sample type, -32 (float) or 16 (unsigned 16 bit)
+#define TIFF_COMPRESS "TIFFCOMPRESS"	// TIFF output compression, 0 (none) or 1 (deflate)
+#define CAL_CACHE_MB "CALCACHEMB"	// Calibrated frame cache size limit (MB) per project, 0 (off)
+#define MEM_BUDGET_MB "MEMBUDGETMB"	// Memory budget (MB) for frames and images held, 0 (half the physical memory)
+#define SESSION_GAP_HRS "SESSIONGAPHRS"	// A gap (hours) between frames longer than this starts a new session
 
 #endif
@@ -42,6 +42,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <defs.h>
 #include <preferences.h>
 
@@ -87,6 +88,11 @@ void default_dir_pref();
 void default_backup_pref();
 void set_user_prefs(PrefUi *);
 int get_user_pref(char *, char **);
+int get_user_pref_int(char *, int *);
+int get_user_pref_dbl(char *, double *);
+int get_user_pref_bool(char *, int *);
+int get_user_pref_path(char *, char **);
+UserPrefData * find_user_pref(char *);
 void get_user_pref_idx(int, char *, char **);
 int match_key_val_combo(char *, char *, int, char **);
 void get_pref_key(int, char *);
@@ -95,6 +101,9 @@ int set_user_pref(char *, char *);
 int add_user_pref(char *, char *);
 int add_user_pref_idx(char *, char *, int);
 void delete_user_pref(char *);
+static void index_user_pref(UserPrefData *);
+static void parse_pref_val(UserPrefData *);
+static void free_pref_val(UserPrefData *);
 int pref_save_reqd(PrefUi *);
 int pref_changed(char *, char *);
 int validate_pref(PrefUi *);
@@ -129,6 +138,7 @@ static const char *debug_hdr = "DEBUG-prefs_ui.c ";
 static int save_indi;
 static GList *pref_list = NULL;
 static GList *pref_list_head = NULL;
+static GHashTable *pref_hash = NULL;
 static int pref_count;
 
 
@@ -315,9 +325,11 @@ int read_user_prefs(GtkWidget *window)
     char *p, *p2;
     int app_dir_len;
     int err;
+    GList *new_list = NULL;
+    UserPrefData *curr;
 
-    /* Initial */
-    pref_count = 0;
+    /* Initial - preferences may already be loaded, in which case they are refreshed in place */
+    pref_count = g_list_length(pref_list_head);
 
     /* Get the full path for the preferences file */
     app_dir = app_dir_path();
@@ -386,13 +398,24 @@ int read_user_prefs(GtkWidget *window)
 	Preference->val = (char *) malloc(strlen(p) + 1);
 	strcpy(Preference->val, p);
 	string_trim(Preference->val);
-	    
-	pref_list = g_list_prepend(pref_list, Preference);
+
+	/* An existing key is updated rather than duplicated */
+	if ((curr = find_user_pref(Preference->key)) != NULL)
+	{
+	    set_user_pref(curr->key, Preference->val);
+	    free(Preference->val);
+	    free(Preference);
+	    continue;
+	}
+
+	parse_pref_val(Preference);
+	index_user_pref(Preference);
+	new_list = g_list_prepend(new_list, Preference);
 	pref_count++;
     }
 
     /* Still may need set up some default preferences */
-    pref_list_head = g_list_reverse(pref_list);
+    pref_list_head = g_list_concat(pref_list_head, g_list_reverse(new_list));
     set_default_prefs();
 
     /* Close off */
@@ -418,7 +441,7 @@ int write_user_prefs(GtkWidget *window)
     app_dir = app_dir_path();
     app_dir_len = strlen(app_dir);
     prefs_fn = (char *) malloc(app_dir_len + 19);
-    sprintf(prefs_fn, "%s/app_settings", app_dir);
+    sprintf(prefs_fn, "%s/%s", app_dir, USER_PREFS);
 
     /* New or overwrite file */
     if ((fd = fopen(prefs_fn, "w")) == (FILE *) NULL)
@@ -440,8 +463,9 @@ int write_user_prefs(GtkWidget *window)
 	    
 	    if ((fputs(buf, fd)) == EOF)
 	    {
-		free(prefs_fn);
 		log_msg("SYS9005", prefs_fn, "SYS9005", window);
+		fclose(fd);
+		free(prefs_fn);
 		return FALSE;
 	    }
     	}
@@ -476,6 +500,97 @@ void set_default_prefs()
     if (p == NULL)
 	default_backup_pref();
 
+    /* Default worker threads (one per processor) */
+    get_user_pref(THREAD_COUNT, &p);
+
+    if (p == NULL)
+	add_user_pref(THREAD_COUNT, "0");
+
+    /* Default dark scaling on */
+    get_user_pref(DARK_SCALE, &p);
+
+    if (p == NULL)
+	add_user_pref(DARK_SCALE, "1");
+
+    /* Default quality rejection thresholds, no weighting */
+    get_user_pref(QUAL_FWHM, &p);
+
+    if (p == NULL)
+	add_user_pref(QUAL_FWHM, "1.5");
+
+    get_user_pref(QUAL_STARS, &p);
+
+    if (p == NULL)
+	add_user_pref(QUAL_STARS, "0.5");
+
+    get_user_pref(QUAL_ECC, &p);
+
+    if (p == NULL)
+	add_user_pref(QUAL_ECC, "0.85");
+
+    get_user_pref(QUAL_WEIGHT, &p);
+
+    if (p == NULL)
+	add_user_pref(QUAL_WEIGHT, "0");
+
+    /* Star matching registration (frames may rotate) */
+    get_user_pref(REG_TRANSLATE, &p);
+
+    if (p == NULL)
+	add_user_pref(REG_TRANSLATE, "0");
+
+    /* Bilinear stacking interpolation */
+    get_user_pref(STACK_INTERP, &p);
+
+    if (p == NULL)
+	add_user_pref(STACK_INTERP, "0");
+
+    /* No drizzle, mono frames */
+    get_user_pref(DRIZ_SCALE, &p);
+
+    if (p == NULL)
+	add_user_pref(DRIZ_SCALE, "1");
+
+    get_user_pref(DRIZ_DROP, &p);
+
+    if (p == NULL)
+	add_user_pref(DRIZ_DROP, "0.7");
+
+    get_user_pref(CFA_PATTERN, &p);
+
+    if (p == NULL)
+	add_user_pref(CFA_PATTERN, "NONE");
+
+    /* Float FITS output */
+    get_user_pref(OUT_BITPIX, &p);
+
+    if (p == NULL)
+	add_user_pref(OUT_BITPIX, "-32");
+
+    /* Deflate TIFF output */
+    get_user_pref(TIFF_COMPRESS, &p);
+
+    if (p == NULL)
+	add_user_pref(TIFF_COMPRESS, "1");
+
+    /* Calibrated frame cache */
+    get_user_pref(CAL_CACHE_MB, &p);
+
+    if (p == NULL)
+	add_user_pref(CAL_CACHE_MB, "4096");
+
+    /* Memory budget */
+    get_user_pref(MEM_BUDGET_MB, &p);
+
+    if (p == NULL)
+	add_user_pref(MEM_BUDGET_MB, "0");
+
+    /* Imaging sessions */
+    get_user_pref(SESSION_GAP_HRS, &p);
+
+    if (p == NULL)
+	add_user_pref(SESSION_GAP_HRS, "4");
+
     /* Save to file */
     write_user_prefs(NULL);
 
@@ -559,9 +674,12 @@ int add_user_pref(char *key, char *val)
     UserPrefData *Preference;
 
     Preference = (UserPrefData *) malloc(sizeof(UserPrefData));
+    memset(Preference, 0, sizeof (UserPrefData));
     strcpy(Preference->key, key);
     Preference->val = (char *) malloc(strlen(val) + 1);
     strcpy(Preference->val, val);
+    parse_pref_val(Preference);
+    index_user_pref(Preference);
 
     pref_list = g_list_append(pref_list_head, (gpointer) Preference);
     pref_count++;
@@ -580,9 +698,12 @@ int add_user_pref_idx(char *key, char *val, int idx)
     UserPrefData *Preference;
 
     Preference = (UserPrefData *) malloc(sizeof(UserPrefData));
+    memset(Preference, 0, sizeof (UserPrefData));
     strcpy(Preference->key, key);
     Preference->val = (char *) malloc(strlen(val) + 1);
     strcpy(Preference->val, val);
+    parse_pref_val(Preference);
+    index_user_pref(Preference);
 
     pref_list_head = g_list_insert(pref_list_head, (gpointer) Preference, idx);
     pref_count++;
@@ -599,31 +720,32 @@ int set_user_pref(char *key, char *val)
     UserPrefData *Preference;
 
     /* Find the key entry and set the new value */
-    pref_list = g_list_first(pref_list_head);
-    i = 0;
+    if ((Preference = find_user_pref(key)) == NULL)
+    	return FALSE;
 
-    while(pref_list != NULL)
-    {
-    	Preference = (UserPrefData *) pref_list->data;
+    free_pref_val(Preference);
+    i = strlen(val);
 
-    	if (strcmp(Preference->key, key) == 0)
-    	{
-	    i = strlen(val);
+    if (i > strlen(Preference->val))
+	Preference->val = (char *) realloc(Preference->val, i + 1);
 
-	    if (i > strlen(Preference->val))
-		Preference->val = (char *) realloc(Preference->val, i + 1);
+    strcpy(Preference->val, val);
 
-	    strcpy(Preference->val, val);
-	    break;
-    	}
+    /* Typed values are always kept in step with the string */
+    parse_pref_val(Preference);
 
-	pref_list = g_list_next(pref_list);
-    }
+    return TRUE;
+}
 
-    if (i == 0)
-    	return FALSE;
 
-    return TRUE;
+/* Return the preference entry for a key or NULL */
+
+UserPrefData * find_user_pref(char *key)
+{
+    if (pref_hash == NULL)
+    	return NULL;
+
+    return (UserPrefData *) g_hash_table_lookup(pref_hash, key);
 }
 
 
@@ -631,29 +753,87 @@ int set_user_pref(char *key, char *val)
 
 int get_user_pref(char *key, char **val)
 {
-    int i;
     UserPrefData *Preference;
 
     *val = NULL;
-    i = 0;
 
-    pref_list = g_list_first(pref_list_head);
+    if ((Preference = find_user_pref(key)) == NULL)
+    	return FALSE;
 
-    while(pref_list != NULL)
-    {
-    	Preference = (UserPrefData *) pref_list->data;
+    *val = Preference->val;
 
-    	if (strcmp(Preference->key, key) == 0)
-    	{
-	    *val = Preference->val;
-	    break;
-    	}
+    return TRUE;
+}
 
-	pref_list = g_list_next(pref_list);
-	i++;
-    }
 
-    return i;
+/* Return an integer user preference (parsed at load), FALSE if not present or not numeric */
+
+int get_user_pref_int(char *key, int *val)
+{
+    UserPrefData *Preference;
+
+    if ((Preference = find_user_pref(key)) == NULL)
+    	return FALSE;
+
+    if (! (Preference->types & PREF_TYPE_INT))
+    	return FALSE;
+
+    *val = Preference->i_val;
+
+    return TRUE;
+}
+
+
+/* Return a double user preference (parsed at load), FALSE if not present or not numeric */
+
+int get_user_pref_dbl(char *key, double *val)
+{
+    UserPrefData *Preference;
+
+    if ((Preference = find_user_pref(key)) == NULL)
+    	return FALSE;
+
+    if (! (Preference->types & PREF_TYPE_DBL))
+    	return FALSE;
+
+    *val = Preference->d_val;
+
+    return TRUE;
+}
+
+
+/* Return a boolean user preference (Y/N, Yes/No, True/False, On/Off, 1/0) */
+
+int get_user_pref_bool(char *key, int *val)
+{
+    UserPrefData *Preference;
+
+    if ((Preference = find_user_pref(key)) == NULL)
+    	return FALSE;
+
+    if (! (Preference->types & PREF_TYPE_BOOL))
+    	return FALSE;
+
+    *val = Preference->b_val;
+
+    return TRUE;
+}
+
+
+/* Return a path user preference with any leading '~' already expanded */
+
+int get_user_pref_path(char *key, char **val)
+{
+    UserPrefData *Preference;
+
+    *val = NULL;
+
+    if ((Preference = find_user_pref(key)) == NULL)
+    	return FALSE;
+
+    *val = Preference->path;
+
+    return TRUE;
 }
 
 
@@ -723,6 +903,17 @@ int match_key_val_combo(char *key, char *s_val, int s_len, char **val)
     *val = NULL;
     k_len = strlen(key);
 
+    /* A full key can be found directly */
+    if ((Preference = find_user_pref(key)) != NULL)
+    {
+	if (strncmp(Preference->val, s_val, s_len) == 0)
+	{
+	    *val = Preference->val;
+	    return g_list_index(pref_list_head, Preference);
+	}
+    }
+
+    /* Otherwise the key is a prefix so check each */
     pref_list = g_list_first(pref_list_head);
 
     while(pref_list != NULL)
@@ -760,8 +951,11 @@ void delete_user_pref(char *key)
     	if (strcmp(Preference->key, key) == 0)
     	{
 	    pref_list_head = g_list_remove_link(pref_list_head, llink);
+	    g_hash_table_remove(pref_hash, Preference->key);
+	    free_pref_val(Preference);
 	    free(Preference->val);
 	    free(Preference);
+	    pref_count--;
 	    g_list_free(llink);
 	    break;
     	}
@@ -842,6 +1036,7 @@ void free_prefs()
     while(pref_list != NULL)
     {
     	Preference = (UserPrefData *) pref_list->data;
+	free_pref_val(Preference);
     	free(Preference->val);
     	free(Preference);
 
@@ -849,6 +1044,110 @@ void free_prefs()
     }
 
     g_list_free(pref_list_head);
+    pref_list_head = NULL;
+    pref_list = NULL;
+    pref_count = 0;
+
+    if (pref_hash != NULL)
+    {
+	g_hash_table_destroy(pref_hash);
+	pref_hash = NULL;
+    }
+
+    return;
+}
+
+
+/* Add a preference to the key index */
+
+static void index_user_pref(UserPrefData *Preference)
+{
+    if (pref_hash == NULL)
+	pref_hash = g_hash_table_new(g_str_hash, g_str_equal);
+
+    g_hash_table_insert(pref_hash, Preference->key, Preference);
+
+    return;
+}
+
+
+/* Parse a preference value once into each typed form it validly represents */
+
+static void parse_pref_val(UserPrefData *Preference)
+{
+    char *end, *home_str;
+    long l;
+    double d;
+    const char *s;
+    int i;
+
+    const char *true_vals[] = { "Y", "YES", "TRUE", "ON", "1" };
+    const char *false_vals[] = { "N", "NO", "FALSE", "OFF", "0" };
+
+    s = Preference->val;
+    Preference->types = 0;
+    Preference->path = Preference->val;
+
+    if (*s == '\0')
+    	return;
+
+    /* Integer */
+    errno = 0;
+    l = strtol(s, &end, 10);
+
+    if (errno == 0 && *end == '\0' && l >= INT_MIN && l <= INT_MAX)
+    {
+	Preference->i_val = (int) l;
+	Preference->types |= PREF_TYPE_INT;
+    }
+
+    /* Double (an integer is also a valid double) */
+    errno = 0;
+    d = g_ascii_strtod(s, &end);
+
+    if (errno == 0 && *end == '\0')
+    {
+	Preference->d_val = d;
+	Preference->types |= PREF_TYPE_DBL;
+    }
+
+    /* Boolean */
+    for(i = 0; i < 5; i++)
+    {
+    	if (g_ascii_strcasecmp(s, true_vals[i]) == 0)
+    	{
+	    Preference->b_val = TRUE;
+	    Preference->types |= PREF_TYPE_BOOL;
+	    break;
+    	}
+
+    	if (g_ascii_strcasecmp(s, false_vals[i]) == 0)
+    	{
+	    Preference->b_val = FALSE;
+	    Preference->types |= PREF_TYPE_BOOL;
+	    break;
+    	}
+    }
+
+    /* Path - expand home directory */
+    if (*s == '~' && (*(s + 1) == '/' || *(s + 1) == '\0') && (home_str = home_dir()) != NULL)
+    {
+	Preference->path = (char *) malloc(strlen(home_str) + strlen(s));
+	sprintf(Preference->path, "%s%s", home_str, s + 1);
+    }
+
+    return;
+}
+
+
+/* Free any separately allocated typed value */
+
+static void free_pref_val(UserPrefData *Preference)
+{
+    if (Preference->path != NULL && Preference->path != Preference->val)
+	free(Preference->path);
+
+    Preference->path = NULL;
 
     return;
 }
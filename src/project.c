@@ -57,8 +57,6 @@
 /* Prototypes */
 
 ProjectData * new_proj_data();
-int convert_exif(ImgExif *, int *, int *, int *, GtkWidget *);
-void free_img(gpointer);
 int load_proj_from_file(ProjectData *, char *, GtkWidget *);
 int load_files(GList **, char **, const char *, const char *, GtkWidget *);
 char * get_xmltag_val(char **, const char *, const char *, int, GtkWidget *);
@@ -75,17 +73,24 @@ int read_proj_file(FILE *, char *, int, GtkWidget *);
 int get_hdr_sz();
 int get_image_sz(int, GList *);
 void set_image_xml(char **, GList *, int);
+int load_badpix(BadPixMap *, char **, GtkWidget *);
+void set_badpix_xml(char *, BadPixMap *);
 
 extern int load_exif_data(Image *, char *, GtkWidget *);
+extern Image * img_new(const char *, const char *);
+extern void free_img(gpointer);
 extern int remove_dir(const char *);
 extern int get_user_pref(char *, char **);
-extern int val_str2numb(char *, int *, char *, GtkWidget *);
 extern int check_dir(char *);
 extern int make_dir(char *);
 extern int get_file_stat(char *, struct stat *);
 extern void log_msg(char*, char*, char*, GtkWidget*);
 extern void view_menu_sensitive(MainUi *, int);
 extern gint query_dialog(GtkWidget *, char *, char *);
+extern int frame_sessions(GList **, int);
+extern void stop_processing(MainUi *);
+extern void video_close_all();
+extern void badpix_free(BadPixMap *);
 
 
 /* Globals */
@@ -103,10 +108,17 @@ static const char *proj_tags[][2] =
       { "<Images>", "</Images>" },
         { "<File>", "</File>" },
       { "<Darks>", "</Darks>" },
-        { "<File>", "</File>" }
+        { "<File>", "</File>" },
+      { "<Flats>", "</Flats>" },
+        { "<File>", "</File>" },
+      { "<DarkFlats>", "</DarkFlats>" },
+        { "<File>", "</File>" },
+      { "<Bias>", "</Bias>" },
+        { "<File>", "</File>" },
+      { "<BadPixels>", "</BadPixels>" }
 };
 
-static const int Tag_Count = 12;
+static const int Tag_Count = 19;
 static const char *debug_hdr = "DEBUG-project.c ";
 
 static const int starsal_idx = 1;
@@ -120,6 +132,10 @@ static const int img_idx = 8;
 static const int dark_idx = 10;
 static const int file1_idx = 9;
 static const int file2_idx = 11;
+static const int flat_idx = 12;
+static const int darkflat_idx = 14;
+static const int bias_idx = 16;
+static const int badpix_idx = 18;
 
 
 
@@ -135,52 +151,6 @@ ProjectData * new_proj_data()
 }
 
 
-/* Convert iso, width and height to integer */
-
-int convert_exif(ImgExif *e, int *iso, int *w, int *h, GtkWidget *window)
-{
-    if (val_str2numb(e->iso, iso, e->iso, window) == FALSE)
-	return FALSE;
-
-    if (val_str2numb(e->width, w, e->width, window) == FALSE)
-	return FALSE;
-
-    if (val_str2numb(e->height, h, e->height, window) == FALSE)
-	return FALSE;
-
-    return TRUE;
-}
-
-
-/* Free an image or dark */
-
-void free_img(gpointer data)
-{
-    Image *img;
-    ImgExif *e;
-
-    img = (Image *) data;
-    e = &(img->img_exif);
-
-    free(img->nm);
-    free(img->path);
-
-    free(e->make);
-    free(e->model);
-    free(e->type);
-    free(e->date);
-    free(e->width);
-    free(e->height);
-    free(e->iso);
-    free(e->exposure);
-    free(e->f_stop);
-
-    free(img);
-
-    return;
-}
-
-
 /* Open a project */
 
 ProjectData * open_project(char *nm, GtkWidget *window)
@@ -260,6 +230,22 @@ int load_proj_from_file(ProjectData *proj, char *buf, GtkWidget *window)
     load_files(&(proj->images_gl), &buf_ptr, proj_tags[img_idx][0], proj_tags[img_idx][1], window);
     load_files(&(proj->darks_gl), &buf_ptr, proj_tags[dark_idx][0], proj_tags[dark_idx][1], window);
 
+    /* Imaging sessions (the order is kept as the base image is an index) */
+    frame_sessions(&(proj->images_gl), FALSE);
+    frame_sessions(&(proj->darks_gl), FALSE);
+
+    /* Flats, Dark Flats and Bias (not in older project files) */
+    if (strstr(buf_ptr, proj_tags[flat_idx][0]) != NULL)
+    {
+	load_files(&(proj->flats_gl), &buf_ptr, proj_tags[flat_idx][0], proj_tags[flat_idx][1], window);
+	load_files(&(proj->darkflats_gl), &buf_ptr, proj_tags[darkflat_idx][0], proj_tags[darkflat_idx][1], window);
+	load_files(&(proj->bias_gl), &buf_ptr, proj_tags[bias_idx][0], proj_tags[bias_idx][1], window);
+    }
+
+    /* Bad pixel map (if found yet) */
+    if (strstr(buf_ptr, proj_tags[badpix_idx][0]) != NULL)
+	load_badpix(&(proj->badpix), &buf_ptr, window);
+
     return TRUE;
 }
 
@@ -289,6 +275,10 @@ int load_files(GList **gl, char **buf_ptr, const char *start_tag, const char *en
 
     while(end_ptr > ptr)
     {
+	/* Files beyond the end tag belong to the next list */
+	if ((p = strstr(ptr, proj_tags[file1_idx][0])) == NULL || p > end_ptr)
+	    break;
+
 	fn = get_xmltag_val(&ptr, proj_tags[file1_idx][0], proj_tags[file1_idx][1], FALSE, NULL);
 	
 	//if (fn == NULL || ptr > end_ptr)
@@ -297,25 +287,21 @@ int load_files(GList **gl, char **buf_ptr, const char *start_tag, const char *en
 
 	/* Set up an image */
 	Image *img;
-	img = (Image *) malloc(sizeof(Image));
 
 	if ((p = strrchr(fn, '/')) == NULL)
-	    p = fn;
-	else
-	    p++;
-
-	img->nm = strdup(p);
-
-	if (p == fn)
 	{
-	    img->path = NULL;
+	    img = img_new(fn, NULL);
 	}
 	else
 	{
-	    img->path = strndup(fn, p - fn - 1);
+	    /* Directory and name split in place for the record */
+	    *p = '\0';
+	    img = img_new(p + 1, fn);
+	    *p = '/';
 	    
 	    if (! load_exif_data(img, fn, window))
 	    {
+	    	free_img(img);
 	    	free(fn);
 	    	continue;
 	    }
@@ -333,6 +319,46 @@ int load_files(GList **gl, char **buf_ptr, const char *start_tag, const char *en
 }
 
 
+/* Extract the bad pixel map from the buffer - width height count, then the pixel offsets */
+
+int load_badpix(BadPixMap *bp, char **buf_ptr, GtkWidget *window)
+{
+    int i;
+    char *tmp_tag, *p, *e;
+
+    if ((tmp_tag = get_xmltag_val(buf_ptr, proj_tags[badpix_idx][0], proj_tags[badpix_idx][1], TRUE, window)) == NULL)
+    	return FALSE;
+
+    memset(bp, 0, sizeof(BadPixMap));
+    bp->width = (int) strtol(tmp_tag, &p, 10);
+    bp->height = (int) strtol(p, &p, 10);
+    bp->n = (int) strtol(p, &p, 10);
+
+    if (bp->width <= 0 || bp->height <= 0 || bp->n < 0)
+    {
+	log_msg("SYS9014", (char *) proj_tags[badpix_idx][0], "SYS9014", window);
+	free(tmp_tag);
+	memset(bp, 0, sizeof(BadPixMap));
+    	return FALSE;
+    }
+
+    bp->off = (guint32 *) malloc((bp->n + 1) * sizeof(guint32));
+
+    for(i = 0; i < bp->n; i++, p = e)
+    {
+	bp->off[i] = (guint32) strtoul(p, &e, 10);
+
+	if (e == p)
+	    break;
+    }
+
+    bp->n = i;
+    free(tmp_tag);
+
+    return TRUE;
+}
+
+
 /* Extract the value of a xml tag from the buffer */
 
 char * get_xmltag_val(char **buf_ptr, const char *start_tag, const char *end_tag, int err, GtkWidget *window)
@@ -382,6 +408,10 @@ int proj_close_check_save(ProjectData *proj, MainUi *m_ui)
 {
     int action = FALSE;     // To be coded later with dialog
 
+    /* Any processing uses the project images (and videos) */
+    stop_processing(m_ui);
+    video_close_all();
+
     if (action == FALSE)
     {
 	close_project(proj);
@@ -419,6 +449,8 @@ void close_main_display(MainUi *m_ui)
     if (m_ui->base_pixbuf != NULL)
 	g_object_unref (m_ui->base_pixbuf);
 
+    m_ui->base_pixbuf = NULL;
+
     free(m_ui->img_fn);
     gtk_image_clear(GTK_IMAGE (m_ui->image_area));
     view_menu_sensitive(m_ui, FALSE);
@@ -435,12 +467,19 @@ void close_main_display(MainUi *m_ui)
 
 void close_project(ProjectData *proj)
 {
-    /* Free the listed images and darks */
+    /* Free the listed images and calibration frames */
     g_list_free_full(proj->images_gl, (GDestroyNotify) free_img);
     g_list_free_full(proj->darks_gl, (GDestroyNotify) free_img);
+    g_list_free_full(proj->flats_gl, (GDestroyNotify) free_img);
+    g_list_free_full(proj->darkflats_gl, (GDestroyNotify) free_img);
+    g_list_free_full(proj->bias_gl, (GDestroyNotify) free_img);
+    badpix_free(&(proj->badpix));
 
     proj->images_gl = NULL;
     proj->darks_gl = NULL;
+    proj->flats_gl = NULL;
+    proj->darkflats_gl = NULL;
+    proj->bias_gl = NULL;
 
     /* Free remaining */
     free(proj->project_name);
@@ -488,9 +527,15 @@ int save_proj_init(ProjectData *proj, GtkWidget *window)
     /* Add size for project title, path, status and base images */
     buf_sz += (nml + descl + pathl + 6);
 
-    /* Add size for images and darks */
+    /* Add size for images and calibration frames (all use the File tag) */
     buf_sz += get_image_sz(strlen(proj_tags[file1_idx][0]), proj->images_gl);
     buf_sz += get_image_sz(strlen(proj_tags[file2_idx][0]), proj->darks_gl);
+    buf_sz += get_image_sz(strlen(proj_tags[file2_idx][0]), proj->flats_gl);
+    buf_sz += get_image_sz(strlen(proj_tags[file2_idx][0]), proj->darkflats_gl);
+    buf_sz += get_image_sz(strlen(proj_tags[file2_idx][0]), proj->bias_gl);
+
+    /* Add size for the bad pixel map (offsets up to 10 digits and a separator) */
+    buf_sz += 40 + (proj->badpix.n * 11);
 
     /* Prepare the project header details and tags */
     buf = (char *) malloc(buf_sz);
@@ -521,6 +566,12 @@ int save_proj_init(ProjectData *proj, GtkWidget *window)
     /* Prepare the Prepare the file names and tags */
     set_image_xml(&buf, proj->images_gl, img_idx);
     set_image_xml(&buf, proj->darks_gl, dark_idx);
+    set_image_xml(&buf, proj->flats_gl, flat_idx);
+    set_image_xml(&buf, proj->darkflats_gl, darkflat_idx);
+    set_image_xml(&buf, proj->bias_gl, bias_idx);
+
+    if (proj->badpix.width > 0)
+	set_badpix_xml(buf, &(proj->badpix));
 
     /* Prepare the project header end tag */
     sprintf(buf, "%s%s\n", buf, proj_tags[starsal_idx][1]);		// End StarsAl tag
@@ -600,6 +651,25 @@ void set_image_xml(char **buf, GList *gl, int idx)
 }
 
 
+/* Set up the bad pixel map xml - 16 offsets a line */
+
+void set_badpix_xml(char *buf, BadPixMap *bp)
+{
+    int i;
+    char *p;
+
+    p = buf + strlen(buf);
+    p += sprintf(p, "%s%d %d %d", proj_tags[badpix_idx][0], bp->width, bp->height, bp->n);
+
+    for(i = 0; i < bp->n; i++)
+	p += sprintf(p, "%c%u", (i % 16 == 0) ? '\n' : ' ', bp->off[i]);
+
+    sprintf(p, "\n%s\n", proj_tags[badpix_idx][1]);
+
+    return;
+}
+
+
 /* Remove a project to the backup directory */
 
 int remove_proj(ProjectData *proj, MainUi *m_ui)
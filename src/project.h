@@ -41,6 +41,14 @@
 #define PROJECT_H
 
 
+typedef struct _BadPixMap
+{
+    int width, height;			// Frame size (0 if there is no map)
+    int n;
+    guint32 *off;			// Pixel offsets (y * width + x), ascending
+} BadPixMap;
+
+
 typedef struct _ProjectData
 {
     char *project_name;
@@ -49,6 +57,10 @@ typedef struct _ProjectData
     int status, baseimg, basedark;
     GList *images_gl;
     GList *darks_gl;
+    GList *flats_gl;
+    GList *darkflats_gl;
+    GList *bias_gl;
+    BadPixMap badpix;
 } ProjectData;
 
 
@@ -66,11 +78,50 @@ typedef struct _ImgExif
 } ImgExif;
 
 
+typedef struct _ImgQuality
+{
+    int measured;			// Set by registration
+    int n_stars;
+    float fwhm;				// Median star full width at half maximum (pixels)
+    float ecc;				// Median star eccentricity (0 is round)
+    float bg, noise;			// Sky background and noise (0 - 65535)
+    float score;			// Relative to the best frame (0 - 1), the stacking weight
+    int rejected;			// Left out of registration and stacking
+} ImgQuality;
+
+
+// Image records and their strings are held in the image store (imgstore.c), the strings
+// shared - make with img_new and free with free_img, never free or change the strings.
+
 typedef struct _Image
 {
     char *nm;
     char *path;
     ImgExif img_exif;
+    gint64 taken;			// Exif date, seconds from 1970 (0 if unknown)
+    int session;			// Imaging session (night) from 0, by date taken
+    int vframes;			// Frames in a video (video.c), 0 for a still image
+    int vframe;				// Frame of the video (1 - vframes) or 0 for the whole video
+    ImgQuality quality;
 } Image;
 
+
+// Frame table (frametable.c) - the Exif values of a list of frames parsed once into an array
+// each, row i being the i'th frame of the list. Checks and selections are scans of the arrays.
+
+#define FT_EXPOSURE 0x01
+#define FT_ISO 0x02
+#define FT_SIZE 0x04
+#define FT_ALL (FT_EXPOSURE | FT_ISO | FT_SIZE)
+
+typedef struct _FrameTable
+{
+    int n;
+    Image **img;
+    double *exposure;			// Seconds (0 if unknown)
+    gint64 *time;			// Date taken, seconds from 1970 (0 if unknown)
+    int *iso;				// 0 if unknown
+    int *width, *height;
+} FrameTable;
+
 #endif
@@ -30,6 +30,11 @@
 */
 
 
+/* Defines */
+
+#define IMG_GRP_SHOW 8			// Exposure groups listed
+
+
 /* Includes */
 
 #include <gtk/gtk.h>
@@ -59,7 +64,7 @@ int project_init(GtkWidget *);
 ProjectUi * new_proj_ui();
 void project_ui(ProjectData *, ProjectUi *);
 void proj_data(ProjectData *, ProjectUi *);
-void select_images(SelectListUi *, ProjectUi *, char *);
+void select_images(SelectListUi *, ProjectUi *, char *, char *);
 void set_proj_ui(ProjectData *, ProjectUi *);
 void set_listbox_ui(SelectListUi *, GList *);
 void show_list(SelectListUi *, GSList *, ProjectUi *p_ui);
@@ -68,13 +73,13 @@ void remove_image_list_row(SelectListUi *, GtkWidget *, GtkListBoxRow *);
 void clear_image_list(SelectListUi *, GtkWidget *);
 int proj_save_reqd(ProjectData *, ProjectUi *);
 int proj_validate(ProjectUi *);
-int validate_images(GList *, ImgExif *, ProjectUi *);
-void validate_darks(GList **, ImgExif *, ProjectUi *);
-void check_arr_int(int, int *, int *);
-void check_arr_s(char *, char **, int *);
+FrameTable * validate_images(GList **, ProjectUi *);
+void validate_darks(GList **, FrameTable *, ProjectUi *);
+void validate_calib(GList **, FrameTable *, int, char *, ProjectUi *);
 void setup_proj(ProjectData *, ProjectUi *p_ui);
 //void copy_glist(GList *, GList *);
 static void window_cleanup(GtkWidget *, ProjectUi *);
+static int drop_unmatched(GList **, FrameTable *, int);
 
 static void OnProjCancel(GtkWidget*, gpointer);
 static gboolean OnProjWinDelete(GtkWidget*, GdkEvent *, gpointer);
@@ -89,21 +94,30 @@ extern void display_proj(ProjectData *, MainUi *);
 extern int save_proj_init(ProjectData *, GtkWidget *);
 extern Image * setup_image(char *, char *, char *, ProjectUi *);
 extern void free_img(gpointer);
-extern int convert_exif(ImgExif *, int *, int *, int *, GtkWidget *);
+extern void badpix_free(BadPixMap *);
+extern FrameTable * frame_table_new(GList *);
+extern void frame_table_free(FrameTable *);
+extern int frame_table_match(FrameTable *, FrameTable *, int, int, char *);
+extern int frame_table_drop(GList **, char *);
+extern int frame_table_group(FrameTable *, int, int *);
+extern int frame_sessions(GList **, int);
 extern void create_label2(GtkWidget **, char *, char *, GtkWidget *, int, int, int, int);
 extern void create_label3(GtkWidget **, char *, char *);
 extern void create_label4(GtkWidget **, char *, char *, gint, gint, GtkAlign);
 extern void create_entry(GtkWidget **, char *, GtkWidget *, int, int);
 extern int get_user_pref(char *, char **);
+extern int get_user_pref_bool(char *, int *);
 extern void basename_dirname(char *, char **, char **);
 extern int check_dir(char *);
 extern void log_msg(char*, char*, char*, GtkWidget*);
 extern void app_msg(char*, char*, GtkWidget*);
+extern gint query_dialog(GtkWidget *, char *, char *);
 extern void register_window(GtkWidget *);
 extern void deregister_window(GtkWidget *);
 extern int remove_dir(const char *);
 extern void string_trim(char *);
 extern char * image_type(char *, GtkWidget *);
+extern void stop_processing(MainUi *);
 
 
 /* Globals */
@@ -282,10 +296,17 @@ void proj_data(ProjectData *proj, ProjectUi *p_ui)
     gtk_box_pack_start (GTK_BOX (p_ui->proj_cntr), p_ui->title_fr, FALSE, FALSE, 0);
 
     /* Images selection */
-    select_images(&(p_ui->images), p_ui, "Select Images");
+    select_images(&(p_ui->images), p_ui, "Select Images", NULL);
+
+    /* Calibration frames - a tab each */
+    p_ui->calib_nb = gtk_notebook_new();
+    gtk_widget_set_margin_top (GTK_WIDGET (p_ui->calib_nb), 5);
+    gtk_box_pack_start (GTK_BOX (p_ui->proj_cntr), p_ui->calib_nb, FALSE, FALSE, 0);
 
-    /* Darks */
-    select_images(&(p_ui->darks), p_ui, "Select Darks");
+    select_images(&(p_ui->darks), p_ui, "Select Darks", "Darks");
+    select_images(&(p_ui->flats), p_ui, "Select Flats", "Flats");
+    select_images(&(p_ui->darkflats), p_ui, "Select Dark Flats", "Dark Flats");
+    select_images(&(p_ui->bias), p_ui, "Select Bias", "Bias");
 
     /* Apply values if required */
     if (proj->project_name)
@@ -295,9 +316,9 @@ void proj_data(ProjectData *proj, ProjectUi *p_ui)
 }
 
 
-/* Widgets for selecting images and darks */
+/* Widgets for selecting images or calibration frames - calibration frames go on a notebook tab */
 
-void select_images(SelectListUi *lst, ProjectUi *p_ui, char *desc)
+void select_images(SelectListUi *lst, ProjectUi *p_ui, char *desc, char *tab)
 {  
     GtkWidget *heading_lbl, *row;
 
@@ -335,7 +356,7 @@ void select_images(SelectListUi *lst, ProjectUi *p_ui, char *desc)
     gtk_box_pack_start (GTK_BOX (lst->btn_vbox), lst->remove_btn, FALSE, FALSE, 0);
     g_signal_connect(lst->remove_btn, "clicked", G_CALLBACK(OnListRemove), (gpointer) p_ui);
 
-    /* Images or Darks list */
+    /* Images or calibration frames list */
     lst->list_box = gtk_list_box_new();
     lst->sel_handler_id = g_signal_connect(lst->list_box, "row-selected", G_CALLBACK(OnRowSelect), (gpointer) lst);
 
@@ -368,7 +389,11 @@ void select_images(SelectListUi *lst, ProjectUi *p_ui, char *desc)
     gtk_box_pack_start (GTK_BOX (lst->sel_vbox), lst->dir_lbl, FALSE, FALSE, 0);
     gtk_box_pack_start (GTK_BOX (lst->sel_vbox), lst->meta_lbl, FALSE, FALSE, 0);
     gtk_container_add(GTK_CONTAINER (lst->sel_fr), lst->sel_vbox);
-    gtk_box_pack_start (GTK_BOX (p_ui->proj_cntr), lst->sel_fr, FALSE, FALSE, 0);
+
+    if (tab == NULL)
+	gtk_box_pack_start (GTK_BOX (p_ui->proj_cntr), lst->sel_fr, FALSE, FALSE, 0);
+    else
+	gtk_notebook_append_page (GTK_NOTEBOOK (p_ui->calib_nb), lst->sel_fr, gtk_label_new(tab));
 
     return;
 }
@@ -383,6 +408,9 @@ void set_proj_ui(ProjectData *proj, ProjectUi *p_ui)
 
     set_listbox_ui(&(p_ui->images), proj->images_gl);
     set_listbox_ui(&(p_ui->darks), proj->darks_gl);
+    set_listbox_ui(&(p_ui->flats), proj->flats_gl);
+    set_listbox_ui(&(p_ui->darkflats), proj->darkflats_gl);
+    set_listbox_ui(&(p_ui->bias), proj->bias_gl);
 
     return;
 }
@@ -618,7 +646,7 @@ int proj_save_reqd(ProjectData *proj, ProjectUi *p_ui)
 int proj_validate(ProjectUi *p_ui)
 {
     const gchar *nm;
-    ImgExif exif;
+    FrameTable *imgs, *flats;
 
     /* Project name must be present */
     nm = gtk_entry_get_text (GTK_ENTRY (p_ui->proj_nm));
@@ -631,145 +659,129 @@ int proj_validate(ProjectUi *p_ui)
     }
 
     /* Check all the images for exposure consistency */
-    if ((validate_images(p_ui->images.img_files, &exif, p_ui)) == FALSE)
+    if ((imgs = validate_images(&(p_ui->images.img_files), p_ui)) == NULL)
     	return FALSE;
 
+    /* Flats and bias need only match the image size, dark flats must match the flats exposure */
+    validate_calib(&(p_ui->flats.img_files), imgs, FT_SIZE, "flats", p_ui);
+    validate_calib(&(p_ui->bias.img_files), imgs, FT_SIZE, "bias frames", p_ui);
+
+    flats = frame_table_new(p_ui->flats.img_files);
+    validate_calib(&(p_ui->darkflats.img_files), flats, FT_ALL, "dark flats", p_ui);
+    frame_table_free(flats);
+
     /* Discard and warn of unusable darks */
-    validate_darks(&(p_ui->darks.img_files), &exif, p_ui);
+    validate_darks(&(p_ui->darks.img_files), imgs, p_ui);
+    frame_table_free(imgs);
 
     return TRUE;
 }
 
 
-/* Validate images for exposure consistency (iso, exposure, width, height) */
+/* Validate images for exposure consistency (iso, exposure, width, height) - mixed images are
+   grouped on their exposure and the user may keep the largest group. Returns the table of the
+   images kept (NULL if not usable). */
 
-int validate_images(GList *img_files, ImgExif *exif, ProjectUi *p_ui)
+FrameTable * validate_images(GList **img_files, ProjectUi *p_ui)
 {
-    typedef struct
-    {
-	int iso;
-	char *exp;
-	int width;
-	int height;
-    } ExArray;
-
-    ExArray *img_arr;
-    int i, img_cnt, iso, w, h, r;
-    int iso_fnd, exp_fnd, w_fnd, h_fnd;
+    int i, n, g, big;
+    int *grp, *cnt, *first;
+    char *keep, *msg, *p;
+    FrameTable *imgs;
     Image *img;
-    ImgExif e;
-    GList *l;
 
-    /* Set up a dynamic array as count of each element to check */
-    img_cnt = g_list_length(img_files);
-    img_arr = malloc(img_cnt * sizeof(ExArray));
-    memset(img_arr, 0, img_cnt * sizeof(ExArray));
-    r = FALSE;
-
-    if (img_cnt == 0)
+    if (*img_files == NULL)
     {
 	log_msg("APP0015", NULL, "APP0015", p_ui->window);
-	return r;
+	return NULL;
     }
 
-    /* Iterate each image file and check the exposure data */
-    for(l = img_files; l != NULL; l = l->next)
+    /* Group on the exposure signature */
+    imgs = frame_table_new(*img_files);
+    grp = (int *) malloc(imgs->n * sizeof(int));
+    n = frame_table_group(imgs, FT_ALL, grp);
+
+    if (n == 1)
     {
-	img = (Image *) l->data;
-	e = img->img_exif;
-	iso_fnd = exp_fnd = w_fnd = h_fnd = FALSE;
+	free(grp);
+	return imgs;
+    }
 
-	if (convert_exif(&e, &iso, &w, &h, p_ui->window) == FALSE)
-	    break;
+    /* Size of each group and its first image (groups are numbered in order of their first) */
+    cnt = (int *) malloc(n * sizeof(int) * 2);
+    first = cnt + n;
+    memset(cnt, 0, n * sizeof(int));
 
-	for(i = 0; i < img_cnt; i++)
-	{
-	    check_arr_s(e.exposure, &(img_arr[i].exp), &exp_fnd);
-	    check_arr_int(iso, &(img_arr[i].iso), &iso_fnd);
-	    check_arr_int(w, &(img_arr[i].width), &w_fnd);
-	    check_arr_int(h, &(img_arr[i].height), &h_fnd);
+    for(i = 0, g = 0; i < imgs->n; i++)
+    {
+	if (grp[i] == g)
+	    first[g++] = i;
 
-	    if (iso_fnd == TRUE  &&  exp_fnd == TRUE  &&  w_fnd == TRUE  &&  h_fnd == TRUE)
-	    	break;
-	};
-    };
+    	cnt[grp[i]]++;
+    }
+
+    for(g = 1, big = 0; g < n; g++)
+    	if (cnt[g] > cnt[big])
+	    big = g;
 
-    /* Check for errors */
-    for(i = 0; i < img_cnt; i++)
+    /* List the groups and log them */
+    msg = (char *) malloc((MIN(n, IMG_GRP_SHOW) + 4) * 128);
+    p = msg + sprintf(msg, "The images have %d different exposure settings -\n\n", n);
+
+    for(g = 0; g < MIN(n, IMG_GRP_SHOW); g++)
     {
-	if (img_arr[i].iso == 0  &&  img_arr[i].width == 0  &&  img_arr[i].width == 0  && !(img_arr[i].exp))
-	    break;
+	img = imgs->img[first[g]];
+	p += sprintf(p, "    %d images - %.30s  ISO %d  %d x %d\n", cnt[g], img->img_exif.exposure,
+		     imgs->iso[first[g]], imgs->width[first[g]], imgs->height[first[g]]);
     }
 
-    if (i > 1)
+    if (n > IMG_GRP_SHOW)
+	p += sprintf(p, "    ... and %d more\n", n - IMG_GRP_SHOW);
+
+    sprintf(p, "\nKeep only the %d images of the largest group?", cnt[big]);
+
+    snprintf(app_msg_extra, sizeof(app_msg_extra), "%s", msg);
+    log_msg("APP0012", NULL, NULL, NULL);
+
+    /* Keep the largest group (the rest are discarded) or go back to change the images */
+    if (query_dialog(p_ui->window, "%s", msg) == GTK_RESPONSE_YES)
     {
-	/* More than one row means images are not consistent */
-	log_msg("APP0012", NULL, "APP0012", p_ui->window);
+	keep = (char *) malloc(imgs->n);
+
+	for(i = 0; i < imgs->n; i++)
+	    keep[i] = (grp[i] == big);
+
+	frame_table_drop(img_files, keep);
+	frame_table_free(imgs);
+	imgs = frame_table_new(*img_files);
+	free(keep);
     }
     else
     {
-    	/* The final ImgExif will still have all correct values to return */
-    	exif->exposure = strdup(e.exposure);
-    	exif->iso = strdup(e.iso);
-    	exif->width = strdup(e.width);
-    	exif->height = strdup(e.height);
-    	r = TRUE;
+	frame_table_free(imgs);
+	imgs = NULL;
     }
 
-    /* Free the array */
-    for(i = 0; i < img_cnt; i++)
-    {
-    	if (img_arr[i].exp)
-    	    free(img_arr[i].exp);
-    }
+    free(msg);
+    free(cnt);
+    free(grp);
 
-    free(img_arr);
-    
-    return r;
+    return imgs;
 }
 
 
 /* Validate darks for exposure consistency with images list - discard unusable files */
+/* Darks are scaled to fit each image if preferred, when the exposure time need not match */
 
-void validate_darks(GList **darks_files, ImgExif *exif, ProjectUi *p_ui)
+void validate_darks(GList **darks_files, FrameTable *imgs, ProjectUi *p_ui)
 {
-    int w;
-    Image *img;
-    ImgExif e;
-    GList *l;
+    int w, scale;
     
-    /* Iterate each dark file and check the exposure data */
-    w = 0;
-    l = g_list_last(*darks_files); 
+    if (! get_user_pref_bool(DARK_SCALE, &scale))
+    	scale = FALSE;
 
-    while(l != NULL)
-    {
-	img = (Image *) l->data;
-	e = img->img_exif;
-
-	/* Discard any darks that do not match image exposure data */
-	if ((strcmp(e.exposure, exif->exposure) != 0) ||
-	    (strcmp(e.iso, exif->iso) != 0)      ||
-	    (strcmp(e.width, exif->width) != 0)      ||
-	    (strcmp(e.height, exif->height) != 0))
-	{
-	    free_img(img);
-	    l->data = NULL;
-	    *darks_files = g_list_delete_link(*darks_files, l);
-	    l = g_list_last(*darks_files); 
-	    w++;
-	}
-	else
-	{
-	    l = l->prev;
-	}
-    }
-
-    /* Free the saved exif */
-    free(exif->exposure);
-    free(exif->iso);
-    free(exif->width);
-    free(exif->height);
+    /* Discard any darks that do not match image exposure data */
+    w = drop_unmatched(darks_files, imgs, (scale) ? (FT_ISO | FT_SIZE) : FT_ALL);
 
     /* Warn that one or more darks have been discarded */
     if (w > 0)
@@ -782,42 +794,50 @@ void validate_darks(GList **darks_files, ImgExif *exif, ProjectUi *p_ui)
 }
 
 
-/* Check if an integer exif item is present and add if necessary */
+/* Validate calibration frames against the first of the reference frames on the fields given
+   (all are discarded if there is no reference) - discard unusable files */
 
-void check_arr_int(int i, int *arr_i, int *fnd)
+void validate_calib(GList **files, FrameTable *ref, int fields, char *desc, ProjectUi *p_ui)
 {
-    if (*arr_i == 0)
-    {
-	*arr_i = i;
-	*fnd = TRUE;
-    }
-    else
+    int w;
+
+    w = drop_unmatched(files, ref, fields);
+
+    if (w > 0)
     {
-	if (*arr_i == i)
-	    *fnd = TRUE;
+    	if (ref->n == 0)
+	    sprintf(app_msg_extra, "There is nothing to match the %d %s against.", w, desc);
+	else
+	    sprintf(app_msg_extra, "Exposure data was found in %d %s that \ndid not match.", w, desc);
+
+    	app_msg("APP0022", desc, p_ui->window);
     }
 
     return;
 }
 
 
-/* Check if a string exif item is present and add if necessary */
+/* Remove the frames not matching the first reference frame on the fields given - returns the
+   number removed */
 
-void check_arr_s(char *s, char **arr_s, int *fnd)
+static int drop_unmatched(GList **files, FrameTable *ref, int fields)
 {
-    if (! (*arr_s))
-    {
-	*arr_s = (char *) malloc(strlen(s) + 1);
-	strcpy(*arr_s, s);
-	*fnd = TRUE;
-    }
-    else
-    {
-	if (strcmp(*arr_s, s) == 0)
-	    *fnd = TRUE;
-    }
+    int w;
+    char *keep;
+    FrameTable *t;
 
-    return;
+    if (*files == NULL)
+    	return 0;
+
+    t = frame_table_new(*files);
+    keep = (char *) malloc(t->n);
+    frame_table_match(t, ref, 0, fields, keep);
+    w = frame_table_drop(files, keep);
+
+    free(keep);
+    frame_table_free(t);
+
+    return w;
 }
 
 
@@ -885,15 +905,25 @@ void setup_proj(ProjectData *proj, ProjectUi *p_ui)
 
     strcpy(proj->project_desc, desc);
 
-    /* Images and Darks */
-    if (proj->images_gl != NULL)
-	g_list_free (proj->images_gl);
-
-    if (proj->darks_gl != NULL)
-	g_list_free (proj->darks_gl);
+    /* Images and calibration frames */
+    g_list_free (proj->images_gl);
+    g_list_free (proj->darks_gl);
+    g_list_free (proj->flats_gl);
+    g_list_free (proj->darkflats_gl);
+    g_list_free (proj->bias_gl);
 
     proj->images_gl = g_list_copy(p_ui->images.img_files);
     proj->darks_gl = g_list_copy(p_ui->darks.img_files);
+    proj->flats_gl = g_list_copy(p_ui->flats.img_files);
+    proj->darkflats_gl = g_list_copy(p_ui->darkflats.img_files);
+    proj->bias_gl = g_list_copy(p_ui->bias.img_files);
+
+    /* Date order with the imaging sessions marked (only once the lists have validated) */
+    frame_sessions(&(proj->images_gl), TRUE);
+    frame_sessions(&(proj->darks_gl), TRUE);
+
+    /* Any bad pixel map is for the old calibration frames */
+    badpix_free(&(proj->badpix));
 
     /* Project status and Base Images */
     proj->status = 1;
@@ -993,6 +1023,8 @@ void OnListClear(GtkWidget *clear_btn, gpointer user_data)
     if (lst->img_files == NULL)
     	return;
 
+    /* Any processing may be using the images */
+    stop_processing(p_ui->m_ui);
     clear_image_list(lst, lst->list_box);
 
     return;
@@ -1018,6 +1050,8 @@ void OnListRemove(GtkWidget *remove_btn, gpointer user_data)
     	return;
     }
 
+    /* Any processing may be using the image */
+    stop_processing(p_ui->m_ui);
     remove_image_list_row(lst, lst->list_box, row);
 
     return;
@@ -1070,6 +1104,9 @@ void OnProjSave(GtkWidget *btn, gpointer user_data)
     if ((save_indi = proj_save_reqd(proj, ui)) == FALSE)
     	return;
 
+    /* Validation drops frames and the project lists are replaced - stop any processing first */
+    stop_processing(m_ui);
+
     /* Error check */
     if (proj_validate(ui) == FALSE)
     	return;
@@ -1147,10 +1184,16 @@ static void window_cleanup(GtkWidget *window, ProjectUi *ui)
     /* Unwanted callback action */
     g_signal_handler_block (ui->images.list_box, ui->images.sel_handler_id);
     g_signal_handler_block (ui->darks.list_box, ui->darks.sel_handler_id);
+    g_signal_handler_block (ui->flats.list_box, ui->flats.sel_handler_id);
+    g_signal_handler_block (ui->darkflats.list_box, ui->darkflats.sel_handler_id);
+    g_signal_handler_block (ui->bias.list_box, ui->bias.sel_handler_id);
     
-    /* Free the images and darks lists, but not the images attached as they are now attached to the project */
+    /* Free the image lists, but not the images attached as they are now attached to the project */
     g_list_free(ui->images.img_files);
     g_list_free(ui->darks.img_files);
+    g_list_free(ui->flats.img_files);
+    g_list_free(ui->darkflats.img_files);
+    g_list_free(ui->bias.img_files);
     /*
     g_list_free_full(ui->images.img_files, (GDestroyNotify) free_img);
     
@@ -61,6 +61,10 @@ typedef struct _ProjectUi
     GtkWidget *proj_nm_lbl, *proj_nm, *proj_desc_lbl, *proj_desc, *proj_path_lbl;
     SelectListUi images;
     SelectListUi darks;
+    SelectListUi flats;
+    SelectListUi darkflats;
+    SelectListUi bias;
+    GtkWidget *calib_nb;
     GtkWidget *save_btn, *cancel_btn;
     int close_handler_id;
     MainUi *m_ui;
@@ -0,0 +1,304 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Frame quality - star count, star size (FWHM) and shape (eccentricity), sky background
+**  and noise measured while the stars are detected, then a score for each frame and
+**  rejection of the poor ones before they are registered or stacked.
+**  A star's size and shape come from the pixels above half its peak: the area gives the
+**  FWHM (as a circle) and the flux weighted second moments within 1.5 FWHM of the centre
+**  the eccentricity. The median over the
+**  brighter unsaturated stars is kept. The score is the star count (transparency) over
+**  the star area and noise variance (a point source signal to noise), scaled so the best
+**  frame is 1. Frames are rejected against the medians of all the frames, so the limits
+**  adapt to the night's conditions.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define SHAPE_STARS 50			// Brightest stars measured
+#define SHAPE_R 10			// Measuring window radius
+#define SHAPE_SAT 60000.0		// Peak level taken as saturated
+#define FWHM_K 1.1283792		// 2 / sqrt(pi) - circle diameter from area
+#define SHAPE_AP 1.5f			// Moment aperture radius (FWHM multiple)
+#define PIX_VAR (1.0f / 12.0f)		// Variance of a uniform pixel
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <preferences.h>
+#include <pipeline.h>
+
+
+/* Prototypes */
+
+void star_shape(ImgFrame *, Star *, int, float, ImgQuality *);
+int quality_assess(PipeRun *, int);
+static float median_f(float *, int);
+static int float_cmp(const void *, const void *);
+
+extern int get_user_pref_dbl(char *, double *);
+extern void log_msg_extra(char*, char*, char*, char*, GtkWidget*);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-quality.c ";
+
+
+/* Median size and shape of the brighter stars in a frame (stars brightest first) */
+
+void star_shape(ImgFrame *frm, Star *st, int n, float bg, ImgQuality *q)
+{
+    int x, y, cx, cy, k, nm, area;
+    float peak, half, v, mx, my, sw, r2, dx, dy, sxx, syy, sxy, l1, l2, d;
+    float *fwhm, *ecc;
+
+    q->n_stars = n;
+    q->fwhm = 0.0f;
+    q->ecc = 0.0f;
+    q->measured = TRUE;
+
+    fwhm = (float *) malloc(SHAPE_STARS * sizeof(float));
+    ecc = (float *) malloc(SHAPE_STARS * sizeof(float));
+    nm = 0;
+
+    for(k = 0; k < n && nm < SHAPE_STARS; k++)
+    {
+	cx = (int) (st[k].x + 0.5f);
+	cy = (int) (st[k].y + 0.5f);
+
+	if (cx < SHAPE_R || cy < SHAPE_R || cx >= frm->width - SHAPE_R || cy >= frm->height - SHAPE_R)
+	    continue;
+
+	/* Peak (centroid may be off the brightest pixel) */
+	peak = 0.0f;
+
+	for(y = cy - 1; y <= cy + 1; y++)
+	    for(x = cx - 1; x <= cx + 1; x++)
+		if (FRAME_LUMA(frm, y * frm->width + x) > peak)
+		    peak = FRAME_LUMA(frm, y * frm->width + x);
+
+	if (peak >= SHAPE_SAT || peak <= bg)
+	    continue;
+
+	half = bg + (peak - bg) * 0.5f;
+
+	/* Half maximum area and centroid */
+	area = 0;
+	mx = my = sw = 0.0f;
+
+	for(y = cy - SHAPE_R; y <= cy + SHAPE_R; y++)
+	    for(x = cx - SHAPE_R; x <= cx + SHAPE_R; x++)
+	    {
+		v = FRAME_LUMA(frm, y * frm->width + x);
+
+		if (v < half)
+		    continue;
+
+		v -= bg;
+		mx += v * x;
+		my += v * y;
+		sw += v;
+		area++;
+	    }
+
+	mx /= sw;
+	my /= sw;
+	fwhm[nm] = (float) (FWHM_K * sqrt((double) area));
+
+	/* Flux weighted moments over a round aperture (no shape from the cut) */
+	r2 = fwhm[nm] * SHAPE_AP;
+	r2 = MIN(r2 * r2, (float) (SHAPE_R * SHAPE_R));
+	sxx = syy = sxy = sw = 0.0f;
+
+	for(y = cy - SHAPE_R; y <= cy + SHAPE_R; y++)
+	    for(x = cx - SHAPE_R; x <= cx + SHAPE_R; x++)
+	    {
+		dx = x - mx;
+		dy = y - my;
+
+		if (dx * dx + dy * dy > r2)
+		    continue;
+
+		v = FRAME_LUMA(frm, y * frm->width + x) - bg;
+
+		if (v <= 0.0f)
+		    continue;
+
+		sxx += v * dx * dx;
+		syy += v * dy * dy;
+		sxy += v * dx * dy;
+		sw += v;
+	    }
+
+	/* Each pixel covers an area, not a point */
+	sxx = sxx / sw + PIX_VAR;
+	syy = syy / sw + PIX_VAR;
+	sxy /= sw;
+
+	/* Eigenvalues of the second moments - major and minor axes */
+	d = sqrtf((sxx - syy) * (sxx - syy) * 0.25f + sxy * sxy);
+	l1 = (sxx + syy) * 0.5f + d;
+	l2 = (sxx + syy) * 0.5f - d;
+
+	ecc[nm] = (l1 > 0.0f) ? sqrtf(1.0f - MAX(l2, 0.0f) / l1) : 0.0f;
+	nm++;
+    }
+
+    if (nm > 0)
+    {
+	q->fwhm = median_f(fwhm, nm);
+	q->ecc = median_f(ecc, nm);
+    }
+
+    free(fwhm);
+    free(ecc);
+
+    return;
+}
+
+
+/* Score the measured frames and reject the poor ones (never the base), returns the number kept */
+
+int quality_assess(PipeRun *run, int base)
+{
+    int i, n, kept;
+    char why[100];
+    double max_fwhm, min_stars, max_ecc;
+    float med_fwhm, med_stars, best;
+    float *v;
+    ImgQuality *q;
+
+    if (! get_user_pref_dbl(QUAL_FWHM, &max_fwhm))
+    	max_fwhm = 0.0;
+
+    if (! get_user_pref_dbl(QUAL_STARS, &min_stars))
+    	min_stars = 0.0;
+
+    if (! get_user_pref_dbl(QUAL_ECC, &max_ecc))
+    	max_ecc = 0.0;
+
+    /* Medians over the frames measured */
+    v = (float *) malloc((run->n_frames + 1) * sizeof(float));
+    n = 0;
+
+    for(i = 0; i < run->n_frames; i++)
+    	if (run->frames[i].img->quality.measured && run->frames[i].img->quality.fwhm > 0.0f)
+	    v[n++] = run->frames[i].img->quality.fwhm;
+
+    med_fwhm = (n > 0) ? median_f(v, n) : 0.0f;
+    n = 0;
+
+    for(i = 0; i < run->n_frames; i++)
+    	if (run->frames[i].img->quality.measured)
+	    v[n++] = (float) run->frames[i].img->quality.n_stars;
+
+    med_stars = (n > 0) ? median_f(v, n) : 0.0f;
+    free(v);
+
+    /* Score */
+    best = 0.0f;
+
+    for(i = 0; i < run->n_frames; i++)
+    {
+	q = &(run->frames[i].img->quality);
+	q->score = 0.0f;
+
+	if (! q->measured || q->fwhm <= 0.0f)
+	    continue;
+
+	q->score = (float) q->n_stars / (q->fwhm * q->fwhm * q->noise * q->noise);
+
+	if (q->score > best)
+	    best = q->score;
+    }
+
+    /* Scale and reject */
+    kept = 0;
+
+    for(i = 0; i < run->n_frames; i++)
+    {
+	q = &(run->frames[i].img->quality);
+
+	if (best > 0.0f)
+	    q->score /= best;
+
+	q->rejected = FALSE;
+	why[0] = '\0';
+
+	if (i != base && q->measured)
+	{
+	    if (min_stars > 0.0 && q->n_stars < min_stars * med_stars)
+		sprintf(why, "%d stars (median %.0f)", q->n_stars, med_stars);
+	    else if (max_fwhm > 0.0 && med_fwhm > 0.0f && (q->fwhm == 0.0f || q->fwhm > max_fwhm * med_fwhm))
+		sprintf(why, "FWHM %.2f (median %.2f)", q->fwhm, med_fwhm);
+	    else if (max_ecc > 0.0 && q->ecc > max_ecc)
+		sprintf(why, "Eccentricity %.2f", q->ecc);
+
+	    q->rejected = (why[0] != '\0');
+	}
+
+	if (q->rejected)
+	    log_msg_extra("APP0023", run->frames[i].img->nm, why, NULL, NULL);
+	else
+	    kept++;
+    }
+
+    return kept;
+}
+
+
+/* Median (reorders the values) */
+
+static float median_f(float *v, int n)
+{
+    qsort(v, n, sizeof(float), float_cmp);
+
+    return v[n / 2];
+}
+
+
+/* Compare floats */
+
+static int float_cmp(const void *a, const void *b)
+{
+    float x, y;
+
+    x = *(const float *) a;
+    y = *(const float *) b;
+
+    return (x > y) - (x < y);
+}
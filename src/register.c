@@ -0,0 +1,848 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Registration - find the stars in each frame and the transform that maps them onto
+**  the stars of the base image.
+**  Stars are local maxima above the background (median + n * sigma) centroided over a
+**  small window, moved onto the centre so a flat topped (saturated) star is centred well.
+**  Matching tries a similarity transform for each pair of bright star
+**  pairs of similar separation, keeps the one agreeing with the most stars and then
+**  refines it as an affine transform by least squares over all the matched stars.
+**  The frame quality is measured first on a binned luminance, so the poor frames can be
+**  left out before any matching is done.
+**  Other frames are registered coarse to fine: the transform is found from the stars of
+**  a 1/4 scale binned luminance, then refined with the stars measured at full resolution
+**  only where the base image stars are predicted to fall. Full resolution detection is
+**  the fallback if the coarse stage fails.
+**  Frames of a sequence drift smoothly, so when the caller can predict the transform from
+**  the frames before, the stars are measured straight away in a small window about where
+**  it puts them - no pair search at all, one window per star. The coarse stage is the
+**  fallback if most of the stars do not agree.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define DETECT_SIGMA 5.0
+#define CENTROID_R 3
+#define CENTROID_ITER 3
+#define EDGE 4
+#define MATCH_TOP 15
+#define MATCH_TOL 3.0
+#define MIN_MATCH 4
+#define BG_SAMPLES 10000
+#define PYR_MIN_SIZE 256		// Smallest binned frame side worth registering coarse
+#define PYR_SEARCH 4			// Full resolution search about a star placed by the coarse transform
+#define PRED_SEARCH 6			// Search about a star placed by the transform predicted from earlier frames
+#define FINE_AGREE 4			// At least 1 in this many reference stars in the frame must agree
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <pipeline.h>
+#include <instrument.h>
+
+
+/* Prototypes */
+
+int detect_stars(ImgFrame *, Star **, ImgQuality *);
+int match_stars(Star *, int, Star *, int, Xform *);
+int register_frame(ImgFrame *, Star *, int, Xform *, Xform *, Star **, ImgQuality *);
+int frame_quality(ImgFrame *, ImgQuality *);
+void xform_identity(Xform *);
+void xform_apply(Xform *, double, double, double *, double *);
+int xform_invert(Xform *, Xform *);
+void xform_extrapolate(Xform *, Xform *, Xform *);
+void frame_background(ImgFrame *, float *, float *);
+static int register_coarse(ImgFrame *, Star *, int, Xform *, Star **, ImgQuality *);
+static int register_fine(ImgFrame *, Star *, int, int, Xform *, Star **, ImgQuality *);
+static int star_near(ImgFrame *, double, double, int, float, float, Star *);
+static void centroid(ImgFrame *, int, int, float, Star *);
+static void luma_background(ImgFrame *, float *, float *);
+static int count_inliers(Star *, int, Star *, int, Xform *);
+static int refine_xform(Star *, int, Star *, int, Xform *);
+static int fit_pairs(Star *, Star *, int *, int, double, Xform *);
+static int similarity(Star *, Star *, Star *, Star *, Xform *);
+static int solve3(double [3][3], double [3], double [3]);
+static int star_cmp(const void *, const void *);
+static int float_cmp(const void *, const void *);
+
+extern ImgFrame * frame_luma(ImgFrame *);
+extern ImgFrame * frame_bin_luma(ImgFrame *, int);
+extern void frame_free(ImgFrame *);
+extern void star_shape(ImgFrame *, Star *, int, float, ImgQuality *);
+extern void instr_start(InstrTimer *, int);
+extern void instr_stop(InstrTimer *, gint64, int);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-register.c ";
+
+
+/* Find the stars in a frame, brightest first (at most PIPE_MAX_STARS), and measure its quality if 'q' is given */
+
+int detect_stars(ImgFrame *frm, Star **stars, ImgQuality *q)
+{
+    int x, y, n, sz;
+    float bg, sigma, thresh, v;
+    float *d;
+    Star *st;
+    ImgFrame *lum;
+    InstrTimer tmr;
+
+    *stars = NULL;
+    instr_start(&tmr, INS_DETECT);
+
+    if ((lum = frame_luma(frm)) == NULL)
+    	return 0;
+
+    frame_background(lum, &bg, &sigma);
+    thresh = bg + DETECT_SIGMA * sigma;
+    d = lum->data;
+
+    n = 0;
+    sz = PIPE_MAX_STARS;
+    st = (Star *) malloc(sz * sizeof(Star));
+
+    for(y = EDGE; y < lum->height - EDGE; y++)
+    {
+	for(x = EDGE; x < lum->width - EDGE; x++)
+	{
+	    v = d[y * lum->width + x];
+
+	    if (v <= thresh)
+	    	continue;
+
+	    /* Local maximum (ties go to the later pixel) */
+	    if (v <  d[(y - 1) * lum->width + x - 1] || v <  d[(y - 1) * lum->width + x] ||
+		v <  d[(y - 1) * lum->width + x + 1] || v <  d[y * lum->width + x - 1] ||
+		v <= d[y * lum->width + x + 1] || v <= d[(y + 1) * lum->width + x - 1] ||
+		v <= d[(y + 1) * lum->width + x] || v <= d[(y + 1) * lum->width + x + 1])
+		continue;
+
+	    if (n >= sz)
+	    {
+	    	sz *= 2;
+		st = (Star *) realloc(st, sz * sizeof(Star));
+	    }
+
+	    centroid(lum, x, y, bg, &st[n]);
+	    n++;
+	}
+    }
+
+    qsort(st, n, sizeof(Star), star_cmp);
+
+    if (n > PIPE_MAX_STARS)
+    	n = PIPE_MAX_STARS;
+
+    if (q != NULL)
+    {
+	q->bg = bg;
+	q->noise = sigma;
+	star_shape(lum, st, n, bg, q);
+    }
+
+    frame_free(lum);
+
+    *stars = st;
+    instr_stop(&tmr, (gint64) frm->width * frm->height * frm->channels * sizeof(float), 1);
+
+    return n;
+}
+
+
+/* Find the transform mapping stars 's' onto the reference stars */
+
+int match_stars(Star *ref, int nref, Star *s, int n, Xform *xf)
+{
+    int i, j, k, l, m_ref, m, cnt, best;
+    float dr, ds;
+    Xform cand;
+    InstrTimer tmr;
+
+    xform_identity(xf);
+    m_ref = MIN(nref, MATCH_TOP);
+    m = MIN(n, MATCH_TOP);
+
+    if (m_ref < 2 || m < 2)
+    	return FALSE;
+
+    instr_start(&tmr, INS_MATCH);
+
+    best = 0;
+
+    /* Each pair of reference stars against each pair of frame stars of similar separation */
+    for(i = 0; i < m_ref; i++)
+    {
+	for(k = i + 1; k < m_ref; k++)
+	{
+	    dr = hypotf(ref[k].x - ref[i].x, ref[k].y - ref[i].y);
+
+	    for(j = 0; j < m; j++)
+	    {
+		for(l = 0; l < m; l++)
+		{
+		    if (l == j)
+		    	continue;
+
+		    ds = hypotf(s[l].x - s[j].x, s[l].y - s[j].y);
+
+		    if (fabsf(dr - ds) > MATCH_TOL)
+		    	continue;
+
+		    if (! similarity(&s[j], &s[l], &ref[i], &ref[k], &cand))
+		    	continue;
+
+		    cnt = count_inliers(ref, m_ref, s, m, &cand);
+
+		    if (cnt > best)
+		    {
+			best = cnt;
+			*xf = cand;
+		    }
+		}
+	    }
+	}
+    }
+
+    if (best < MIN(MIN_MATCH, MIN(m_ref, m)))
+    {
+	instr_stop(&tmr, 0, 1);
+    	return FALSE;
+    }
+
+    /* Refine over all the stars */
+    for(i = 0; i < 2; i++)
+    	if (! refine_xform(ref, nref, s, n, xf))
+	    break;
+
+    instr_stop(&tmr, 0, 1);
+
+    return TRUE;
+}
+
+
+/* Stars of a frame and the transform onto the reference stars - from the predicted transform
+   (may be NULL), else coarse to fine, else at full resolution */
+
+int register_frame(ImgFrame *frm, Star *ref, int nref, Xform *pred, Xform *xf, Star **stars, ImgQuality *q)
+{
+    int n;
+
+    *stars = NULL;
+
+    if (pred != NULL)
+    {
+	*xf = *pred;
+
+	if (register_fine(frm, ref, nref, PRED_SEARCH, xf, stars, q))
+	    return TRUE;
+    }
+
+    if (frm->width / PIPE_BIN >= PYR_MIN_SIZE && frm->height / PIPE_BIN >= PYR_MIN_SIZE)
+	if (register_coarse(frm, ref, nref, xf, stars, q))
+	    return TRUE;
+
+    n = detect_stars(frm, stars, q);
+
+    return match_stars(ref, nref, *stars, n, xf);
+}
+
+
+/* Quality of a frame measured on its binned luminance - cheap enough to run on every frame
+   before any is matched (full resolution if the frame is too small to bin). The star size is
+   given in full resolution pixels and the noise scaled back from the binned mean, but size and
+   shape are widened by the binning, so the values only compare with frames measured the same
+   way. Returns the number of stars. */
+
+int frame_quality(ImgFrame *frm, ImgQuality *q)
+{
+    int n;
+    Star *st;
+    ImgFrame *bin;
+
+    if (frm->width / PIPE_BIN < PYR_MIN_SIZE || frm->height / PIPE_BIN < PYR_MIN_SIZE ||
+    	(bin = frame_bin_luma(frm, PIPE_BIN)) == NULL)
+    {
+	n = detect_stars(frm, &st, q);
+	free(st);
+
+	return n;
+    }
+
+    n = detect_stars(bin, &st, q);
+    free(st);
+    frame_free(bin);
+
+    q->fwhm *= PIPE_BIN;
+    q->noise *= PIPE_BIN;
+
+    return n;
+}
+
+
+/* Identity transform */
+
+void xform_identity(Xform *xf)
+{
+    memset(xf, 0, sizeof(Xform));
+    xf->a = 1.0;
+    xf->e = 1.0;
+
+    return;
+}
+
+
+/* Apply a transform to a point */
+
+void xform_apply(Xform *xf, double x, double y, double *ox, double *oy)
+{
+    *ox = xf->a * x + xf->b * y + xf->c;
+    *oy = xf->d * x + xf->e * y + xf->f;
+
+    return;
+}
+
+
+/* Inverse of a transform */
+
+int xform_invert(Xform *xf, Xform *inv)
+{
+    double det;
+
+    det = xf->a * xf->e - xf->b * xf->d;
+
+    if (fabs(det) < 1e-12)
+    	return FALSE;
+
+    inv->a = xf->e / det;
+    inv->b = -xf->b / det;
+    inv->d = -xf->d / det;
+    inv->e = xf->a / det;
+    inv->c = -(inv->a * xf->c + inv->b * xf->f);
+    inv->f = -(inv->d * xf->c + inv->e * xf->f);
+
+    return TRUE;
+}
+
+
+/* Transform one frame on from the last (x1) carrying on the change from the one before (x2, may be NULL) */
+
+void xform_extrapolate(Xform *x1, Xform *x2, Xform *pred)
+{
+    *pred = *x1;
+
+    if (x2 == NULL)
+    	return;
+
+    pred->a += x1->a - x2->a;
+    pred->b += x1->b - x2->b;
+    pred->c += x1->c - x2->c;
+    pred->d += x1->d - x2->d;
+    pred->e += x1->e - x2->e;
+    pred->f += x1->f - x2->f;
+
+    return;
+}
+
+
+/* Transform from the binned frame then refined by the stars found near the predicted positions */
+
+static int register_coarse(ImgFrame *frm, Star *ref, int nref, Xform *xf, Star **stars, ImgQuality *q)
+{
+    int i, nc, ok;
+    Star *st;
+    ImgFrame *bin;
+
+    if ((bin = frame_bin_luma(frm, PIPE_BIN)) == NULL)
+    	return FALSE;
+
+    nc = detect_stars(bin, &st, NULL);
+    frame_free(bin);
+
+    /* Binned pixel centres in full resolution pixels */
+    for(i = 0; i < nc; i++)
+    {
+	st[i].x = st[i].x * PIPE_BIN + (PIPE_BIN - 1) * 0.5f;
+	st[i].y = st[i].y * PIPE_BIN + (PIPE_BIN - 1) * 0.5f;
+    }
+
+    ok = match_stars(ref, nref, st, nc, xf);
+    free(st);
+
+    if (! ok)
+    	return FALSE;
+
+    return register_fine(frm, ref, nref, PYR_SEARCH, xf, stars, q);
+}
+
+
+/* Measure each reference star only near where a transform puts it, then refine the transform
+   over those pairs - no pair search. Most of the stars found, and a fair share of those that
+   should be in the frame, must agree (a wrong transform finds few stars) */
+
+static int register_fine(ImgFrame *frm, Star *ref, int nref, int search, Xform *xf, Star **stars, ImgQuality *q)
+{
+    int i, n, cnt, n_in;
+    int *idx;
+    float bg, sigma;
+    double x, y;
+    Star *st;
+    Xform inv;
+    InstrTimer tmr;
+
+    if (! xform_invert(xf, &inv))
+    	return FALSE;
+
+    instr_start(&tmr, INS_DETECT);
+    luma_background(frm, &bg, &sigma);
+    st = (Star *) malloc(MAX(nref, 1) * sizeof(Star));
+    idx = (int *) malloc(MAX(nref, 1) * sizeof(int));
+    n = n_in = 0;
+
+    for(i = 0; i < nref; i++)
+    {
+	xform_apply(&inv, ref[i].x, ref[i].y, &x, &y);
+
+	if (x >= 0.0 && y >= 0.0 && x < frm->width && y < frm->height)
+	    n_in++;
+
+	if (star_near(frm, x, y, search, bg, bg + DETECT_SIGMA * sigma, &st[n]))
+	    idx[n++] = i;
+    }
+
+    instr_stop(&tmr, (gint64) nref * (2 * search + 1) * (2 * search + 1) * sizeof(float), 1);
+
+    /* All the pairs first (the transform may be off by up to the search), then only those that agree */
+    cnt = fit_pairs(ref, st, idx, n, 0.0, xf);
+
+    for(i = 0; i < 2 && cnt >= MIN_MATCH; i++)
+    	cnt = fit_pairs(ref, st, idx, n, MATCH_TOL, xf);
+
+    free(idx);
+
+    if (cnt < MIN_MATCH || cnt < n / 2 || cnt < n_in / FINE_AGREE)
+    {
+	free(st);
+    	return FALSE;
+    }
+
+    if (q != NULL)
+    {
+	q->bg = bg;
+	q->noise = sigma;
+	star_shape(frm, st, n, bg, q);
+    }
+
+    *stars = st;
+
+    return TRUE;
+}
+
+
+/* Star centred on the brightest pixel within the search distance of a predicted position */
+
+static int star_near(ImgFrame *frm, double px, double py, int search, float bg, float thresh, Star *star)
+{
+    int x, y, bx, by, x0, y0;
+    float v, peak;
+
+    x0 = (int) (px + 0.5);
+    y0 = (int) (py + 0.5);
+
+    if (x0 < search + CENTROID_R || y0 < search + CENTROID_R ||
+	x0 >= frm->width - search - CENTROID_R || y0 >= frm->height - search - CENTROID_R)
+    	return FALSE;
+
+    bx = by = -1;
+    peak = 0.0f;
+
+    /* Ties (saturation) go to the later pixel as for detection so the centroids agree */
+    for(y = y0 - search; y <= y0 + search; y++)
+	for(x = x0 - search; x <= x0 + search; x++)
+	{
+	    v = FRAME_LUMA(frm, y * frm->width + x);
+
+	    if (v > thresh && v >= peak)
+	    {
+		peak = v;
+		bx = x;
+		by = y;
+	    }
+	}
+
+    if (bx < 0)
+    	return FALSE;
+
+    centroid(frm, bx, by, bg, star);
+
+    return TRUE;
+}
+
+
+/* Flux weighted centre about a peak, the window moved onto the centre until it settles */
+
+static void centroid(ImgFrame *frm, int x, int y, float bg, Star *star)
+{
+    int i, j, k, cx, cy;
+    float f, sx, sy, sf;
+
+    cx = x;
+    cy = y;
+    star->x = (float) x;
+    star->y = (float) y;
+    star->flux = 0.0f;
+
+    for(k = 0; k < CENTROID_ITER; k++)
+    {
+	sx = sy = sf = 0.0f;
+
+	for(j = -CENTROID_R; j <= CENTROID_R; j++)
+	{
+	    for(i = -CENTROID_R; i <= CENTROID_R; i++)
+	    {
+		f = FRAME_LUMA(frm, (cy + j) * frm->width + cx + i) - bg;
+
+		if (f <= 0.0f)
+		    continue;
+
+		sx += f * i;
+		sy += f * j;
+		sf += f;
+	    }
+	}
+
+	if (sf <= 0.0f)
+	    break;
+
+	star->x = cx + sx / sf;
+	star->y = cy + sy / sf;
+	star->flux = sf;
+
+	/* Settled, or no room to move */
+	x = (int) (star->x + 0.5f);
+	y = (int) (star->y + 0.5f);
+
+	if ((x == cx && y == cy) || x < CENTROID_R || y < CENTROID_R ||
+	    x >= frm->width - CENTROID_R || y >= frm->height - CENTROID_R)
+	    break;
+
+	cx = x;
+	cy = y;
+    }
+
+    return;
+}
+
+
+/* Background level and noise of the luminance from a sample of pixels (median and MAD) */
+
+static void luma_background(ImgFrame *frm, float *bg, float *sigma)
+{
+    int i, n;
+    size_t sz, step;
+    float *v;
+
+    sz = (size_t) frm->width * frm->height;
+    step = MAX(sz / BG_SAMPLES, 1);
+    n = (int) (sz / step);
+    v = (float *) malloc(n * sizeof(float));
+
+    for(i = 0; i < n; i++)
+    	v[i] = FRAME_LUMA(frm, (size_t) i * step);
+
+    qsort(v, n, sizeof(float), float_cmp);
+    *bg = v[n / 2];
+
+    for(i = 0; i < n; i++)
+    	v[i] = fabsf(v[i] - *bg);
+
+    qsort(v, n, sizeof(float), float_cmp);
+    *sigma = v[n / 2] * 1.4826f;
+
+    if (*sigma < 1.0f)
+    	*sigma = 1.0f;
+
+    free(v);
+
+    return;
+}
+
+
+/* Estimate the background level and noise from a sample of pixels (median and MAD) */
+
+void frame_background(ImgFrame *frm, float *bg, float *sigma)
+{
+    int i, n, step;
+    size_t sz;
+    float *v;
+
+    sz = (size_t) frm->width * frm->height * frm->channels;
+    step = (int) (sz / BG_SAMPLES);
+
+    if (step < 1)
+    	step = 1;
+
+    n = (int) (sz / step);
+    v = (float *) malloc(n * sizeof(float));
+
+    for(i = 0; i < n; i++)
+    	v[i] = frm->data[(size_t) i * step];
+
+    qsort(v, n, sizeof(float), float_cmp);
+    *bg = v[n / 2];
+
+    for(i = 0; i < n; i++)
+    	v[i] = fabsf(v[i] - *bg);
+
+    qsort(v, n, sizeof(float), float_cmp);
+    *sigma = v[n / 2] * 1.4826f;
+
+    if (*sigma < 1.0f)
+    	*sigma = 1.0f;
+
+    free(v);
+
+    return;
+}
+
+
+/* Number of stars that land on a reference star */
+
+static int count_inliers(Star *ref, int nref, Star *s, int n, Xform *xf)
+{
+    int i, j, cnt;
+    double x, y;
+
+    cnt = 0;
+
+    for(i = 0; i < n; i++)
+    {
+	xform_apply(xf, s[i].x, s[i].y, &x, &y);
+
+	for(j = 0; j < nref; j++)
+	{
+	    if (fabs(ref[j].x - x) <= MATCH_TOL && fabs(ref[j].y - y) <= MATCH_TOL)
+	    {
+	    	cnt++;
+		break;
+	    }
+	}
+    }
+
+    return cnt;
+}
+
+
+/* Least squares affine fit over the stars matched by the current transform */
+
+static int refine_xform(Star *ref, int nref, Star *s, int n, Xform *xf)
+{
+    int i, j, k, ok;
+    int *idx;
+    double x, y, d, best_d;
+
+    idx = (int *) malloc(MAX(n, 1) * sizeof(int));
+
+    for(i = 0; i < n; i++)
+    {
+	xform_apply(xf, s[i].x, s[i].y, &x, &y);
+	k = -1;
+	best_d = MATCH_TOL * MATCH_TOL;
+
+	for(j = 0; j < nref; j++)
+	{
+	    d = (ref[j].x - x) * (ref[j].x - x) + (ref[j].y - y) * (ref[j].y - y);
+
+	    if (d <= best_d)
+	    {
+	    	best_d = d;
+		k = j;
+	    }
+	}
+
+	idx[i] = k;
+    }
+
+    ok = (fit_pairs(ref, s, idx, n, 0.0, xf) > 0);
+    free(idx);
+
+    return ok;
+}
+
+
+/* Least squares affine fit of stars 's' onto the reference stars 'idx' gives for each (-1 is none).
+   With a tolerance, pairs the current transform puts further apart than that are dropped
+   first. Returns the pairs used, 0 if there were too few */
+
+static int fit_pairs(Star *ref, Star *s, int *idx, int n, double tol, Xform *xf)
+{
+    int i, j, cnt;
+    double x, y;
+    double A[3][3], bx[3], by[3], px[3], py[3];
+
+    memset(A, 0, sizeof(A));
+    memset(bx, 0, sizeof(bx));
+    memset(by, 0, sizeof(by));
+    cnt = 0;
+
+    for(i = 0; i < n; i++)
+    {
+	if (idx[i] < 0)
+	    continue;
+
+	if (tol > 0.0)
+	{
+	    xform_apply(xf, s[i].x, s[i].y, &x, &y);
+
+	    if (fabs(ref[idx[i]].x - x) > tol || fabs(ref[idx[i]].y - y) > tol)
+	    	continue;
+	}
+
+	px[0] = s[i].x; px[1] = s[i].y; px[2] = 1.0;
+
+	for(j = 0; j < 3; j++)
+	{
+	    A[j][0] += px[j] * px[0];
+	    A[j][1] += px[j] * px[1];
+	    A[j][2] += px[j] * px[2];
+	    bx[j] += px[j] * ref[idx[i]].x;
+	    by[j] += px[j] * ref[idx[i]].y;
+	}
+
+	cnt++;
+    }
+
+    if (cnt < 3)
+    	return 0;
+
+    if (! solve3(A, bx, px) || ! solve3(A, by, py))
+    	return 0;
+
+    xf->a = px[0]; xf->b = px[1]; xf->c = px[2];
+    xf->d = py[0]; xf->e = py[1]; xf->f = py[2];
+
+    return cnt;
+}
+
+
+/* Similarity transform (shift, rotation, near unit scale) taking p1, p2 onto q1, q2 */
+
+static int similarity(Star *p1, Star *p2, Star *q1, Star *q2, Xform *xf)
+{
+    double vx, vy, wx, wy, sc, th;
+
+    vx = p2->x - p1->x;
+    vy = p2->y - p1->y;
+    wx = q2->x - q1->x;
+    wy = q2->y - q1->y;
+
+    if (vx == 0.0 && vy == 0.0)
+    	return FALSE;
+
+    sc = hypot(wx, wy) / hypot(vx, vy);
+
+    /* Same camera and lens - scale should be close to 1 */
+    if (sc < 0.9 || sc > 1.1)
+    	return FALSE;
+
+    th = atan2(wy, wx) - atan2(vy, vx);
+    xf->a = sc * cos(th);
+    xf->b = -sc * sin(th);
+    xf->d = sc * sin(th);
+    xf->e = sc * cos(th);
+    xf->c = q1->x - (xf->a * p1->x + xf->b * p1->y);
+    xf->f = q1->y - (xf->d * p1->x + xf->e * p1->y);
+
+    return TRUE;
+}
+
+
+/* Solve a 3x3 linear system (Cramer's rule) */
+
+static int solve3(double A[3][3], double b[3], double x[3])
+{
+    int i;
+    double det, M[3][3];
+
+    det = A[0][0] * (A[1][1] * A[2][2] - A[1][2] * A[2][1])
+	- A[0][1] * (A[1][0] * A[2][2] - A[1][2] * A[2][0])
+	+ A[0][2] * (A[1][0] * A[2][1] - A[1][1] * A[2][0]);
+
+    if (fabs(det) < 1e-9)
+    	return FALSE;
+
+    for(i = 0; i < 3; i++)
+    {
+	memcpy(M, A, sizeof(M));
+	M[0][i] = b[0];
+	M[1][i] = b[1];
+	M[2][i] = b[2];
+
+	x[i] = (M[0][0] * (M[1][1] * M[2][2] - M[1][2] * M[2][1])
+	      - M[0][1] * (M[1][0] * M[2][2] - M[1][2] * M[2][0])
+	      + M[0][2] * (M[1][0] * M[2][1] - M[1][1] * M[2][0])) / det;
+    }
+
+    return TRUE;
+}
+
+
+/* Sort stars brightest first */
+
+static int star_cmp(const void *a, const void *b)
+{
+    float fa, fb;
+
+    fa = ((Star *) a)->flux;
+    fb = ((Star *) b)->flux;
+
+    return (fa < fb) - (fa > fb);
+}
+
+
+/* Sort floats ascending */
+
+static int float_cmp(const void *a, const void *b)
+{
+    float fa, fb;
+
+    fa = *(float *) a;
+    fb = *(float *) b;
+
+    return (fa > fb) - (fa < fb);
+}
@@ -0,0 +1,466 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Stacking - warp each registered (calibrated) frame onto the base image and
+**  average. Each output pixel is sampled from the frame (bilinear) through the inverse
+**  of the frame's transform and the count of frames covering it is kept so the edges
+**  are averaged correctly. The next frame is decoded and calibrated while the current
+**  one is warped, unless the memory budget only has room for one.
+**  Frames may be weighted by their quality score, the count then being the weight total.
+**  Undersampled frames may be drizzled onto a finer grid instead (see drizzle.c).
+**  The accumulator is saved as the run goes so an interrupted stack, or one with frames
+**  added, carries on from it (see journal.c).
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define WARP_TILE 256			// Output columns warped together down a band of rows
+#define WARP_EPS 1e-3			// Keeps the sampled positions clear of the frame edges
+#define STACK_FRAME_COPIES 2		// A frame and its decode and calibration buffers
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <pipeline.h>
+#include <instrument.h>
+
+
+/* Types */
+
+typedef struct _StackAcc
+{
+    ImgFrame *sum;
+    float *cnt;
+    ImgFrame *frm;
+    Xform inv;
+    float w;
+    int interp;
+} StackAcc;
+
+typedef struct _Prefetch
+{
+    PipeRun *run;
+    int idx;
+    ImgFrame *frm;
+} Prefetch;
+
+
+/* Prototypes */
+
+ImgFrame * stack_frames(PipeRun *, GtkWidget *);
+void warp_accumulate(ImgFrame *, Xform *, ImgFrame *, float *, float, int);
+void stack_average(ImgFrame *, float *, int);
+static void warp_rows(int, int, gpointer);
+static int row_extent(StackAcc *, int, int *, int *);
+static void clip_run(double, double, double, double, double *, double *);
+static void average_rows(int, int, gpointer);
+static void prefetch_job(Job *);
+static int next_registered(PipeRun *, int);
+static gint64 acc_bytes(StackAccum *);
+
+extern ImgFrame * frame_new(int, int, int);
+extern void frame_free(ImgFrame *);
+extern ImgFrame * cache_frame(PipeRun *, int);
+extern int xform_invert(Xform *, Xform *);
+extern ImgFrame * drizzle_new(PipeRun *, ImgFrame *, float **, int *);
+extern void drizzle_accumulate(PipeRun *, ImgFrame *, Xform *, ImgFrame *, float *, float);
+extern void drizzle_average(ImgFrame *, float *, int, int);
+extern void warp_span(const WarpSpan *, int);
+extern int journal_stack_resume(PipeRun *, StackAccum *);
+extern gint64 mem_reserve(gint64, gint64);
+extern int mem_reserve_count(gint64, int, int);
+extern void mem_release(gint64);
+extern void journal_stack_save(PipeRun *, StackAccum *, int);
+extern void job_submit(int, void (*)(Job *), gpointer, JobToken *, JobGroup *, void (*)(Job *));
+extern void job_group_init(JobGroup *);
+extern void job_group_wait(JobGroup *);
+extern void job_parallel_for(int, int, int, int, JobRangeFunc, gpointer, JobToken *);
+extern int job_cancelled(JobToken *);
+extern void job_progress(JobToken *, double, char *);
+extern void instr_start(InstrTimer *, int);
+extern void instr_stop(InstrTimer *, gint64, int);
+extern void log_msg(char*, char*, char*, GtkWidget*);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-stack.c ";
+
+
+/* Stack all the registered frames - on to the saved accumulator if it still applies, and
+   saving it as the run goes */
+
+ImgFrame * stack_frames(PipeRun *run, GtkWidget *window)
+{
+    int i, nxt, driz, n_frm;
+    float w;
+    char msg[100];
+    gint64 acc_mem, frm_mem;
+    ImgFrame *sum, *frm;
+    StackAccum acc;
+    Prefetch pf;
+    JobGroup grp;
+
+    driz = (run->driz_scale > 1.0);
+    acc_mem = frm_mem = 0;
+    n_frm = 0;
+
+    if (journal_stack_resume(run, &acc))
+	acc_mem = mem_reserve(acc_bytes(&acc), acc_bytes(&acc));
+
+    /* Start decoding the first frame */
+    memset(&pf, 0, sizeof(Prefetch));
+    job_group_init(&grp);
+    pf.run = run;
+
+    if ((i = next_registered(run, 0)) >= 0)
+    {
+	pf.idx = i;
+	job_submit(JOB_PRI_BATCH, prefetch_job, &pf, run->token, &grp, NULL);
+    }
+
+    while(i >= 0)
+    {
+	job_group_wait(&grp);
+	frm = pf.frm;
+	pf.frm = NULL;
+
+	if (job_cancelled(run->token))
+	{
+	    frame_free(frm);
+	    break;
+	}
+
+	/* Decode the next one while this is processed - if the budget has room for both */
+	if (frm != NULL && n_frm == 0)
+	{
+	    frm_mem = (gint64) frm->width * frm->height * frm->channels * sizeof(float) * STACK_FRAME_COPIES;
+	    n_frm = mem_reserve_count(frm_mem, 2, 1);
+	}
+
+	if ((nxt = next_registered(run, i + 1)) >= 0 && n_frm != 1)
+	{
+	    pf.idx = nxt;
+	    job_submit(JOB_PRI_BATCH, prefetch_job, &pf, run->token, &grp, NULL);
+	}
+
+	if (frm != NULL)
+	{
+	    if (acc.sum == NULL)
+	    {
+		acc.fw = frm->width;
+		acc.fh = frm->height;
+		acc.fc = frm->channels;
+
+		if (driz)
+		    acc.sum = drizzle_new(run, frm, &(acc.cnt), &(acc.wch));
+		else
+		{
+		    acc.sum = frame_new(acc.fw, acc.fh, acc.fc);
+		    acc.cnt = (float *) calloc((size_t) acc.fw * acc.fh, sizeof(float));
+		    acc.wch = 1;
+		}
+
+		acc.n_cnt = (int64_t) acc.sum->width * acc.sum->height * acc.wch;
+		acc_mem = mem_reserve(acc_bytes(&acc), acc_bytes(&acc));
+	    }
+
+	    if (frm->width == acc.fw && frm->height == acc.fh && frm->channels == acc.fc)
+	    {
+		w = 1.0f;
+
+		if (run->weighted && run->frames[i].img->quality.score > 0.0f)
+		    w = run->frames[i].img->quality.score;
+
+		if (driz)
+		    drizzle_accumulate(run, frm, &(run->frames[i].xf), acc.sum, acc.cnt, w);
+		else
+		    warp_accumulate(frm, &(run->frames[i].xf), acc.sum, acc.cnt, w, run->interp);
+
+		run->frames[i].stacked = TRUE;
+		acc.done++;
+		journal_stack_save(run, &acc, FALSE);
+	    }
+	}
+
+	frame_free(frm);
+
+	if (nxt >= 0 && n_frm == 1)
+	{
+	    pf.idx = nxt;
+	    job_submit(JOB_PRI_BATCH, prefetch_job, &pf, run->token, &grp, NULL);
+	}
+
+	sprintf(msg, "Stacking: %d of %d", acc.done, run->n_registered);
+	job_progress(run->token, (double) acc.done / run->n_registered, msg);
+	i = nxt;
+    }
+
+    job_group_wait(&grp);
+    frame_free(pf.frm);
+
+    mem_release(frm_mem * n_frm);
+
+    /* Kept as it stands to carry on from (or add new frames to) */
+    journal_stack_save(run, &acc, TRUE);
+    mem_release(acc_mem);
+
+    if (acc.sum == NULL || job_cancelled(run->token) || acc.done == 0)
+    {
+	frame_free(acc.sum);
+	free(acc.cnt);
+    	return NULL;
+    }
+
+    sum = acc.sum;
+
+    if (driz)
+	drizzle_average(sum, acc.cnt, acc.wch, acc.done);
+    else
+	stack_average(sum, acc.cnt, acc.done);
+
+    free(acc.cnt);
+
+    return sum;
+}
+
+
+/* Divide the sums by the coverage counts */
+
+void stack_average(ImgFrame *sum, float *cnt, int frames)
+{
+    StackAcc acc;
+    InstrTimer tmr;
+
+    memset(&acc, 0, sizeof(StackAcc));
+    acc.sum = sum;
+    acc.cnt = cnt;
+    instr_start(&tmr, INS_ACCUM);
+    job_parallel_for(JOB_PRI_BATCH, 0, sum->height, 0, average_rows, &acc, NULL);
+    instr_stop(&tmr, (gint64) sum->width * sum->height * sum->channels * sizeof(float), frames);
+
+    return;
+}
+
+
+/* Warp a frame onto the base image and add it in with weight 'w' */
+
+void warp_accumulate(ImgFrame *frm, Xform *xf, ImgFrame *sum, float *cnt, float w, int interp)
+{
+    StackAcc acc;
+    InstrTimer tmr;
+
+    acc.sum = sum;
+    acc.cnt = cnt;
+    acc.frm = frm;
+    acc.w = w;
+    acc.interp = interp;
+
+    if (! xform_invert(xf, &(acc.inv)))
+    	return;
+
+    instr_start(&tmr, INS_WARP);
+    job_parallel_for(JOB_PRI_BATCH, 0, sum->height, 0, warp_rows, &acc, NULL);
+    instr_stop(&tmr, (gint64) frm->width * frm->height * frm->channels * sizeof(float), 1);
+
+    return;
+}
+
+
+/* Warp a range of output rows - a tile of columns at a time so the source rows the
+   interpolation reads stay in cache from one output row to the next */
+
+static void warp_rows(int lo, int hi, gpointer data)
+{
+    int x0, x1, xa, xb, y, ch;
+    WarpSpan ws;
+    StackAcc *acc;
+
+    acc = (StackAcc *) data;
+    ch = acc->frm->channels;
+    ws.src = acc->frm->data;
+    ws.w = acc->frm->width;
+    ws.h = acc->frm->height;
+    ws.ch = ch;
+    ws.dx = acc->inv.a;
+    ws.dy = acc->inv.d;
+    ws.wt = acc->w;
+
+    for(x0 = 0; x0 < acc->sum->width; x0 += WARP_TILE)
+    {
+	x1 = MIN(x0 + WARP_TILE, acc->sum->width);
+
+	for(y = lo; y < hi; y++)
+	{
+	    if (! row_extent(acc, y, &xa, &xb))
+	    	continue;
+
+	    xa = MAX(xa, x0);
+	    xb = MIN(xb, x1);
+
+	    if (xa >= xb)
+	    	continue;
+
+	    ws.sx = acc->inv.a * xa + acc->inv.b * y + acc->inv.c;
+	    ws.sy = acc->inv.d * xa + acc->inv.e * y + acc->inv.f;
+	    ws.n = xb - xa;
+	    ws.out = acc->sum->data + ((size_t) y * acc->sum->width + xa) * ch;
+	    ws.cnt = acc->cnt + (size_t) y * acc->sum->width + xa;
+	    warp_span(&ws, acc->interp);
+	}
+    }
+
+    return;
+}
+
+
+/* Output columns [xa, xb) of a row whose source positions the interpolation can sample */
+
+static int row_extent(StackAcc *acc, int y, int *xa, int *xb)
+{
+    int m;
+    double t0, t1;
+
+    /* Samples needed before and after the position */
+    m = (acc->interp == WARP_LANCZOS3) ? 2 : 0;
+    t0 = 0.0;
+    t1 = acc->sum->width;
+
+    clip_run(acc->inv.b * y + acc->inv.c, acc->inv.a, m + WARP_EPS, acc->frm->width - 1 - m - WARP_EPS, &t0, &t1);
+    clip_run(acc->inv.e * y + acc->inv.f, acc->inv.d, m + WARP_EPS, acc->frm->height - 1 - m - WARP_EPS, &t0, &t1);
+
+    if (t1 < t0)
+    	return FALSE;
+
+    *xa = MAX((int) ceil(t0), 0);
+    *xb = MIN((int) floor(t1) + 1, acc->sum->width);
+
+    return (*xa < *xb);
+}
+
+
+/* Narrow [t0, t1] to where p + q * t lies within [lo, hi] */
+
+static void clip_run(double p, double q, double lo, double hi, double *t0, double *t1)
+{
+    double a, b;
+
+    if (fabs(q) < 1e-12)
+    {
+	if (p < lo || p > hi)
+	    *t1 = *t0 - 1.0;
+
+	return;
+    }
+
+    a = (lo - p) / q;
+    b = (hi - p) / q;
+
+    if (q < 0.0)
+    {
+	*t0 = MAX(*t0, b);
+	*t1 = MIN(*t1, a);
+    }
+    else
+    {
+	*t0 = MAX(*t0, a);
+	*t1 = MIN(*t1, b);
+    }
+
+    return;
+}
+
+
+/* Divide by coverage for a range of rows */
+
+static void average_rows(int lo, int hi, gpointer data)
+{
+    int x, y, c, ch;
+    float n;
+    float *s;
+    StackAcc *acc;
+
+    acc = (StackAcc *) data;
+    ch = acc->sum->channels;
+
+    for(y = lo; y < hi; y++)
+    {
+	s = acc->sum->data + (size_t) y * acc->sum->width * ch;
+
+	for(x = 0; x < acc->sum->width; x++, s += ch)
+	{
+	    n = acc->cnt[(size_t) y * acc->sum->width + x];
+
+	    for(c = 0; c < ch; c++)
+		s[c] = (n > 0.0f) ? s[c] / n : 0.0f;
+	}
+    }
+
+    return;
+}
+
+
+/* Decode and calibrate (or fetch from the cache) a frame ahead of use */
+
+static void prefetch_job(Job *job)
+{
+    Prefetch *pf;
+
+    pf = (Prefetch *) job->data;
+    pf->frm = cache_frame(pf->run, pf->idx);
+
+    return;
+}
+
+
+/* Index of the next registered frame (not yet stacked) from 'i' on (-1 if none) */
+
+static int next_registered(PipeRun *run, int i)
+{
+    for(; i < run->n_frames; i++)
+    	if (run->frames[i].registered && ! run->frames[i].stacked)
+	    return i;
+
+    return -1;
+}
+
+
+/* Size of the stacking sums */
+
+static gint64 acc_bytes(StackAccum *acc)
+{
+    return ((gint64) acc->sum->width * acc->sum->height * acc->sum->channels + acc->n_cnt) * sizeof(float);
+}
@@ -57,6 +57,8 @@ extern int check_app_dir();
 extern int reset_log();
 extern void close_log();
 extern int read_user_prefs(GtkWidget *);
+extern int job_sched_init(int);
+extern void job_sched_close();
 extern void log_msg(char*, char*, char*, GtkWidget*);
 //extern void debug_session();
 
@@ -114,6 +116,9 @@ void initialise(MainUi *m_ui)
     if (! read_user_prefs(NULL))
     	log_msg("APP0005", "No user preferences", NULL, NULL);
 
+    /* Start the worker threads (sized from preferences) */
+    job_sched_init(TRUE);
+
     return;
 }
 
@@ -122,6 +127,9 @@ void initialise(MainUi *m_ui)
 
 void final(MainUi *m_ui)
 {
+    /* Stop the worker threads */
+    job_sched_close();
+
     /* Close log file */
     log_msg("SYS9002", NULL, NULL, NULL);
     close_log();
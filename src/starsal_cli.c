@@ -0,0 +1,257 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Application:	StarsAl (command line)
+**
+** Author:	Anthony Buckley
+**
+** Description:
+**  	Batch (headless) processing for StarsAl - no GTK initialisation.
+**  	Each project named is opened and taken through darks, register and stack with the
+**  	same engines as the user interface and the result written to the project directory
+**  	(or -o file for a single project) as FITS, or TIFF or 16 bit PPM / PGM if -o names one.
+**  	Stage timings go to standard output, one line per stage, tab separated:
+**  	    project  stage  milliseconds
+**  	followed by a 'result' line (ok or failed). Messages go to standard error.
+**  	The exit status is non zero if any project fails.
+**  	-m sets the memory budget in MB for this run (the user setting otherwise).
+**
+**	Usage: starsal-cli [-j threads] [-m MB] [-o output] [-q] project ...
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gtk/gtk.h>
+#include <main.h>
+#include <defs.h>
+#include <preferences.h>
+
+
+/* Defines */
+
+
+/* Prototypes */
+
+int cli_initialise(int, char **);
+int process_project(char *);
+void cli_usage(char *);
+void cli_progress(JobToken *, gpointer);
+
+extern int check_app_dir();
+extern int read_user_prefs(GtkWidget *);
+extern int set_user_pref(char *, char *);
+extern int add_user_pref(char *, char *);
+extern ProjectData * open_project(char *, GtkWidget *);
+extern void close_project(ProjectData *);
+extern PipeRun * pipeline_new(ProjectData *, JobToken *);
+extern void pipeline_free(PipeRun *);
+extern int pipeline_run_all(PipeRun *, GtkWidget *);
+extern const char * pipeline_stage_nm(int);
+extern int job_sched_init(int);
+extern void job_sched_close();
+extern void job_set_progress_fn(JobProgressFunc, gpointer);
+extern JobToken * job_token_new(char *);
+extern int64_t msec_time();
+extern void log_msg(char*, char*, char*, GtkWidget*);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-starsal_cli.c ";
+static char *out_fn = NULL;
+static int quiet = FALSE;
+
+
+/* Batch control */
+
+int main(int argc, char *argv[])
+{
+    int i, err;
+
+    if ((i = cli_initialise(argc, argv)) < 0)
+    	exit(2);
+
+    err = 0;
+
+    for(; i < argc; i++)
+    	if (! process_project(argv[i]))
+	    err++;
+
+    job_sched_close();
+
+    exit((err > 0) ? 1 : 0);
+}
+
+
+/* Options, preferences and worker threads. Returns the index of the first project */
+
+int cli_initialise(int argc, char *argv[])
+{
+    int c;
+    char *threads, *mem_mb;
+
+    app_msg_extra[0] = '\0';
+    threads = mem_mb = NULL;
+
+    while((c = getopt(argc, argv, "j:m:o:q")) != -1)
+    {
+    	switch(c)
+	{
+	    case 'j':
+		threads = optarg;
+		break;
+
+	    case 'm':
+		mem_mb = optarg;
+		break;
+
+	    case 'o':
+		out_fn = optarg;
+		break;
+
+	    case 'q':
+		quiet = TRUE;
+		break;
+
+	    default:
+		cli_usage(argv[0]);
+		return -1;
+	}
+    }
+
+    if (optind >= argc || (out_fn != NULL && argc - optind > 1))
+    {
+	cli_usage(argv[0]);
+    	return -1;
+    }
+
+    /* No log file reset - messages go to standard error */
+    if (! check_app_dir())
+    	return -1;
+
+    if (! read_user_prefs(NULL))
+    {
+    	log_msg("APP0005", "No user preferences", NULL, NULL);
+    	return -1;
+    }
+
+    if (threads != NULL)
+    	if (! set_user_pref(THREAD_COUNT, threads))
+	    add_user_pref(THREAD_COUNT, threads);
+
+    if (mem_mb != NULL)
+    	if (! set_user_pref(MEM_BUDGET_MB, mem_mb))
+	    add_user_pref(MEM_BUDGET_MB, mem_mb);
+
+    job_sched_init(FALSE);
+
+    if (! quiet && isatty(fileno(stderr)))
+	job_set_progress_fn(cli_progress, NULL);
+
+    return optind;
+}
+
+
+/* Open a project and run all the stages */
+
+int process_project(char *nm)
+{
+    int i, ok;
+    int64_t t;
+    ProjectData *proj;
+    PipeRun *run;
+
+    if ((proj = open_project(nm, NULL)) == NULL)
+    {
+	printf("%s\tresult\tfailed\n", nm);
+	fflush(stdout);
+    	return FALSE;
+    }
+
+    run = pipeline_new(proj, job_token_new(nm));
+
+    if (out_fn != NULL)
+    {
+    	free(run->out_fn);
+	run->out_fn = strdup(out_fn);
+    }
+
+    t = msec_time();
+    ok = pipeline_run_all(run, NULL);
+    t = msec_time() - t;
+
+    if (! quiet && isatty(fileno(stderr)))
+	fprintf(stderr, "\n");
+
+    for(i = 0; i < PIPE_STAGES; i++)
+	printf("%s\t%s\t%ld\n", nm, pipeline_stage_nm(i), (long) run->stage_ms[i]);
+
+    printf("%s\ttotal\t%ld\n", nm, (long) t);
+    printf("%s\tresult\t%s\n", nm, ok ? "ok" : "failed");
+    fflush(stdout);
+
+    pipeline_free(run);
+    close_project(proj);
+
+    return ok;
+}
+
+
+/* Progress on the terminal */
+
+void cli_progress(JobToken *token, gpointer user_data)
+{
+    double fraction;
+    char msg[100];
+
+    g_mutex_lock(&(token->lock));
+    fraction = token->fraction;
+    strcpy(msg, token->msg);
+    g_mutex_unlock(&(token->lock));
+
+    fprintf(stderr, "\r%s: %-40s %3d%%", token->desc, msg, (int) (fraction * 100.0));
+
+    return;
+}
+
+
+/* Usage */
+
+void cli_usage(char *prog)
+{
+    fprintf(stderr, "Usage: %s [-j threads] [-m MB] [-o output] [-q] project ...\n", prog);
+    fprintf(stderr, "\t-j threads\tworker threads (default from user settings)\n");
+    fprintf(stderr, "\t-m MB\t\tmemory budget (default from user settings)\n");
+    fprintf(stderr, "\t-o output\toutput file, FITS or .tif / .ppm / .pgm (single project only)\n");
+    fprintf(stderr, "\t-q\t\tno progress display\n");
+
+    return;
+}
@@ -0,0 +1,294 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Synthetic star field generator - light frames with a known transform and dark frames,
+**  for benchmarking and checking registration without real data.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define PSF_RADIUS 4.0			// In sigmas
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <synth.h>
+
+
+/* Prototypes */
+
+void synth_default_params(SynthParams *);
+SynthField * synth_new_field(SynthParams *);
+void synth_free_field(SynthField *);
+void synth_frame_xform(SynthField *, int, Xform *);
+ImgFrame * synth_light(SynthField *, Xform *);
+ImgFrame * synth_dark(SynthField *);
+static void add_noise(SynthField *, ImgFrame *, double, double);
+static uint32_t rng_next(uint32_t *);
+static double rng_uniform(uint32_t *);
+static double rng_gauss(uint32_t *);
+
+extern ImgFrame * frame_new(int, int, int);
+extern int xform_invert(Xform *, Xform *);
+extern void xform_apply(Xform *, double, double, double *, double *);
+extern void xform_identity(Xform *);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-synth.c ";
+
+
+/* Defaults - a modest DSLR crop */
+
+void synth_default_params(SynthParams *prm)
+{
+    prm->width = 2000;
+    prm->height = 1500;
+    prm->star_density = 100.0;
+    prm->psf_sigma = 1.5;
+    prm->sky = 1500.0;
+    prm->noise = 40.0;
+    prm->dark_level = 300.0;
+    prm->hot_pixels = 200;
+    prm->max_shift = 25.0;
+    prm->max_rot = 0.5;
+    prm->drift = 0.0;
+    prm->seed = 12345;
+
+    return;
+}
+
+
+/* Lay out the stars and hot pixels */
+
+SynthField * synth_new_field(SynthParams *prm)
+{
+    int i;
+    double u;
+    SynthField *fld;
+
+    fld = (SynthField *) malloc(sizeof(SynthField));
+    fld->prm = *prm;
+    fld->rng = prm->seed ? prm->seed : 1;
+    fld->n_stars = (int) (prm->star_density * prm->width * prm->height / 1e6);
+    fld->stars = (Star *) malloc(fld->n_stars * sizeof(Star));
+
+    /* Flux has many faint and few bright stars */
+    for(i = 0; i < fld->n_stars; i++)
+    {
+	fld->stars[i].x = (float) (rng_uniform(&(fld->rng)) * prm->width);
+	fld->stars[i].y = (float) (rng_uniform(&(fld->rng)) * prm->height);
+	u = rng_uniform(&(fld->rng));
+	fld->stars[i].flux = (float) (2000.0 * pow(100.0, u * u * u) * 2.0 * M_PI * prm->psf_sigma * prm->psf_sigma);
+    }
+
+    fld->hot_idx = (int *) malloc((prm->hot_pixels + 1) * sizeof(int));
+
+    for(i = 0; i < prm->hot_pixels; i++)
+	fld->hot_idx[i] = (int) (rng_uniform(&(fld->rng)) * ((double) prm->width * prm->height - 1));
+
+    return fld;
+}
+
+
+/* Free a field */
+
+void synth_free_field(SynthField *fld)
+{
+    if (fld == NULL)
+    	return;
+
+    free(fld->stars);
+    free(fld->hot_idx);
+    free(fld);
+
+    return;
+}
+
+
+// Known transform (frame to base) for frame 'i' - frame 0 is the base.
+// Depends only on the seed and frame number so results are repeatable.
+
+void synth_frame_xform(SynthField *fld, int i, Xform *xf)
+{
+    uint32_t r;
+    double th, dx, dy, cx, cy;
+
+    xform_identity(xf);
+
+    if (i == 0)
+    	return;
+
+    r = fld->prm.seed * 2654435761u + (uint32_t) i * 40503u + 1;
+    dx = (rng_uniform(&r) * 2.0 - 1.0) * fld->prm.max_shift;
+    dy = (rng_uniform(&r) * 2.0 - 1.0) * fld->prm.max_shift;
+    th = (rng_uniform(&r) * 2.0 - 1.0) * fld->prm.max_rot * M_PI / 180.0;
+
+    /* Steady walk (3, 4, 5 direction) */
+    dx += i * fld->prm.drift * 0.8;
+    dy += i * fld->prm.drift * 0.6;
+
+    /* Rotate about the centre then shift */
+    cx = fld->prm.width / 2.0;
+    cy = fld->prm.height / 2.0;
+    xf->a = cos(th);
+    xf->b = -sin(th);
+    xf->d = sin(th);
+    xf->e = cos(th);
+    xf->c = cx - xf->a * cx - xf->b * cy + dx;
+    xf->f = cy - xf->d * cx - xf->e * cy + dy;
+
+    return;
+}
+
+
+/* Render a light frame whose coordinates map onto the base through 'xf' */
+
+ImgFrame * synth_light(SynthField *fld, Xform *xf)
+{
+    int i, x, y, x0, x1, y0, y1, w, h;
+    double sx, sy, r, s2, amp;
+    float *p;
+    Xform inv;
+    ImgFrame *frm;
+
+    w = fld->prm.width;
+    h = fld->prm.height;
+
+    if ((frm = frame_new(w, h, 1)) == NULL)
+    	return NULL;
+
+    xform_invert(xf, &inv);
+    r = PSF_RADIUS * fld->prm.psf_sigma;
+    s2 = 2.0 * fld->prm.psf_sigma * fld->prm.psf_sigma;
+
+    for(i = 0; i < fld->n_stars; i++)
+    {
+	xform_apply(&inv, fld->stars[i].x, fld->stars[i].y, &sx, &sy);
+	x0 = MAX((int) (sx - r), 0);
+	x1 = MIN((int) (sx + r) + 1, w - 1);
+	y0 = MAX((int) (sy - r), 0);
+	y1 = MIN((int) (sy + r) + 1, h - 1);
+	amp = fld->stars[i].flux / (M_PI * s2);
+
+	for(y = y0; y <= y1; y++)
+	{
+	    p = frm->data + (size_t) y * w;
+
+	    for(x = x0; x <= x1; x++)
+		p[x] += (float) (amp * exp(-((x - sx) * (x - sx) + (y - sy) * (y - sy)) / s2));
+	}
+    }
+
+    add_noise(fld, frm, fld->prm.sky + fld->prm.dark_level, fld->prm.noise);
+
+    return frm;
+}
+
+
+/* Render a dark frame */
+
+ImgFrame * synth_dark(SynthField *fld)
+{
+    ImgFrame *frm;
+
+    if ((frm = frame_new(fld->prm.width, fld->prm.height, 1)) == NULL)
+    	return NULL;
+
+    add_noise(fld, frm, fld->prm.dark_level, fld->prm.noise * 0.5);
+
+    return frm;
+}
+
+
+/* Background, noise and hot pixels */
+
+static void add_noise(SynthField *fld, ImgFrame *frm, double level, double sigma)
+{
+    int i;
+    size_t j, n;
+
+    n = (size_t) frm->width * frm->height;
+
+    for(j = 0; j < n; j++)
+	frm->data[j] += (float) (level + sigma * rng_gauss(&(fld->rng)));
+
+    for(i = 0; i < fld->prm.hot_pixels; i++)
+	frm->data[fld->hot_idx[i]] = 60000.0f;
+
+    for(j = 0; j < n; j++)
+	frm->data[j] = CLAMP(frm->data[j], 0.0f, 65535.0f);
+
+    return;
+}
+
+
+/* xorshift32 */
+
+static uint32_t rng_next(uint32_t *s)
+{
+    uint32_t x;
+
+    x = *s;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *s = x;
+
+    return x;
+}
+
+
+/* Uniform [0, 1) */
+
+static double rng_uniform(uint32_t *s)
+{
+    return (rng_next(s) >> 8) / 16777216.0;
+}
+
+
+/* Standard normal (Box-Muller) */
+
+static double rng_gauss(uint32_t *s)
+{
+    double u1, u2;
+
+    u1 = rng_uniform(s) + 1e-12;
+    u2 = rng_uniform(s);
+
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
@@ -0,0 +1,75 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:	Synthetic star field (benchmark data) details
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial
+**
+*/
+
+
+/* Includes */
+
+#include <stdint.h>
+#include <pipeline.h>
+
+
+// Structure(s) for generating synthetic frames.
+// A star field is laid out once (positions on the base frame, fluxes) and each light frame
+// is rendered through a known transform (shift and rotation about the centre) with a
+// gaussian PSF, sky background, gaussian noise and fixed hot pixels. The transforms are
+// independent for each frame, or with a drift they follow a steady walk as a sequence does. Dark frames carry
+// the same hot pixels and dark level. Generation uses its own random number generator so
+// the same seed gives the same frames on any platform.
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+typedef struct _SynthParams
+{
+    int width, height;
+    double star_density;		// Stars per megapixel
+    double psf_sigma;			// Pixels
+    double sky, noise;			// Background level and noise sigma (0 - 65535 scale)
+    double dark_level;
+    int hot_pixels;
+    double max_shift;			// Pixels
+    double max_rot;			// Degrees
+    double drift;			// Pixels per frame - the frames walk steadily, the shift and
+    					// rotation above being the jitter about that
+    uint32_t seed;
+} SynthParams;
+
+
+typedef struct _SynthField
+{
+    SynthParams prm;
+    int n_stars;
+    Star *stars;
+    int *hot_idx;
+    uint32_t rng;
+} SynthField;
+
+#endif
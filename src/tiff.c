@@ -0,0 +1,919 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  TIFF files - stacks exported for other programs as 16 bit unsigned or 32 bit float
+**  (0 - 1) samples, and TIFF frames read at their full depth (gdk-pixbuf gives 8 bits).
+**  Images are written in strips of about 256 KB, optionally deflate compressed with the
+**  horizontal (16 bit) or floating point (float) predictor. A batch of strips is converted
+**  and compressed across the worker threads, then written in order, so the compression
+**  scales with the cores and only a batch is held compressed.
+**  The reader takes a single image of strips (not tiles), 8, 16 or 32 bit, grey or RGB
+**  (any alpha dropped), uncompressed or deflate, either byte order; the strips are
+**  decoded in parallel. Anything else is left to gdk-pixbuf.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define TIFF_STRIP_BYTES 262144		// Target uncompressed strip size
+#define TIFF_BATCH 64			// Strips worked in parallel before being written
+#define TIFF_ZLEVEL 1			// Deflate level, run length matches only (Z_RLE) -
+					// the sky noise leaves little for longer matches to find
+#define TIFF_IFD_TAGS 13		// Tags written
+#define TIFF_MAX 0xffffffffUL		// Largest offset in a (classic) TIFF file
+
+/* Tags and types used */
+#define TAG_WIDTH 256
+#define TAG_LENGTH 257
+#define TAG_BITS 258
+#define TAG_COMPRESS 259
+#define TAG_PHOTOMETRIC 262
+#define TAG_STRIP_OFFSETS 273
+#define TAG_SPP 277
+#define TAG_ROWS_STRIP 278
+#define TAG_STRIP_COUNTS 279
+#define TAG_PLANAR 284
+#define TAG_SOFTWARE 305
+#define TAG_PREDICTOR 317
+#define TAG_TILE_WIDTH 322
+#define TAG_SAMPLE_FMT 339
+#define TT_ASCII 2
+#define TT_SHORT 3
+#define TT_LONG 4
+#define COMP_NONE 1
+#define COMP_DEFLATE 8
+#define COMP_DEFLATE_OLD 32946
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <pipeline.h>
+#include <instrument.h>
+
+
+/* Types */
+
+typedef struct _TiffStrip
+{
+    unsigned char *buf;
+    size_t n;				// Bytes (0 - failed)
+} TiffStrip;
+
+typedef struct _TiffLayout
+{
+    int width, height, spp;		// Samples per pixel in the file
+    int bits;				// 8, 16 or 32
+    int is_float;
+    int compress;			// COMP_ values
+    int predictor;			// 1 none, 2 horizontal, 3 floating point
+    int rows;				// Rows per strip
+    int n_strips;
+    int big_endian;
+    size_t row_bytes;
+} TiffLayout;
+
+typedef struct _TiffWork
+{
+    ImgFrame *frm;
+    TiffLayout lay;
+    int first;				// First strip of the batch (write)
+    TiffStrip *st;
+    unsigned char *file;		// Whole file (read)
+    size_t file_n;
+    guint32 *offsets, *counts;		// Strip positions (read)
+    int failed;
+} TiffWork;
+
+
+/* Prototypes */
+
+int tiff_write(ImgFrame *, char *, int, int, GtkWidget *);
+ImgFrame * tiff_read(char *, int, GtkWidget *);
+static void encode_strips(int, int, gpointer);
+static void deflate_strip(unsigned char *, size_t, TiffStrip *);
+static void decode_strips(int, int, gpointer);
+static void to_samples(TiffWork *, int, unsigned char *);
+static void from_samples(TiffWork *, int, int, unsigned char *);
+static void predict(TiffLayout *, unsigned char *, int);
+static void unpredict(TiffLayout *, unsigned char *, int);
+static size_t write_ifd(unsigned char *, TiffLayout *, guint32, guint32 *, guint32 *);
+static unsigned char * ifd_entry(unsigned char *, int, int, guint32, guint32);
+static void put32(unsigned char *, guint32);
+static int read_layout(TiffWork *);
+static guint32 tag_value(TiffWork *, unsigned char *, int);
+static guint32 * tag_array(TiffWork *, unsigned char *, int);
+static guint16 get16(TiffWork *, size_t);
+static guint32 get32(TiffWork *, size_t);
+
+extern ImgFrame * frame_new(int, int, int);
+extern void frame_free(ImgFrame *);
+extern void job_parallel_for(int, int, int, int, JobRangeFunc, gpointer, JobToken *);
+extern void instr_start(InstrTimer *, int);
+extern void instr_stop(InstrTimer *, gint64, int);
+extern void log_msg_extra(char*, char*, char*, char*, GtkWidget*);
+extern int write_all(int, unsigned char *, size_t);
+extern int read_all(int, unsigned char *, size_t);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-tiff.c ";
+static const char *software = "StarsAl";
+
+
+/* Write a frame as a TIFF file - 'bits' 16 (unsigned) or 32 (float, 0 - 1), deflate if 'compress' */
+
+int tiff_write(ImgFrame *frm, char *fn, int bits, int compress, GtkWidget *window)
+{
+    char extra[256];
+    int fd, i, n, ok, err;
+    guint32 pos, ifd;
+    guint32 *offsets, *counts;
+    unsigned char hdr[8];
+    unsigned char *buf;
+    size_t len;
+    TiffWork tw;
+    InstrTimer tmr;
+
+    instr_start(&tmr, INS_WRITE);
+
+    /* Layout */
+    memset(&tw, 0, sizeof(TiffWork));
+    tw.frm = frm;
+    tw.lay.width = frm->width;
+    tw.lay.height = frm->height;
+    tw.lay.spp = frm->channels;
+    tw.lay.bits = (bits == 16) ? 16 : 32;
+    tw.lay.is_float = (tw.lay.bits == 32);
+    tw.lay.compress = (compress) ? COMP_DEFLATE : COMP_NONE;
+    tw.lay.predictor = (! compress) ? 1 : (tw.lay.is_float) ? 3 : 2;
+    tw.lay.row_bytes = (size_t) frm->width * frm->channels * (tw.lay.bits / 8);
+    tw.lay.rows = CLAMP((int) (TIFF_STRIP_BYTES / tw.lay.row_bytes), 1, frm->height);
+    tw.lay.n_strips = (frm->height + tw.lay.rows - 1) / tw.lay.rows;
+
+    if ((double) tw.lay.row_bytes * frm->height > TIFF_MAX * 0.99)
+    {
+	log_msg_extra("SYS9012", fn, "Image too large for TIFF", "SYS9012", window);
+	instr_stop(&tmr, 0, 0);
+    	return FALSE;
+    }
+
+    if ((fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+	sprintf(extra, "Error: (%d) %s", errno, strerror(errno));
+	log_msg_extra("SYS9005", fn, extra, "SYS9005", window);
+	instr_stop(&tmr, 0, 0);
+    	return FALSE;
+    }
+
+    offsets = (guint32 *) malloc(tw.lay.n_strips * sizeof(guint32));
+    counts = (guint32 *) malloc(tw.lay.n_strips * sizeof(guint32));
+    tw.st = (TiffStrip *) calloc(TIFF_BATCH, sizeof(TiffStrip));
+
+    /* Header (IFD position filled in at the end) */
+    memcpy(hdr, "II\x2a\0\0\0\0\0", 8);
+    ok = write_all(fd, hdr, 8);
+    pos = 8;
+
+    /* Strips a batch at a time */
+    for(tw.first = 0; ok && tw.first < tw.lay.n_strips; tw.first += TIFF_BATCH)
+    {
+	n = MIN(TIFF_BATCH, tw.lay.n_strips - tw.first);
+	job_parallel_for(JOB_PRI_BATCH, 0, n, 1, encode_strips, &tw, NULL);
+
+	for(i = 0; i < n && ok; i++)
+	{
+	    if (tw.st[i].n == 0 || (double) pos + tw.st[i].n > TIFF_MAX * 0.99)
+	    {
+		errno = (tw.st[i].n == 0) ? ENOMEM : EFBIG;
+		ok = FALSE;
+		break;
+	    }
+
+	    offsets[tw.first + i] = pos;
+	    counts[tw.first + i] = (guint32) tw.st[i].n;
+	    ok = write_all(fd, tw.st[i].buf, tw.st[i].n);
+	    pos += tw.st[i].n;
+	}
+
+	for(i = 0; i < n; i++)
+	{
+	    free(tw.st[i].buf);
+	    tw.st[i].buf = NULL;
+	}
+    }
+
+    /* Directory (word aligned) and its arrays after the strips */
+    if (ok)
+    {
+	ifd = pos + (pos & 1);
+	buf = (unsigned char *) calloc(1, 256 + (size_t) tw.lay.n_strips * 8);
+	len = write_ifd(buf + (ifd - pos), &(tw.lay), ifd, offsets, counts) + (ifd - pos);
+	ok = write_all(fd, buf, len);
+	free(buf);
+
+	put32(hdr + 4, ifd);
+	ok = ok && (pwrite(fd, hdr, 8, 0) == 8);
+	pos += len;
+    }
+
+    err = errno;
+
+    if (close(fd) != 0 && ok)
+    {
+	ok = FALSE;
+	err = errno;
+    }
+
+    free(tw.st);
+    free(offsets);
+    free(counts);
+
+    if (! ok)
+    {
+	sprintf(extra, "Error: (%d) %s", err, strerror(err));
+	log_msg_extra("SYS9012", fn, extra, "SYS9012", window);
+	instr_stop(&tmr, 0, 0);
+    	return FALSE;
+    }
+
+    instr_stop(&tmr, (gint64) pos, 1);
+
+    return TRUE;
+}
+
+
+/* Read a TIFF image as a frame (0 - 65535), grey as 1 channel, colour as 3.
+   If 'quiet' a file this cannot read is left without a message (for another decoder) */
+
+ImgFrame * tiff_read(char *fn, int quiet, GtkWidget *window)
+{
+    char extra[256];
+    int fd, ok;
+    struct stat sb;
+    TiffWork tw;
+    InstrTimer tmr;
+
+    instr_start(&tmr, INS_DECODE);
+    memset(&tw, 0, sizeof(TiffWork));
+
+    if ((fd = open(fn, O_RDONLY)) < 0 || fstat(fd, &sb) != 0)
+    {
+	sprintf(extra, "Error: (%d) %s", errno, strerror(errno));
+	log_msg_extra("SYS9005", fn, extra, "SYS9005", window);
+
+	if (fd >= 0)
+	    close(fd);
+
+	instr_stop(&tmr, 0, 0);
+    	return NULL;
+    }
+
+    /* The whole file - strips are decoded straight from it */
+    tw.file_n = sb.st_size;
+    tw.file = (unsigned char *) malloc(tw.file_n + 1);
+    ok = (tw.file != NULL && read_all(fd, tw.file, tw.file_n));
+    close(fd);
+
+    if (! ok)
+    {
+	sprintf(extra, "Error: (%d) %s", errno, strerror(errno));
+	log_msg_extra("SYS9013", fn, extra, "SYS9013", window);
+	free(tw.file);
+	instr_stop(&tmr, 0, 0);
+    	return NULL;
+    }
+
+    if (read_layout(&tw))
+    {
+	tw.frm = frame_new(tw.lay.width, tw.lay.height, (tw.lay.spp == 1) ? 1 : 3);
+
+	if (tw.frm != NULL)
+	    job_parallel_for(JOB_PRI_BATCH, 0, tw.lay.n_strips, 0, decode_strips, &tw, NULL);
+
+	if (tw.frm == NULL || g_atomic_int_get(&(tw.failed)))
+	{
+	    frame_free(tw.frm);
+	    tw.frm = NULL;
+	}
+    }
+
+    free(tw.offsets);
+    free(tw.counts);
+    free(tw.file);
+
+    if (tw.frm == NULL)
+    {
+	if (! quiet)
+	    log_msg_extra("APP0025", fn, NULL, "APP0025", window);
+
+	instr_stop(&tmr, 0, 0);
+    	return NULL;
+    }
+
+    instr_stop(&tmr, (gint64) tw.file_n, 1);
+
+    return tw.frm;
+}
+
+
+/* Convert (and compress) strips [lo, hi) of the batch */
+
+static void encode_strips(int lo, int hi, gpointer data)
+{
+    int i, s, rows;
+    size_t raw;
+    unsigned char *tmp;
+    TiffWork *tw;
+
+    tw = (TiffWork *) data;
+
+    for(i = lo; i < hi; i++)
+    {
+	s = tw->first + i;
+	rows = MIN(tw->lay.rows, tw->lay.height - s * tw->lay.rows);
+	raw = tw->lay.row_bytes * rows;
+	tmp = (unsigned char *) malloc(raw);
+	to_samples(tw, s, tmp);
+	tw->st[i].n = 0;
+
+	if (tw->lay.compress == COMP_NONE)
+	{
+	    tw->st[i].buf = tmp;
+	    tw->st[i].n = raw;
+	    continue;
+	}
+
+	predict(&(tw->lay), tmp, rows);
+	deflate_strip(tmp, raw, &(tw->st[i]));
+	free(tmp);
+    }
+
+    return;
+}
+
+
+/* Compress a strip (n is left 0 on failure) */
+
+static void deflate_strip(unsigned char *in, size_t n, TiffStrip *st)
+{
+    z_stream zs;
+
+    memset(&zs, 0, sizeof(z_stream));
+    st->n = 0;
+
+    if (deflateInit2(&zs, TIFF_ZLEVEL, Z_DEFLATED, 15, 8, Z_RLE) != Z_OK)
+    	return;
+
+    zs.avail_out = deflateBound(&zs, n);
+    st->buf = (unsigned char *) malloc(zs.avail_out);
+    zs.next_out = st->buf;
+    zs.next_in = in;
+    zs.avail_in = n;
+
+    if (deflate(&zs, Z_FINISH) == Z_STREAM_END)
+	st->n = zs.total_out;
+
+    deflateEnd(&zs);
+
+    return;
+}
+
+
+/* Decode (and expand) strips [lo, hi) */
+
+static void decode_strips(int lo, int hi, gpointer data)
+{
+    int s, rows;
+    size_t raw;
+    uLongf n;
+    unsigned char *tmp, *src;
+    TiffWork *tw;
+
+    tw = (TiffWork *) data;
+    tmp = (unsigned char *) malloc(tw->lay.row_bytes * tw->lay.rows);
+
+    for(s = lo; s < hi && ! g_atomic_int_get(&(tw->failed)); s++)
+    {
+	rows = MIN(tw->lay.rows, tw->lay.height - s * tw->lay.rows);
+	raw = tw->lay.row_bytes * rows;
+	src = tw->file + tw->offsets[s];
+
+	if ((size_t) tw->offsets[s] + tw->counts[s] > tw->file_n)
+	{
+	    g_atomic_int_set(&(tw->failed), TRUE);
+	    break;
+	}
+
+	/* Uncompressed samples are taken straight from the file */
+	if (tw->lay.compress == COMP_NONE)
+	{
+	    if (tw->counts[s] < raw)
+	    {
+		g_atomic_int_set(&(tw->failed), TRUE);
+		break;
+	    }
+
+	    from_samples(tw, s, rows, src);
+	    continue;
+	}
+
+	n = raw;
+
+	if (uncompress(tmp, &n, src, tw->counts[s]) != Z_OK || n != raw)
+	{
+	    g_atomic_int_set(&(tw->failed), TRUE);
+	    break;
+	}
+
+	unpredict(&(tw->lay), tmp, rows);
+	from_samples(tw, s, rows, tmp);
+    }
+
+    free(tmp);
+
+    return;
+}
+
+
+/* Frame rows of a strip to little endian file samples */
+
+static void to_samples(TiffWork *tw, int s, unsigned char *out)
+{
+    size_t i, n;
+    int v;
+    float *p;
+    guint16 *o16;
+    guint32 *o32;
+    union { float f; guint32 u; } fu;
+
+    n = (size_t) tw->lay.width * tw->lay.spp * MIN(tw->lay.rows, tw->lay.height - s * tw->lay.rows);
+    p = tw->frm->data + (size_t) s * tw->lay.rows * tw->lay.width * tw->lay.spp;
+    o16 = (guint16 *) out;
+    o32 = (guint32 *) out;
+
+    if (tw->lay.is_float)
+    {
+	for(i = 0; i < n; i++)
+	{
+	    fu.f = p[i] * (1.0f / 65535.0f);
+	    o32[i] = GUINT32_TO_LE(fu.u);
+	}
+    }
+    else
+    {
+	for(i = 0; i < n; i++)
+	{
+	    v = (int) (p[i] + 0.5f);
+	    o16[i] = GUINT16_TO_LE((guint16) CLAMP(v, 0, 65535));
+	}
+    }
+
+    return;
+}
+
+
+/* File samples of a strip (in file byte order) to frame rows, any alpha or extra dropped */
+
+static void from_samples(TiffWork *tw, int s, int rows, unsigned char *in)
+{
+    size_t i, n;
+    int c, ch, spp;
+    float *q;
+    guint16 u16;
+    guint32 u32;
+    union { float f; guint32 u; } fu;
+
+    ch = tw->frm->channels;
+    spp = tw->lay.spp;
+    n = (size_t) tw->lay.width * rows;
+    q = tw->frm->data + (size_t) s * tw->lay.rows * tw->lay.width * ch;
+
+    for(i = 0; i < n; i++, q += ch, in += spp * (tw->lay.bits / 8))
+    {
+	for(c = 0; c < ch; c++)
+	{
+	    if (tw->lay.bits == 8)
+	    {
+		q[c] = in[c] * 257.0f;
+	    }
+	    else if (tw->lay.bits == 16)
+	    {
+		memcpy(&u16, in + c * 2, 2);
+		q[c] = (tw->lay.big_endian) ? GUINT16_FROM_BE(u16) : GUINT16_FROM_LE(u16);
+	    }
+	    else
+	    {
+		memcpy(&u32, in + c * 4, 4);
+		fu.u = (tw->lay.big_endian) ? GUINT32_FROM_BE(u32) : GUINT32_FROM_LE(u32);
+		q[c] = (tw->lay.is_float) ? fu.f * 65535.0f : fu.u * (65535.0f / 4294967295.0f);
+	    }
+	}
+    }
+
+    return;
+}
+
+
+/* Predictor before compression - differences along each row (floats by byte plane) */
+
+static void predict(TiffLayout *lay, unsigned char *buf, int rows)
+{
+    int r;
+    size_t i, n, w;
+    unsigned char *row, *tmp;
+    guint16 *p;
+
+    w = (size_t) lay->width * lay->spp;
+
+    if (lay->predictor == 2)
+    {
+	for(r = 0; r < rows; r++)
+	{
+	    p = (guint16 *) (buf + r * lay->row_bytes);
+
+	    for(i = w - 1; i >= (size_t) lay->spp; i--)
+		p[i] = GUINT16_TO_LE(GUINT16_FROM_LE(p[i]) - GUINT16_FROM_LE(p[i - lay->spp]));
+	}
+    }
+    else if (lay->predictor == 3)
+    {
+	/* Bytes of each float regrouped most significant first, then differenced */
+	tmp = (unsigned char *) malloc(lay->row_bytes);
+	n = lay->row_bytes;
+
+	for(r = 0; r < rows; r++)
+	{
+	    row = buf + r * lay->row_bytes;
+
+	    for(i = 0; i < w; i++)
+	    {
+		tmp[i] = row[i * 4 + 3];
+		tmp[w + i] = row[i * 4 + 2];
+		tmp[w * 2 + i] = row[i * 4 + 1];
+		tmp[w * 3 + i] = row[i * 4];
+	    }
+
+	    for(i = n - 1; i >= (size_t) lay->spp; i--)
+		tmp[i] -= tmp[i - lay->spp];
+
+	    memcpy(row, tmp, n);
+	}
+
+	free(tmp);
+    }
+
+    return;
+}
+
+
+/* Undo the predictor after decompression (samples left in file byte order) */
+
+static void unpredict(TiffLayout *lay, unsigned char *buf, int rows)
+{
+    int r, k, b;
+    size_t i, n, w;
+    unsigned char *row, *tmp;
+    guint16 *p;
+    guint16 v;
+
+    w = (size_t) lay->width * lay->spp;
+    b = lay->bits / 8;
+
+    if (lay->predictor == 2 && lay->bits == 16)
+    {
+	for(r = 0; r < rows; r++)
+	{
+	    p = (guint16 *) (buf + r * lay->row_bytes);
+
+	    for(i = lay->spp; i < w; i++)
+	    {
+		if (lay->big_endian)
+		{
+		    v = GUINT16_FROM_BE(p[i]) + GUINT16_FROM_BE(p[i - lay->spp]);
+		    p[i] = GUINT16_TO_BE(v);
+		}
+		else
+		{
+		    v = GUINT16_FROM_LE(p[i]) + GUINT16_FROM_LE(p[i - lay->spp]);
+		    p[i] = GUINT16_TO_LE(v);
+		}
+	    }
+	}
+    }
+    else if (lay->predictor == 2 && lay->bits == 8)
+    {
+	for(r = 0; r < rows; r++)
+	{
+	    row = buf + r * lay->row_bytes;
+
+	    for(i = lay->spp; i < w; i++)
+		row[i] += row[i - lay->spp];
+	}
+    }
+    else if (lay->predictor == 3)
+    {
+	/* Sum the bytes, then back from planes to samples in file byte order */
+	tmp = (unsigned char *) malloc(lay->row_bytes);
+	n = lay->row_bytes;
+
+	for(r = 0; r < rows; r++)
+	{
+	    row = buf + r * lay->row_bytes;
+
+	    for(i = lay->spp; i < n; i++)
+		row[i] += row[i - lay->spp];
+
+	    for(i = 0; i < w; i++)
+		for(k = 0; k < b; k++)
+		    tmp[i * b + ((lay->big_endian) ? k : b - 1 - k)] = row[w * k + i];
+
+	    memcpy(row, tmp, n);
+	}
+
+	free(tmp);
+    }
+
+    return;
+}
+
+
+/* The image file directory and its arrays at file offset 'ifd', returns the size */
+
+static size_t write_ifd(unsigned char *buf, TiffLayout *lay, guint32 ifd, guint32 *offsets, guint32 *counts)
+{
+    int i;
+    guint32 ext, bits_at, fmt_at, off_at, cnt_at, sw_at;
+    unsigned char *p, *x;
+
+    /* Values too large for an entry follow the directory */
+    ext = ifd + 2 + TIFF_IFD_TAGS * 12 + 4;
+    bits_at = ext;
+    fmt_at = bits_at + lay->spp * 2;
+    sw_at = fmt_at + lay->spp * 2;
+    off_at = sw_at + ((strlen(software) + 2) & ~1);
+    cnt_at = off_at + lay->n_strips * 4;
+
+    p = buf;
+    *p++ = TIFF_IFD_TAGS & 0xff;
+    *p++ = 0;
+    p = ifd_entry(p, TAG_WIDTH, TT_LONG, 1, lay->width);
+    p = ifd_entry(p, TAG_LENGTH, TT_LONG, 1, lay->height);
+    p = ifd_entry(p, TAG_BITS, TT_SHORT, lay->spp, (lay->spp == 1) ? (guint32) lay->bits : bits_at);
+    p = ifd_entry(p, TAG_COMPRESS, TT_SHORT, 1, lay->compress);
+    p = ifd_entry(p, TAG_PHOTOMETRIC, TT_SHORT, 1, (lay->spp == 1) ? 1 : 2);
+    p = ifd_entry(p, TAG_STRIP_OFFSETS, TT_LONG, lay->n_strips, (lay->n_strips == 1) ? offsets[0] : off_at);
+    p = ifd_entry(p, TAG_SPP, TT_SHORT, 1, lay->spp);
+    p = ifd_entry(p, TAG_ROWS_STRIP, TT_LONG, 1, lay->rows);
+    p = ifd_entry(p, TAG_STRIP_COUNTS, TT_LONG, lay->n_strips, (lay->n_strips == 1) ? counts[0] : cnt_at);
+    p = ifd_entry(p, TAG_PLANAR, TT_SHORT, 1, 1);
+    p = ifd_entry(p, TAG_SOFTWARE, TT_ASCII, strlen(software) + 1, sw_at);
+    p = ifd_entry(p, TAG_PREDICTOR, TT_SHORT, 1, lay->predictor);
+    p = ifd_entry(p, TAG_SAMPLE_FMT, TT_SHORT, lay->spp, (lay->spp == 1) ? (guint32) ((lay->is_float) ? 3 : 1) : fmt_at);
+    memset(p, 0, 4);				// No further directories
+    p += 4;
+
+    /* Arrays */
+    x = buf + (bits_at - ifd);
+
+    for(i = 0; i < lay->spp; i++)
+    {
+	x[i * 2] = lay->bits;
+	x[i * 2 + 1] = 0;
+	x[(fmt_at - bits_at) + i * 2] = (lay->is_float) ? 3 : 1;
+	x[(fmt_at - bits_at) + i * 2 + 1] = 0;
+    }
+
+    memcpy(buf + (sw_at - ifd), software, strlen(software) + 1);
+
+    for(i = 0; i < lay->n_strips; i++)
+    {
+	put32(buf + (off_at - ifd) + i * 4, offsets[i]);
+	put32(buf + (cnt_at - ifd) + i * 4, counts[i]);
+    }
+
+    return (cnt_at - ifd) + lay->n_strips * 4;
+}
+
+
+/* A directory entry (little endian), values of 2 bytes or less left justified */
+
+static unsigned char * ifd_entry(unsigned char *p, int tag, int type, guint32 count, guint32 val)
+{
+    p[0] = tag & 0xff;
+    p[1] = (tag >> 8) & 0xff;
+    p[2] = type & 0xff;
+    p[3] = 0;
+    put32(p + 4, count);
+    put32(p + 8, val);
+
+    return p + 12;
+}
+
+
+/* Little endian file value */
+
+static void put32(unsigned char *p, guint32 val)
+{
+    p[0] = val & 0xff;
+    p[1] = (val >> 8) & 0xff;
+    p[2] = (val >> 16) & 0xff;
+    p[3] = (val >> 24) & 0xff;
+
+    return;
+}
+
+
+/* Layout of the first image - FALSE if not one that can be read here */
+
+static int read_layout(TiffWork *tw)
+{
+    int i, n;
+    guint32 ifd, v;
+    unsigned char *e;
+    unsigned char *ent[TAG_SAMPLE_FMT - TAG_WIDTH + 1];
+    TiffLayout *lay;
+
+    lay = &(tw->lay);
+
+    if (tw->file_n < 8 || (memcmp(tw->file, "II", 2) != 0 && memcmp(tw->file, "MM", 2) != 0))
+    	return FALSE;
+
+    lay->big_endian = (tw->file[0] == 'M');
+
+    if (get16(tw, 2) != 42)
+    	return FALSE;
+
+    /* Entries used, by tag */
+    ifd = get32(tw, 4);
+
+    if ((size_t) ifd + 2 > tw->file_n)
+    	return FALSE;
+
+    n = get16(tw, ifd);
+
+    if ((size_t) ifd + 2 + n * 12 > tw->file_n)
+    	return FALSE;
+
+    memset(ent, 0, sizeof(ent));
+
+    for(i = 0; i < n; i++)
+    {
+	e = tw->file + ifd + 2 + i * 12;
+	v = get16(tw, e - tw->file);
+
+	if (v >= TAG_WIDTH && v <= TAG_SAMPLE_FMT)
+	    ent[v - TAG_WIDTH] = e;
+    }
+
+    /* Tiles and planes are not read here */
+    if (ent[TAG_TILE_WIDTH - TAG_WIDTH] != NULL || tag_value(tw, ent[TAG_PLANAR - TAG_WIDTH], 1) != 1)
+    	return FALSE;
+
+    lay->width = tag_value(tw, ent[0], 0);
+    lay->height = tag_value(tw, ent[TAG_LENGTH - TAG_WIDTH], 0);
+    lay->spp = tag_value(tw, ent[TAG_SPP - TAG_WIDTH], 1);
+    lay->bits = tag_value(tw, ent[TAG_BITS - TAG_WIDTH], 1);
+    lay->compress = tag_value(tw, ent[TAG_COMPRESS - TAG_WIDTH], COMP_NONE);
+    lay->predictor = tag_value(tw, ent[TAG_PREDICTOR - TAG_WIDTH], 1);
+    lay->is_float = (tag_value(tw, ent[TAG_SAMPLE_FMT - TAG_WIDTH], 1) == 3);
+    lay->rows = MIN(tag_value(tw, ent[TAG_ROWS_STRIP - TAG_WIDTH], lay->height), (guint32) lay->height);
+    v = tag_value(tw, ent[TAG_PHOTOMETRIC - TAG_WIDTH], 1);
+
+    if (lay->width <= 0 || lay->height <= 0 || lay->rows <= 0 || (v != 1 && v != 2)
+    	|| (lay->spp != 1 && lay->spp < 3) || lay->spp > 4 || (v == 2) != (lay->spp >= 3)
+    	|| (lay->bits != 8 && lay->bits != 16 && lay->bits != 32) || (lay->is_float && lay->bits != 32)
+    	|| (lay->compress != COMP_NONE && lay->compress != COMP_DEFLATE && lay->compress != COMP_DEFLATE_OLD)
+    	|| lay->predictor < 1 || lay->predictor > 3 || (lay->predictor == 3 && ! lay->is_float)
+    	|| (lay->predictor == 2 && lay->bits == 32))
+	return FALSE;
+
+    if (lay->compress == COMP_DEFLATE_OLD)
+	lay->compress = COMP_DEFLATE;
+
+    if (lay->compress == COMP_NONE)
+	lay->predictor = 1;
+
+    lay->row_bytes = (size_t) lay->width * lay->spp * (lay->bits / 8);
+    lay->n_strips = (lay->height + lay->rows - 1) / lay->rows;
+
+    /* Strip positions */
+    tw->offsets = tag_array(tw, ent[TAG_STRIP_OFFSETS - TAG_WIDTH], lay->n_strips);
+    tw->counts = tag_array(tw, ent[TAG_STRIP_COUNTS - TAG_WIDTH], lay->n_strips);
+
+    return (tw->offsets != NULL && tw->counts != NULL);
+}
+
+
+/* First value of an entry (SHORT or LONG), 'dflt' if absent */
+
+static guint32 tag_value(TiffWork *tw, unsigned char *e, int dflt)
+{
+    size_t at;
+    guint32 n;
+
+    if (e == NULL)
+    	return dflt;
+
+    at = e - tw->file;
+    n = get32(tw, at + 4);
+
+    if (get16(tw, at + 2) == TT_SHORT)
+	return (n <= 2) ? get16(tw, at + 8) : get16(tw, get32(tw, at + 8));
+
+    return (n <= 1) ? get32(tw, at + 8) : get32(tw, get32(tw, at + 8));
+}
+
+
+/* Array of 'n' values of an entry (SHORT or LONG) - NULL if absent or short */
+
+static guint32 * tag_array(TiffWork *tw, unsigned char *e, int n)
+{
+    int i, sz;
+    size_t at, pos;
+    guint32 *a;
+
+    if (e == NULL || (int) get32(tw, e - tw->file + 4) < n)
+    	return NULL;
+
+    at = e - tw->file;
+    sz = (get16(tw, at + 2) == TT_SHORT) ? 2 : 4;
+    pos = ((size_t) n * sz <= 4) ? at + 8 : get32(tw, at + 8);
+
+    if (pos + (size_t) n * sz > tw->file_n)
+    	return NULL;
+
+    a = (guint32 *) malloc(n * sizeof(guint32));
+
+    for(i = 0; i < n; i++)
+	a[i] = (sz == 2) ? get16(tw, pos + i * 2) : get32(tw, pos + i * 4);
+
+    return a;
+}
+
+
+/* File values in the file's byte order (0 beyond the end) */
+
+static guint16 get16(TiffWork *tw, size_t at)
+{
+    unsigned char *p;
+
+    if (at + 2 > tw->file_n)
+    	return 0;
+
+    p = tw->file + at;
+
+    return (tw->lay.big_endian) ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+
+static guint32 get32(TiffWork *tw, size_t at)
+{
+    unsigned char *p;
+
+    if (at + 4 > tw->file_n)
+    	return 0;
+
+    p = tw->file + at;
+
+    if (tw->lay.big_endian)
+	return ((guint32) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+
+    return ((guint32) p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
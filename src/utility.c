@@ -48,6 +48,7 @@
 #include <ctype.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include <dirent.h>
 #include <errno.h>
 #include <time.h>
@@ -59,6 +60,7 @@
 
 void app_msg(char*, char *, GtkWidget*);
 void log_msg(char*, char*, char*, GtkWidget*);
+void log_msg_extra(char*, char*, char*, char*, GtkWidget*);
 void info_dialog(GtkWidget *, char *, char *);
 gint query_dialog(GtkWidget *, char *, char *);
 int reset_log();
@@ -84,6 +86,8 @@ int remove_dir(const char *);
 int get_file_stat(char *, struct stat *);
 FILE * open_file(char *, char *);
 int read_file(FILE *, char *, int);
+int write_all(int, unsigned char *, size_t);
+int read_all(int, unsigned char *, size_t);
 int val_str2numb(char *, int *, char *, GtkWidget *);
 char * itostr(int);
 void basename_dirname(char *, char **, char **);
@@ -113,6 +117,18 @@ static const char *app_messages[][2] =
     { "APP0013", "Warning: One or more darks have been discarded. "},
     { "APP0014", "File error: Failed to find tag - %s. "},
     { "APP0015", "Error: You must have a least one image. "},
+    { "APP0016", "Error: Failed to load image %s. "},
+    { "APP0017", "%s stage completed. "},
+    { "APP0018", "Error: %s stage failed. "},
+    { "APP0019", "Warning: Image %s could not be registered and is excluded. "},
+    { "APP0020", "Processing summary: %s. "},
+    { "APP0021", "%s timing. "},
+    { "APP0022", "Warning: One or more %s have been discarded. "},
+    { "APP0023", "Warning: Image %s is rejected for poor quality. "},
+    { "APP0024", "Error: %s is not a FITS image that can be read. "},
+    { "APP0025", "Error: %s is not a TIFF image that can be read. "},
+    { "APP0026", "%s resumed from the journal. "},
+    { "APP0027", "Error: %s is not a video that can be read. "},
     { "APP9999", "Application message: "},
     { "SYS9000", "Failed to start application. "},
     { "SYS9001", "Session started. "},
@@ -133,10 +149,11 @@ static const char *app_messages[][2] =
     { "SYS9999", "Error - Unknown error message given. "}			// NB - MUST be last
 };
 
-static const int Msg_Count = 33;
+static const int Msg_Count = 45;
 static char *Home;
 static char *logfile = NULL;
 static FILE *lf = NULL;
+static GMutex log_lock;
 static char *app_dir;
 static int app_dir_len;
 static const char *debug_hdr = "DEBUG-utility.c ";
@@ -165,9 +182,27 @@ void app_msg(char *msg_id, char *opt_str, GtkWidget *window)
 }
 
 
-/* Add a message to the log file and optionally display a popup */
+/* Add a message (with any details in app_msg_extra) to the log file and optionally display
+   a popup - main thread only, jobs use log_msg_extra */
 
 void log_msg(char *msg_id, char *opt_str, char *sys_msg_id, GtkWidget *window)
+{
+    char extra[sizeof(app_msg_extra)];
+
+    /* Take and reset the global error details */
+    strcpy(extra, app_msg_extra);
+    app_msg_extra[0] = '\0';
+
+    log_msg_extra(msg_id, opt_str, extra, sys_msg_id, window);
+
+    return;
+}
+
+
+/* Add a message and its details (may be NULL) to the log file and optionally display a popup.
+   The log is locked so this is safe from any thread, but only the main thread may display. */
+
+void log_msg_extra(char *msg_id, char *opt_str, char *extra, char *sys_msg_id, GtkWidget *window)
 {
     char msg[512];
     char date_str[50];
@@ -175,6 +210,8 @@ void log_msg(char *msg_id, char *opt_str, char *sys_msg_id, GtkWidget *window)
     /* Lookup the error */
     get_msg(msg, msg_id, opt_str);
 
+    g_mutex_lock(&log_lock);
+
     /* Log the message */
     cur_date_str(date_str, sizeof(date_str), "%d-%b-%Y %I:%M:%S %p");
 
@@ -184,13 +221,11 @@ void log_msg(char *msg_id, char *opt_str, char *sys_msg_id, GtkWidget *window)
 
     fprintf(lf, "%s - %s\n", date_str, msg);
 
-    if (strlen(app_msg_extra) > 0)
-	fprintf(lf, "\t%s\n", app_msg_extra);
+    if (extra != NULL && *extra != '\0')
+	fprintf(lf, "\t%s\n", extra);
 
     fflush(lf);
-
-    /* Reset global error details */
-    app_msg_extra[0] = '\0';
+    g_mutex_unlock(&log_lock);
 
     /* Optional display */
     if (sys_msg_id && window && logfile)
@@ -730,6 +765,57 @@ int read_file(FILE *fd, char *buf, int sz_len)
 }
 
 
+/* Write all of a buffer */
+
+int write_all(int fd, unsigned char *buf, size_t n)
+{
+    ssize_t r;
+
+    while(n > 0)
+    {
+	if ((r = write(fd, buf, n)) < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+
+	    return FALSE;
+	}
+
+	buf += r;
+	n -= r;
+    }
+
+    return TRUE;
+}
+
+
+/* Read all of a buffer (a short file is an error) */
+
+int read_all(int fd, unsigned char *buf, size_t n)
+{
+    ssize_t r;
+
+    while(n > 0)
+    {
+	if ((r = read(fd, buf, n)) <= 0)
+	{
+	    if (r < 0 && errno == EINTR)
+		continue;
+
+	    if (r == 0)
+		errno = EIO;
+
+	    return FALSE;
+	}
+
+	buf += r;
+	n -= r;
+    }
+
+    return TRUE;
+}
+
+
 /* Convert a string to a number and validate */
 
 int val_str2numb(char *s, int *numb, char *subst, GtkWidget *window)
@@ -0,0 +1,752 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Video frame source - SER and uncompressed AVI captures (planetary and lunar imaging)
+**  used as a project's images. A video is a single image record in the project (its
+**  'vframes' the frame count) and is expanded into a record a frame ('vframe' 1 - n) only
+**  for a pipeline run, so thousands of frames are measured, registered and stacked
+**  straight from the video without being extracted.
+**  The file is memory mapped once (shared by the worker threads) and frame k is a view
+**  of the mapping, decoded directly into a working frame. SER - mono, Bayer (a single
+**  channel frame, the mosaic given to drizzle) or RGB / BGR, 8 or 16 bit. Samples are scaled
+**  from the header bit depth (10, 12, 14 bit data in 16) unless the first frame shows them
+**  aligned to the top of the sample, and clamped at 65535. The byte order flag is taken the
+**  way capture programs write it (0 little endian), the opposite of the SER spec.
+**  AVI - 8 bit grey (Y800 or paletted, the palette taken as grey) or 24 bit BGR, including
+**  OpenDML (AVIX) files over 1 GB. Mappings are kept until the project is closed.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#define SER_HDR 178			// SER header size
+#define SER_TICKS_1970 G_GINT64_CONSTANT(621355968000000000)	// 100ns ticks from year 1 to 1970
+#define AVI_DEPTH 4			// Deepest LIST nesting searched
+
+
+/* Includes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <pipeline.h>
+#include <instrument.h>
+
+
+/* Types */
+
+enum VideoOrder
+{
+    VID_MONO,
+    VID_RGB,
+    VID_BGR
+};
+
+typedef struct _VideoSrc
+{
+    char *path;
+    const char *fmt;			// 'SER' or 'AVI'
+    guchar *map;
+    gsize size;
+    int width, height, channels;
+    int bytes;				// Per sample (1 or 2)
+    int bits;				// Significant bits a sample
+    int big_end;			// 2 byte samples are big endian
+    int order;				// VideoOrder
+    int flip;				// Rows stored bottom up
+    gsize stride;			// Bytes a row
+    float scale;			// Sample to 0 - 65535
+    int cfa;				// CfaPattern of a Bayer capture
+    int n;				// Frames
+    gsize *off;				// Offset of each frame
+    gint64 *time;			// Each frame taken, seconds from 1970 (may be NULL)
+    gint64 start;			// Capture start (0 if not known)
+    char make[41], model[41];
+} VideoSrc;
+
+typedef struct _AviParse
+{
+    int stream;				// Video stream number (-1 until found)
+    int n_strl;				// Streams seen
+    gint32 bmp_h;			// BITMAPINFOHEADER height (negative is top down)
+    int bits;
+    guint32 comp;
+    GArray *off;
+} AviParse;
+
+
+/* Prototypes */
+
+int video_file(const char *);
+int video_info(Image *, char *, GtkWidget *);
+GList * video_expand(GList *);
+void video_list_free(GList *);
+Image * video_frame_array(GList *, int *);
+ImgFrame * video_frame_load(Image *, GtkWidget *);
+const guchar * video_frame_view(Image *, size_t *);
+int video_cfa(Image *);
+void video_close_all();
+static VideoSrc * video_get(Image *);
+static VideoSrc * video_open(const char *);
+static void video_free(gpointer);
+static int ser_parse(VideoSrc *);
+static void ser_depth_check(VideoSrc *);
+static int avi_parse(VideoSrc *);
+static void avi_walk(VideoSrc *, gsize, gsize, int, AviParse *);
+static guint32 rd32(const guchar *);
+static void trim_field(char *, const guchar *, int);
+
+extern ImgFrame * frame_new(int, int, int);
+extern Image * img_copy(Image *);
+extern char * img_str(const char *);
+extern void free_img(gpointer);
+extern void instr_start(InstrTimer *, int);
+extern void instr_stop(InstrTimer *, gint64, int);
+extern void log_msg_extra(char*, char*, char*, char*, GtkWidget*);
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-video.c ";
+static GMutex vid_lock;
+static GHashTable *videos = NULL;		// Open videos by path
+
+
+/* Whether a file is a video (by its extension) */
+
+int video_file(const char *path)
+{
+    const char *ext;
+
+    if ((ext = strrchr(path, '.')) == NULL)
+    	return FALSE;
+
+    return (strcasecmp(ext, ".ser") == 0 || strcasecmp(ext, ".avi") == 0);
+}
+
+
+/* Set up the image record of a video from its header (in place of Exif) */
+
+int video_info(Image *img, char *path, GtkWidget *window)
+{
+    char s[30];
+    gchar *d;
+    VideoSrc *v;
+    GDateTime *dt;
+
+    if ((v = video_get(img)) == NULL)
+    {
+	log_msg_extra("APP0027", path, NULL, "APP0027", window);
+    	return FALSE;
+    }
+
+    img->vframe = 0;
+    img->vframes = v->n;
+    img->taken = v->start;
+
+    img->img_exif.make = img_str((v->make[0]) ? v->make : "N/A");
+    img->img_exif.model = img_str((v->model[0]) ? v->model : "N/A");
+    img->img_exif.type = img_str(v->fmt);
+    img->img_exif.iso = img_str("N/A");
+    img->img_exif.exposure = img_str("N/A");
+    img->img_exif.f_stop = img_str("N/A");
+
+    sprintf(s, "%d", v->width);
+    img->img_exif.width = img_str(s);
+    sprintf(s, "%d", v->height);
+    img->img_exif.height = img_str(s);
+
+    img->img_exif.date = img_str("N/A");
+
+    if (v->start != 0 && (dt = g_date_time_new_from_unix_utc(v->start)) != NULL)
+    {
+	d = g_date_time_format(dt, "%Y:%m:%d %H:%M:%S");
+	img->img_exif.date = img_str(d);
+	g_free(d);
+	g_date_time_unref(dt);
+    }
+
+    return TRUE;
+}
+
+
+/* A copy of a list with each video replaced by its frames (new records, with their own
+   times if the video has them) - free with video_list_free */
+
+GList * video_expand(GList *gl)
+{
+    int k;
+    GList *l, *out;
+    Image *img, *f;
+    VideoSrc *v;
+
+    out = NULL;
+
+    for(l = gl; l != NULL; l = l->next)
+    {
+	img = (Image *) l->data;
+
+	if (img->vframes == 0 || img->vframe != 0 || (v = video_get(img)) == NULL)
+	{
+	    out = g_list_prepend(out, img);
+	    continue;
+	}
+
+	for(k = 0; k < v->n; k++)
+	{
+	    f = img_copy(img);
+	    f->vframe = k + 1;
+	    f->vframes = v->n;
+
+	    if (v->time != NULL)
+		f->taken = v->time[k];
+
+	    out = g_list_prepend(out, f);
+	}
+    }
+
+    return g_list_reverse(out);
+}
+
+
+/* Free a list from video_expand (with the frame records it made) */
+
+void video_list_free(GList *gl)
+{
+    GList *l;
+
+    for(l = gl; l != NULL; l = l->next)
+	if (((Image *) l->data)->vframe != 0)
+	    free_img(l->data);
+
+    g_list_free(gl);
+
+    return;
+}
+
+
+/* A plain array of copies of a list's records with each video replaced by its frames - for
+   a job off the main thread (no store records are made). Free with free(), NULL if empty. */
+
+Image * video_frame_array(GList *gl, int *n)
+{
+    int i, k;
+    GList *l;
+    Image *img, *arr;
+    VideoSrc *v;
+
+    for(l = gl, *n = 0; l != NULL; l = l->next)
+    {
+	img = (Image *) l->data;
+
+	if (img->vframes > 0 && img->vframe == 0 && (v = video_get(img)) != NULL)
+	    *n += v->n;
+	else
+	    (*n)++;
+    }
+
+    if (*n == 0)
+    	return NULL;
+
+    arr = (Image *) malloc(*n * sizeof(Image));
+
+    for(l = gl, i = 0; l != NULL; l = l->next)
+    {
+	img = (Image *) l->data;
+
+	if (img->vframes == 0 || img->vframe != 0 || (v = video_get(img)) == NULL)
+	{
+	    arr[i++] = *img;
+	    continue;
+	}
+
+	for(k = 0; k < v->n && i < *n; k++, i++)
+	{
+	    arr[i] = *img;
+	    arr[i].vframe = k + 1;
+	    arr[i].vframes = v->n;
+
+	    if (v->time != NULL)
+		arr[i].taken = v->time[k];
+	}
+    }
+
+    *n = i;
+
+    return arr;
+}
+
+
+/* Load a video frame record as a frame scaled to 0 - 65535 */
+
+ImgFrame * video_frame_load(Image *img, GtkWidget *window)
+{
+    int x, y, ch, w, h;
+    const guchar *p, *row;
+    float c, *q;
+    size_t len;
+    VideoSrc *v;
+    ImgFrame *frm;
+    InstrTimer tmr;
+
+    if ((v = video_get(img)) == NULL || (p = video_frame_view(img, &len)) == NULL)
+    {
+	log_msg_extra("APP0027", img->nm, NULL, "APP0027", window);
+    	return NULL;
+    }
+
+    instr_start(&tmr, INS_DECODE);
+    w = v->width;
+    h = v->height;
+    ch = v->channels;
+
+    if ((frm = frame_new(w, h, ch)) == NULL)
+    	return NULL;
+
+    for(y = 0; y < h; y++)
+    {
+	row = p + ((v->flip) ? (gsize) (h - 1 - y) : (gsize) y) * v->stride;
+	q = frm->data + (size_t) y * w * ch;
+
+	if (v->bytes == 1)
+	{
+	    for(x = 0; x < w * ch; x++)
+		q[x] = MIN(row[x] * v->scale, 65535.0f);
+	}
+	else if (v->big_end)
+	{
+	    for(x = 0; x < w * ch; x++)
+		q[x] = MIN(((row[x * 2] << 8) | row[x * 2 + 1]) * v->scale, 65535.0f);
+	}
+	else
+	{
+	    for(x = 0; x < w * ch; x++)
+		q[x] = MIN((row[x * 2] | (row[x * 2 + 1] << 8)) * v->scale, 65535.0f);
+	}
+
+	/* Channels to RGB */
+	if (v->order == VID_BGR)
+	{
+	    for(x = 0; x < w; x++, q += 3)
+	    {
+		c = q[0];
+		q[0] = q[2];
+		q[2] = c;
+	    }
+	}
+    }
+
+    instr_stop(&tmr, (gint64) len, 1);
+
+    return frm;
+}
+
+
+/* A video frame record's data within the mapping (no copy), NULL if it cannot be read */
+
+const guchar * video_frame_view(Image *img, size_t *len)
+{
+    VideoSrc *v;
+
+    if (img->vframe < 1 || (v = video_get(img)) == NULL || img->vframe > v->n)
+    	return NULL;
+
+    *len = v->stride * v->height;
+
+    return v->map + v->off[img->vframe - 1];
+}
+
+
+/* The mosaic pattern of a Bayer video (CFA_NONE if not one) */
+
+int video_cfa(Image *img)
+{
+    VideoSrc *v;
+
+    if (img->vframes == 0 || (v = video_get(img)) == NULL)
+    	return CFA_NONE;
+
+    return v->cfa;
+}
+
+
+/* Unmap all the videos (no run may be using them) */
+
+void video_close_all()
+{
+    g_mutex_lock(&vid_lock);
+
+    if (videos != NULL)
+	g_hash_table_destroy(videos);
+
+    videos = NULL;
+    g_mutex_unlock(&vid_lock);
+
+    return;
+}
+
+
+/* The open video of an image record, opened on first use (NULL if not readable) */
+
+static VideoSrc * video_get(Image *img)
+{
+    char *path;
+    VideoSrc *v;
+
+    path = (char *) malloc(strlen(img->path) + strlen(img->nm) + 2);
+    sprintf(path, "%s/%s", img->path, img->nm);
+
+    g_mutex_lock(&vid_lock);
+
+    if (videos == NULL)
+	videos = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, video_free);
+
+    if ((v = (VideoSrc *) g_hash_table_lookup(videos, path)) == NULL)
+	if ((v = video_open(path)) != NULL)
+	    g_hash_table_insert(videos, v->path, v);
+
+    g_mutex_unlock(&vid_lock);
+    free(path);
+
+    return v;
+}
+
+
+/* Map a video and index its frames */
+
+static VideoSrc * video_open(const char *path)
+{
+    int fd, ok;
+    struct stat sb;
+    VideoSrc *v;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+    	return NULL;
+
+    if (fstat(fd, &sb) != 0 || sb.st_size < SER_HDR)
+    {
+	close(fd);
+    	return NULL;
+    }
+
+    v = (VideoSrc *) malloc(sizeof(VideoSrc));
+    memset(v, 0, sizeof(VideoSrc));
+    v->size = sb.st_size;
+    v->map = (guchar *) mmap(NULL, v->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (v->map == MAP_FAILED)
+    {
+	free(v);
+    	return NULL;
+    }
+
+    v->path = strdup(path);
+    v->cfa = CFA_NONE;
+
+    if (memcmp(v->map, "LUCAM-RECORDER", 14) == 0)
+	ok = ser_parse(v);
+    else if (memcmp(v->map, "RIFF", 4) == 0 && memcmp(v->map + 8, "AVI ", 4) == 0)
+	ok = avi_parse(v);
+    else
+	ok = FALSE;
+
+    if (! ok || v->n == 0)
+    {
+	video_free(v);
+    	return NULL;
+    }
+
+    v->scale = 65535.0f / (float) ((1 << v->bits) - 1);
+
+    /* Frames are mostly read in order */
+    posix_madvise(v->map, v->size, POSIX_MADV_SEQUENTIAL);
+
+    return v;
+}
+
+
+/* Unmap and free a video */
+
+static void video_free(gpointer p)
+{
+    VideoSrc *v = (VideoSrc *) p;
+
+    if (v->map != NULL && v->map != MAP_FAILED)
+	munmap(v->map, v->size);
+
+    free(v->path);
+    free(v->off);
+    free(v->time);
+    free(v);
+
+    return;
+}
+
+
+/* SER header, frames and the optional trailer of frame times */
+
+static int ser_parse(VideoSrc *v)
+{
+    int k, colour, depth, n;
+    gsize fb, trail;
+    gint64 t;
+    const guchar *h;
+
+    h = v->map;
+    colour = (int) rd32(h + 18);
+    v->width = (int) rd32(h + 26);
+    v->height = (int) rd32(h + 30);
+    depth = (int) rd32(h + 34);
+    n = (int) rd32(h + 38);
+
+    if (v->width <= 0 || v->height <= 0 || depth < 1 || depth > 16 || n <= 0)
+    	return FALSE;
+
+    v->fmt = "SER";
+    v->bytes = (depth > 8) ? 2 : 1;
+    v->bits = depth;
+
+    /* The LittleEndian flag is used the opposite way to the SER spec by nearly every capture
+       program, so 0 (the usual value) is taken as little endian data */
+    v->big_end = (v->bytes == 2 && rd32(h + 22) != 0);
+    v->channels = (colour == 100 || colour == 101) ? 3 : 1;
+    v->order = (colour == 100) ? VID_RGB : (colour == 101) ? VID_BGR : VID_MONO;
+
+    switch(colour)
+    {
+	case 8:  v->cfa = CFA_RGGB; break;
+	case 9:  v->cfa = CFA_GRBG; break;
+	case 10: v->cfa = CFA_GBRG; break;
+	case 11: v->cfa = CFA_BGGR; break;
+    }
+
+    trim_field(v->make, h + 82, 40);			// Camera
+    trim_field(v->model, h + 122, 40);			// Telescope
+
+    /* Frames (any cut short by a truncated file are dropped) */
+    v->stride = (gsize) v->width * v->channels * v->bytes;
+    fb = v->stride * v->height;
+    v->n = (int) MIN((gsize) n, (v->size - SER_HDR) / fb);
+    v->off = (gsize *) malloc(v->n * sizeof(gsize));
+
+    for(k = 0; k < v->n; k++)
+	v->off[k] = SER_HDR + (gsize) k * fb;
+
+    ser_depth_check(v);
+
+    /* Start time (UTC, else local) and the frame times if present */
+    t = (gint64) ((guint64) rd32(h + 170) | ((guint64) rd32(h + 174) << 32));
+
+    if (t <= 0)
+	t = (gint64) ((guint64) rd32(h + 162) | ((guint64) rd32(h + 166) << 32));
+
+    if (t > SER_TICKS_1970)
+	v->start = (t - SER_TICKS_1970) / 10000000;
+
+    trail = SER_HDR + (gsize) n * fb;
+
+    if (v->n == n && v->size >= trail + (gsize) n * 8)
+    {
+	v->time = (gint64 *) malloc(n * sizeof(gint64));
+
+	for(k = 0; k < n; k++)
+	{
+	    h = v->map + trail + (gsize) k * 8;
+	    t = (gint64) ((guint64) rd32(h) | ((guint64) rd32(h + 4) << 32));
+	    v->time[k] = (t > SER_TICKS_1970) ? (t - SER_TICKS_1970) / 10000000 : v->start;
+	}
+    }
+
+    return TRUE;
+}
+
+
+/* Some capture programs store fewer bits than the sample size aligned to the top of it, so
+   a first frame sample above the header depth means the full sample range is used instead */
+
+static void ser_depth_check(VideoSrc *v)
+{
+    gsize i, n;
+    guint32 max, smp;
+    const guchar *p;
+
+    if (v->n == 0 || v->bits >= v->bytes * 8)
+    	return;
+
+    max = (1u << v->bits) - 1;
+    p = v->map + v->off[0];
+    n = v->stride * v->height / v->bytes;
+
+    for(i = 0; i < n; i++)
+    {
+	if (v->bytes == 1)
+	    smp = p[i];
+	else if (v->big_end)
+	    smp = (p[i * 2] << 8) | p[i * 2 + 1];
+	else
+	    smp = p[i * 2] | (p[i * 2 + 1] << 8);
+
+	if (smp > max)
+	{
+	    v->bits = v->bytes * 8;
+	    break;
+	}
+    }
+
+    return;
+}
+
+
+/* AVI (and AVIX) lists - the first video stream's format and frame chunks */
+
+static int avi_parse(VideoSrc *v)
+{
+    gsize pos, sz;
+    AviParse ap;
+
+    memset(&ap, 0, sizeof(AviParse));
+    ap.stream = -1;
+    ap.off = g_array_new(FALSE, FALSE, sizeof(gsize));
+
+    /* Top level RIFF 'AVI ' then any 'AVIX' */
+    for(pos = 0; pos + 12 <= v->size; pos += 8 + sz + (sz & 1))
+    {
+	sz = rd32(v->map + pos + 4);
+
+	if (memcmp(v->map + pos, "RIFF", 4) != 0)
+	    continue;
+
+	avi_walk(v, pos + 12, MIN(pos + 8 + sz, v->size), 0, &ap);
+    }
+
+    v->fmt = "AVI";
+    v->n = ap.off->len;
+    v->off = (gsize *) g_array_free(ap.off, FALSE);
+
+    return (ap.stream >= 0 && v->width > 0 && v->height > 0);
+}
+
+
+/* Walk the chunks from 'pos' to 'end' - stream formats in 'hdrl', frames in 'movi' */
+
+static void avi_walk(VideoSrc *v, gsize pos, gsize end, int depth, AviParse *ap)
+{
+    char id[5];
+    guint32 sz;
+    gsize off;
+    const guchar *p;
+
+    id[4] = '\0';
+
+    while(pos + 8 <= end)
+    {
+	p = v->map + pos;
+	memcpy(id, p, 4);
+	sz = rd32(p + 4);
+
+	if (pos + 8 + sz > end)
+	    break;
+
+	if (strcmp(id, "LIST") == 0 && sz >= 4)
+	{
+	    if (memcmp(p + 8, "strl", 4) == 0)
+		ap->n_strl++;
+
+	    if (depth < AVI_DEPTH)
+		avi_walk(v, pos + 12, pos + 8 + sz, depth + 1, ap);
+	}
+	else if (strcmp(id, "strf") == 0 && ap->stream < 0 && sz >= 40 && ap->n_strl > 0)
+	{
+	    /* BITMAPINFOHEADER, if this is a video stream in a form that can be read */
+	    ap->bmp_h = (gint32) rd32(p + 16);
+	    ap->bits = p[22] | (p[23] << 8);
+	    ap->comp = rd32(p + 24);
+
+	    if ((ap->comp == 0 && (ap->bits == 8 || ap->bits == 24)) ||
+	    	((memcmp(p + 24, "Y800", 4) == 0 || memcmp(p + 24, "Y8  ", 4) == 0 ||
+	    	  memcmp(p + 24, "GREY", 4) == 0) && ap->bits == 8))
+	    {
+		ap->stream = ap->n_strl - 1;
+		v->width = (int) rd32(p + 12);
+		v->height = ABS(ap->bmp_h);
+		v->bytes = 1;
+		v->bits = 8;
+		v->channels = (ap->bits == 24) ? 3 : 1;
+		v->order = (ap->bits == 24) ? VID_BGR : VID_MONO;
+		v->flip = (ap->comp == 0 && ap->bmp_h > 0);
+		v->stride = (ap->comp == 0) ? (((gsize) v->width * ap->bits + 31) / 32) * 4 : (gsize) v->width;
+	    }
+	}
+	else if (ap->stream >= 0 && (id[2] == 'd') && (id[3] == 'b' || id[3] == 'c') &&
+		 atoi(id) == ap->stream && id[0] >= '0' && id[0] <= '9')
+	{
+	    /* A frame of the stream (empty ones are dropped frames) */
+	    if (sz >= v->stride * v->height)
+	    {
+		off = pos + 8;
+		g_array_append_val(ap->off, off);
+	    }
+	}
+
+	pos += 8 + sz + (sz & 1);
+    }
+
+    return;
+}
+
+
+/* Little endian 32 bit value */
+
+static guint32 rd32(const guchar *p)
+{
+    return (guint32) p[0] | ((guint32) p[1] << 8) | ((guint32) p[2] << 16) | ((guint32) p[3] << 24);
+}
+
+
+/* Header text field without the padding */
+
+static void trim_field(char *s, const guchar *p, int len)
+{
+    int i;
+
+    memcpy(s, p, len);
+    s[len] = '\0';
+
+    for(i = len - 1; i >= 0 && (s[i] == ' ' || s[i] == '\0'); i--)
+    	s[i] = '\0';
+
+    return;
+}
@@ -0,0 +1,512 @@
+/*
+**  Copyright (C) 2021 Anthony Buckley
+**
+**  This file is part of StarsAl.
+**
+**  StarsAl is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  StarsAl is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with StarsAl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+** Description:
+**  Warp kernels - sample a frame along a run of output pixels (affine, so each pixel is a
+**  fixed step on in the source) and add the weighted samples straight into the stacking
+**  accumulator. Bilinear (2 x 2) and Lanczos-3 (6 x 6, weights from a table) interpolation.
+**  Each has a scalar version and, on x86, an AVX2 version doing 8 pixels at a time with
+**  gathers. Positions are carried in double along the run and made relative to each group
+**  of 8 so single precision within the group loses nothing that matters.
+**  The best version the processor supports is chosen on first use.
+**
+** Author:	Anthony Buckley
+**
+** History
+**	18-Oct-2026	Initial code
+**
+*/
+
+
+/* Defines */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WARP_X86
+#endif
+
+#define LANCZOS_A 3			// Lobes
+#define LANCZOS_RES 1024		// Table entries per pixel
+
+
+/* Includes */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <gtk/gtk.h>
+#include <defs.h>
+#include <pipeline.h>
+#ifdef WARP_X86
+#include <immintrin.h>
+#endif
+
+
+/* Types */
+
+typedef void (*WarpSpanFunc)(const WarpSpan *);
+
+
+/* Prototypes */
+
+void warp_span(const WarpSpan *, int);
+const char * warp_kernel_nm();
+void warp_kernel_force(const char *);
+static void warp_dispatch();
+static void lanczos_weights(float, float *);
+static void bilinear_scalar(const WarpSpan *);
+static void lanczos_scalar(const WarpSpan *);
+static void span_tail(const WarpSpan *, int, WarpSpanFunc);
+#ifdef WARP_X86
+static void bilinear_avx2(const WarpSpan *);
+static void lanczos_avx2(const WarpSpan *);
+#endif
+
+
+/* Globals */
+
+static const char *debug_hdr = "DEBUG-warp_kernels.c ";
+static gsize dispatch_once = 0;
+static WarpSpanFunc bilinear_fn = bilinear_scalar;
+static WarpSpanFunc lanczos_fn = lanczos_scalar;
+static const char *kernel_nm = "scalar";
+static float lanczos_lut[LANCZOS_A * LANCZOS_RES + 2];
+
+
+/* Warp a run of pixels into the accumulator */
+
+void warp_span(const WarpSpan *ws, int interp)
+{
+    if (g_once_init_enter(&dispatch_once))
+    {
+	warp_dispatch();
+	g_once_init_leave(&dispatch_once, 1);
+    }
+
+    if (ws->n <= 0)
+    	return;
+
+    /* Gather offsets are 32 bit */
+    if ((size_t) ws->w * ws->h * ws->ch >= INT_MAX)
+    {
+	if (interp == WARP_LANCZOS3)
+	    lanczos_scalar(ws);
+	else
+	    bilinear_scalar(ws);
+
+	return;
+    }
+
+    if (interp == WARP_LANCZOS3)
+    	(*lanczos_fn)(ws);
+    else
+    	(*bilinear_fn)(ws);
+
+    return;
+}
+
+
+/* Name of the kernels in use */
+
+const char * warp_kernel_nm()
+{
+    if (g_once_init_enter(&dispatch_once))
+    {
+	warp_dispatch();
+	g_once_init_leave(&dispatch_once, 1);
+    }
+
+    return kernel_nm;
+}
+
+
+/* Force a kernel set by name (benchmarks) - ignored if not supported (there is no SSE set), call before any use */
+
+void warp_kernel_force(const char *nm)
+{
+    if (g_once_init_enter(&dispatch_once))
+    {
+	warp_dispatch();
+	g_once_init_leave(&dispatch_once, 1);
+    }
+
+    if (strcmp(nm, "scalar") == 0 || strcmp(nm, "sse") == 0)
+    {
+	bilinear_fn = bilinear_scalar;
+	lanczos_fn = lanczos_scalar;
+	kernel_nm = "scalar";
+    }
+#ifdef WARP_X86
+    else if (strcmp(nm, "avx2") == 0 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+	bilinear_fn = bilinear_avx2;
+	lanczos_fn = lanczos_avx2;
+	kernel_nm = "avx2";
+    }
+#endif
+
+    return;
+}
+
+
+/* Build the Lanczos table and choose the kernels for this processor */
+
+static void warp_dispatch()
+{
+    int i;
+    double x, px;
+
+    for(i = 0; i < LANCZOS_A * LANCZOS_RES + 2; i++)
+    {
+	x = (double) i / LANCZOS_RES;
+	px = G_PI * x;
+
+	if (i == 0)
+	    lanczos_lut[i] = 1.0f;
+	else if (x >= LANCZOS_A)
+	    lanczos_lut[i] = 0.0f;
+	else
+	    lanczos_lut[i] = (float) (LANCZOS_A * sin(px) * sin(px / LANCZOS_A) / (px * px));
+    }
+
+#ifdef WARP_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+	bilinear_fn = bilinear_avx2;
+	lanczos_fn = lanczos_avx2;
+	kernel_nm = "avx2";
+    }
+#endif
+
+    return;
+}
+
+
+/* Normalised weights of the 6 samples (-2 to +3) about a position 'f' (0 - 1) past a sample */
+
+static void lanczos_weights(float f, float *wt)
+{
+    int t;
+    float d, sum;
+
+    sum = 0.0f;
+
+    for(t = 0; t < 2 * LANCZOS_A; t++)
+    {
+	d = fabsf((float) (t - LANCZOS_A + 1) - f);
+	wt[t] = lanczos_lut[(int) (d * LANCZOS_RES + 0.5f)];
+	sum += wt[t];
+    }
+
+    for(t = 0; t < 2 * LANCZOS_A; t++)
+    	wt[t] /= sum;
+
+    return;
+}
+
+
+/* Scalar bilinear (also does the vector tails) */
+
+static void bilinear_scalar(const WarpSpan *ws)
+{
+    int k, c, ix, iy, ch, w;
+    double sx, sy, fx, fy;
+    float w00, w01, w10, w11;
+    const float *p;
+    float *o;
+
+    ch = ws->ch;
+    w = ws->w;
+
+    for(k = 0; k < ws->n; k++)
+    {
+	sx = ws->sx + k * ws->dx;
+	sy = ws->sy + k * ws->dy;
+	ix = (int) sx;
+	iy = (int) sy;
+	fx = sx - ix;
+	fy = sy - iy;
+	w00 = (float) ((1.0 - fx) * (1.0 - fy)) * ws->wt;
+	w01 = (float) (fx * (1.0 - fy)) * ws->wt;
+	w10 = (float) ((1.0 - fx) * fy) * ws->wt;
+	w11 = (float) (fx * fy) * ws->wt;
+	p = ws->src + ((size_t) iy * w + ix) * ch;
+	o = ws->out + (size_t) k * ch;
+
+	for(c = 0; c < ch; c++)
+	    o[c] += w00 * p[c] + w01 * p[ch + c] + w10 * p[w * ch + c] + w11 * p[(w + 1) * ch + c];
+
+	ws->cnt[k] += ws->wt;
+    }
+
+    return;
+}
+
+
+/* Scalar Lanczos-3 (also does the vector tails) */
+
+static void lanczos_scalar(const WarpSpan *ws)
+{
+    int k, c, i, j, ix, iy, ch, w;
+    double sx, sy;
+    float v, row;
+    float wx[2 * LANCZOS_A], wy[2 * LANCZOS_A];
+    const float *p, *q;
+    float *o;
+
+    ch = ws->ch;
+    w = ws->w;
+
+    for(k = 0; k < ws->n; k++)
+    {
+	sx = ws->sx + k * ws->dx;
+	sy = ws->sy + k * ws->dy;
+	ix = (int) sx;
+	iy = (int) sy;
+	lanczos_weights((float) (sx - ix), wx);
+	lanczos_weights((float) (sy - iy), wy);
+	p = ws->src + ((size_t) (iy - LANCZOS_A + 1) * w + ix - LANCZOS_A + 1) * ch;
+	o = ws->out + (size_t) k * ch;
+
+	for(c = 0; c < ch; c++)
+	{
+	    v = 0.0f;
+
+	    for(j = 0; j < 2 * LANCZOS_A; j++)
+	    {
+		q = p + (size_t) j * w * ch + c;
+		row = 0.0f;
+
+		for(i = 0; i < 2 * LANCZOS_A; i++)
+		    row += wx[i] * q[i * ch];
+
+		v += wy[j] * row;
+	    }
+
+	    o[c] += v * ws->wt;
+	}
+
+	ws->cnt[k] += ws->wt;
+    }
+
+    return;
+}
+
+
+/* Finish a run from pixel 'k' on with a scalar kernel */
+
+static void span_tail(const WarpSpan *ws, int k, WarpSpanFunc fn)
+{
+    WarpSpan tail;
+
+    if (k >= ws->n)
+    	return;
+
+    tail = *ws;
+    tail.sx = ws->sx + k * ws->dx;
+    tail.sy = ws->sy + k * ws->dy;
+    tail.n = ws->n - k;
+    tail.out = ws->out + (size_t) k * ws->ch;
+    tail.cnt = ws->cnt + k;
+    (*fn)(&tail);
+
+    return;
+}
+
+
+#ifdef WARP_X86
+
+/* AVX2 bilinear - 8 pixels at a time, the 4 neighbours of each channel gathered */
+
+__attribute__((target("avx2,fma")))
+static void bilinear_avx2(const WarpSpan *ws)
+{
+    int k, c, l, ix0, iy0, ch, w;
+    double sx, sy;
+    float tmp[8];
+    __m256 lane, u, v, fx, fy, gx, gy, w00, w01, w10, w11, s, wt;
+    __m256i idx;
+    float *o;
+
+    ch = ws->ch;
+    w = ws->w;
+    lane = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    wt = _mm256_set1_ps(ws->wt);
+
+    for(k = 0; k + 8 <= ws->n; k += 8)
+    {
+	/* Positions relative to the first of the 8 */
+	sx = ws->sx + k * ws->dx;
+	sy = ws->sy + k * ws->dy;
+	ix0 = (int) sx;
+	iy0 = (int) sy;
+	u = _mm256_fmadd_ps(lane, _mm256_set1_ps((float) ws->dx), _mm256_set1_ps((float) (sx - ix0)));
+	v = _mm256_fmadd_ps(lane, _mm256_set1_ps((float) ws->dy), _mm256_set1_ps((float) (sy - iy0)));
+	gx = _mm256_floor_ps(u);
+	gy = _mm256_floor_ps(v);
+	fx = _mm256_sub_ps(u, gx);
+	fy = _mm256_sub_ps(v, gy);
+
+	/* Sample index of the top left neighbour */
+	idx = _mm256_add_epi32(_mm256_cvtps_epi32(gx), _mm256_set1_epi32(ix0));
+	idx = _mm256_add_epi32(idx, _mm256_mullo_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(gy),
+							_mm256_set1_epi32(iy0)), _mm256_set1_epi32(w)));
+	idx = _mm256_mullo_epi32(idx, _mm256_set1_epi32(ch));
+
+	gx = _mm256_sub_ps(_mm256_set1_ps(1.0f), fx);
+	gy = _mm256_sub_ps(_mm256_set1_ps(1.0f), fy);
+	w00 = _mm256_mul_ps(_mm256_mul_ps(gx, gy), wt);
+	w01 = _mm256_mul_ps(_mm256_mul_ps(fx, gy), wt);
+	w10 = _mm256_mul_ps(_mm256_mul_ps(gx, fy), wt);
+	w11 = _mm256_mul_ps(_mm256_mul_ps(fx, fy), wt);
+	o = ws->out + (size_t) k * ch;
+
+	for(c = 0; c < ch; c++)
+	{
+	    s = _mm256_mul_ps(w00, _mm256_i32gather_ps(ws->src + c, idx, 4));
+	    s = _mm256_fmadd_ps(w01, _mm256_i32gather_ps(ws->src + ch + c, idx, 4), s);
+	    s = _mm256_fmadd_ps(w10, _mm256_i32gather_ps(ws->src + (size_t) w * ch + c, idx, 4), s);
+	    s = _mm256_fmadd_ps(w11, _mm256_i32gather_ps(ws->src + (size_t) (w + 1) * ch + c, idx, 4), s);
+
+	    if (ch == 1)
+	    {
+		_mm256_storeu_ps(o, _mm256_add_ps(_mm256_loadu_ps(o), s));
+	    }
+	    else
+	    {
+		_mm256_storeu_ps(tmp, s);
+
+		for(l = 0; l < 8; l++)
+		    o[l * ch + c] += tmp[l];
+	    }
+	}
+
+	_mm256_storeu_ps(ws->cnt + k, _mm256_add_ps(_mm256_loadu_ps(ws->cnt + k), wt));
+    }
+
+    span_tail(ws, k, bilinear_scalar);
+
+    return;
+}
+
+
+/* AVX2 Lanczos-3 - 8 pixels at a time, the weights gathered from the table */
+
+__attribute__((target("avx2,fma")))
+static void lanczos_avx2(const WarpSpan *ws)
+{
+    int k, c, i, j, l, ix0, iy0, ch, w;
+    double sx, sy;
+    float tmp[8];
+    int off[2 * LANCZOS_A][2 * LANCZOS_A];
+    __m256 lane, u, v, fx, fy, d, sum_x, sum_y, norm, s, row, wt, res, absmask;
+    __m256 wx[2 * LANCZOS_A], wy[2 * LANCZOS_A];
+    __m256i idx;
+    float *o;
+
+    ch = ws->ch;
+    w = ws->w;
+    lane = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    wt = _mm256_set1_ps(ws->wt);
+    res = _mm256_set1_ps((float) LANCZOS_RES);
+    absmask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+    /* Sample offsets of the 6 x 6 window from the pixel at or before the position */
+    for(j = 0; j < 2 * LANCZOS_A; j++)
+    	for(i = 0; i < 2 * LANCZOS_A; i++)
+	    off[j][i] = ((j - LANCZOS_A + 1) * w + i - LANCZOS_A + 1) * ch;
+
+    for(k = 0; k + 8 <= ws->n; k += 8)
+    {
+	sx = ws->sx + k * ws->dx;
+	sy = ws->sy + k * ws->dy;
+	ix0 = (int) sx;
+	iy0 = (int) sy;
+	u = _mm256_fmadd_ps(lane, _mm256_set1_ps((float) ws->dx), _mm256_set1_ps((float) (sx - ix0)));
+	v = _mm256_fmadd_ps(lane, _mm256_set1_ps((float) ws->dy), _mm256_set1_ps((float) (sy - iy0)));
+	fx = _mm256_floor_ps(u);
+	fy = _mm256_floor_ps(v);
+
+	idx = _mm256_add_epi32(_mm256_cvtps_epi32(fx), _mm256_set1_epi32(ix0));
+	idx = _mm256_add_epi32(idx, _mm256_mullo_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(fy),
+							_mm256_set1_epi32(iy0)), _mm256_set1_epi32(w)));
+	idx = _mm256_mullo_epi32(idx, _mm256_set1_epi32(ch));
+	fx = _mm256_sub_ps(u, fx);
+	fy = _mm256_sub_ps(v, fy);
+
+	/* Weights each way, normalised */
+	sum_x = sum_y = _mm256_setzero_ps();
+
+	for(i = 0; i < 2 * LANCZOS_A; i++)
+	{
+	    d = _mm256_and_ps(_mm256_sub_ps(_mm256_set1_ps((float) (i - LANCZOS_A + 1)), fx), absmask);
+	    wx[i] = _mm256_i32gather_ps(lanczos_lut, _mm256_cvttps_epi32(_mm256_fmadd_ps(d, res, _mm256_set1_ps(0.5f))), 4);
+	    sum_x = _mm256_add_ps(sum_x, wx[i]);
+	    d = _mm256_and_ps(_mm256_sub_ps(_mm256_set1_ps((float) (i - LANCZOS_A + 1)), fy), absmask);
+	    wy[i] = _mm256_i32gather_ps(lanczos_lut, _mm256_cvttps_epi32(_mm256_fmadd_ps(d, res, _mm256_set1_ps(0.5f))), 4);
+	    sum_y = _mm256_add_ps(sum_y, wy[i]);
+	}
+
+	/* The frame weight goes in with the row normalisation */
+	norm = _mm256_div_ps(wt, _mm256_mul_ps(sum_x, sum_y));
+	o = ws->out + (size_t) k * ch;
+
+	for(c = 0; c < ch; c++)
+	{
+	    s = _mm256_setzero_ps();
+
+	    for(j = 0; j < 2 * LANCZOS_A; j++)
+	    {
+		row = _mm256_setzero_ps();
+
+		for(i = 0; i < 2 * LANCZOS_A; i++)
+		    row = _mm256_fmadd_ps(wx[i], _mm256_i32gather_ps(ws->src + c + off[j][i], idx, 4), row);
+
+		s = _mm256_fmadd_ps(wy[j], row, s);
+	    }
+
+	    s = _mm256_mul_ps(s, norm);
+
+	    if (ch == 1)
+	    {
+		_mm256_storeu_ps(o, _mm256_add_ps(_mm256_loadu_ps(o), s));
+	    }
+	    else
+	    {
+		_mm256_storeu_ps(tmp, s);
+
+		for(l = 0; l < 8; l++)
+		    o[l * ch + c] += tmp[l];
+	    }
+	}
+
+	_mm256_storeu_ps(ws->cnt + k, _mm256_add_ps(_mm256_loadu_ps(ws->cnt + k), wt));
+    }
+
+    span_tail(ws, k, lanczos_scalar);
+
+    return;
+}
+
+#endif